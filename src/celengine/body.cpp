@@ -891,12 +891,19 @@ void Body::computeLocations()
     if (locationsComputed)
         return;
 
-    locationsComputed = true;
-
     // No work to do if there's no mesh, or if the mesh cannot be loaded
     if (geometry == InvalidResource)
+    {
+        locationsComputed = true;
         return;
+    }
+
+    // Try again later if the mesh is still loading in the background
     Geometry* g = GetGeometryManager()->find(geometry);
+    if (g == NULL && GetGeometryManager()->getResourceInfo(geometry)->state == ResourceLoading)
+        return;
+
+    locationsComputed = true;
     if (g == NULL)
         return;
 
@@ -1282,7 +1289,9 @@ bool PlanetarySystem::traverse(TraversalFunc func, void* info) const
     return true;
 }
 
-std::vector<std::string> PlanetarySystem::getCompletion(const std::string& _name, bool deepSearch) const
+std::vector<std::string> PlanetarySystem::getCompletion(const std::string& _name,
+                                                        bool deepSearch,
+                                                        unsigned int maxCompletions) const
 {
     std::vector<std::string> completion;
     int _name_length = UTF8Length(_name);
@@ -1295,6 +1304,8 @@ std::vector<std::string> PlanetarySystem::getCompletion(const std::string& _name
         
         if (UTF8StringCompare(alias, _name, _name_length) == 0)
         {
+            if (maxCompletions != 0 && completion.size() == maxCompletions)
+                return completion;
             completion.push_back(alias);
         }
     }
@@ -1307,7 +1318,15 @@ std::vector<std::string> PlanetarySystem::getCompletion(const std::string& _name
         {
             if ((*iter)->getSatellites() != NULL)
             {
-                vector<string> bodies = (*iter)->getSatellites()->getCompletion(_name);
+                unsigned int remaining = 0;
+                if (maxCompletions != 0)
+                {
+                    if (completion.size() == maxCompletions)
+                        break;
+                    remaining = maxCompletions - completion.size();
+                }
+
+                vector<string> bodies = (*iter)->getSatellites()->getCompletion(_name, true, remaining);
                 completion.insert(completion.end(), bodies.begin(), bodies.end());
             }
         }
@@ -60,7 +60,9 @@ class PlanetarySystem
 
     bool traverse(TraversalFunc, void*) const;
     Body* find(const std::string&, bool deepSearch = false, bool i18n = false) const;
-    std::vector<std::string> getCompletion(const std::string& _name, bool rec = true) const;
+    std::vector<std::string> getCompletion(const std::string& _name,
+                                           bool rec = true,
+                                           unsigned int maxCompletions = 0) const;
 
  private:
     void addBodyToNameIndex(Body* body);
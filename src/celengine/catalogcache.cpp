@@ -0,0 +1,258 @@
+// catalogcache.cpp
+//
+// Copyright (C) 2010, the Celestia Development Team
+//
+// Cache of catalog files recorded in a compact binary form.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include "tokenizer.h"
+#include "catalogcache.h"
+
+using namespace std;
+
+
+// Cache files begin with a header identifying the catalog file they were
+// recorded from, followed by the path of the catalog and the recording.
+// Recordings are in native byte order, so the byte order mark rejects
+// caches copied from machines of the other byte order.
+static const char CacheFileMagic[8] = { 'C', 'E', 'L', 'C', 'A', 'T', '0', '1' };
+static const uint32 ByteOrderMark = 0x01020304;
+
+struct CacheFileHeader
+{
+    char magic[8];
+    uint32 byteOrder;
+    uint32 pathLength;
+    uint64 sourceSize;
+    int64 sourceModificationTime;
+    uint64 sourceContentHash;
+    uint64 recordingSize;
+    uint64 recordingHash;
+};
+
+
+static bool readFile(const string& filename, ios::openmode mode, string& contents)
+{
+    ifstream in(filename.c_str(), mode);
+    if (!in.good())
+        return false;
+
+    ostringstream out;
+    out << in.rdbuf();
+    contents = out.str();
+
+    return !in.bad();
+}
+
+
+CatalogCache::CatalogCache(const string& _directory) :
+    directory(_directory)
+{
+}
+
+
+bool CatalogCache::getSourceInfo(const string& filename, SourceInfo& info)
+{
+    struct stat fileInfo;
+    if (stat(filename.c_str(), &fileInfo) != 0)
+        return false;
+
+    info.size = (uint64) fileInfo.st_size;
+    info.modificationTime = (int64) fileInfo.st_mtime;
+    info.contentHash = 0;
+
+    return true;
+}
+
+
+// 64-bit FNV-1a hash
+uint64 CatalogCache::hash(const char* data, size_t size)
+{
+    uint64 h = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; i++)
+    {
+        h ^= (uint64) (unsigned char) data[i];
+        h *= 1099511628211ULL;
+    }
+
+    return h;
+}
+
+
+string CatalogCache::cacheFilename(const string& filename) const
+{
+    uint64 h = hash(filename.data(), filename.size());
+    char name[32];
+    sprintf(name, "%08x%08x.cache", (uint32) (h >> 32), (uint32) h);
+
+    return directory + '/' + name;
+}
+
+
+bool CatalogCache::load(const string& filename, SourceInfo& info, string& recording)
+{
+    string contents;
+    if (!readFile(cacheFilename(filename), ios::in | ios::binary, contents))
+        return false;
+
+    CacheFileHeader header;
+    if (contents.size() < sizeof(header))
+        return false;
+    memcpy(&header, contents.data(), sizeof(header));
+
+    if (memcmp(header.magic, CacheFileMagic, sizeof(header.magic)) != 0 ||
+        header.byteOrder != ByteOrderMark ||
+        header.sourceSize != info.size ||
+        contents.size() - sizeof(header) < header.pathLength ||
+        contents.size() - sizeof(header) - header.pathLength != header.recordingSize ||
+        contents.compare(sizeof(header), header.pathLength, filename) != 0)
+    {
+        return false;
+    }
+
+    // The catalog file may have been touched without being changed
+    if (header.sourceModificationTime != info.modificationTime)
+    {
+        string source;
+        if (!readFile(filename, ios::in, source) ||
+            hash(source.data(), source.size()) != header.sourceContentHash)
+        {
+            return false;
+        }
+    }
+
+    const char* recordingData = contents.data() + sizeof(header) + header.pathLength;
+    if (hash(recordingData, (size_t) header.recordingSize) != header.recordingHash)
+        return false;
+
+    info.contentHash = header.sourceContentHash;
+    recording.assign(recordingData, (size_t) header.recordingSize);
+
+    // Record the new modification time, so that the contents needn't be
+    // hashed again.
+    if (header.sourceModificationTime != info.modificationTime)
+        store(filename, info, recording);
+
+    return true;
+}
+
+
+bool CatalogCache::store(const string& filename, const SourceInfo& info, const string& recording)
+{
+    CacheFileHeader header;
+    memcpy(header.magic, CacheFileMagic, sizeof(header.magic));
+    header.byteOrder = ByteOrderMark;
+    header.pathLength = (uint32) filename.size();
+    header.sourceSize = info.size;
+    header.sourceModificationTime = info.modificationTime;
+    header.sourceContentHash = info.contentHash;
+    header.recordingSize = recording.size();
+    header.recordingHash = hash(recording.data(), recording.size());
+
+    string cacheFile = cacheFilename(filename);
+    ofstream out(cacheFile.c_str(), ios::out | ios::binary | ios::trunc);
+    if (!out.good())
+        return false;
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(filename.data(), filename.size());
+    out.write(recording.data(), recording.size());
+    out.close();
+
+    // A partly written cache file fails the recording hash check, but
+    // don't leave it around.
+    if (out.fail())
+    {
+        remove(cacheFile.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+
+CatalogReader::CatalogReader(const string& _filename, CatalogCache* _cache) :
+    filename(_filename),
+    cache(_cache),
+    isGood(false),
+    cached(false),
+    in(NULL),
+    tokenizer(NULL)
+{
+    if (cache != NULL && CatalogCache::getSourceInfo(filename, info))
+    {
+        if (cache->load(filename, info, recording))
+        {
+            tokenizer = new Tokenizer(recording.data(), recording.size());
+            cached = true;
+            isGood = true;
+            return;
+        }
+
+        // Read the complete text, so that its hash can be recorded
+        if (readFile(filename, ios::in, data))
+        {
+            info.contentHash = CatalogCache::hash(data.data(), data.size());
+            in = new istringstream(data);
+            tokenizer = new Tokenizer(in);
+            tokenizer->setRecording(&recording);
+            isGood = true;
+            return;
+        }
+    }
+
+    // Read the file without recording it
+    cache = NULL;
+    in = new ifstream(filename.c_str(), ios::in);
+    tokenizer = new Tokenizer(in);
+    isGood = in->good();
+}
+
+
+CatalogReader::~CatalogReader()
+{
+    delete tokenizer;
+    delete in;
+}
+
+
+bool CatalogReader::good() const
+{
+    return isGood;
+}
+
+
+bool CatalogReader::isCached() const
+{
+    return cached;
+}
+
+
+Tokenizer& CatalogReader::getTokenizer()
+{
+    return *tokenizer;
+}
+
+
+void CatalogReader::finish(bool success)
+{
+    // The recording is abandoned by the tokenizer if any part of it
+    // couldn't be recorded.
+    if (success && cache != NULL && !cached && tokenizer->getRecording() != NULL)
+    {
+        if (!cache->store(filename, info, recording))
+            clog << "Error writing catalog cache for " << filename << '\n';
+    }
+
+    tokenizer->setRecording(NULL);
+}
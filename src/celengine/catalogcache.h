@@ -0,0 +1,103 @@
+// catalogcache.h
+//
+// Copyright (C) 2010, the Celestia Development Team
+//
+// Cache of catalog files recorded in a compact binary form.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#ifndef _CELENGINE_CATALOGCACHE_H_
+#define _CELENGINE_CATALOGCACHE_H_
+
+#include <cstddef>
+#include <string>
+#include <iostream>
+#include <celutil/basictypes.h>
+
+class Tokenizer;
+
+
+/*! The CatalogCache stores recordings of the solar system, star, and deep
+ *  sky catalog files that have been read (see Tokenizer::setRecording.)
+ *  Object definitions are stored whole, so a catalog that hasn't changed is
+ *  loaded again without tokenizing or parsing its text.
+ *
+ *  Each recording is kept in a file in the cache directory named after the
+ *  catalog's path, along with the size, modification time, and a hash of
+ *  the contents of the catalog file. A recording is used only if the size
+ *  matches and either the modification time or the hash of the current
+ *  contents matches; otherwise the catalog is read from the text and
+ *  recorded again.
+ */
+class CatalogCache
+{
+ public:
+    // The cache directory must already exist
+    CatalogCache(const std::string& directory);
+
+    struct SourceInfo
+    {
+        uint64 size;
+        int64 modificationTime;
+        uint64 contentHash;
+    };
+
+    // Get the size and modification time of a catalog file; returns false
+    // if the file doesn't exist.
+    static bool getSourceInfo(const std::string& filename, SourceInfo& info);
+
+    static uint64 hash(const char* data, std::size_t size);
+
+    // Read the recording of a catalog file, returning false if there's no
+    // current recording. The content hash of info is filled in.
+    bool load(const std::string& filename, SourceInfo& info, std::string& recording);
+
+    bool store(const std::string& filename, const SourceInfo& info, const std::string& recording);
+
+ private:
+    std::string cacheFilename(const std::string& filename) const;
+
+    std::string directory;
+};
+
+
+/*! A CatalogReader opens a catalog file for loading. The cached recording
+ *  of the file is replayed if there is a current one; otherwise the text is
+ *  read and recorded, and the recording is stored in the cache once the
+ *  catalog has been loaded successfully.
+ */
+class CatalogReader
+{
+ public:
+    // The cache may be NULL, in which case the text is always read
+    CatalogReader(const std::string& filename, CatalogCache* cache);
+    ~CatalogReader();
+
+    // Returns false if the catalog file couldn't be opened
+    bool good() const;
+
+    // Returns true if the catalog is replayed from the cache
+    bool isCached() const;
+
+    Tokenizer& getTokenizer();
+
+    // Call once the catalog has been loaded
+    void finish(bool success);
+
+ private:
+    std::string filename;
+    CatalogCache* cache;
+    CatalogCache::SourceInfo info;
+    bool isGood;
+    bool cached;
+
+    std::string data;
+    std::string recording;
+    std::istream* in;
+    Tokenizer* tokenizer;
+};
+
+#endif // _CELENGINE_CATALOGCACHE_H_
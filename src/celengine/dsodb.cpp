@@ -120,13 +120,14 @@ DeepSkyObject* DSODatabase::find(const string& name) const
 }
 
 
-vector<string> DSODatabase::getCompletion(const string& name) const
+vector<string> DSODatabase::getCompletion(const string& name,
+                                         unsigned int maxCompletions) const
 {
     vector<string> completion;
 
     // only named DSOs are supported by completion.
     if (!name.empty() && namesDB != NULL)
-        return namesDB->getCompletion(name);
+        return namesDB->getCompletion(name, maxCompletions);
     else
         return completion;
 }
@@ -237,6 +238,12 @@ void DSODatabase::setNameDatabase(DSONameDatabase* _namesDB)
 bool DSODatabase::load(istream& in, const string& resourcePath)
 {
     Tokenizer tokenizer(&in);
+    return load(tokenizer, resourcePath);
+}
+
+
+bool DSODatabase::load(Tokenizer& tokenizer, const string& resourcePath)
+{
     Parser    parser(&tokenizer);
 
     while (tokenizer.nextToken() != Tokenizer::TokenEnd)
@@ -400,10 +407,12 @@ void DSODatabase::buildOctree()
     // objects end up straddling the base level nodes when the center of the
     // octree is at the origin.
     DynamicDSOOctree* root   = new DynamicDSOOctree(Vector3d::Zero(), absMag);
+    vector<DeepSkyObject* const*> objects(nDSOs);
     for (int i = 0; i < nDSOs; ++i)
     {
-        root->insertObject(DSOs[i], DSO_OCTREE_ROOT_SIZE);
+        objects[i] = &DSOs[i];
     }
+    root->insertObjects(objects, DSO_OCTREE_ROOT_SIZE, WorkerPool::getSharedPool());
 
     DPRINTF(1, "Spatially sorting DSOs for improved locality of reference . . .\n");
     DeepSkyObject** sortedDSOs    = new DeepSkyObject*[nDSOs];
@@ -39,7 +39,8 @@ class DSODatabase
     DeepSkyObject* find(const uint32 catalogNumber) const;
     DeepSkyObject* find(const std::string&) const;
 
-    std::vector<std::string> getCompletion(const std::string&) const;
+    std::vector<std::string> getCompletion(const std::string&,
+                                           unsigned int maxCompletions = 0) const;
 
     void findVisibleDSOs(DSOHandler&    dsoHandler,
                          const Eigen::Vector3d& obsPosition,
@@ -59,6 +60,7 @@ class DSODatabase
     void setNameDatabase(DSONameDatabase*);
 
     bool load(std::istream&, const std::string& resourcePath);
+    bool load(Tokenizer&, const std::string& resourcePath);
     bool loadBinary(std::istream&);
     void finish();
 
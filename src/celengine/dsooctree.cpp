@@ -73,12 +73,15 @@ template<> DynamicDSOOctree::ExclusionFactorDecayFunction*
 
 // total specialization of the StaticOctree template process*() methods for DSOs:
 template<>
-void DSOOctree::processVisibleObjects(DSOHandler&    processor,
-                                      const PointType& obsPosition,
-                                      const Hyperplane<double, 3>*  frustumPlanes,
-                                      float          limitingFactor,
-                                      double         scale) const
+void DSOOctree::processVisibleNode(uint32         node,
+                                   DSOHandler&    processor,
+                                   const PointType& obsPosition,
+                                   const Hyperplane<double, 3>*  frustumPlanes,
+                                   float          limitingFactor,
+                                   double         scale) const
 {
+    PointType cellCenterPos = cellCenter(node);
+
     // See if this node lies within the view frustum
 
     // Test the cubic octree node against each one of the five
@@ -108,9 +111,11 @@ void DSOOctree::processVisibleObjects(DSOHandler&    processor,
     // Process the objects in this node
     double dimmest     = minDistance > 0.0 ? astro::appToAbsMag((double) limitingFactor, minDistance) : 1000.0;
 
-    for (unsigned int i=0; i<nObjects; ++i)
+    DeepSkyObject* const* nodeObjects = objects + firstObjects[node];
+    uint32 nObjects = objectCounts[node];
+    for (uint32 i = 0; i < nObjects; ++i)
     {
-        DeepSkyObject* _obj = _firstObject[i];
+        DeepSkyObject* _obj = nodeObjects[i];
         float  absMag      = _obj->getAbsoluteMagnitude();
         if (absMag < dimmest)
         {
@@ -124,18 +129,20 @@ void DSOOctree::processVisibleObjects(DSOHandler&    processor,
 
     // See if any of the objects in child nodes are potentially included
     // that we need to recurse deeper.
-    if (minDistance <= 0.0 || astro::absToAppMag((double) exclusionFactor, minDistance) <= limitingFactor)
+    if (minDistance <= 0.0 || astro::absToAppMag((double) exclusionFactors[node], minDistance) <= limitingFactor)
     {
         // Recurse into the child nodes
-        if (_children != NULL)
+        uint32 firstChild = firstChildren[node];
+        if (firstChild != 0)
         {
-            for (int i = 0; i < 8; ++i)
+            for (uint32 i = 0; i < 8; ++i)
             {
-                _children[i]->processVisibleObjects(processor,
-                                                    obsPosition,
-                                                    frustumPlanes,
-                                                    limitingFactor,
-                                                    scale * 0.5f);
+                processVisibleNode(firstChild + i,
+                                   processor,
+                                   obsPosition,
+                                   frustumPlanes,
+                                   limitingFactor,
+                                   scale * 0.5f);
             }
         }
     }
@@ -143,11 +150,14 @@ void DSOOctree::processVisibleObjects(DSOHandler&    processor,
 
 
 template<>
-void DSOOctree::processCloseObjects(DSOHandler&    processor,
-                                    const PointType& obsPosition,
-                                    double         boundingRadius,
-                                    double         scale) const
+void DSOOctree::processCloseNode(uint32         node,
+                                 DSOHandler&    processor,
+                                 const PointType& obsPosition,
+                                 double         boundingRadius,
+                                 double         scale) const
 {
+    PointType cellCenterPos = cellCenter(node);
+
     // Compute the distance to node; this is equal to the distance to
     // the cellCenterPos of the node minus the boundingRadius of the node, scale * SQRT3.
     double nodeDistance    = (obsPosition - cellCenterPos).norm() - scale * DSOOctree::SQRT3;    //
@@ -163,9 +173,11 @@ void DSOOctree::processCloseObjects(DSOHandler&    processor,
     double radiusSquared    = boundingRadius * boundingRadius;    //
 
     // Check all the objects in the node.
-    for (unsigned int i=0; i<nObjects; ++i)
+    DeepSkyObject* const* nodeObjects = objects + firstObjects[node];
+    uint32 nObjects = objectCounts[node];
+    for (uint32 i = 0; i < nObjects; ++i)
     {
-        DeepSkyObject* _obj = _firstObject[i];        //
+        DeepSkyObject* _obj = nodeObjects[i];        //
 
         if ((obsPosition - _obj->getPosition()).squaredNorm() < radiusSquared)    //
         {
@@ -177,14 +189,16 @@ void DSOOctree::processCloseObjects(DSOHandler&    processor,
     }
 
     // Recurse into the child nodes
-    if (_children != NULL)
+    uint32 firstChild = firstChildren[node];
+    if (firstChild != 0)
     {
-        for (int i = 0; i < 8; ++i)
+        for (uint32 i = 0; i < 8; ++i)
         {
-            _children[i]->processCloseObjects(processor,
-                                              obsPosition,
-                                              boundingRadius,
-                                              scale * 0.5f);
+            processCloseNode(firstChild + i,
+                             processor,
+                             obsPosition,
+                             boundingRadius,
+                             scale * 0.5f);
         }
     }
 }
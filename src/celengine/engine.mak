@@ -23,6 +23,7 @@ OBJS=\
 	$(INTDIR)\axisarrow.obj \
 	$(INTDIR)\body.obj \
 	$(INTDIR)\boundaries.obj \
+	$(INTDIR)\catalogcache.obj \
 	$(INTDIR)\catalogxref.obj \
 	$(INTDIR)\cmdparser.obj \
 	$(INTDIR)\command.obj \
@@ -59,6 +60,7 @@ OBJS=\
 	$(INTDIR)\observer.obj \
 	$(INTDIR)\opencluster.obj \
 	$(INTDIR)\orbit.obj \
+	$(INTDIR)\orbitcache.obj \
 	$(INTDIR)\overlay.obj \
 	$(INTDIR)\parseobject.obj \
 	$(INTDIR)\parser.obj \
@@ -47,6 +47,11 @@ class ReferenceFrame
 
 	virtual bool isInertial() const = 0;
 
+    /*! Return true if the orientation of the frame never changes, so that
+     *  getOrientation() may be called once and the result reused.
+     */
+    virtual bool hasFixedOrientation() const { return false; }
+
     enum FrameType
     {
         PositionFrame = 1,
@@ -103,6 +108,7 @@ class J2000EclipticFrame : public ReferenceFrame
     }
 
 	virtual bool isInertial() const;
+    virtual bool hasFixedOrientation() const { return true; }
 
     virtual unsigned int nestingDepth(unsigned int depth,
                                       unsigned int maxDepth,
@@ -118,6 +124,7 @@ class J2000EquatorFrame : public ReferenceFrame
     virtual ~J2000EquatorFrame() {};
     Eigen::Quaterniond getOrientation(double tjd) const;
 	virtual bool isInertial() const;
+    virtual bool hasFixedOrientation() const { return true; }
     virtual unsigned int nestingDepth(unsigned int depth,
                                       unsigned int maxDepth,
                                       FrameType frameType) const;
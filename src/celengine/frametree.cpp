@@ -12,10 +12,17 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cmath>
 #include "celengine/frametree.h"
 #include "celengine/timeline.h"
 #include "celengine/timelinephase.h"
 #include "celengine/frame.h"
+#include <celephem/orbit.h>
+#include <celmath/mathlib.h>
+#include <celutil/workerpool.h>
+#include <Eigen/Geometry>
+
+using namespace Eigen;
 
 
 /* A FrameTree is hierarchy of solar system bodies organized according to
@@ -38,12 +45,155 @@
  * object will all cause the tree to be marked as changed.
  */
 
+
+/* Children with elliptical orbits in frames with a fixed orientation--the
+ * usual case for asteroids and comets--have their positions computed
+ * together by an EllipticalOrbitArray, with the frame orientations looked
+ * up just once. All other children are evaluated individually.
+ */
+class FrameTree::ChildPositionCache
+{
+public:
+    ChildPositionCache(const vector<TimelinePhase*>& children);
+
+    void computeEllipticalPositions(double tdb,
+                                    Vector3d* positions,
+                                    unsigned int first,
+                                    unsigned int count) const;
+    void startEllipticalPositions(double tdb,
+                                  Vector3d* positions,
+                                  WorkerPool* pool,
+                                  TaskGroup& tasks) const;
+    void computeSelectedPositions(double tdb,
+                                  Vector3d* positions,
+                                  const unsigned int* orbitIndices,
+                                  unsigned int count) const;
+
+    EllipticalOrbitArray ellipticalOrbits;
+
+    // Index of the child for each of the elliptical orbits
+    vector<unsigned int> ellipticalChildren;
+
+    // Conjugate of the frame orientation for each elliptical orbit, stored
+    // as w, x, y, z
+    vector<double> frameOrientations;
+
+    vector<unsigned int> otherChildren;
+
+    // Computes a range of the elliptical orbits on a worker thread
+    class EllipticalPositionsTask : public Task
+    {
+    public:
+        EllipticalPositionsTask(const ChildPositionCache* _cache,
+                                double _tdb,
+                                Vector3d* _positions,
+                                unsigned int _first,
+                                unsigned int _count) :
+            cache(_cache),
+            tdb(_tdb),
+            positions(_positions),
+            first(_first),
+            count(_count)
+        {
+        }
+
+        void run()
+        {
+            cache->computeEllipticalPositions(tdb, positions, first, count);
+        }
+
+    private:
+        const ChildPositionCache* cache;
+        double tdb;
+        Vector3d* positions;
+        unsigned int first;
+        unsigned int count;
+    };
+};
+
+
+/* Children with bounded elliptical orbits in frames with a fixed orientation
+ * are organized into a bounding volume hierarchy of axis aligned boxes, so
+ * that groups of them outside the view can be rejected without computing
+ * their positions. Rather than computing every position each frame, the
+ * hierarchy keeps the last computed position of each orbit: since an orbit
+ * never moves faster than its speed at pericenter, the body lies within a
+ * sphere around that position whose radius grows with the time elapsed.
+ * The boxes are refit to those spheres each frame, and a position is only
+ * recomputed when its sphere has grown too large or the body may be in
+ * view. When time is passing so quickly that most of the bodies have
+ * moved significantly since the last frame, the positions are all computed
+ * in a batch, and the hierarchy isn't used.
+ */
+class FrameTree::ChildBVH
+{
+public:
+    ChildBVH(const vector<TimelinePhase*>& children,
+             const ChildPositionCache& _positionCache,
+             const CullingInfo& cullingInfo);
+
+    void findVisibleChildren(double tdb,
+                             const ViewCone& cone,
+                             const CullingInfo& cullingInfo,
+                             vector<unsigned int>& visibleChildren,
+                             vector<Vector3d>& positions,
+                             WorkerPool* pool);
+
+private:
+    struct Node
+    {
+        double boxMin[3];
+        double boxMax[3];
+        unsigned int first;   // first item in a leaf
+        unsigned int count;   // number of items in a leaf; zero for interior nodes
+        unsigned int right;   // second child of an interior node; the first
+                              // child immediately follows its parent
+    };
+
+    void build(double tdb);
+    unsigned int buildNode(unsigned int first, unsigned int count, unsigned int* order);
+    double refit(double tdb);
+    void computeAllItemPositions(double tdb, vector<Vector3d>& positions, WorkerPool* pool);
+    void computeItemPositions(double tdb, vector<Vector3d>& positions);
+    void updateItem(unsigned int item, double tdb, const Vector3d& position);
+    double itemRadius(unsigned int item, double tdb) const
+    {
+        return cullingRadii[item] + maxSpeeds[item] * fabs(tdb - sampleTimes[item]);
+    }
+
+    const ChildPositionCache& positionCache;
+
+    vector<Node> nodes;
+    double builtLeafRadius;
+
+    // Attributes of the orbits in the hierarchy, in leaf order. Items are
+    // identified by their index in the elliptical orbit array.
+    vector<unsigned int> items;
+    vector<Vector3d> itemPositions;
+    vector<double> sampleTimes;
+    vector<double> maxSpeeds;
+    vector<double> cullingRadii;
+    vector<double> refreshDistances;
+
+    // Elliptical orbits that aren't in the hierarchy
+    vector<unsigned int> unboundedOrbits;
+
+    // Scratch lists of items and orbits whose positions are computed
+    vector<unsigned int> selectedItems;
+    vector<unsigned int> selectedOrbits;
+};
+
+
 /*! Create a frame tree associated with a star.
  */
 FrameTree::FrameTree(Star* star) :
     starParent(star),
     bodyParent(NULL),
-    defaultFrame(NULL)
+    m_changed(false),
+    m_threadSafe(false),
+    defaultFrame(NULL),
+    positionCache(NULL),
+    childBVH(NULL)
 {
     // Default frame for a star is J2000 ecliptical, centered
     // on the star.
@@ -57,7 +207,11 @@ FrameTree::FrameTree(Star* star) :
 FrameTree::FrameTree(Body* body) :
     starParent(NULL),
     bodyParent(body),
-    defaultFrame(NULL)
+    m_changed(false),
+    m_threadSafe(false),
+    defaultFrame(NULL),
+    positionCache(NULL),
+    childBVH(NULL)
 {
     // Default frame for a solar system body is the mean equatorial frame of the body.
     defaultFrame = new BodyMeanEquatorFrame(Selection(body), Selection(body));
@@ -67,6 +221,8 @@ FrameTree::FrameTree(Body* body) :
 
 FrameTree::~FrameTree()
 {
+    delete childBVH;
+    delete positionCache;
     defaultFrame->release();
 }
 
@@ -118,8 +274,8 @@ FrameTree::markUpdated()
 /*! Recompute the bounding sphere for this tree and all subtrees marked
  *  as having changed. The bounding sphere is large enough to accommodate
  *  the orbits (and radii) of all child bodies. This method also recomputes
- *  the maximum child radius, secondary illuminator status, and child
- *  class mask.
+ *  the maximum child radius, secondary illuminator status, child
+ *  class mask, and thread safety.
  */
 void
 FrameTree::recomputeBoundingSphere()
@@ -129,12 +285,21 @@ FrameTree::recomputeBoundingSphere()
         m_boundingSphereRadius = 0.0;
         m_maxChildRadius = 0.0;
         m_containsSecondaryIlluminators = false;
+        m_threadSafe = true;
         m_childClassMask = 0;
 
-        for (vector<TimelinePhase*>::iterator iter = children.begin();
-             iter != children.end(); iter++)
+        // The hierarchy depends on the culling radii of the children
+        delete childBVH;
+        childBVH = NULL;
+
+        m_cullingInfo.startTimes.resize(children.size());
+        m_cullingInfo.endTimes.resize(children.size());
+        m_cullingInfo.cullingRadii.resize(children.size());
+        m_cullingInfo.alwaysVisit.resize(children.size());
+
+        for (unsigned int i = 0; i < children.size(); i++)
         {
-            TimelinePhase* phase = *iter;
+            TimelinePhase* phase = children[i];
             double bodyRadius = phase->body()->getRadius();
             double r = phase->body()->getCullingRadius() + phase->orbit()->getBoundingRadius();
             m_maxChildRadius = max(m_maxChildRadius, bodyRadius);
@@ -142,6 +307,18 @@ FrameTree::recomputeBoundingSphere()
             m_childClassMask |= phase->body()->getClassification();
 
             FrameTree* tree = phase->body()->getFrameTree();
+            m_cullingInfo.startTimes[i] = phase->startTime();
+            m_cullingInfo.endTimes[i] = phase->endTime();
+            m_cullingInfo.cullingRadii[i] = phase->body()->getCullingRadius();
+            m_cullingInfo.alwaysVisit[i] = phase->body()->isSecondaryIlluminator() || tree != NULL;
+
+            const Orbit* orbit = phase->orbit();
+            Selection center = phase->orbitFrame()->getCenter();
+            m_threadSafe = m_threadSafe &&
+                           (orbit->getEllipticalOrbit() != NULL || dynamic_cast<const FixedOrbit*>(orbit) != NULL) &&
+                           phase->orbitFrame()->hasFixedOrientation() &&
+                           center.star() == starParent && center.body() == bodyParent;
+
             if (tree != NULL)
             {
                 tree->recomputeBoundingSphere();
@@ -149,6 +326,7 @@ FrameTree::recomputeBoundingSphere()
                 m_maxChildRadius = max(m_maxChildRadius, tree->m_maxChildRadius);
                 m_containsSecondaryIlluminators = m_containsSecondaryIlluminators || tree->containsSecondaryIlluminators();
                 m_childClassMask |= tree->childClassMask();
+                m_threadSafe = m_threadSafe && tree->isThreadSafe();
             }
 
             m_boundingSphereRadius = max(m_boundingSphereRadius, r);
@@ -165,6 +343,13 @@ FrameTree::addChild(TimelinePhase* phase)
     phase->addRef();
     children.push_back(phase);
     markChanged();
+
+    // The culling information is indexed by child
+    m_cullingInfo = CullingInfo();
+    delete childBVH;
+    childBVH = NULL;
+    delete positionCache;
+    positionCache = NULL;
 }
 
 
@@ -180,6 +365,12 @@ FrameTree::removeChild(TimelinePhase* phase)
         (*iter)->release();
         children.erase(iter);
         markChanged();
+
+        m_cullingInfo = CullingInfo();
+        delete childBVH;
+        childBVH = NULL;
+        delete positionCache;
+        positionCache = NULL;
     }
 }
 
@@ -198,3 +389,641 @@ FrameTree::childCount() const
 {
     return children.size();
 }
+
+
+// Batches of elliptical orbits at least this large are split among the
+// threads of a worker pool.
+static const unsigned int MinParallelOrbitCount = 16384;
+
+
+// Order elliptical orbits by eccentricity, so that orbits using the same
+// Kepler equation solver are adjacent in the orbit array.
+struct EccentricityPredicate
+{
+    EccentricityPredicate(const vector<TimelinePhase*>& _children) :
+        children(_children)
+    {
+    }
+
+    bool operator()(unsigned int a, unsigned int b) const
+    {
+        return children[a]->orbit()->getEllipticalOrbit()->getEccentricity() <
+               children[b]->orbit()->getEllipticalOrbit()->getEccentricity();
+    }
+
+    const vector<TimelinePhase*>& children;
+};
+
+
+FrameTree::ChildPositionCache::ChildPositionCache(const vector<TimelinePhase*>& children)
+{
+    for (unsigned int i = 0; i < children.size(); i++)
+    {
+        const EllipticalOrbit* orbit = children[i]->orbit()->getEllipticalOrbit();
+        const ReferenceFrame* frame = children[i]->orbitFrame();
+        if (orbit != NULL && frame->hasFixedOrientation())
+            ellipticalChildren.push_back(i);
+        else
+            otherChildren.push_back(i);
+    }
+
+    stable_sort(ellipticalChildren.begin(), ellipticalChildren.end(),
+                EccentricityPredicate(children));
+
+    for (unsigned int i = 0; i < ellipticalChildren.size(); i++)
+    {
+        const TimelinePhase* phase = children[ellipticalChildren[i]];
+        ellipticalOrbits.add(*phase->orbit()->getEllipticalOrbit());
+
+        Quaterniond q = phase->orbitFrame()->getOrientation(0.0).conjugate();
+        frameOrientations.push_back(q.w());
+        frameOrientations.push_back(q.x());
+        frameOrientations.push_back(q.y());
+        frameOrientations.push_back(q.z());
+    }
+}
+
+
+void
+FrameTree::ChildPositionCache::computeEllipticalPositions(double tdb,
+                                                          Vector3d* positions,
+                                                          unsigned int first,
+                                                          unsigned int count) const
+{
+    const unsigned int BlockSize = 256;
+    Vector3d orbitPositions[BlockSize];
+
+    for (unsigned int blockStart = first; blockStart < first + count; blockStart += BlockSize)
+    {
+        unsigned int n = min(BlockSize, first + count - blockStart);
+        ellipticalOrbits.positionsAtTime(tdb, orbitPositions, blockStart, n);
+        for (unsigned int i = 0; i < n; i++)
+        {
+            const double* q = &frameOrientations[(blockStart + i) * 4];
+            positions[ellipticalChildren[blockStart + i]] =
+                Quaterniond(q[0], q[1], q[2], q[3]) * orbitPositions[i];
+        }
+    }
+}
+
+
+/* Compute the positions of all the elliptical orbits, storing them in the
+ * positions array indexed by child. When there are enough orbits and a
+ * worker pool is given, the work is started on the pool's threads; the
+ * caller must wait for the tasks before reading the positions.
+ */
+void
+FrameTree::ChildPositionCache::startEllipticalPositions(double tdb,
+                                                        Vector3d* positions,
+                                                        WorkerPool* pool,
+                                                        TaskGroup& tasks) const
+{
+    unsigned int nElliptical = ellipticalOrbits.size();
+    if (pool != NULL && nElliptical >= MinParallelOrbitCount)
+    {
+        unsigned int nTasks = pool->getThreadCount() + 1;
+        unsigned int taskSize = (nElliptical + nTasks - 1) / nTasks;
+        for (unsigned int first = 0; first < nElliptical; first += taskSize)
+        {
+            unsigned int count = min(taskSize, nElliptical - first);
+            pool->submit(new EllipticalPositionsTask(this, tdb, positions, first, count), &tasks);
+        }
+    }
+    else
+    {
+        computeEllipticalPositions(tdb, positions, 0, nElliptical);
+    }
+}
+
+
+// Compute the positions of the elliptical orbits with the specified
+// indices, which should be in increasing order.
+void
+FrameTree::ChildPositionCache::computeSelectedPositions(double tdb,
+                                                        Vector3d* positions,
+                                                        const unsigned int* orbitIndices,
+                                                        unsigned int count) const
+{
+    const unsigned int BlockSize = 256;
+    Vector3d orbitPositions[BlockSize];
+
+    for (unsigned int blockStart = 0; blockStart < count; blockStart += BlockSize)
+    {
+        unsigned int n = min(BlockSize, count - blockStart);
+        ellipticalOrbits.indexedPositionsAtTime(tdb, orbitPositions, orbitIndices + blockStart, n);
+        for (unsigned int i = 0; i < n; i++)
+        {
+            unsigned int orbitIndex = orbitIndices[blockStart + i];
+            const double* q = &frameOrientations[orbitIndex * 4];
+            positions[ellipticalChildren[orbitIndex]] =
+                Quaterniond(q[0], q[1], q[2], q[3]) * orbitPositions[i];
+        }
+    }
+}
+
+
+/*! Compute the positions at time tdb of all children in this tree that
+ *  are active at that time. The positions are relative to the center of
+ *  the tree, and in the universal frame; positions for inactive children
+ *  are undefined. If a worker pool is given, large numbers of children
+ *  with elliptical orbits are split among its threads. This method may
+ *  be called from any thread, but not concurrently for the same tree.
+ */
+void
+FrameTree::computeChildPositions(double tdb,
+                                 vector<Vector3d>& positions,
+                                 WorkerPool* pool) const
+{
+    if (positionCache == NULL)
+        positionCache = new ChildPositionCache(children);
+
+    positions.resize(children.size());
+    if (children.empty())
+        return;
+
+    // Start the elliptical orbits on the pool, so that they're computed
+    // while this thread works on the other children.
+    TaskGroup ellipticalTasks;
+    positionCache->startEllipticalPositions(tdb, &positions[0], pool, ellipticalTasks);
+
+    // Children in the same frame are usually adjacent, so the orientation
+    // of the last frame is reused.
+    const ReferenceFrame* lastFrame = NULL;
+    Quaterniond frameOrientation;
+    for (unsigned int i = 0; i < positionCache->otherChildren.size(); i++)
+    {
+        unsigned int childIndex = positionCache->otherChildren[i];
+        const TimelinePhase* phase = children[childIndex];
+        if (!phase->includes(tdb))
+            continue;
+
+        Vector3d p = phase->orbit()->positionAtTime(tdb);
+        const ReferenceFrame* frame = phase->orbitFrame();
+        if (frame != lastFrame)
+        {
+            frameOrientation = frame->getOrientation(tdb).conjugate();
+            lastFrame = frame;
+        }
+
+        positions[childIndex] = frameOrientation * p;
+    }
+
+    if (pool != NULL)
+        pool->wait(ellipticalTasks);
+}
+
+
+// Trees with fewer bounded elliptical orbits than this don't use a
+// hierarchy; the children are simply tested one by one.
+static const unsigned int MinBVHOrbitCount = 64;
+
+static const unsigned int MaxBVHLeafSize = 8;
+
+// The position of an orbit is recomputed once it may have moved more than
+// this fraction of its apocenter distance since it was last computed.
+static const double PositionRefreshFraction = 1.0 / 64.0;
+
+// When more than this fraction of the orbits in the hierarchy have to be
+// computed, they're all computed at once.
+static const unsigned int BatchUpdateDivisor = 2;
+
+// The hierarchy is rebuilt when the bodies have moved apart enough that the
+// leaves are this much larger than when it was built.
+static const double BVHRebuildFactor = 4.0;
+
+
+// Test whether a sphere intersects the view cone; this is the same test
+// that the renderer applies to bodies.
+static bool sphereInViewCone(const Vector3d& center, double radius,
+                             const FrameTree::ViewCone& cone)
+{
+    Vector3d v = center - cone.apex;
+    double distAlongAxis = cone.axis.dot(v);
+    if (distAlongAxis <= -radius)
+        return false;
+
+    double maxPerpDist = (radius + distAlongAxis * cone.sinAngle) / cone.cosAngle;
+    double perpDistSq = v.squaredNorm() - distAlongAxis * distAlongAxis;
+    return perpDistSq < maxPerpDist * maxPerpDist;
+}
+
+
+FrameTree::ChildBVH::ChildBVH(const vector<TimelinePhase*>& children,
+                              const ChildPositionCache& _positionCache,
+                              const CullingInfo& cullingInfo) :
+    positionCache(_positionCache),
+    builtLeafRadius(0.0)
+{
+    // Children that must always be visited and unbounded orbits are left
+    // out of the hierarchy.
+    for (unsigned int n = 0; n < positionCache.ellipticalChildren.size(); n++)
+    {
+        unsigned int childIndex = positionCache.ellipticalChildren[n];
+        const EllipticalOrbit* orbit = children[childIndex]->orbit()->getEllipticalOrbit();
+        if (cullingInfo.alwaysVisit[childIndex] || orbit->getEccentricity() >= 1.0)
+            unboundedOrbits.push_back(n);
+        else
+            items.push_back(n);
+    }
+
+    if (items.size() < MinBVHOrbitCount)
+    {
+        unboundedOrbits.insert(unboundedOrbits.end(), items.begin(), items.end());
+        items.clear();
+    }
+
+    for (unsigned int i = 0; i < items.size(); i++)
+    {
+        unsigned int childIndex = positionCache.ellipticalChildren[items[i]];
+        const EllipticalOrbit* orbit = children[childIndex]->orbit()->getEllipticalOrbit();
+        double e = orbit->getEccentricity();
+        double apocenter = orbit->getBoundingRadius();
+        double a = apocenter / (1.0 + e);
+
+        maxSpeeds.push_back(2.0 * PI / orbit->getPeriod() * a * sqrt((1.0 + e) / (1.0 - e)));
+        cullingRadii.push_back(cullingInfo.cullingRadii[childIndex]);
+        refreshDistances.push_back(apocenter * PositionRefreshFraction);
+    }
+
+    // The positions are computed on first use
+    itemPositions.resize(items.size(), Vector3d::Zero());
+    sampleTimes.resize(items.size(), 0.0);
+}
+
+
+/*! Find the children that are active at time tdb and may be inside the
+ *  view cone, computing their positions.
+ */
+void
+FrameTree::ChildBVH::findVisibleChildren(double tdb,
+                                         const ViewCone& cone,
+                                         const CullingInfo& cullingInfo,
+                                         vector<unsigned int>& visibleChildren,
+                                         vector<Vector3d>& positions,
+                                         WorkerPool* pool)
+{
+    selectedOrbits.clear();
+    for (unsigned int i = 0; i < unboundedOrbits.size(); i++)
+    {
+        unsigned int childIndex = positionCache.ellipticalChildren[unboundedOrbits[i]];
+        if (cullingInfo.startTimes[childIndex] <= tdb && tdb < cullingInfo.endTimes[childIndex])
+        {
+            selectedOrbits.push_back(unboundedOrbits[i]);
+            visibleChildren.push_back(childIndex);
+        }
+    }
+
+    if (!selectedOrbits.empty())
+        positionCache.computeSelectedPositions(tdb, &positions[0], &selectedOrbits[0], selectedOrbits.size());
+
+    if (items.empty())
+        return;
+
+    // Recompute the positions of bodies that may have moved too far since
+    // they were last computed. There's no need to look further once it's
+    // clear that all of the positions will be computed.
+    selectedItems.clear();
+    for (unsigned int i = 0; i < items.size() && selectedItems.size() <= items.size() / BatchUpdateDivisor; i++)
+    {
+        if (maxSpeeds[i] * fabs(tdb - sampleTimes[i]) > refreshDistances[i])
+            selectedItems.push_back(i);
+    }
+
+    if (nodes.empty() || selectedItems.size() > items.size() / BatchUpdateDivisor)
+    {
+        computeAllItemPositions(tdb, positions, pool);
+
+        if (nodes.empty())
+        {
+            build(tdb);
+        }
+        else
+        {
+            // Most bodies are moving too far between frames for the
+            // hierarchy to be useful.
+            for (unsigned int i = 0; i < items.size(); i++)
+            {
+                unsigned int childIndex = positionCache.ellipticalChildren[items[i]];
+                if (cullingInfo.startTimes[childIndex] <= tdb && tdb < cullingInfo.endTimes[childIndex])
+                    visibleChildren.push_back(childIndex);
+            }
+            return;
+        }
+    }
+    else if (!selectedItems.empty())
+    {
+        computeItemPositions(tdb, positions);
+    }
+
+    if (refit(tdb) > builtLeafRadius * BVHRebuildFactor)
+        build(tdb);
+
+    // Collect the items whose spheres intersect the view cone
+    selectedItems.clear();
+    unsigned int stack[64];
+    unsigned int stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0)
+    {
+        unsigned int nodeIndex = stack[--stackSize];
+        const Node& node = nodes[nodeIndex];
+        Vector3d center(node.boxMax[0] + node.boxMin[0],
+                        node.boxMax[1] + node.boxMin[1],
+                        node.boxMax[2] + node.boxMin[2]);
+        Vector3d diagonal(node.boxMax[0] - node.boxMin[0],
+                          node.boxMax[1] - node.boxMin[1],
+                          node.boxMax[2] - node.boxMin[2]);
+        if (!sphereInViewCone(center * 0.5, diagonal.norm() * 0.5, cone))
+            continue;
+
+        if (node.count == 0)
+        {
+            stack[stackSize++] = node.right;
+            stack[stackSize++] = nodeIndex + 1;
+        }
+        else
+        {
+            for (unsigned int i = node.first; i < node.first + node.count; i++)
+            {
+                unsigned int childIndex = positionCache.ellipticalChildren[items[i]];
+                if (cullingInfo.startTimes[childIndex] <= tdb && tdb < cullingInfo.endTimes[childIndex] &&
+                    sphereInViewCone(itemPositions[i], itemRadius(i, tdb), cone))
+                {
+                    selectedItems.push_back(i);
+                }
+            }
+        }
+    }
+
+    // Compute the positions of the bodies that may be visible, all at once
+    // if there are many of them.
+    if (selectedItems.size() > items.size() / BatchUpdateDivisor)
+        computeAllItemPositions(tdb, positions, pool);
+    else
+        computeItemPositions(tdb, positions);
+
+    for (unsigned int i = 0; i < selectedItems.size(); i++)
+        visibleChildren.push_back(positionCache.ellipticalChildren[items[selectedItems[i]]]);
+}
+
+
+// Compute the positions of all the elliptical orbits, and update the
+// positions of all the items in the hierarchy.
+void
+FrameTree::ChildBVH::computeAllItemPositions(double tdb,
+                                             vector<Vector3d>& positions,
+                                             WorkerPool* pool)
+{
+    TaskGroup ellipticalTasks;
+    positionCache.startEllipticalPositions(tdb, &positions[0], pool, ellipticalTasks);
+    if (pool != NULL)
+        pool->wait(ellipticalTasks);
+
+    for (unsigned int i = 0; i < items.size(); i++)
+        updateItem(i, tdb, positions[positionCache.ellipticalChildren[items[i]]]);
+}
+
+
+// Compute the positions of the selected items
+void
+FrameTree::ChildBVH::computeItemPositions(double tdb, vector<Vector3d>& positions)
+{
+    if (selectedItems.empty())
+        return;
+
+    // Items are in spatial order, but orbits are computed most efficiently
+    // in the order of the orbit array.
+    selectedOrbits.resize(selectedItems.size());
+    for (unsigned int i = 0; i < selectedItems.size(); i++)
+        selectedOrbits[i] = items[selectedItems[i]];
+    sort(selectedOrbits.begin(), selectedOrbits.end());
+
+    positionCache.computeSelectedPositions(tdb, &positions[0], &selectedOrbits[0], selectedOrbits.size());
+
+    for (unsigned int i = 0; i < selectedItems.size(); i++)
+    {
+        unsigned int item = selectedItems[i];
+        updateItem(item, tdb, positions[positionCache.ellipticalChildren[items[item]]]);
+    }
+}
+
+
+void
+FrameTree::ChildBVH::updateItem(unsigned int item, double tdb, const Vector3d& position)
+{
+    itemPositions[item] = position;
+    sampleTimes[item] = tdb;
+}
+
+
+// Orders item indices by position along one axis
+struct ItemPositionPredicate
+{
+    ItemPositionPredicate(const vector<Vector3d>& _positions, int _axis) :
+        positions(_positions),
+        axis(_axis)
+    {
+    }
+
+    bool operator()(unsigned int a, unsigned int b) const
+    {
+        return positions[a][axis] < positions[b][axis];
+    }
+
+    const vector<Vector3d>& positions;
+    int axis;
+};
+
+
+/* Build the hierarchy from the last computed positions of the items,
+ * splitting each node at the median position along its longest axis. The
+ * item arrays are reordered so that the items in each leaf are contiguous.
+ */
+void
+FrameTree::ChildBVH::build(double tdb)
+{
+    vector<unsigned int> order(items.size());
+    for (unsigned int i = 0; i < order.size(); i++)
+        order[i] = i;
+
+    nodes.clear();
+    buildNode(0, items.size(), &order[0]);
+
+    vector<unsigned int> oldItems(items);
+    vector<Vector3d> oldPositions(itemPositions);
+    vector<double> oldSampleTimes(sampleTimes);
+    vector<double> oldMaxSpeeds(maxSpeeds);
+    vector<double> oldCullingRadii(cullingRadii);
+    vector<double> oldRefreshDistances(refreshDistances);
+    for (unsigned int i = 0; i < order.size(); i++)
+    {
+        items[i] = oldItems[order[i]];
+        itemPositions[i] = oldPositions[order[i]];
+        sampleTimes[i] = oldSampleTimes[order[i]];
+        maxSpeeds[i] = oldMaxSpeeds[order[i]];
+        cullingRadii[i] = oldCullingRadii[order[i]];
+        refreshDistances[i] = oldRefreshDistances[order[i]];
+    }
+
+    builtLeafRadius = refit(tdb);
+}
+
+
+unsigned int
+FrameTree::ChildBVH::buildNode(unsigned int first, unsigned int count, unsigned int* order)
+{
+    unsigned int nodeIndex = nodes.size();
+    nodes.push_back(Node());
+    nodes[nodeIndex].first = first;
+    nodes[nodeIndex].count = count;
+    nodes[nodeIndex].right = 0;
+
+    if (count <= MaxBVHLeafSize)
+        return nodeIndex;
+
+    Vector3d lower = itemPositions[order[first]];
+    Vector3d upper = lower;
+    for (unsigned int i = first + 1; i < first + count; i++)
+    {
+        lower = lower.cwise().min(itemPositions[order[i]]);
+        upper = upper.cwise().max(itemPositions[order[i]]);
+    }
+
+    int axis = 0;
+    Vector3d extent = upper - lower;
+    if (extent.y() > extent[axis])
+        axis = 1;
+    if (extent.z() > extent[axis])
+        axis = 2;
+
+    unsigned int half = count / 2;
+    nth_element(order + first, order + first + half, order + first + count,
+                ItemPositionPredicate(itemPositions, axis));
+
+    nodes[nodeIndex].count = 0;
+    buildNode(first, half, order);
+    unsigned int right = buildNode(first + half, count - half, order);
+    nodes[nodeIndex].right = right;
+
+    return nodeIndex;
+}
+
+
+/* Fit the boxes to the spheres containing the items at time tdb. Children
+ * always follow their parents in the node array, so the nodes are visited
+ * in reverse order. Return the sum of the leaf box radii, a measure of
+ * how well the hierarchy fits the current positions.
+ */
+double
+FrameTree::ChildBVH::refit(double tdb)
+{
+    double leafRadiusSum = 0.0;
+
+    for (unsigned int n = nodes.size(); n-- > 0; )
+    {
+        Node& node = nodes[n];
+        if (node.count == 0)
+        {
+            const Node& left = nodes[n + 1];
+            const Node& right = nodes[node.right];
+            for (int k = 0; k < 3; k++)
+            {
+                node.boxMin[k] = min(left.boxMin[k], right.boxMin[k]);
+                node.boxMax[k] = max(left.boxMax[k], right.boxMax[k]);
+            }
+        }
+        else
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                node.boxMin[k] = itemPositions[node.first][k];
+                node.boxMax[k] = itemPositions[node.first][k];
+            }
+
+            for (unsigned int i = node.first; i < node.first + node.count; i++)
+            {
+                double r = itemRadius(i, tdb);
+                for (int k = 0; k < 3; k++)
+                {
+                    node.boxMin[k] = min(node.boxMin[k], itemPositions[i][k] - r);
+                    node.boxMax[k] = max(node.boxMax[k], itemPositions[i][k] + r);
+                }
+            }
+
+            Vector3d diagonal(node.boxMax[0] - node.boxMin[0],
+                              node.boxMax[1] - node.boxMin[1],
+                              node.boxMax[2] - node.boxMin[2]);
+            leafRadiusSum += diagonal.norm() * 0.5;
+        }
+    }
+
+    return leafRadiusSum;
+}
+
+
+/*! Find the children that are active at time tdb and may be inside the
+ *  view cone, and compute their positions. Children with subtrees and
+ *  secondary illuminators are always included, as are children whose
+ *  extent isn't known; the caller must still test each child against the
+ *  view. Groups of children with elliptical orbits are rejected without
+ *  computing their positions. The indices of the children are stored in
+ *  visibleChildren in no particular order, and their positions are stored
+ *  in the positions array, indexed by child; positions of other children
+ *  are undefined. Like computeChildPositions(), this method may be called
+ *  from any thread, but not concurrently for the same tree.
+ */
+void
+FrameTree::findVisibleChildren(double tdb,
+                               const ViewCone& cone,
+                               vector<unsigned int>& visibleChildren,
+                               vector<Vector3d>& positions,
+                               WorkerPool* pool) const
+{
+    visibleChildren.clear();
+
+    // The culling information is cleared when children are added or removed,
+    // and isn't recomputed until the bounding spheres are; until then, all
+    // active children are visible.
+    if (m_cullingInfo.cullingRadii.size() != children.size())
+    {
+        computeChildPositions(tdb, positions, pool);
+        for (unsigned int i = 0; i < children.size(); i++)
+        {
+            if (children[i]->includes(tdb))
+                visibleChildren.push_back(i);
+        }
+        return;
+    }
+
+    positions.resize(children.size());
+    if (children.empty())
+        return;
+
+    if (positionCache == NULL)
+        positionCache = new ChildPositionCache(children);
+    if (childBVH == NULL)
+        childBVH = new ChildBVH(children, *positionCache, m_cullingInfo);
+
+    const ReferenceFrame* lastFrame = NULL;
+    Quaterniond frameOrientation;
+    for (unsigned int i = 0; i < positionCache->otherChildren.size(); i++)
+    {
+        unsigned int childIndex = positionCache->otherChildren[i];
+        const TimelinePhase* phase = children[childIndex];
+        if (!phase->includes(tdb))
+            continue;
+
+        Vector3d p = phase->orbit()->positionAtTime(tdb);
+        const ReferenceFrame* frame = phase->orbitFrame();
+        if (frame != lastFrame)
+        {
+            frameOrientation = frame->getOrientation(tdb).conjugate();
+            lastFrame = frame;
+        }
+
+        positions[childIndex] = frameOrientation * p;
+        visibleChildren.push_back(childIndex);
+    }
+
+    childBVH->findVisibleChildren(tdb, cone, m_cullingInfo, visibleChildren, positions, pool);
+}
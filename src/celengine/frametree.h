@@ -14,11 +14,13 @@
 #define _CELENGINE_FRAMETREE_H_
 
 #include <vector>
+#include <Eigen/Core>
 
 class Star;
 class Body;
 class ReferenceFrame;
 class TimelinePhase;
+class WorkerPool;
 
 
 class FrameTree
@@ -47,6 +49,10 @@ public:
     void markUpdated();
     void recomputeBoundingSphere();
 
+    void computeChildPositions(double tdb,
+                               std::vector<Eigen::Vector3d>& positions,
+                               WorkerPool* pool = NULL) const;
+
     bool isRoot() const
     {
         return bodyParent == NULL;
@@ -88,6 +94,35 @@ public:
         return m_childClassMask;
     }
 
+    /*! Return whether the bodies in this tree and its subtrees can be
+     *  traversed on a worker thread, concurrently with other trees. This
+     *  is the case when every orbit is elliptical or fixed, in a frame of
+     *  fixed orientation centered on the tree's parent; other orbits may
+     *  share state with bodies elsewhere or call into scripts.
+     */
+    bool isThreadSafe() const
+    {
+        return m_threadSafe;
+    }
+
+    /*! A cone with its apex at the observer, used to find the children
+     *  that may be in view. The apex is relative to the center of the
+     *  tree, and the axis is a unit vector.
+     */
+    struct ViewCone
+    {
+        Eigen::Vector3d apex;
+        Eigen::Vector3d axis;
+        double cosAngle;
+        double sinAngle;
+    };
+
+    void findVisibleChildren(double tdb,
+                             const ViewCone& cone,
+                             std::vector<unsigned int>& visibleChildren,
+                             std::vector<Eigen::Vector3d>& positions,
+                             WorkerPool* pool = NULL) const;
+
 private:
     Star* starParent;
     Body* bodyParent;
@@ -97,9 +132,39 @@ private:
     double m_maxChildRadius;
     bool m_containsSecondaryIlluminators;
     bool m_changed;
+    bool m_threadSafe;
     int m_childClassMask;
 
+    /*! The attributes of the children needed for visibility culling,
+     *  stored as arrays indexed by child so that children outside the
+     *  view can be rejected without visiting their Body objects. They
+     *  are refreshed by recomputeBoundingSphere(), and so are only valid
+     *  while the tree is unchanged.
+     */
+    struct CullingInfo
+    {
+        std::vector<double> startTimes;
+        std::vector<double> endTimes;
+        std::vector<float> cullingRadii;
+
+        // Nonzero for children that can't be culled by their own extent:
+        // secondary illuminators and children with subtrees.
+        std::vector<unsigned char> alwaysVisit;
+    };
+
+    CullingInfo m_cullingInfo;
+
     ReferenceFrame* defaultFrame;
+
+    // Information for computing the positions of all children at once;
+    // rebuilt when children are added or removed.
+    class ChildPositionCache;
+    mutable ChildPositionCache* positionCache;
+
+    // Bounding volume hierarchy over the children with elliptical orbits;
+    // rebuilt when the tree changes.
+    class ChildBVH;
+    mutable ChildBVH* childBVH;
 };
 
 #endif // _CELENGINE_FRAMETREE_H_
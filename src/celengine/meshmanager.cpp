@@ -204,6 +204,30 @@ Geometry* GeometryInfo::load(const string& resolvedFilename)
 }
 
 
+// Model files are read and converted without making any OpenGL calls,
+// so all of them may be loaded in the background. Textures referenced by
+// the model are only assigned handles; they're loaded when first used.
+bool GeometryInfo::canLoadInBackground(const string&) const
+{
+    return true;
+}
+
+
+bool GeometryInfo::loadInBackground(const string& resolvedFilename)
+{
+    geometry = load(resolvedFilename);
+    return geometry != NULL;
+}
+
+
+Geometry* GeometryInfo::finishLoad(const string&)
+{
+    Geometry* g = geometry;
+    geometry = NULL;
+    return g;
+}
+
+
 struct NoiseMeshParameters
 {
     Vector3f size;
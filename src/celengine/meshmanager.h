@@ -33,7 +33,8 @@ class GeometryInfo : public ResourceInfo<Geometry>
         resolvedToPath(false),
         center(Eigen::Vector3f::Zero()),
         scale(1.0f),
-        isNormalized(true)
+        isNormalized(true),
+        geometry(NULL)
         {};
 
     GeometryInfo(const std::string _source,
@@ -46,11 +47,20 @@ class GeometryInfo : public ResourceInfo<Geometry>
         resolvedToPath(false),
         center(_center),
         scale(_scale),
-        isNormalized(_isNormalized)
+        isNormalized(_isNormalized),
+        geometry(NULL)
         {};
 
     virtual std::string resolve(const std::string&);
     virtual Geometry* load(const std::string&);
+
+    virtual bool canLoadInBackground(const std::string&) const;
+    virtual bool loadInBackground(const std::string&);
+    virtual Geometry* finishLoad(const std::string&);
+
+ private:
+    // Geometry loaded in the background, owned by finishLoad()
+    Geometry* geometry;
 };
 
 inline bool operator<(const GeometryInfo& g0, const GeometryInfo& g1)
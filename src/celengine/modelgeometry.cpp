@@ -26,6 +26,11 @@ using namespace std;
 
 // VBO optimization is only worthwhile for large enough vertex lists
 static const unsigned int MinVBOSize = 4096;
+
+// Meshes are drawn at the coarsest level of detail that deviates from the
+// full detail mesh by less than this many pixels.
+static const float MaxLODPixelError = 1.0f;
+
 static bool VBOSupportTested = false;
 static bool VBOSupported = false;
 
@@ -133,6 +138,10 @@ ModelGeometry::render(RenderContext& rc, double /* t */)
     unsigned int lastMaterial = ~0u;
     unsigned int materialCount = m_model->getMaterialCount();
 
+    float maxLODError = 0.0f;
+    if (rc.getPixelsPerUnit() > 0.0f)
+        maxLODError = MaxLODPixelError / rc.getPixelsPerUnit();
+
     // Iterate over all meshes in the model
     for (unsigned int meshIndex = 0; meshIndex < m_model->getMeshCount(); ++meshIndex)
     {
@@ -156,10 +165,17 @@ ModelGeometry::render(RenderContext& rc, double /* t */)
             rc.setVertexArrays(mesh->getVertexDescription(), mesh->getVertexData());
         }
 
+        // Draw the primitive groups of the mesh's coarsest level of detail
+        // that's indistinguishable from the full detail mesh at this size.
+        const Mesh::LevelOfDetail* lod = NULL;
+        if (maxLODError > 0.0f)
+            lod = mesh->selectLevelOfDetail(maxLODError);
+        unsigned int groupCount = lod != NULL ? lod->getGroupCount() : mesh->getGroupCount();
+
         // Iterate over all primitive groups in the mesh
-        for (unsigned int groupIndex = 0; groupIndex < mesh->getGroupCount(); ++groupIndex)
+        for (unsigned int groupIndex = 0; groupIndex < groupCount; ++groupIndex)
         {
-            const Mesh::PrimitiveGroup* group = mesh->getGroup(groupIndex);
+            const Mesh::PrimitiveGroup* group = lod != NULL ? lod->getGroup(groupIndex) : mesh->getGroup(groupIndex);
 
             // Set up the material
             const Material* material = NULL;
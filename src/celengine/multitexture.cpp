@@ -88,6 +88,17 @@ Texture* MultiResTexture::find(unsigned int resolution)
         break;
     }
 
+    // While the preferred texture is still being loaded in the background,
+    // fall back to another resolution without giving up on it.
+    const TextureInfo* info = texMan->getResourceInfo(tex[resolution]);
+    if (info != NULL && info->state == ResourceLoading)
+    {
+        res = texMan->find(tex[secondChoice]);
+        if (res == NULL)
+            res = texMan->find(tex[lastResort]);
+        return res;
+    }
+
     tex[resolution] = tex[secondChoice];
     res = texMan->find(tex[resolution]);
     if (res != NULL)
@@ -17,6 +17,7 @@
 #include <iostream>
 #include <map>
 #include <vector>
+#include <algorithm>
 #include <celutil/basictypes.h>
 #include <celutil/debug.h>
 #include <celutil/util.h>
@@ -31,7 +32,7 @@ template <class OBJ> class NameDatabase
     typedef std::multimap<uint32, std::string> NumberIndex;
 
  public:
-    NameDatabase() {};
+    NameDatabase() : completionIndexValid(false) {};
 
 
     uint32 getNameCount() const;
@@ -47,11 +48,34 @@ template <class OBJ> class NameDatabase
     NumberIndex::const_iterator getFirstNameIter(const uint32 catalogNumber) const;
     NumberIndex::const_iterator getFinalNameIter() const;
 
-    std::vector<std::string> getCompletion(const std::string& name) const;
+    // Return the names beginning with the specified prefix, ignoring case.
+    // If maxCompletions is nonzero, at most that many names are returned.
+    std::vector<std::string> getCompletion(const std::string& name,
+                                           unsigned int maxCompletions = 0) const;
 
  protected:
     NameIndex   nameIndex;
     NumberIndex numberIndex;
+
+ private:
+    // Names sorted by their normalized form, so that the names with a
+    // given prefix are found with a binary search. The index is rebuilt
+    // on the first completion after names are added.
+    typedef std::pair<std::string, const std::string*> CompletionEntry;
+    typedef std::vector<CompletionEntry> CompletionIndex;
+
+    struct CompletionEntryPredicate
+    {
+        bool operator()(const CompletionEntry& a, const CompletionEntry& b) const
+        {
+            return a.first < b.first;
+        }
+    };
+
+    void buildCompletionIndex() const;
+
+    mutable CompletionIndex completionIndex;
+    mutable bool completionIndexValid;
 };
 
 
@@ -78,6 +102,7 @@ void NameDatabase<OBJ>::add(const uint32 catalogNumber, const std::string& name)
 
         nameIndex[name]   = catalogNumber;
         numberIndex.insert(NumberIndex::value_type(catalogNumber, name));
+        completionIndexValid = false;
     }
 }
 
@@ -150,18 +175,41 @@ NameDatabase<OBJ>::NumberIndex::const_iterator NameDatabase<OBJ>::getFinalNameIt
 
 
 template <class OBJ>
-std::vector<std::string> NameDatabase<OBJ>::getCompletion(const std::string& name) const
+void NameDatabase<OBJ>::buildCompletionIndex() const
 {
+    completionIndex.clear();
+    completionIndex.reserve(nameIndex.size());
+    for (NameIndex::const_iterator iter = nameIndex.begin(); iter != nameIndex.end(); ++iter)
+        completionIndex.push_back(CompletionEntry(UTF8NormalizeString(iter->first), &iter->first));
+
+    // The stable sort keeps names that differ only in case in the order
+    // of the name index.
+    std::stable_sort(completionIndex.begin(), completionIndex.end(), CompletionEntryPredicate());
+    completionIndexValid = true;
+}
+
+
+template <class OBJ>
+std::vector<std::string> NameDatabase<OBJ>::getCompletion(const std::string& name,
+                                                          unsigned int maxCompletions) const
+{
+    if (!completionIndexValid)
+        buildCompletionIndex();
+
     std::vector<std::string> completion;
-    int name_length = UTF8Length(name);
+    CompletionEntry key(UTF8NormalizeString(name), NULL);
 
-    for (NameIndex::const_iterator iter = nameIndex.begin(); iter != nameIndex.end(); ++iter)
+    typename CompletionIndex::const_iterator iter =
+        std::lower_bound(completionIndex.begin(), completionIndex.end(), key, CompletionEntryPredicate());
+    for (; iter != completionIndex.end(); ++iter)
     {
-        if (!UTF8StringCompare(iter->first, name, name_length))
-        {
-            completion.push_back(iter->first);
-        }
+        if (iter->first.compare(0, key.first.length(), key.first) != 0)
+            break;
+        if (maxCompletions != 0 && completion.size() == maxCompletions)
+            break;
+        completion.push_back(*iter->second);
     }
+
     return completion;
 }
 
@@ -17,7 +17,10 @@
 #include <Eigen/Geometry>
 #include <celmath/plane.h>
 #include <celengine/observer.h>
+#include <celutil/basictypes.h>
+#include <celutil/workerpool.h>
 #include <vector>
+#include <algorithm>
 
 // The DynamicOctree and StaticOctree template arguments are:
 // OBJ:  object hanging from the node,
@@ -33,6 +36,20 @@ template <class OBJ, class PREC> class OctreeProcessor
     virtual ~OctreeProcessor() {};
 
     virtual void process(const OBJ& obj, PREC distance, float appMag) = 0;
+
+    // Octree traversals that evaluate the objects of a node in bulk pass
+    // the candidates to processBatch(). Candidate i is
+    // objects[indices[i]], with distance distances[i] and apparent magnitude
+    // appMags[i]. The default implementation calls process() for each one.
+    virtual void processBatch(const OBJ*    objects,
+                              const uint32* indices,
+                              const PREC*   distances,
+                              const float*  appMags,
+                              unsigned int  count)
+    {
+        for (unsigned int i = 0; i < count; ++i)
+            process(objects[indices[i]], distances[i], appMags[i]);
+    }
 };
 
 
@@ -45,6 +62,22 @@ struct OctreeLevelStatistics
 };
 
 
+// Pointer-free representation of a StaticOctree node, used to store a
+// prebuilt octree in a catalog file. Nodes are kept in breadth-first order;
+// the eight children of a node are stored consecutively beginning at index
+// firstChild, and a firstChild of zero marks a leaf (the root node can never
+// be a child.) Objects are identified by their index in the spatially
+// sorted object array.
+struct OctreeNodeRecord
+{
+    float  center[3];
+    float  exclusionFactor;
+    uint32 firstObject;
+    uint32 nObjects;
+    uint32 firstChild;
+};
+
+
 template <class OBJ, class PREC> class StaticOctree;
 template <class OBJ, class PREC> class DynamicOctree
 {
@@ -65,6 +98,7 @@ private:
     ~DynamicOctree();
 
     void insertObject  (const OBJ&, const PREC);
+    void insertObjects (std::vector<const OBJ*>& objects, const PREC, WorkerPool* pool = NULL);
     void rebuildAndSort(StaticOctree<OBJ, PREC>*&, OBJ*&);
 
  private:
@@ -79,6 +113,36 @@ private:
     void           split(const PREC);
     void           sortIntoChildNodes();
     DynamicOctree* getChild(const OBJ&, const Eigen::Matrix<PREC, 3, 1>&);
+    void           createChildren(const PREC);
+    void           buildSubtree(ObjectList& arrivals,
+                                unsigned int batchSize,
+                                const PREC scale,
+                                WorkerPool* pool,
+                                TaskGroup* group);
+
+    class BuildTask : public Task
+    {
+     public:
+        BuildTask(DynamicOctree* _node, ObjectList* _arrivals, unsigned int _batchSize,
+                  PREC _scale, WorkerPool* _pool, TaskGroup* _group) :
+            node(_node), arrivals(_arrivals), batchSize(_batchSize),
+            scale(_scale), pool(_pool), group(_group) {};
+        ~BuildTask() { delete arrivals; }
+
+        void run() { node->buildSubtree(*arrivals, batchSize, scale, pool, group); }
+
+     private:
+        DynamicOctree* node;
+        ObjectList*    arrivals;
+        unsigned int   batchSize;
+        PREC           scale;
+        WorkerPool*    pool;
+        TaskGroup*     group;
+    };
+
+    // Subtrees with fewer objects than this are built on the thread that
+    // partitioned their parent.
+    static const unsigned int PARALLEL_BUILD_THRESHOLD = 20000;
 
     DynamicOctree**            _children;
     Eigen::Matrix<PREC, 3, 1>  cellCenterPos;
@@ -98,16 +162,9 @@ template <class OBJ, class PREC> class StaticOctree
     typedef Eigen::Matrix<PREC, 3, 1> PointType;
 
  public:
-    StaticOctree(const PointType&    cellCenterPos,
-                 const float         exclusionFactor,
-                 OBJ*                _firstObject,
-                 unsigned int        nObjects);
+    StaticOctree(OBJ* _firstObject);
     ~StaticOctree();
 
-    // These methods are only declared at the template level; we'll implement them as
-    // full specializations, allowing for different traversal strategies depending on the
-    // object type and nature.
-
     // This method searches the octree for objects that are likely to be visible
     // to a viewer with the specified obsPosition and limitingFactor.  The
     // octreeProcessor is invoked for each potentially visible object --no object with
@@ -129,17 +186,63 @@ template <class OBJ, class PREC> class StaticOctree
     int countChildren() const;
     int countObjects()  const;
 
-    void computeStatistics(std::vector<OctreeLevelStatistics>& stats, unsigned int level = 0);
+    void computeStatistics(std::vector<OctreeLevelStatistics>& stats);
+
+    // Convert the octree to and from the breadth-first node records used
+    // for prebuilt octrees; firstObject is the start of the sorted object
+    // array that the node object ranges refer to.
+    void flatten(std::vector<OctreeNodeRecord>& nodes, const OBJ* firstObject) const;
+    static StaticOctree* unflatten(const OctreeNodeRecord* nodes,
+                                   uint32 nNodes,
+                                   OBJ* firstObject);
 
  private:
     static const PREC SQRT3;
 
  private:
-    StaticOctree** _children;
-    Eigen::Matrix<PREC, 3, 1>   cellCenterPos;
-    float          exclusionFactor;
-    OBJ*           _firstObject;
-    unsigned int   nObjects;
+    void addNode(const PointType& cellCenterPos,
+                 float            exclusionFactor,
+                 uint32           firstObject,
+                 uint32           nObjects,
+                 uint32           firstChild);
+
+    PointType cellCenter(uint32 node) const
+    {
+        return PointType(centerX[node], centerY[node], centerZ[node]);
+    }
+
+    // These methods are only declared at the template level; we'll implement them as
+    // full specializations, allowing for different traversal strategies depending on the
+    // object type and nature.
+    void processVisibleNode(uint32                            node,
+                            OctreeProcessor<OBJ, PREC>&       processor,
+                            const PointType&                  obsPosition,
+                            const Eigen::Hyperplane<PREC, 3>* frustumPlanes,
+                            float                             limitingFactor,
+                            PREC                              scale) const;
+
+    void processCloseNode(uint32                             node,
+                          OctreeProcessor<OBJ, PREC>&        processor,
+                          const PointType&                   obsPosition,
+                          PREC                               boundingRadius,
+                          PREC                               scale) const;
+
+ private:
+    // The nodes are stored in breadth-first order as a structure of arrays,
+    // so that traversal touches a few compact arrays instead of chasing
+    // pointers to nodes scattered over the heap. The eight children of a
+    // node are adjacent, starting at index firstChildren[node]; leaf nodes
+    // have a firstChildren entry of zero. The objects of a node are
+    // objects[firstObjects[node]] through
+    // objects[firstObjects[node] + objectCounts[node] - 1].
+    std::vector<PREC>   centerX;
+    std::vector<PREC>   centerY;
+    std::vector<PREC>   centerZ;
+    std::vector<float>  exclusionFactors;
+    std::vector<uint32> firstObjects;
+    std::vector<uint32> objectCounts;
+    std::vector<uint32> firstChildren;
+    OBJ*                objects;
 };
 
 
@@ -236,6 +339,14 @@ inline void DynamicOctree<OBJ, PREC>::add(const OBJ& obj)
 
 template <class OBJ, class PREC>
 inline void DynamicOctree<OBJ, PREC>::split(const PREC scale)
+{
+    createChildren(scale);
+    sortIntoChildNodes();
+}
+
+
+template <class OBJ, class PREC>
+inline void DynamicOctree<OBJ, PREC>::createChildren(const PREC scale)
 {
     _children = new DynamicOctree*[8];
 
@@ -256,7 +367,6 @@ inline void DynamicOctree<OBJ, PREC>::split(const PREC scale)
         _children[i] = new DynamicOctree(centerPos,
                                          decayFunction(exclusionFactor));
     }
-    sortIntoChildNodes();
 }
 
 
@@ -287,26 +397,195 @@ inline void DynamicOctree<OBJ, PREC>::sortIntoChildNodes()
 }
 
 
+// Insert a list of objects into an empty octree. The resulting tree is
+// identical to the one produced by calling insertObject() for each object
+// in list order, but it is built top down: each node partitions the objects
+// that reach it by octant, so the eight subtrees below a node are
+// independent of each other and may be built concurrently by the worker
+// pool. The object list is consumed.
+template <class OBJ, class PREC>
+void DynamicOctree<OBJ, PREC>::insertObjects(std::vector<const OBJ*>& objects,
+                                             const PREC scale,
+                                             WorkerPool* pool)
+{
+    if (pool == NULL || pool->getThreadCount() == 0 || objects.size() < PARALLEL_BUILD_THRESHOLD)
+    {
+        buildSubtree(objects, 0, scale, NULL, NULL);
+    }
+    else
+    {
+        TaskGroup group;
+        buildSubtree(objects, 0, scale, pool, &group);
+        pool->wait(group);
+    }
+}
+
+
+// Reproduce the effect of inserting the arrivals list into this node one
+// object at a time. The first batchSize objects were placed in the node by
+// the parent's split, bypassing insertObject(); all others arrived through
+// insertObject(). The node splits on the first non-kept insertion that
+// finds SPLIT_THRESHOLD or more objects already in the node. That object
+// stays in this node; every other non-kept object ends up in a child, in
+// arrival order, with those that arrived before the split forming the
+// child's own initial batch.
+template <class OBJ, class PREC>
+void DynamicOctree<OBJ, PREC>::buildSubtree(ObjectList& arrivals,
+                                            unsigned int batchSize,
+                                            const PREC scale,
+                                            WorkerPool* pool,
+                                            TaskGroup* group)
+{
+    unsigned int nArrivals = arrivals.size();
+    if (nArrivals == 0)
+        return;
+
+    unsigned int splitIndex = nArrivals;
+    unsigned int firstCandidate = batchSize > SPLIT_THRESHOLD ? batchSize : SPLIT_THRESHOLD;
+    for (unsigned int i = firstCandidate; i < nArrivals; ++i)
+    {
+        const OBJ& obj = *arrivals[i];
+        if (!limitingFactorPredicate(obj, exclusionFactor) &&
+            !straddlingPredicate(cellCenterPos, obj, exclusionFactor))
+        {
+            splitIndex = i;
+            break;
+        }
+    }
+
+    _objects = new ObjectList;
+    if (splitIndex == nArrivals)
+    {
+        _objects->swap(arrivals);
+        return;
+    }
+
+    createChildren(scale * 0.5f);
+
+    ObjectList* childArrivals[8];
+    unsigned int childBatchSize[8];
+    for (int i = 0; i < 8; ++i)
+    {
+        childArrivals[i] = new ObjectList;
+        childBatchSize[i] = 0;
+    }
+
+    for (unsigned int i = 0; i < nArrivals; ++i)
+    {
+        const OBJ& obj = *arrivals[i];
+
+        if (i == splitIndex ||
+            limitingFactorPredicate(obj, exclusionFactor) ||
+            straddlingPredicate(cellCenterPos, obj, exclusionFactor))
+        {
+            _objects->push_back(&obj);
+        }
+        else
+        {
+            DynamicOctree* child = getChild(obj, cellCenterPos);
+            int childIndex = 0;
+            while (_children[childIndex] != child)
+                childIndex++;
+
+            childArrivals[childIndex]->push_back(&obj);
+            if (i < splitIndex)
+                childBatchSize[childIndex]++;
+        }
+    }
+
+    // Release the arrivals before descending, so that memory use stays
+    // proportional to the number of objects.
+    ObjectList().swap(arrivals);
+
+    for (int i = 0; i < 8; ++i)
+    {
+        if (group != NULL && childArrivals[i]->size() >= PARALLEL_BUILD_THRESHOLD)
+        {
+            pool->submit(new BuildTask(_children[i], childArrivals[i], childBatchSize[i],
+                                       scale * (PREC) 0.5, pool, group),
+                         group);
+        }
+        else
+        {
+            _children[i]->buildSubtree(*childArrivals[i], childBatchSize[i],
+                                       scale * (PREC) 0.5, pool, group);
+            delete childArrivals[i];
+        }
+    }
+}
+
+
+// Compile the dynamic octree into a StaticOctree. The objects are copied
+// into _sortedObjects in depth-first order, so that every subtree occupies
+// a contiguous range of the sorted array; the nodes are then laid out in
+// breadth-first order.
 template <class OBJ, class PREC>
 inline void DynamicOctree<OBJ, PREC>::rebuildAndSort(StaticOctree<OBJ, PREC>*& _staticNode, OBJ*& _sortedObjects)
 {
-    OBJ* _firstObject = _sortedObjects;
+    OBJ* firstObject = _sortedObjects;
+
+    // Depth-first pass: copy the objects and record the range of each node
+    std::vector<const DynamicOctree*> stack;
+    std::vector<const DynamicOctree*> nodes;
+    std::vector<uint32> objectRanges;
+    stack.push_back(this);
+    while (!stack.empty())
+    {
+        const DynamicOctree* node = stack.back();
+        stack.pop_back();
 
-    if (_objects != NULL)
-        for (typename ObjectList::const_iterator iter = _objects->begin(); iter != _objects->end(); ++iter)
+        uint32 first = (uint32) (_sortedObjects - firstObject);
+        if (node->_objects != NULL)
         {
-            *_sortedObjects++ = **iter;
+            for (typename ObjectList::const_iterator iter = node->_objects->begin();
+                 iter != node->_objects->end(); ++iter)
+            {
+                *_sortedObjects++ = **iter;
+            }
         }
 
-    unsigned int nObjects  = (unsigned int) (_sortedObjects - _firstObject);
-    _staticNode            = new StaticOctree<OBJ, PREC>(cellCenterPos, exclusionFactor, _firstObject, nObjects);
+        nodes.push_back(node);
+        objectRanges.push_back(first);
+        objectRanges.push_back((uint32) (_sortedObjects - firstObject) - first);
 
-    if (_children != NULL)
+        if (node->_children != NULL)
+        {
+            for (int i = 7; i >= 0; --i)
+                stack.push_back(node->_children[i]);
+        }
+    }
+
+    // Map each dynamic node to its depth-first index
+    std::vector<std::pair<const DynamicOctree*, uint32> > nodeIndex(nodes.size());
+    for (uint32 i = 0; i < nodes.size(); i++)
+        nodeIndex[i] = std::make_pair(nodes[i], i);
+    std::sort(nodeIndex.begin(), nodeIndex.end());
+
+    // Breadth-first pass: emit the static nodes
+    _staticNode = new StaticOctree<OBJ, PREC>(firstObject);
+
+    std::vector<const DynamicOctree*> queue;
+    queue.reserve(nodes.size());
+    queue.push_back(this);
+    for (uint32 i = 0; i < queue.size(); i++)
     {
-        _staticNode->_children    = new StaticOctree<OBJ, PREC>*[8];
+        const DynamicOctree* node = queue[i];
+        uint32 dfsIndex = std::lower_bound(nodeIndex.begin(), nodeIndex.end(),
+                                           std::make_pair(node, (uint32) 0))->second;
+
+        uint32 firstChild = 0;
+        if (node->_children != NULL)
+        {
+            firstChild = (uint32) queue.size();
+            for (int j = 0; j < 8; j++)
+                queue.push_back(node->_children[j]);
+        }
 
-        for (int i=0; i<8; ++i)
-            _children[i]->rebuildAndSort(_staticNode->_children[i], _sortedObjects);
+        _staticNode->addNode(node->cellCenterPos,
+                             (float) node->exclusionFactor,
+                             objectRanges[dfsIndex * 2],
+                             objectRanges[dfsIndex * 2 + 1],
+                             firstChild);
     }
 }
 
@@ -317,15 +596,8 @@ const PREC StaticOctree<OBJ, PREC>::SQRT3 = (PREC) 1.732050807568877;
 
 
 template <class OBJ, class PREC>
-inline StaticOctree<OBJ, PREC>::StaticOctree(const Eigen::Matrix<PREC, 3, 1>& cellCenterPos,
-                                             const float         exclusionFactor,
-                                             OBJ*                _firstObject,
-                                             unsigned int        nObjects):
-    _children      (NULL),
-    cellCenterPos  (cellCenterPos),
-    exclusionFactor(exclusionFactor),
-    _firstObject   (_firstObject),
-    nObjects       (nObjects)
+inline StaticOctree<OBJ, PREC>::StaticOctree(OBJ* _firstObject):
+    objects(_firstObject)
 {
 }
 
@@ -333,46 +605,78 @@ inline StaticOctree<OBJ, PREC>::StaticOctree(const Eigen::Matrix<PREC, 3, 1>& ce
 template <class OBJ, class PREC>
 inline StaticOctree<OBJ, PREC>::~StaticOctree()
 {
-    if (_children != NULL)
-    {
-        for (int i = 0; i < 8; ++i)
-            delete _children[i];
+}
 
-        delete[] _children;
-    }
+
+template <class OBJ, class PREC>
+inline void StaticOctree<OBJ, PREC>::addNode(const PointType& cellCenterPos,
+                                             float            exclusionFactor,
+                                             uint32           firstObject,
+                                             uint32           nObjects,
+                                             uint32           firstChild)
+{
+    centerX.push_back(cellCenterPos.x());
+    centerY.push_back(cellCenterPos.y());
+    centerZ.push_back(cellCenterPos.z());
+    exclusionFactors.push_back(exclusionFactor);
+    firstObjects.push_back(firstObject);
+    objectCounts.push_back(nObjects);
+    firstChildren.push_back(firstChild);
 }
 
 
 template <class OBJ, class PREC>
-inline int StaticOctree<OBJ, PREC>::countChildren() const
+inline void StaticOctree<OBJ, PREC>::processVisibleObjects(OctreeProcessor<OBJ, PREC>&       processor,
+                                                           const PointType&                  obsPosition,
+                                                           const Eigen::Hyperplane<PREC, 3>* frustumPlanes,
+                                                           float                             limitingFactor,
+                                                           PREC                              scale) const
 {
-    int count    = 0;
+    if (!firstChildren.empty())
+        processVisibleNode(0, processor, obsPosition, frustumPlanes, limitingFactor, scale);
+}
 
-    for (int i = 0; i < 8; ++i)
-        count    += _children != NULL ? 1 + _children[i]->countChildren() : 0;
 
-    return count;
+template <class OBJ, class PREC>
+inline void StaticOctree<OBJ, PREC>::processCloseObjects(OctreeProcessor<OBJ, PREC>& processor,
+                                                         const PointType&            obsPosition,
+                                                         PREC                        boundingRadius,
+                                                         PREC                        scale) const
+{
+    if (!firstChildren.empty())
+        processCloseNode(0, processor, obsPosition, boundingRadius, scale);
+}
+
+
+template <class OBJ, class PREC>
+inline int StaticOctree<OBJ, PREC>::countChildren() const
+{
+    return firstChildren.empty() ? 0 : (int) firstChildren.size() - 1;
 }
 
 
 template <class OBJ, class PREC>
 inline int StaticOctree<OBJ, PREC>::countObjects() const
 {
-    int count    = nObjects;
+    int count    = 0;
 
-    if (_children != NULL)
-        for (int i = 0; i < 8; ++i)
-            count    += _children[i]->countObjects();
+    for (unsigned int i = 0; i < objectCounts.size(); ++i)
+        count    += objectCounts[i];
 
     return count;
 }
 
 
 template <class OBJ, class PREC>
-void StaticOctree<OBJ, PREC>::computeStatistics(std::vector<OctreeLevelStatistics>& stats, unsigned int level)
+void StaticOctree<OBJ, PREC>::computeStatistics(std::vector<OctreeLevelStatistics>& stats)
 {
-    if (level >= stats.size())
+    // Nodes are in breadth-first order, so a node's level is always known
+    // before its children are reached.
+    std::vector<unsigned int> levels(firstChildren.size(), 0);
+
+    for (unsigned int i = 0; i < firstChildren.size(); i++)
     {
+        unsigned int level = levels[i];
         while (level >= stats.size())
         {
             OctreeLevelStatistics levelStats;
@@ -381,17 +685,61 @@ void StaticOctree<OBJ, PREC>::computeStatistics(std::vector<OctreeLevelStatistic
             levelStats.size = 0.0;
             stats.push_back(levelStats);
         }
+
+        stats[level].nodeCount++;
+        stats[level].objectCount += objectCounts[i];
+        stats[level].size = 0.0;
+
+        if (firstChildren[i] != 0)
+        {
+            for (unsigned int j = 0; j < 8; j++)
+                levels[firstChildren[i] + j] = level + 1;
+        }
     }
+}
 
-    stats[level].nodeCount++;
-    stats[level].objectCount += nObjects;
-    stats[level].size = 0.0;
 
-    if (_children != NULL)
+template <class OBJ, class PREC>
+void StaticOctree<OBJ, PREC>::flatten(std::vector<OctreeNodeRecord>& nodes,
+                                      const OBJ* firstObject) const
+{
+    uint32 objectOffset = (uint32) (objects - firstObject);
+
+    nodes.resize(firstChildren.size());
+    for (unsigned int i = 0; i < firstChildren.size(); i++)
+    {
+        OctreeNodeRecord& record = nodes[i];
+        record.center[0]       = (float) centerX[i];
+        record.center[1]       = (float) centerY[i];
+        record.center[2]       = (float) centerZ[i];
+        record.exclusionFactor = exclusionFactors[i];
+        record.firstObject     = firstObjects[i] + objectOffset;
+        record.nObjects        = objectCounts[i];
+        record.firstChild      = firstChildren[i];
+    }
+}
+
+
+template <class OBJ, class PREC>
+StaticOctree<OBJ, PREC>* StaticOctree<OBJ, PREC>::unflatten(const OctreeNodeRecord* nodes,
+                                                            uint32 nNodes,
+                                                            OBJ* firstObject)
+{
+    StaticOctree* octree = new StaticOctree(firstObject);
+
+    for (uint32 i = 0; i < nNodes; i++)
     {
-        for (int i = 0; i < 8; i++)
-            _children[i]->computeStatistics(stats, level + 1);
+        const OctreeNodeRecord& record = nodes[i];
+        octree->addNode(PointType((PREC) record.center[0],
+                                  (PREC) record.center[1],
+                                  (PREC) record.center[2]),
+                        record.exclusionFactor,
+                        record.firstObject,
+                        record.nObjects,
+                        record.firstChild);
     }
+
+    return octree;
 }
 
 
@@ -0,0 +1,405 @@
+// orbitcache.cpp
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// Cache of plotted orbit paths, limited by the memory that the plots use.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include <algorithm>
+#include <vector>
+#include <celephem/orbit.h>
+#include <celutil/timer.h>
+#include <celutil/workerpool.h>
+#include <curveplot.h>
+#include "orbitcache.h"
+
+using namespace Eigen;
+using namespace std;
+
+
+// Orbit samples are dropped where the plotted path stays within this
+// distance (in km) of the path through all of the orbit's samples
+static const double OrbitSampleTolerance = 1.0;
+
+// Number of evenly spaced samples in the coarse plot shown while the full
+// plot of an orbit is computed
+static const unsigned int CoarsePlotSampleCount = 32;
+
+// Number of threads used to sample orbits in the background, and the
+// number of plots that may be queued for them. Orbits beyond the limit
+// keep their coarse plots until earlier ones have finished.
+static const unsigned int OrbitPlotterThreadCount = 2;
+static const unsigned int MaxPendingPlots = 64;
+
+// Maximum time per frame (in seconds) spent sampling orbits that can't be
+// sampled in the background; at least one orbit is sampled per frame.
+static const double OrbitPlotTimeBudget = 0.005;
+
+static const size_t DefaultMemoryBudget = 64 * 1024 * 1024;
+
+static WorkerPool* orbitPlotterPool = NULL;
+
+static WorkerPool* getOrbitPlotterPool()
+{
+    if (orbitPlotterPool == NULL)
+        orbitPlotterPool = new WorkerPool(OrbitPlotterThreadCount);
+    return orbitPlotterPool;
+}
+
+
+static size_t plotSize(const CurvePlot* plot)
+{
+    return sizeof(CurvePlot) + plot->sampleCount() * sizeof(CurvePlotSample);
+}
+
+
+class OrbitSampler : public OrbitSampleProc
+{
+public:
+    vector<CurvePlotSample> samples;
+
+    OrbitSampler()
+    {
+    }
+
+    void sample(double t, const Vector3d& position, const Vector3d& velocity)
+    {
+        CurvePlotSample samp;
+        samp.t = t;
+        samp.position = position;
+        samp.velocity = velocity;
+        samples.push_back(samp);
+    }
+
+    void insertForward(CurvePlot* plot)
+    {
+        for (vector<CurvePlotSample>::const_iterator iter = samples.begin(); iter != samples.end(); ++iter)
+        {
+            plot->addSample(*iter);
+        }
+    }
+
+    void insertBackward(CurvePlot* plot)
+    {
+        for (vector<CurvePlotSample>::const_reverse_iterator iter = samples.rbegin(); iter != samples.rend(); ++iter)
+        {
+            plot->addSample(*iter);
+        }
+    }
+};
+
+
+// Samples an elliptical orbit on a plotter thread
+class OrbitCache::PlotTask : public Task
+{
+ public:
+    PlotTask(OrbitCache* _cache, const Orbit* _orbit,
+             double _startTime, double _endTime,
+             unsigned int _generation) :
+        cache(_cache), orbit(_orbit),
+        startTime(_startTime), endTime(_endTime),
+        generation(_generation) {};
+
+    void run()
+    {
+        // Skip plots requested before the cache was cleared; the orbit
+        // may no longer exist.
+        {
+            MutexLock lock(cache->finishedMutex);
+            if (generation != cache->generation)
+                return;
+        }
+
+        CurvePlot* plot = new CurvePlot();
+        OrbitCache::addSamples(orbit, startTime, endTime, plot);
+        cache->plotFinished(orbit, plot, generation);
+    }
+
+ private:
+    OrbitCache* cache;
+    const Orbit* orbit;
+    double startTime;
+    double endTime;
+    unsigned int generation;
+};
+
+
+OrbitCache::Statistics::Statistics() :
+    hits(0),
+    coarseHits(0),
+    misses(0),
+    evictions(0),
+    plotCount(0),
+    pendingCount(0),
+    bytesUsed(0)
+{
+}
+
+
+OrbitCache::OrbitCache() :
+    memoryBudget(DefaultMemoryBudget),
+    pendingPlots(0),
+    syncTimeUsed(0.0),
+    timer(CreateTimer()),
+    finishedMutex(NewMutex()),
+    generation(0),
+    plotGroup(new TaskGroup())
+{
+}
+
+
+OrbitCache::~OrbitCache()
+{
+    clear();
+
+    delete plotGroup;
+    delete finishedMutex;
+    delete timer;
+}
+
+
+CurvePlot* OrbitCache::getPlot(const Orbit* orbit, double startTime, double endTime, uint32 frame)
+{
+    EntryMap::iterator iter = entries.find(orbit);
+    if (iter != entries.end())
+    {
+        Entry& entry = iter->second;
+        if (entry.coarse)
+        {
+            stats.coarseHits++;
+            if (!entry.pending)
+                requestPlot(orbit, entry, startTime, endTime);
+        }
+        else
+        {
+            stats.hits++;
+        }
+
+        entry.plot->setLastUsed(frame);
+        return entry.plot;
+    }
+
+    stats.misses++;
+
+    Entry entry;
+    entry.plot = NULL;
+    entry.coarse = false;
+    entry.pending = false;
+
+    if (orbit->getEllipticalOrbit() != NULL)
+    {
+        // Elliptical orbits are cheap to evaluate, so the coarse plot can
+        // be computed immediately.
+        entry.plot = new CurvePlot();
+        entry.coarse = true;
+        double dt = (endTime - startTime) / (double) (CoarsePlotSampleCount - 1);
+        for (unsigned int i = 0; i < CoarsePlotSampleCount; i++)
+        {
+            CurvePlotSample samp;
+            samp.t = startTime + dt * (double) i;
+            samp.position = orbit->positionAtTime(samp.t);
+            samp.velocity = orbit->velocityAtTime(samp.t);
+            entry.plot->addSample(samp);
+        }
+
+        requestPlot(orbit, entry, startTime, endTime);
+    }
+    else
+    {
+        // Defer the plot to a later frame when this frame's time budget
+        // has been used up.
+        if (syncTimeUsed >= OrbitPlotTimeBudget)
+            return NULL;
+
+        double sampleStartTime = timer->getTime();
+        entry.plot = new CurvePlot();
+        addSamples(orbit, startTime, endTime, entry.plot);
+        syncTimeUsed += timer->getTime() - sampleStartTime;
+    }
+
+    entry.plot->setLastUsed(frame);
+    entries.insert(EntryMap::value_type(orbit, entry));
+
+    return entry.plot;
+}
+
+
+void OrbitCache::update(uint32 frame)
+{
+    syncTimeUsed = 0.0;
+
+    vector<FinishedPlot> finished;
+    {
+        MutexLock lock(finishedMutex);
+        finished.swap(finishedPlots);
+    }
+
+    // Replace coarse plots with the finished ones
+    for (vector<FinishedPlot>::const_iterator iter = finished.begin(); iter != finished.end(); ++iter)
+    {
+        pendingPlots--;
+
+        EntryMap::iterator entryIter = entries.find(iter->orbit);
+        if (entryIter != entries.end() && entryIter->second.pending)
+        {
+            Entry& entry = entryIter->second;
+            iter->plot->setLastUsed(entry.plot->lastUsed());
+            delete entry.plot;
+            entry.plot = iter->plot;
+            entry.coarse = false;
+            entry.pending = false;
+        }
+        else
+        {
+            delete iter->plot;
+        }
+    }
+
+    evictPlots(frame);
+}
+
+
+void OrbitCache::clear()
+{
+    // Cancel the plots that haven't been started, and wait for the rest
+    {
+        MutexLock lock(finishedMutex);
+        generation++;
+    }
+
+    if (orbitPlotterPool != NULL)
+        orbitPlotterPool->wait(*plotGroup);
+
+    {
+        MutexLock lock(finishedMutex);
+        for (vector<FinishedPlot>::const_iterator iter = finishedPlots.begin(); iter != finishedPlots.end(); ++iter)
+            delete iter->plot;
+        finishedPlots.clear();
+    }
+
+    for (EntryMap::const_iterator iter = entries.begin(); iter != entries.end(); ++iter)
+        delete iter->second.plot;
+    entries.clear();
+
+    pendingPlots = 0;
+    stats.plotCount = 0;
+    stats.pendingCount = 0;
+    stats.bytesUsed = 0;
+}
+
+
+void OrbitCache::setMemoryBudget(size_t bytes)
+{
+    memoryBudget = bytes;
+}
+
+
+size_t OrbitCache::getMemoryBudget() const
+{
+    return memoryBudget;
+}
+
+
+const OrbitCache::Statistics& OrbitCache::getStatistics() const
+{
+    return stats;
+}
+
+
+/*! Sample the orbit over the span from startTime to endTime. When the span
+ *  ends before the start of the plot, the samples are added to the front of
+ *  the plot; otherwise, they're added to the back. Samples that don't
+ *  change the plotted path by more than OrbitSampleTolerance are dropped.
+ */
+void OrbitCache::addSamples(const Orbit* orbit, double startTime, double endTime, CurvePlot* plot)
+{
+    OrbitSampler sampler;
+    OrbitSampleDecimator decimator(sampler, OrbitSampleTolerance);
+    orbit->sample(startTime, endTime, decimator);
+    decimator.finish();
+
+    if (!plot->empty() && endTime <= plot->startTime())
+        sampler.insertBackward(plot);
+    else
+        sampler.insertForward(plot);
+}
+
+
+void OrbitCache::requestPlot(const Orbit* orbit, Entry& entry, double startTime, double endTime)
+{
+    if (pendingPlots >= MaxPendingPlots)
+        return;
+
+    entry.pending = true;
+    pendingPlots++;
+    getOrbitPlotterPool()->submit(new PlotTask(this, orbit, startTime, endTime, generation),
+                                  plotGroup);
+}
+
+
+// Called from a plotter thread when a plot has been computed
+void OrbitCache::plotFinished(const Orbit* orbit, CurvePlot* plot, unsigned int plotGeneration)
+{
+    MutexLock lock(finishedMutex);
+    if (plotGeneration == generation)
+    {
+        FinishedPlot finished;
+        finished.orbit = orbit;
+        finished.plot = plot;
+        finishedPlots.push_back(finished);
+    }
+    else
+    {
+        delete plot;
+    }
+}
+
+
+struct PlotLRUPredicate
+{
+    bool operator()(const pair<uint32, const Orbit*>& a, const pair<uint32, const Orbit*>& b) const
+    {
+        return a.first < b.first;
+    }
+};
+
+
+// Evict the least recently used plots until the cache fits within the
+// memory budget. Plots used in the previous frame and plots waiting to be
+// replaced by a full plot are never evicted.
+void OrbitCache::evictPlots(uint32 frame)
+{
+    size_t bytesUsed = 0;
+    for (EntryMap::const_iterator iter = entries.begin(); iter != entries.end(); ++iter)
+        bytesUsed += plotSize(iter->second.plot);
+
+    if (bytesUsed > memoryBudget)
+    {
+        vector<pair<uint32, const Orbit*> > candidates;
+        for (EntryMap::const_iterator iter = entries.begin(); iter != entries.end(); ++iter)
+        {
+            uint32 lastUsed = iter->second.plot->lastUsed();
+            if (!iter->second.pending && lastUsed + 1 < frame)
+                candidates.push_back(make_pair(lastUsed, iter->first));
+        }
+
+        sort(candidates.begin(), candidates.end(), PlotLRUPredicate());
+
+        for (unsigned int i = 0; i < candidates.size() && bytesUsed > memoryBudget; i++)
+        {
+            EntryMap::iterator iter = entries.find(candidates[i].second);
+            bytesUsed -= plotSize(iter->second.plot);
+            delete iter->second.plot;
+            entries.erase(iter);
+            stats.evictions++;
+        }
+    }
+
+    stats.plotCount = entries.size();
+    stats.pendingCount = pendingPlots;
+    stats.bytesUsed = bytesUsed;
+}
@@ -0,0 +1,116 @@
+// orbitcache.h
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// Cache of plotted orbit paths, limited by the memory that the plots use.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#ifndef _CELENGINE_ORBITCACHE_H_
+#define _CELENGINE_ORBITCACHE_H_
+
+#include <cstddef>
+#include <map>
+#include <vector>
+#include <celutil/basictypes.h>
+#include <celutil/thread.h>
+
+class Orbit;
+class CurvePlot;
+class TaskGroup;
+class Timer;
+
+
+/*! The OrbitCache holds the sampled paths of the orbits that the renderer
+ *  draws. Plots that haven't been used recently are evicted once the total
+ *  size of the plots exceeds the memory budget.
+ *
+ *  Elliptical orbits are sampled on worker threads. Until the full plot is
+ *  ready, a coarse plot with a few samples is returned in its place. Other
+ *  orbits may have state that can't be shared between threads, so they're
+ *  sampled on the calling thread, limited to a time budget per frame;
+ *  plots that don't fit in the budget are deferred to later frames.
+ */
+class OrbitCache
+{
+ public:
+    OrbitCache();
+    ~OrbitCache();
+
+    struct Statistics
+    {
+        Statistics();
+
+        unsigned int hits;        // full plot found
+        unsigned int coarseHits;  // coarse plot found, full plot not ready
+        unsigned int misses;      // orbit not in the cache
+        unsigned int evictions;
+        unsigned int plotCount;
+        unsigned int pendingCount;
+        size_t bytesUsed;
+    };
+
+    // Return the plot of the orbit, or NULL if it hasn't been computed
+    // yet. A new plot covers the span from startTime to endTime.
+    CurvePlot* getPlot(const Orbit* orbit, double startTime, double endTime, uint32 frame);
+
+    // Install plots finished by the worker threads and evict plots if the
+    // memory budget is exceeded. Call once per frame, before getPlot().
+    void update(uint32 frame);
+
+    // Discard all plots, waiting for the worker threads to finish with
+    // the plots they're computing.
+    void clear();
+
+    void setMemoryBudget(size_t bytes);
+    size_t getMemoryBudget() const;
+
+    const Statistics& getStatistics() const;
+
+    // Sample the orbit from startTime to endTime, adding the samples to
+    // the front or back of the plot.
+    static void addSamples(const Orbit* orbit, double startTime, double endTime, CurvePlot* plot);
+
+ private:
+    struct Entry
+    {
+        CurvePlot* plot;
+        bool coarse;
+        bool pending;
+    };
+
+    struct FinishedPlot
+    {
+        const Orbit* orbit;
+        CurvePlot* plot;
+    };
+
+    typedef std::map<const Orbit*, Entry> EntryMap;
+
+    class PlotTask;
+    friend class PlotTask;
+
+    void requestPlot(const Orbit* orbit, Entry& entry, double startTime, double endTime);
+    void plotFinished(const Orbit* orbit, CurvePlot* plot, unsigned int generation);
+    void evictPlots(uint32 frame);
+
+    EntryMap entries;
+    size_t memoryBudget;
+    unsigned int pendingPlots;
+    double syncTimeUsed;
+    Timer* timer;
+
+    Statistics stats;
+
+    // The generation is incremented whenever the cache is cleared, so that
+    // plots started before the cache was cleared are discarded.
+    Mutex* finishedMutex;
+    std::vector<FinishedPlot> finishedPlots;
+    unsigned int generation;
+    TaskGroup* plotGroup;
+};
+
+#endif // _CELENGINE_ORBITCACHE_H_
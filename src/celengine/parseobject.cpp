@@ -222,7 +222,8 @@ CreateEllipticalOrbit(Hash* orbitData,
  * } \endcode
  *
  * Source is the only required field. Interpolation defaults to cubic, and
- * DoublePrecision defaults to true.
+ * DoublePrecision defaults to true. Binary trajectory files (.xyzbin and
+ * .xyzvbin) are always double precision.
  */
 static Orbit*
 CreateSampledTrajectory(Hash* trajData, const string& path)
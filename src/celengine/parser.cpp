@@ -8,74 +8,345 @@
 // as published by the Free Software Foundation; either version 2
 // of the License, or (at your option) any later version.
 
+#include <cstring>
+#include <algorithm>
+#include <set>
+#include <new>
+#include <celutil/memorypool.h>
+#include <celutil/thread.h>
 #include "parser.h"
 #include "astro.h"
 
 using namespace Eigen;
 
 
+// Block size of the pools that arrays and hashes are allocated from. One
+// block is usually enough for a catalog object; longer strings are
+// allocated separately.
+static const unsigned int ValuePoolBlockSize = 4096;
+static const unsigned int MaxPoolStringLength = ValuePoolBlockSize / 4;
+
+
+/****** Interned hash keys ******/
+
+static Mutex* hashKeyMutex = NewMutex();
+static set<string> hashKeys;
+
+const string* InternHashKey(const string& key)
+{
+    MutexLock lock(hashKeyMutex);
+    return &*hashKeys.insert(key).first;
+}
+
+
+// Hash entries are ordered by key length and then by the characters of the
+// key, which is quicker than lexical order since most keys differ in length.
+static inline bool keyLess(const string& a, const string& b)
+{
+    if (a.size() != b.size())
+        return a.size() < b.size();
+    else
+        return memcmp(a.data(), b.data(), a.size()) < 0;
+}
+
+
+struct HashEntryLess
+{
+    bool operator()(const HashEntry& a, const HashEntry& b) const
+    {
+        return a.first != b.first && keyLess(*a.first, *b.first);
+    }
+
+    bool operator()(const HashEntry& entry, const string& key) const
+    {
+        return keyLess(*entry.first, key);
+    }
+
+    bool operator()(const string& key, const HashEntry& entry) const
+    {
+        return keyLess(key, *entry.first);
+    }
+};
+
+
+/****** Value encoding for token recordings ******/
+
+// Values are encoded as a type byte followed by the value: numbers as
+// doubles, booleans as a byte, strings as a 32-bit length and the
+// characters, and arrays and hashes as a 32-bit count and their elements.
+// Hash elements are a key string followed by a value. All fields are in
+// native byte order.
+
+static void encodeUint32(string& out, uint32 n)
+{
+    out.append(reinterpret_cast<const char*>(&n), sizeof(n));
+}
+
+
+static void encodeString(string& out, const string& s)
+{
+    encodeUint32(out, (uint32) s.size());
+    out += s;
+}
+
+
+static void encodeValue(string& out, Value& value)
+{
+    out += (char) value.getType();
+    switch (value.getType())
+    {
+    case Value::NumberType:
+        {
+            double d = value.getNumber();
+            out.append(reinterpret_cast<const char*>(&d), sizeof(d));
+        }
+        break;
+
+    case Value::StringType:
+        encodeString(out, value.getString());
+        break;
+
+    case Value::BooleanType:
+        out += (char) (value.getBoolean() ? 1 : 0);
+        break;
+
+    case Value::ArrayType:
+        {
+            Array* array = value.getArray();
+            encodeUint32(out, (uint32) array->size());
+            for (Array::const_iterator iter = array->begin(); iter != array->end(); iter++)
+                encodeValue(out, **iter);
+        }
+        break;
+
+    case Value::HashType:
+        {
+            Hash* hash = value.getHash();
+            uint32 count = 0;
+            for (HashIterator iter = hash->begin(); iter != hash->end(); iter++)
+                count++;
+            encodeUint32(out, count);
+            for (HashIterator iter = hash->begin(); iter != hash->end(); iter++)
+            {
+                encodeString(out, *iter->first);
+                encodeValue(out, *iter->second);
+            }
+        }
+        break;
+    }
+}
+
+
+static bool decodeUint32(const char*& in, const char* end, uint32& n)
+{
+    if (end - in < (ptrdiff_t) sizeof(n))
+        return false;
+    memcpy(&n, in, sizeof(n));
+    in += sizeof(n);
+    return true;
+}
+
+
+// Returns NULL if the encoding is malformed
+Value* Parser::decodeValue(const char*& in, const char* end)
+{
+    if (in == end)
+        return NULL;
+
+    char type = *in++;
+    switch (type)
+    {
+    case Value::NumberType:
+        {
+            double d;
+            if (end - in < (ptrdiff_t) sizeof(d))
+                return NULL;
+            memcpy(&d, in, sizeof(d));
+            in += sizeof(d);
+            return newNumber(d);
+        }
+
+    case Value::StringType:
+        {
+            uint32 length = 0;
+            if (!decodeUint32(in, end, length) || (uint32) (end - in) < length)
+                return NULL;
+            Value* value = newString(in, length);
+            in += length;
+            return value;
+        }
+
+    case Value::BooleanType:
+        if (in == end)
+            return NULL;
+        return newBoolean(*in++ != 0);
+
+    case Value::ArrayType:
+        {
+            uint32 count = 0;
+            if (!decodeUint32(in, end, count))
+                return NULL;
+
+            beginContainer();
+            std::size_t first = elementStack.size();
+            for (uint32 i = 0; i < count; i++)
+            {
+                Value* element = decodeValue(in, end);
+                if (element == NULL)
+                {
+                    discardElements(first);
+                    endContainer(false);
+                    return NULL;
+                }
+                elementStack.push_back(element);
+            }
+
+            Array* array = finishArray(first);
+            endContainer(true);
+            return newValue(array);
+        }
+
+    case Value::HashType:
+        {
+            uint32 count = 0;
+            if (!decodeUint32(in, end, count))
+                return NULL;
+
+            beginContainer();
+            std::size_t first = entryStack.size();
+            for (uint32 i = 0; i < count; i++)
+            {
+                uint32 length = 0;
+                const string* key = NULL;
+                Value* element = NULL;
+                if (decodeUint32(in, end, length) && (uint32) (end - in) >= length)
+                {
+                    decodedKey.assign(in, length);
+                    key = internKey(decodedKey);
+                    in += length;
+                    element = decodeValue(in, end);
+                }
+
+                if (element == NULL)
+                {
+                    discardEntries(first);
+                    endContainer(false);
+                    return NULL;
+                }
+                entryStack.push_back(HashEntry(key, element));
+            }
+
+            Hash* hash = finishHash(first);
+            endContainer(true);
+            return newValue(hash);
+        }
+
+    default:
+        return NULL;
+    }
+}
+
+
 /****** Value method implementations *******/
 
-Value::Value(double d)
+Value::Value(double d) :
+    type(NumberType),
+    inPool(false),
+    pool(NULL)
 {
-    type = NumberType;
     data.d = d;
 }
 
-Value::Value(string s)
+Value::Value(const string& s) :
+    type(StringType),
+    inPool(false),
+    pool(NULL)
+{
+    data.s.length = (unsigned int) s.size();
+    data.s.chars = new char[s.size() + 1];
+    memcpy(data.s.chars, s.c_str(), s.size() + 1);
+}
+
+// Create a string value with its characters allocated from a pool
+Value::Value(const char* s, unsigned int length, MemoryPool* stringPool) :
+    type(StringType),
+    inPool(false),
+    pool(NULL)
 {
-    type = StringType;
-    data.s = new string(s);
+    data.s.length = length;
+    data.s.chars = reinterpret_cast<char*>(stringPool->allocate(length + 1));
+    memcpy(data.s.chars, s, length);
+    data.s.chars[length] = '\0';
 }
 
-Value::Value(Array* a)
+Value::Value(Array* a) :
+    type(ArrayType),
+    inPool(false),
+    pool(NULL)
 {
-    type = ArrayType;
     data.a = a;
 }
 
-Value::Value(Hash* h)
+Value::Value(Hash* h) :
+    type(HashType),
+    inPool(false),
+    pool(NULL)
 {
-    type = HashType;
     data.h = h;
 }
 
-Value::Value(bool b)
+Value::Value(bool b) :
+    type(BooleanType),
+    inPool(false),
+    pool(NULL)
 {
-    type = BooleanType;
     data.d = b ? 1.0 : 0.0;
 }
 
 Value::~Value()
 {
+    // The outermost value of a tree read by the parser isn't in the pool
+    // itself, but its array or hash is.
+    bool payloadInPool = inPool || pool != NULL;
+
     if (type == StringType)
     {
-        delete data.s;
+        if (!payloadInPool)
+            delete[] data.s.chars;
     }
     else if (type == ArrayType)
     {
         if (data.a != NULL)
         {
             for (unsigned int i = 0; i < data.a->size(); i++)
-                delete (*data.a)[i];
-            delete data.a;
+                destroy((*data.a)[i]);
+            if (payloadInPool)
+                data.a->~Array();
+            else
+                delete data.a;
         }
     }
     else if (type == HashType)
     {
         if (data.h != NULL)
         {
-#if 0
-            Hash::iterator iter = data.h->begin();
-            while (iter != data.h->end())
-            {
-                delete iter->second;
-                iter++;
-            }
-#endif
-            delete data.h;
+            if (payloadInPool)
+                data.h->~Hash();
+            else
+                delete data.h;
         }
     }
+
+    delete pool;
+}
+
+// Destroy a value that may have been allocated from a pool
+void Value::destroy(Value* value)
+{
+    if (value->inPool)
+        value->~Value();
+    else
+        delete value;
 }
 
 Value::ValueType Value::getType() const
@@ -92,7 +363,7 @@ double Value::getNumber() const
 string Value::getString() const
 {
     // ASSERT(type == StringType);
-    return *data.s;
+    return string(data.s.chars, data.s.length);
 }
 
 Array* Value::getArray() const
@@ -117,8 +388,18 @@ bool Value::getBoolean() const
 /****** Parser method implementation ******/
 
 Parser::Parser(Tokenizer* _tokenizer) :
-    tokenizer(_tokenizer)
+    tokenizer(_tokenizer),
+    pool(NULL),
+    depth(0)
+{
+    for (unsigned int i = 0; i < KeyCacheSize; i++)
+        keyCache[i] = NULL;
+}
+
+
+Parser::~Parser()
 {
+    delete pool;
 }
 
 
@@ -131,23 +412,30 @@ Array* Parser::readArray()
         return NULL;
     }
 
-    Array* array = new Array();
+    beginContainer();
+    std::size_t first = elementStack.size();
 
-    Value* v = readValue();
+    Value* v = parseValue();
     while (v != NULL)
     {
-        array->insert(array->end(), v);
-        v = readValue();
+        elementStack.push_back(v);
+        v = parseValue();
     }
     
+    Array* array = NULL;
     tok = tokenizer->nextToken();
-    if (tok != Tokenizer::TokenEndArray)
+    if (tok == Tokenizer::TokenEndArray)
+    {
+        array = finishArray(first);
+    }
+    else
     {
         tokenizer->pushBack();
-        delete array;
-        return NULL;
+        discardElements(first);
     }
 
+    endContainer(array != NULL);
+
     return array;
 }
 
@@ -161,7 +449,9 @@ Hash* Parser::readHash()
         return NULL;
     }
 
-    Hash* hash = new Hash();
+    beginContainer();
+    std::size_t first = entryStack.size();
+    bool succeeded = true;
 
     tok = tokenizer->nextToken();
     while (tok != Tokenizer::TokenEndGroup)
@@ -169,42 +459,49 @@ Hash* Parser::readHash()
         if (tok != Tokenizer::TokenName)
         {
             tokenizer->pushBack();
-            delete hash;
-            return NULL;
+            succeeded = false;
+            break;
         }
-        string name = tokenizer->getNameValue();
+        const string* name = internKey(tokenizer->getNameValue());
         
 #ifndef USE_POSTFIX_UNITS
-        readUnits(name, hash);
+        readUnits(*name);
 #endif
 
-        Value* value = readValue();
+        Value* value = parseValue();
         if (value == NULL)
         {
-            delete hash;
-            return NULL;
+            succeeded = false;
+            break;
         }
 
-        hash->addValue(name, *value);
+        entryStack.push_back(HashEntry(name, value));
         
 #ifdef USE_POSTFIX_UNITS
-        readUnits(name, hash);
+        readUnits(*name);
 #endif
 
         tok = tokenizer->nextToken();
     }
 
+    Hash* hash = NULL;
+    if (succeeded)
+        hash = finishHash(first);
+    else
+        discardEntries(first);
+
+    endContainer(hash != NULL);
+
     return hash;
 }
 
 
 /**
- * Reads a units section into the hash.
+ * Reads a units section into the entries of the hash being read.
  * @param[in] propertyName Name of the current property.
- * @param[in] hash Hash to add units quantities into.
  * @return True if a units section was successfully read, false otherwise.
  */
-bool Parser::readUnits(const string& propertyName, Hash* hash)
+bool Parser::readUnits(const string& propertyName)
 {
     Tokenizer::TokenType tok = tokenizer->nextToken();
     if (tok != Tokenizer::TokenBeginUnits)
@@ -222,29 +519,18 @@ bool Parser::readUnits(const string& propertyName, Hash* hash)
             return false;
         }
        
-        string unit = tokenizer->getNameValue();
-        Value* value = new Value(unit);
-        
+        const string& unit = tokenizer->getNameValue();
+        string keyName;
         if (astro::isLengthUnit(unit))
-        {
-            string keyName(propertyName + "%Length");
-            hash->addValue(keyName, *value);
-        }
+            keyName = propertyName + "%Length";
         else if (astro::isTimeUnit(unit))
-        {
-            string keyName(propertyName + "%Time");
-            hash->addValue(keyName, *value);
-        }
+            keyName = propertyName + "%Time";
         else if (astro::isAngleUnit(unit))
-        {
-            string keyName(propertyName + "%Angle");
-            hash->addValue(keyName, *value);
-        }
+            keyName = propertyName + "%Angle";
         else
-        {
-            delete value;
             return false;
-        }
+
+        entryStack.push_back(HashEntry(internKey(keyName), newString(unit.data(), unit.size())));
         
         tok = tokenizer->nextToken();
     }
@@ -253,22 +539,213 @@ bool Parser::readUnits(const string& propertyName, Hash* hash)
 }
 
 
+/*! Intern a hash key, checking a small cache of the keys most recently
+ *  seen by this parser before locking the shared table of keys.
+ */
+const string* Parser::internKey(const string& key)
+{
+    unsigned int slot = (unsigned int) key.size();
+    if (!key.empty())
+        slot = slot * 31 + (unsigned char) key[0] * 7 + (unsigned char) key[key.size() - 1];
+    slot %= KeyCacheSize;
+
+    const string* cached = keyCache[slot];
+    if (cached == NULL || *cached != key)
+    {
+        cached = InternHashKey(key);
+        keyCache[slot] = cached;
+    }
+
+    return cached;
+}
+
+
+// The outermost array or hash creates the pool for the values it contains.
+// If it can't be read, the pool is freed along with everything in it.
+void Parser::beginContainer()
+{
+    if (depth == 0)
+        pool = new MemoryPool(sizeof(double), ValuePoolBlockSize);
+    depth++;
+}
+
+
+void Parser::endContainer(bool succeeded)
+{
+    depth--;
+    if (depth == 0 && !succeeded)
+    {
+        delete pool;
+        pool = NULL;
+    }
+}
+
+
+// Mark a new value as belonging to the pool when it's inside an array or
+// hash. An outermost array or hash takes ownership of the pool.
+Value* Parser::adopt(Value* value)
+{
+    if (depth != 0)
+    {
+        value->inPool = true;
+    }
+    else if (value->type == Value::ArrayType || value->type == Value::HashType)
+    {
+        value->pool = pool;
+        pool = NULL;
+    }
+
+    return value;
+}
+
+
+// Values inside an array or hash are allocated from the pool; values read
+// on their own are allocated individually.
+Value* Parser::newNumber(double d)
+{
+    if (depth == 0)
+        return new Value(d);
+    else
+        return adopt(new (pool->allocate(sizeof(Value))) Value(d));
+}
+
+
+Value* Parser::newBoolean(bool b)
+{
+    if (depth == 0)
+        return new Value(b);
+    else
+        return adopt(new (pool->allocate(sizeof(Value))) Value(b));
+}
+
+
+Value* Parser::newString(const char* s, std::size_t length)
+{
+    if (depth == 0 || length > MaxPoolStringLength)
+        return new Value(string(s, length));
+    else
+        return adopt(new (pool->allocate(sizeof(Value))) Value(s, (unsigned int) length, pool));
+}
+
+
+Value* Parser::newValue(Array* array)
+{
+    if (depth == 0)
+        return adopt(new Value(array));
+    else
+        return adopt(new (pool->allocate(sizeof(Value))) Value(array));
+}
+
+
+Value* Parser::newValue(Hash* hash)
+{
+    if (depth == 0)
+        return adopt(new Value(hash));
+    else
+        return adopt(new (pool->allocate(sizeof(Value))) Value(hash));
+}
+
+
+// Copy the elements read for an array into a new array in the pool
+Array* Parser::finishArray(std::size_t first)
+{
+    Array* array = new (pool->allocate(sizeof(Array))) Array(elementStack.begin() + first, elementStack.end());
+    elementStack.resize(first);
+
+    return array;
+}
+
+
+// Copy the entries read for a hash into a new hash in the pool
+Hash* Parser::finishHash(std::size_t first)
+{
+    Hash* hash = new (pool->allocate(sizeof(Hash))) Hash();
+    if (first < entryStack.size())
+        hash->setEntries(&entryStack[first], &entryStack[0] + entryStack.size(), pool);
+    entryStack.resize(first);
+
+    return hash;
+}
+
+
+void Parser::discardElements(std::size_t first)
+{
+    for (std::size_t i = first; i < elementStack.size(); i++)
+        Value::destroy(elementStack[i]);
+    elementStack.resize(first);
+}
+
+
+void Parser::discardEntries(std::size_t first)
+{
+    for (std::size_t i = first; i < entryStack.size(); i++)
+        Value::destroy(entryStack[i].second);
+    entryStack.resize(first);
+}
+
+
+/*! Read a value. When the tokenizer is recording, hashes and arrays are
+ *  recorded whole instead of as tokens, and when it's replaying a
+ *  recording, they're decoded without parsing.
+ */
 Value* Parser::readValue()
+{
+    const char* encodedValue = NULL;
+    std::size_t encodedSize = 0;
+    if (tokenizer->replayValue(encodedValue, encodedSize))
+    {
+        const char* in = encodedValue;
+        Value* value = decodeValue(in, encodedValue + encodedSize);
+        if (value == NULL)
+            cerr << "Bad value in token recording\n";
+        return value;
+    }
+
+    string* recording = tokenizer->getRecording();
+    if (recording == NULL)
+        return parseValue();
+
+    Tokenizer::TokenType tok = tokenizer->nextToken();
+    tokenizer->pushBack();
+    if (tok != Tokenizer::TokenBeginGroup && tok != Tokenizer::TokenBeginArray)
+        return parseValue();
+
+    // Record the value in place of its tokens. The recording is abandoned
+    // if the value can't be read, since tokens may have been lost.
+    tokenizer->unrecordPushedBack();
+    tokenizer->setRecording(NULL);
+    Value* value = parseValue();
+    if (value != NULL)
+    {
+        string encoded;
+        encodeValue(encoded, *value);
+        tokenizer->setRecording(recording);
+        tokenizer->recordValue(tok, encoded);
+    }
+
+    return value;
+}
+
+
+Value* Parser::parseValue()
 {
     Tokenizer::TokenType tok = tokenizer->nextToken();
     switch (tok)
     {
     case Tokenizer::TokenNumber:
-        return new Value(tokenizer->getNumberValue());
+        return newNumber(tokenizer->getNumberValue());
 
     case Tokenizer::TokenString:
-        return new Value(tokenizer->getStringValue());
+        {
+            const string& s = tokenizer->getStringValue();
+            return newString(s.data(), s.size());
+        }
 
     case Tokenizer::TokenName:
         if (tokenizer->getNameValue() == "false")
-            return new Value(false);
+            return newBoolean(false);
         else if (tokenizer->getNameValue() == "true")
-            return new Value(true);
+            return newBoolean(true);
         else
         {
             tokenizer->pushBack();
@@ -282,7 +759,7 @@ Value* Parser::readValue()
             if (array == NULL)
                 return NULL;
             else
-                return new Value(array);
+                return newValue(array);
         }
 
     case Tokenizer::TokenBeginGroup:
@@ -292,7 +769,7 @@ Value* Parser::readValue()
             if (hash == NULL)
                 return NULL;
             else
-                return new Value(hash);
+                return newValue(hash);
         }
 
     default:
@@ -302,36 +779,92 @@ Value* Parser::readValue()
 }
 
 
-AssociativeArray::AssociativeArray()
+AssociativeArray::AssociativeArray() :
+    entries(NULL),
+    count(0),
+    capacity(0),
+    entriesInPool(false)
 {
 }
 
 AssociativeArray::~AssociativeArray()
 {
-#if 0
-    Hash::iterator iter = data.h->begin();
-    while (iter != data.h->end())
-    {
-        delete iter->second;
-        iter++;
-    }
-#endif
-    for (map<string, Value*>::iterator iter = assoc.begin(); iter != assoc.end(); iter++)
-        delete iter->second;
+    for (unsigned int i = 0; i < count; i++)
+        Value::destroy(entries[i].second);
+    if (!entriesInPool)
+        delete[] entries;
 }
 
-Value* AssociativeArray::getValue(string key) const
+Value* AssociativeArray::getValue(const string& key) const
 {
-    map<string, Value*>::const_iterator iter = assoc.find(key);
-    if (iter == assoc.end())
+    const HashEntry* iter = lower_bound(entries, entries + count, key, HashEntryLess());
+    if (iter == entries + count || *iter->first != key)
         return NULL;
     else
         return iter->second;
 }
 
-void AssociativeArray::addValue(string key, Value& val)
+/*! Add a value to the hash, which takes ownership of it. If there's
+ *  already a value with the same key, the new value is discarded.
+ */
+void AssociativeArray::addValue(const string& key, Value& val)
+{
+    HashEntry* iter = lower_bound(entries, entries + count, key, HashEntryLess());
+    if (iter != entries + count && *iter->first == key)
+    {
+        Value::destroy(&val);
+        return;
+    }
+
+    unsigned int index = (unsigned int) (iter - entries);
+    if (count == capacity)
+    {
+        capacity = capacity < 4 ? 8 : capacity * 2;
+        HashEntry* newEntries = new HashEntry[capacity];
+        copy(entries, entries + count, newEntries);
+        if (!entriesInPool)
+            delete[] entries;
+        entries = newEntries;
+        entriesInPool = false;
+    }
+
+    copy_backward(entries + index, entries + count, entries + count + 1);
+    entries[index] = HashEntry(InternHashKey(key), &val);
+    count++;
+}
+
+/*! Set the entries of a hash read by the parser, keeping the first of any
+ *  entries with the same key. Hashes are usually small, so the entries are
+ *  sorted by insertion. The entry array is allocated from the pool unless
+ *  it's too large to fit comfortably in a block.
+ */
+void AssociativeArray::setEntries(const HashEntry* first, const HashEntry* last, MemoryPool* pool)
 {
-    assoc.insert(map<string, Value*>::value_type(key, &val));
+    unsigned int n = (unsigned int) (last - first);
+    entries = NULL;
+    if (n * sizeof(HashEntry) <= pool->blockSize() / 4)
+        entries = reinterpret_cast<HashEntry*>(pool->allocate(n * sizeof(HashEntry)));
+    entriesInPool = entries != NULL;
+    if (!entriesInPool)
+        entries = new HashEntry[n];
+    capacity = n;
+    count = 0;
+
+    HashEntryLess less;
+    for (const HashEntry* entry = first; entry != last; entry++)
+    {
+        HashEntry* iter = upper_bound(entries, entries + count, *entry, less);
+        if (iter != entries && (iter - 1)->first == entry->first)
+        {
+            Value::destroy(entry->second);
+        }
+        else
+        {
+            copy_backward(iter, entries + count, entries + count + 1);
+            *iter = *entry;
+            count++;
+        }
+    }
 }
 
 bool AssociativeArray::getNumber(const string& key, double& val) const
@@ -891,12 +1424,12 @@ bool AssociativeArray::getTimeScale(const string& key, float& scale) const
 HashIterator
 AssociativeArray::begin()
 {
-    return assoc.begin();
+    return entries;
 }
 
 
 HashIterator
 AssociativeArray::end()
 {
-    return assoc.end();
+    return entries + count;
 }
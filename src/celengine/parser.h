@@ -12,7 +12,7 @@
 #define _PARSER_H_
 
 #include <vector>
-#include <map>
+#include <string>
 #include <celmath/vecmath.h>
 #include <celmath/quaternion.h>
 #include <celutil/color.h>
@@ -22,17 +22,29 @@
 #include <Eigen/Geometry>
 
 class Value;
+class MemoryPool;
 
-typedef map<string, Value*>::const_iterator HashIterator;
+/*! Hash keys are interned: there's a single copy of each distinct key,
+ *  shared by all hashes and never freed, so a key is stored as a pointer.
+ */
+typedef std::pair<const std::string*, Value*> HashEntry;
+typedef const HashEntry* HashIterator;
 
+extern const std::string* InternHashKey(const std::string& key);
+
+/*! An AssociativeArray is a flat array of entries sorted by key. When
+ *  there are duplicate keys in the input, the first value is kept. The
+ *  entries of a hash read by the Parser are allocated from its pool,
+ *  unless there are too many of them to fit in a pool block.
+ */
 class AssociativeArray
 {
  public:
     AssociativeArray();
     ~AssociativeArray();
 
-    Value* getValue(string) const;
-    void addValue(string, Value&);
+    Value* getValue(const std::string&) const;
+    void addValue(const std::string&, Value&);
 
     bool getNumber(const std::string&, double&) const;
     bool getNumber(const std::string&, float&) const;
@@ -68,7 +80,14 @@ class AssociativeArray
     HashIterator end();
     
  private:
-    map<string, Value*> assoc;
+    void setEntries(const HashEntry* first, const HashEntry* last, MemoryPool* pool);
+
+    HashEntry* entries;
+    unsigned int count;
+    unsigned int capacity;
+    bool entriesInPool;
+
+    friend class Parser;
 };
 
 typedef vector<Value*> Array;
@@ -86,7 +105,7 @@ public:
     };
 
     Value(double);
-    Value(string);
+    Value(const string&);
     Value(Array*);
     Value(Hash*);
     Value(bool);
@@ -101,14 +120,34 @@ public:
     bool getBoolean() const;
 
 private:
+    Value(const char* s, unsigned int length, MemoryPool* stringPool);
+
+    static void destroy(Value*);
+
     ValueType type;
 
+    // Values read by the Parser as part of an array or hash are allocated
+    // from a MemoryPool, along with their strings, arrays, and hashes, and
+    // are destroyed in place. The pool belongs to the outermost value and
+    // is freed with it.
+    bool inPool;
+    MemoryPool* pool;
+
+    struct StringData
+    {
+        char* chars;
+        unsigned int length;
+    };
+
     union {
-        string* s;
+        StringData s;
         double d;
         Array* a;
         Hash* h;
     } data;
+
+    friend class Parser;
+    friend class AssociativeArray;
 };
 
 
@@ -116,15 +155,50 @@ class Parser
 {
 public:
     Parser(Tokenizer*);
+    ~Parser();
 
     Value* readValue();
 
 private:
+    enum
+    {
+        KeyCacheSize = 64,
+    };
+
     Tokenizer* tokenizer;
-    
-    bool readUnits(const std::string&, Hash*);
+
+    // Pool for the array or hash being read, and its nesting depth
+    MemoryPool* pool;
+    unsigned int depth;
+
+    // Elements and entries of the arrays and hashes being read; the
+    // finished array or hash is copied out with its exact size.
+    vector<Value*> elementStack;
+    vector<HashEntry> entryStack;
+
+    // Recently interned keys, to avoid locking the table of keys
+    const std::string* keyCache[KeyCacheSize];
+    string decodedKey;
+
+    Value* parseValue();
+    bool readUnits(const std::string&);
     Array* readArray();
     Hash* readHash();
+    Value* decodeValue(const char*& in, const char* end);
+
+    const std::string* internKey(const std::string&);
+    void beginContainer();
+    void endContainer(bool succeeded);
+    Value* adopt(Value*);
+    Value* newNumber(double);
+    Value* newBoolean(bool);
+    Value* newString(const char*, std::size_t);
+    Value* newValue(Array*);
+    Value* newValue(Hash*);
+    Array* finishArray(std::size_t first);
+    Hash* finishHash(std::size_t first);
+    void discardElements(std::size_t first);
+    void discardEntries(std::size_t first);
 };
 
 #endif // _PARSER_H_
@@ -88,6 +88,7 @@ RenderContext::RenderContext() :
     locked(false),
     renderPass(PrimaryPass),
     pointScale(1.0f),
+    pixelsPerUnit(0.0f),
     usePointSize(false),
     useNormals(true),
     useColors(false),
@@ -96,7 +97,8 @@ RenderContext::RenderContext() :
 }
 
 
-RenderContext::RenderContext(const Material* _material)
+RenderContext::RenderContext(const Material* _material) :
+    pixelsPerUnit(0.0f)
 {
     if (_material == NULL)
         material = &defaultMaterial;
@@ -155,6 +157,24 @@ RenderContext::getPointScale() const
 }
 
 
+/*! Set the size in pixels of one unit of model space, which determines the
+ *  level of detail drawn for meshes that have them. Zero, the default,
+ *  means that meshes are always drawn at full detail.
+ */
+void
+RenderContext::setPixelsPerUnit(float _pixelsPerUnit)
+{
+    pixelsPerUnit = _pixelsPerUnit;
+}
+
+
+float
+RenderContext::getPixelsPerUnit() const
+{
+    return pixelsPerUnit;
+}
+
+
 void
 RenderContext::setCameraOrientation(const Quaternionf& q)
 {
@@ -47,6 +47,9 @@ class RenderContext
 
     void setPointScale(float);
     float getPointScale() const;
+
+    void setPixelsPerUnit(float);
+    float getPixelsPerUnit() const;
     
     void setCameraOrientation(const Eigen::Quaternionf& q);
     Eigen::Quaternionf getCameraOrientation() const;
@@ -56,6 +59,7 @@ class RenderContext
     bool locked;
     RenderPass renderPass;
     float pointScale;
+    float pixelsPerUnit;   // used to choose a mesh level of detail
     Eigen::Quaternionf cameraOrientation;  // required for drawing billboards
 
  protected:
@@ -55,6 +55,7 @@ std::ofstream hdrlog;
 #include "regcombine.h"
 #include "vertexprog.h"
 #include "texmanager.h"
+#include "virtualtex.h"
 #include "meshmanager.h"
 #include "renderinfo.h"
 #include "renderglsl.h"
@@ -71,6 +72,7 @@ std::ofstream hdrlog;
 #include <celutil/utf8.h>
 #include <celutil/util.h>
 #include <celutil/timer.h>
+#include <celutil/workerpool.h>
 #include <curveplot.h>
 #include <GL/glew.h>
 #include <algorithm>
@@ -168,6 +170,8 @@ LODSphereMesh* g_lodSphere = NULL;
 
 static Texture* normalizationTex = NULL;
 
+static WorkerPool* resourceLoaderPool = NULL;
+
 static Texture* starTex = NULL;
 static Texture* glareTex = NULL;
 static Texture* shadowTex = NULL;
@@ -195,10 +199,12 @@ static const int MaxSkyRings = 32;
 static const int MaxSkySlices = 180;
 static const int MinSkySlices = 30;
 
-// Size at which the orbit cache will be flushed of old orbit paths
-static const unsigned int OrbitCacheCullThreshold = 200;
-// Age in frames at which unused orbit paths may be eliminated from the cache
-static const uint32 OrbitCacheRetireAge = 16;
+// Number of threads used to load textures and models in the background
+static const unsigned int ResourceLoaderThreadCount = 2;
+// Maximum time per frame (in seconds) spent creating textures and models
+// that have finished loading in the background; at least one resource of
+// each type is created per frame regardless.
+static const double ResourceLoadTimeBudget = 0.005;
 
 Color Renderer::StarLabelColor          (0.471f, 0.356f, 0.682f);
 Color Renderer::PlanetLabelColor        (0.407f, 0.333f, 0.964f);
@@ -599,6 +605,8 @@ Renderer::Renderer() :
     fragmentShaderEnabled(false),
     vertexShaderEnabled(false),
     brightnessBias(0.0f),
+    faintestMag(6.0f),
+    faintestPlanetMag(6.0f),
     saturationMagNight(1.0f),
     saturationMag(1.0f),
     starStyle(FuzzyPointStars),
@@ -611,7 +619,6 @@ Renderer::Renderer() :
     textureResolution(medres),
     useNewStarRendering(false),
     frameCount(0),
-    lastOrbitCacheFlush(0),
     minOrbitSize(MinOrbitSizeForLabel),
     distanceLimit(1.0e6f),
     minFeatureSize(MinFeatureSizeForLabel),
@@ -693,6 +700,9 @@ Renderer::~Renderer()
     if (sceneTexture != 0)
         glDeleteTextures(1, &sceneTexture);
 #endif
+
+    for (unsigned int i = 0; i < systemRenderLists.size(); i++)
+        delete systemRenderLists[i];
 }
 
 
@@ -700,7 +710,9 @@ Renderer::DetailOptions::DetailOptions() :
     ringSystemSections(100),
     orbitPathSamplePoints(100),
     shadowTextureSize(256),
-    eclipseTextureSize(128)
+    eclipseTextureSize(128),
+    virtualTextureMemory(128),
+    orbitCacheMemory(64)
 {
 }
 
@@ -1061,6 +1073,9 @@ bool Renderer::init(GLContext* _context,
     context = _context;
     detailOptions = _detailOptions;
 
+    VirtualTexture::setMemoryBudget((size_t) detailOptions.virtualTextureMemory * 1024 * 1024);
+    orbitCache.setMemoryBudget((size_t) detailOptions.orbitCacheMemory * 1024 * 1024);
+
     // Initialize static meshes and textures common to all instances of Renderer
     if (!commonDataInitialized)
     {
@@ -1155,6 +1170,12 @@ bool Renderer::init(GLContext* _context,
         }
 #endif
 
+        // Decode textures and load models on loader threads, so that the
+        // frame rate doesn't drop whenever new objects come into view.
+        resourceLoaderPool = new WorkerPool(ResourceLoaderThreadCount);
+        GetTextureManager()->setLoaderPool(resourceLoaderPool);
+        GetGeometryManager()->setLoaderPool(resourceLoaderPool);
+
         commonDataInitialized = true;
     }
 
@@ -1307,6 +1328,7 @@ void Renderer::resize(int width, int height)
     windowWidth = width;
     windowHeight = height;
     cosViewConeAngle = computeCosViewConeAngle(fov, windowWidth, windowHeight);
+    pixelSize = calcPixelSize(fov, (float) windowHeight);
     // glViewport(windowWidth, windowHeight);
 
 #ifdef USE_HDR
@@ -1328,6 +1350,7 @@ void Renderer::setFieldOfView(float _fov)
     fov = _fov;
     corrFac = (0.12f * fov/FOV * fov/FOV + 1.0f);
     cosViewConeAngle = computeCosViewConeAngle(fov, windowWidth, windowHeight);
+    pixelSize = calcPixelSize(fov, (float) windowHeight);
 }
 
 int Renderer::getScreenDpi() const
@@ -1601,6 +1624,21 @@ void Renderer::addSortedAnnotation(const MarkerRepresentation* markerRep,
                                    LabelAlignment halign,
                                    LabelVerticalAlignment valign,
                                    float size)
+{
+    addSortedAnnotation(depthSortedAnnotations, markerRep, labelText, color, pos, halign, valign, size);
+}
+
+
+// Add an annotation to a list that will be merged with the depth sorted
+// annotations. This may be called from worker threads.
+void Renderer::addSortedAnnotation(vector<Annotation>& annotations,
+                                   const MarkerRepresentation* markerRep,
+                                   const string& labelText,
+                                   Color color,
+                                   const Vector3f& pos,
+                                   LabelAlignment halign,
+                                   LabelVerticalAlignment valign,
+                                   float size)
 {
     double winX, winY, winZ;
     int view[4] = { 0, 0, 0, 0 };
@@ -1632,7 +1670,7 @@ void Renderer::addSortedAnnotation(const MarkerRepresentation* markerRep,
         a.halign = halign;
         a.valign = valign;
         a.size = size;
-        depthSortedAnnotations.push_back(a);
+        annotations.push_back(a);
     }
 }
 
@@ -1756,42 +1794,6 @@ static void disableSmoothLines()
 }
 
 
-class OrbitSampler : public OrbitSampleProc
-{
-public:
-    vector<CurvePlotSample> samples;
-
-    OrbitSampler()
-    {
-    }
-
-    void sample(double t, const Vector3d& position, const Vector3d& velocity)
-    {
-        CurvePlotSample samp;
-        samp.t = t;
-        samp.position = position;
-        samp.velocity = velocity;
-        samples.push_back(samp);
-    }
-
-    void insertForward(CurvePlot* plot)
-    {
-        for (vector<CurvePlotSample>::const_iterator iter = samples.begin(); iter != samples.end(); ++iter)
-        {
-            plot->addSample(*iter);
-        }
-    }
-
-    void insertBackward(CurvePlot* plot)
-    {
-        for (vector<CurvePlotSample>::const_reverse_iterator iter = samples.rbegin(); iter != samples.rend(); ++iter)
-        {
-            plot->addSample(*iter);
-        }
-    }
-};
-
-
 Vector4f renderOrbitColor(const Body *body, bool selected, float opacity)
 {
     Color orbitColor;
@@ -1872,82 +1874,31 @@ void Renderer::renderOrbit(const OrbitPathListEntry& orbitPath,
     else
         orbit = orbitPath.star->getOrbit();
 
-    CurvePlot* cachedOrbit = NULL;
-    OrbitCache::iterator cached = orbitCache.find(orbit);
-    if (cached != orbitCache.end())
+    // Periodic orbits are sampled over the revolution leading up to the
+    // current time, and aperiodic trajectories over their valid range.
+    // The orbit is sampled adaptively, so the number of samples depends
+    // on the shape of the path rather than its duration.
+    double startTime = t;
+    if (!orbit->isPeriodic())
     {
-        cachedOrbit = cached->second;
-        cachedOrbit->setLastUsed(frameCount);
-    }
+        double begin = 0.0, end = 0.0;
+        orbit->getValidRange(begin, end);
 
-    // If it's not in the cache already
-    if (cachedOrbit == NULL)
+        if (begin != end)
+            startTime = begin;
+    }
+    else
     {
-        double startTime = t;
-        int nSamples = detailOptions.orbitPathSamplePoints;
-
-        // Adjust the number of samples used for aperiodic orbits--these aren't
-        // true orbits, but are sampled trajectories, generally of spacecraft.
-        // Better control is really needed--some sort of adaptive sampling would
-        // be ideal.
-        if (!orbit->isPeriodic())
-        {
-            double begin = 0.0, end = 0.0;
-            orbit->getValidRange(begin, end);
-
-            if (begin != end)
-            {
-                startTime = begin;
-                nSamples = (int) (orbit->getPeriod() * 100.0);
-                nSamples = max(min(nSamples, 1000), 100);
-            }
-            else
-            {
-                // If the orbit is aperiodic and doesn't have a
-                // finite duration, we don't render it. A compromise
-                // would be to pick some time window centered at the
-                // current time, but we'd have to pick some arbitrary
-                // duration.
-                nSamples = 0;
-            }
-        }
-        else
-        {
-            startTime = t - orbit->getPeriod();
-        }
-
-        cachedOrbit = new CurvePlot();
-        cachedOrbit->setLastUsed(frameCount);
-
-        OrbitSampler sampler;
-        orbit->sample(startTime,
-                      startTime + orbit->getPeriod(),
-                      sampler);
-        sampler.insertForward(cachedOrbit);
-
-        // If the orbit cache is full, first try and eliminate some old orbits
-        if (orbitCache.size() > OrbitCacheCullThreshold)
-        {
-            // Check for old orbits at most once per frame
-            if (lastOrbitCacheFlush != frameCount)
-            {
-                for (OrbitCache::iterator iter = orbitCache.begin(); iter != orbitCache.end();)
-                {
-                    // Tricky code to eliminate a node in the orbit cache without screwing
-                    // up the iterator. Should work in all STL implementations.
-                    if (frameCount - iter->second->lastUsed() > OrbitCacheRetireAge)
-                        orbitCache.erase(iter++);
-                    else
-                        ++iter;
-                }
-                lastOrbitCacheFlush = frameCount;
-            }
-        }
-
-        orbitCache[orbit] = cachedOrbit;
+        startTime = t - orbit->getPeriod();
     }
 
-    if (cachedOrbit->empty())
+    // The plot is NULL when sampling the orbit has been deferred to a
+    // later frame.
+    CurvePlot* cachedOrbit = orbitCache.getPlot(orbit,
+                                                startTime,
+                                                startTime + orbit->getPeriod(),
+                                                frameCount);
+    if (cachedOrbit == NULL || cachedOrbit->empty())
         return;
 
     //*** Orbit rendering parameters
@@ -1995,9 +1946,7 @@ void Renderer::renderOrbit(const OrbitPathListEntry& orbitPath,
             cachedOrbit->removeSamplesBefore(cachedOrbit->startTime() * (1.0 + 1.0e-15));
 
             // Add the new samples
-            OrbitSampler sampler;
-            orbit->sample(newWindowStart, min(currentWindowStart, newWindowEnd), sampler);
-            sampler.insertBackward(cachedOrbit);
+            OrbitCache::addSamples(orbit, newWindowStart, min(currentWindowStart, newWindowEnd), cachedOrbit);
 #if DEBUG_ORBIT_CACHE
             clog << "new sample count: " << cachedOrbit->sampleCount() << endl;
 #endif
@@ -2011,9 +1960,7 @@ void Renderer::renderOrbit(const OrbitPathListEntry& orbitPath,
             cachedOrbit->removeSamplesAfter(cachedOrbit->endTime() * (1.0 - 1.0e-15));
 
             // Add the new samples
-            OrbitSampler sampler;
-            orbit->sample(max(currentWindowEnd, newWindowStart), newWindowEnd, sampler);
-            sampler.insertForward(cachedOrbit);
+            OrbitCache::addSamples(orbit, max(currentWindowEnd, newWindowStart), newWindowEnd, cachedOrbit);
 #if DEBUG_ORBIT_CACHE
             clog << "new sample count: " << cachedOrbit->sampleCount() << endl;
 #endif
@@ -2720,6 +2667,14 @@ void Renderer::render(const Observer& observer,
                       float faintestMagNight,
                       const Selection& sel)
 {
+    // Create textures and models that finished loading in the background
+    // since the last frame.
+    GetTextureManager()->finishLoads(ResourceLoadTimeBudget);
+    GetGeometryManager()->finishLoads(ResourceLoadTimeBudget);
+
+    // Install orbit paths computed in the background
+    orbitCache.update(frameCount);
+
     glMatrixMode(GL_PROJECTION);
     glLoadIdentity();
 
@@ -2789,7 +2744,6 @@ void Renderer::draw(const Observer& observer,
 
     // Compute the size of a pixel
     setFieldOfView(radToDeg(observer.getFOV()));
-    pixelSize = calcPixelSize(fov, (float) windowHeight);
 
     // Set up the projection we'll use for rendering stars.
     gluPerspective(fov,
@@ -2878,57 +2832,8 @@ void Renderer::draw(const Observer& observer,
         nearStars.clear();
         universe.getNearStars(observer.getPosition(), 1.0f, nearStars);
 
-        // Set up direct light sources (i.e. just stars at the moment)
-        setupLightSources(nearStars, observer.getPosition(), now, lightSourceList);
-
-        // Traverse the frame trees of each nearby solar system and
-        // build the list of objects to be rendered.
-        for (vector<const Star*>::const_iterator iter = nearStars.begin();
-             iter != nearStars.end(); iter++)
-        {
-            const Star* sun = *iter;
-            SolarSystem* solarSystem = universe.getSolarSystem(sun);
-            if (solarSystem != NULL)
-            {
-                FrameTree* solarSysTree = solarSystem->getFrameTree();
-                if (solarSysTree != NULL)
-                {
-                    if (solarSysTree->updateRequired())
-                    {
-                        // Tree has changed, so we must recompute bounding spheres.
-                        solarSysTree->recomputeBoundingSphere();
-                        solarSysTree->markUpdated();
-                    }
-
-                    // Compute the position of the observer in astrocentric coordinates
-                    Vector3d astrocentricObserverPos = astrocentricPosition(observer.getPosition(), *sun, now);
-
-                    // Build render lists for bodies and orbits paths
-                    buildRenderLists(astrocentricObserverPos,
-                                     xfrustum,
-                                     observer.getOrientation().conjugate() * -Vector3d::UnitZ(),
-                                     Vector3d::Zero(),
-                                     solarSysTree,
-                                     observer,
-                                     now);
-                    if (renderFlags & ShowOrbits)
-                    {
-                        buildOrbitLists(astrocentricObserverPos,
-                                        observer.getOrientation(),
-                                        xfrustum,
-                                        solarSysTree,
-                                        now);
-                    }
-                }
-            }
-
-            addStarOrbitToRenderList(*sun, observer, now);
-        }
-
-        if ((labelMode & (BodyLabelMask)) != 0)
-        {
-            buildLabelLists(xfrustum, now);
-        }
+        // Build the lists of solar system objects to be rendered
+        buildNearSystemsLists(nearStars, universe, observer, xfrustum, WorkerPool::getSharedPool());
 
         starTex->bind();
     }
@@ -5020,6 +4925,7 @@ static void renderModelDefault(Geometry* geometry,
     Material m;
 
     rc.setLighting(lit);
+    rc.setPixelsPerUnit(ri.pixelsPerUnit);
 
     if (ri.baseTex == NULL)
     {
@@ -5890,6 +5796,7 @@ static void renderShadowedGeometryDefault(Geometry* geometry,
     else
     {
         FixedFunctionRenderContext rc;
+        rc.setPixelsPerUnit(ri.pixelsPerUnit);
         geometry->render(rc);
     }
     glEnable(GL_LIGHTING);
@@ -6908,6 +6815,10 @@ void Renderer::renderObject(const Vector3f& pos,
 
     ri.pixWidth = discSizeInPixels;
 
+    // Size of one unit of model space on screen, used to choose the mesh
+    // level of detail
+    ri.pixelsPerUnit = discSizeInPixels * scaleFactors.maxCoeff() / radius;
+
     // Set up the colors
     if (ri.baseTex == NULL ||
         (obj.surface->appearanceFlags & Surface::BlendTexture) != 0)
@@ -8251,7 +8162,8 @@ static float luminosityAtOpposition(float sunLuminosity,
 
 void Renderer::addRenderListEntries(RenderListEntry& rle,
                                     Body& body,
-                                    bool isLabeled)
+                                    bool isLabeled,
+                                    SystemRenderLists& lists)
 {
     bool visibleAsPoint = rle.appMag < faintestPlanetMag && body.isVisibleAsPoint();
 
@@ -8260,20 +8172,14 @@ void Renderer::addRenderListEntries(RenderListEntry& rle,
         rle.renderableType = RenderListEntry::RenderableBody;
         rle.body = &body;
 
+        // The geometry manager may only be used on the main thread, so the
+        // opacity of bodies with geometry is looked up when the lists are
+        // merged.
+        rle.isOpaque = true;
         if (body.getGeometry() != InvalidResource && rle.discSizeInPixels > 1)
-        {
-            Geometry* geometry = GetGeometryManager()->find(body.getGeometry());
-            if (geometry == NULL)
-                rle.isOpaque = true;
-            else
-                rle.isOpaque = geometry->isOpaque();
-        }
-        else
-        {
-            rle.isOpaque = true;
-        }
+            lists.geometryEntries.push_back(lists.renderList.size());
         rle.radius = body.getRadius();
-        renderList.push_back(rle);
+        lists.renderList.push_back(rle);
     }
 
     if (body.getClassification() == Body::Comet && (renderFlags & ShowCometTails) != 0)
@@ -8287,7 +8193,7 @@ void Renderer::addRenderListEntries(RenderListEntry& rle,
             rle.isOpaque = false;
             rle.radius = radius;
             rle.discSizeInPixels = discSize;
-            renderList.push_back(rle);
+            lists.renderList.push_back(rle);
         }
     }
 
@@ -8303,19 +8209,212 @@ void Renderer::addRenderListEntries(RenderListEntry& rle,
             rle.refMark = rm;
             rle.isOpaque = rm->isOpaque();
             rle.radius = rm->boundingSphereRadius();
-            renderList.push_back(rle);
+            lists.renderList.push_back(rle);
         }
     }
 }
 
 
+void Renderer::SystemRenderLists::clear()
+{
+    renderList.clear();
+    secondaryIlluminators.clear();
+    orbitPathList.clear();
+    labels.clear();
+    geometryEntries.clear();
+}
+
+
+// Append the contents of src to dest, emptying src
+template<class T> static void appendList(vector<T>& dest, vector<T>& src)
+{
+    if (dest.empty())
+        dest.swap(src);
+    else
+        dest.insert(dest.end(), src.begin(), src.end());
+    src.clear();
+}
+
+
+// Builds the lists for one solar system on a worker thread
+class Renderer::BuildSystemListsTask : public Task
+{
+ public:
+    BuildSystemListsTask(Renderer* _renderer,
+                         const Vector3d& _astrocentricObserverPos,
+                         const Frustum& _viewFrustum,
+                         const FrameTree* _tree,
+                         const Observer& _observer,
+                         double _now,
+                         SystemRenderLists& _lists,
+                         WorkerPool* _pool) :
+        renderer(_renderer),
+        astrocentricObserverPos(_astrocentricObserverPos),
+        viewFrustum(_viewFrustum),
+        tree(_tree),
+        observer(_observer),
+        now(_now),
+        lists(_lists),
+        pool(_pool) {};
+
+    void run()
+    {
+        renderer->buildSystemLists(astrocentricObserverPos, viewFrustum, tree,
+                                   observer, now, lists, pool);
+    }
+
+ private:
+    Renderer* renderer;
+    Vector3d astrocentricObserverPos;
+    const Frustum& viewFrustum;
+    const FrameTree* tree;
+    const Observer& observer;
+    double now;
+    SystemRenderLists& lists;
+    WorkerPool* pool;
+};
+
+
+void Renderer::buildNearSystemsLists(const vector<const Star*>& stars,
+                                     const Universe& universe,
+                                     const Observer& observer,
+                                     const Frustum& viewFrustum,
+                                     WorkerPool* pool)
+{
+    double now = observer.getTime();
+
+    clearSortedAnnotations();
+    renderList.clear();
+    orbitPathList.clear();
+    lightSourceList.clear();
+    secondaryIlluminators.clear();
+
+    // Set up direct light sources (i.e. just stars at the moment)
+    setupLightSources(stars, observer.getPosition(), now, lightSourceList);
+
+    while (systemRenderLists.size() < stars.size())
+        systemRenderLists.push_back(new SystemRenderLists());
+
+    // Solar systems whose orbits can all be evaluated on any thread are
+    // traversed by the worker pool; the rest are traversed here while the
+    // workers run.
+    TaskGroup tasks;
+    vector<unsigned int> serialSystems;
+    vector<Vector3d> serialObserverPositions;
+    for (unsigned int i = 0; i < stars.size(); i++)
+    {
+        SystemRenderLists& lists = *systemRenderLists[i];
+        lists.clear();
+
+        SolarSystem* solarSystem = universe.getSolarSystem(stars[i]);
+        if (solarSystem == NULL)
+            continue;
+
+        FrameTree* solarSysTree = solarSystem->getFrameTree();
+        if (solarSysTree == NULL)
+            continue;
+
+        if (solarSysTree->updateRequired())
+        {
+            // Tree has changed, so we must recompute bounding spheres.
+            solarSysTree->recomputeBoundingSphere();
+            solarSysTree->markUpdated();
+        }
+
+        // Compute the position of the observer in astrocentric coordinates
+        Vector3d astrocentricObserverPos = astrocentricPosition(observer.getPosition(), *stars[i], now);
+
+        if (pool != NULL && solarSysTree->isThreadSafe())
+        {
+            pool->submit(new BuildSystemListsTask(this, astrocentricObserverPos, viewFrustum,
+                                                  solarSysTree, observer, now, lists, pool),
+                         &tasks);
+        }
+        else
+        {
+            serialSystems.push_back(i);
+            serialObserverPositions.push_back(astrocentricObserverPos);
+        }
+    }
+
+    for (unsigned int i = 0; i < serialSystems.size(); i++)
+    {
+        const Star* sun = stars[serialSystems[i]];
+        buildSystemLists(serialObserverPositions[i], viewFrustum,
+                         universe.getSolarSystem(sun)->getFrameTree(),
+                         observer, now, *systemRenderLists[serialSystems[i]], pool);
+    }
+
+    if (pool != NULL)
+        pool->wait(tasks);
+
+    // Merge the lists in star order
+    for (unsigned int i = 0; i < stars.size(); i++)
+    {
+        SystemRenderLists& lists = *systemRenderLists[i];
+
+        for (vector<unsigned int>::const_iterator iter = lists.geometryEntries.begin();
+             iter != lists.geometryEntries.end(); iter++)
+        {
+            RenderListEntry& rle = lists.renderList[*iter];
+            Geometry* geometry = GetGeometryManager()->find(rle.body->getGeometry());
+            rle.isOpaque = geometry == NULL || geometry->isOpaque();
+        }
+
+        appendList(renderList, lists.renderList);
+        appendList(secondaryIlluminators, lists.secondaryIlluminators);
+        appendList(orbitPathList, lists.orbitPathList);
+        appendList(depthSortedAnnotations, lists.labels);
+
+        addStarOrbitToRenderList(*stars[i], observer, now);
+    }
+}
+
+
+// Build the lists for the frame tree of one solar system. This may run on
+// a worker thread, and so must only modify the lists passed to it.
+void Renderer::buildSystemLists(const Vector3d& astrocentricObserverPos,
+                                const Frustum& viewFrustum,
+                                const FrameTree* tree,
+                                const Observer& observer,
+                                double now,
+                                SystemRenderLists& lists,
+                                WorkerPool* pool)
+{
+    // Build render lists for bodies and orbits paths
+    buildRenderLists(astrocentricObserverPos,
+                     viewFrustum,
+                     observer.getOrientation().conjugate() * -Vector3d::UnitZ(),
+                     Vector3d::Zero(),
+                     tree,
+                     observer,
+                     now,
+                     lists,
+                     pool);
+    if (renderFlags & ShowOrbits)
+    {
+        buildOrbitLists(astrocentricObserverPos,
+                        observer.getOrientation(),
+                        viewFrustum,
+                        tree,
+                        now,
+                        lists);
+    }
+
+    if ((labelMode & BodyLabelMask) != 0)
+        buildLabelLists(viewFrustum, now, lists);
+}
+
+
 void Renderer::buildRenderLists(const Vector3d& astrocentricObserverPos,
                                 const Frustum& viewFrustum,
                                 const Vector3d& viewPlaneNormal,
                                 const Vector3d& frameCenter,
                                 const FrameTree* tree,
                                 const Observer& observer,
-                                double now)
+                                double now,
+                                SystemRenderLists& lists,
+                                WorkerPool* pool)
 {
     int labelClassMask = translateLabelModeToClassMask(labelMode);
 
@@ -8324,24 +8423,31 @@ void Renderer::buildRenderLists(const Vector3d& astrocentricObserverPos,
     double invCosViewAngle = 1.0 / cosViewConeAngle;
     double sinViewAngle = sqrt(1.0 - square(cosViewConeAngle));   
 
-    unsigned int nChildren = tree != NULL ? tree->childCount() : 0;
-    for (unsigned int i = 0; i < nChildren; i++)
+    // Find the children that may be in the view cone, and compute their
+    // positions relative to the frame center. Groups of children outside
+    // the view cone are rejected without evaluating their orbits; this
+    // matters for systems with hundreds of thousands of asteroids.
+    vector<unsigned int> visibleChildren;
+    vector<Vector3d> childPositions;
+    if (tree != NULL)
     {
-        const TimelinePhase* phase = tree->getChild(i);
-
-        // No need to do anything if the phase isn't active now
-        if (!phase->includes(now))
-            continue;
+        FrameTree::ViewCone viewCone;
+        viewCone.apex = astrocentricObserverPos - frameCenter;
+        viewCone.axis = viewPlaneNormal;
+        viewCone.cosAngle = cosViewConeAngle;
+        viewCone.sinAngle = sinViewAngle;
+        tree->findVisibleChildren(now, viewCone, visibleChildren, childPositions, pool);
+    }
 
-        Body* body = phase->body();
+    for (unsigned int child = 0; child < visibleChildren.size(); child++)
+    {
+        unsigned int i = visibleChildren[child];
 
         // pos_s: sun-relative position of object
         // pos_v: viewer-relative position of object
 
         // Get the position of the body relative to the sun.
-        Vector3d p = phase->orbit()->positionAtTime(now);
-        ReferenceFrame* frame = phase->orbitFrame();
-        Vector3d pos_s = frameCenter + frame->getOrientation(now).conjugate() * p;
+        Vector3d pos_s = frameCenter + childPositions[i];
 
         // We now have the positions of the observer and the planet relative
         // to the sun.  From these, compute the position of the body
@@ -8355,6 +8461,9 @@ void Renderer::buildRenderLists(const Vector3d& astrocentricObserverPos,
         // Vector from object center to its projection on the view normal.
         Vector3d toViewNormal = pos_v - dist_vn * viewPlaneNormal;
 
+        const TimelinePhase* phase = tree->getChild(i);
+        Body* body = phase->body();
+
         float cullingRadius = body->getCullingRadius();
 
         // The result of the planetshine test can be reused for the view cone
@@ -8381,7 +8490,7 @@ void Renderer::buildRenderLists(const Vector3d& astrocentricObserverPos,
                         illum.body = body;
                         illum.position_v = pos_v;
                         illum.radius = body->getRadius();
-                        secondaryIlluminators.push_back(illum);
+                        lists.secondaryIlluminators.push_back(illum);
                     }
                 }
                 else
@@ -8445,7 +8554,7 @@ void Renderer::buildRenderLists(const Vector3d& astrocentricObserverPos,
                 // defined relative to the SSB.)
                 rle.sun = -pos_s.cast<float>();
 
-                addRenderListEntries(rle, *body, isLabeled);
+                addRenderListEntries(rle, *body, isLabeled, lists);
             }
         }
 
@@ -8529,7 +8638,9 @@ void Renderer::buildRenderLists(const Vector3d& astrocentricObserverPos,
                                  pos_s,
                                  subtree,
                                  observer,
-                                 now);
+                                 now,
+                                 lists,
+                                 pool);
             }
         } // end subtree traverse
 
@@ -8541,7 +8652,8 @@ void Renderer::buildOrbitLists(const Vector3d& astrocentricObserverPos,
                                const Quaterniond& observerOrientation,
                                const Frustum& viewFrustum,
                                const FrameTree* tree,
-                               double now)
+                               double now,
+                               SystemRenderLists& lists)
 {
     Matrix3d viewMat = observerOrientation.toRotationMatrix();
     Vector3d viewMatZ = viewMat.row(2);
@@ -8601,7 +8713,7 @@ void Renderer::buildOrbitLists(const Vector3d& astrocentricObserverPos,
                 path.radius = (float) boundingRadius;
                 path.origin = relOrigin;
                 path.opacity = sizeFade(orbitRadiusInPixels, minOrbitSize, 2.0f);
-                orbitPathList.push_back(path);
+                lists.orbitPathList.push_back(path);
             }
         }
 
@@ -8636,7 +8748,8 @@ void Renderer::buildOrbitLists(const Vector3d& astrocentricObserverPos,
                                     observerOrientation,
                                     viewFrustum,
                                     subtree,
-                                    now);
+                                    now,
+                                    lists);
                 }
             }
         } // end subtree traverse
@@ -8645,14 +8758,15 @@ void Renderer::buildOrbitLists(const Vector3d& astrocentricObserverPos,
 
 
 void Renderer::buildLabelLists(const Frustum& viewFrustum,
-                               double now)
+                               double now,
+                               SystemRenderLists& lists)
 {
     int labelClassMask = translateLabelModeToClassMask(labelMode);
     Body* lastPrimary = NULL;
     Sphered primarySphere;
 
-    for (vector<RenderListEntry>::const_iterator iter = renderList.begin();
-         iter != renderList.end(); iter++)
+    for (vector<RenderListEntry>::const_iterator iter = lists.renderList.begin();
+         iter != lists.renderList.end(); iter++)
     {
         int classification = iter->body->getOrbitClassification();
 
@@ -8783,7 +8897,7 @@ void Renderer::buildLabelLists(const Frustum& viewFrustum,
                         }
                     }
 
-                    addSortedAnnotation(NULL, body->getName(true), labelColor, pos);
+                    addSortedAnnotation(lists.labels, NULL, body->getName(true), labelColor, pos);
                 }
             }
         }
@@ -8890,12 +9004,42 @@ ObjectRenderer<OBJ, PREC>::ObjectRenderer(const PREC _distanceLimit) :
 }
 
 
+// Reject the stars in a batch from the star octree that are beyond the
+// distance limit or behind the viewer, and pass the rest on to the
+// renderer's process() method.
+template <class STAR_RENDERER>
+static void processStarBatch(STAR_RENDERER& renderer,
+                             const Star* stars,
+                             const uint32* indices,
+                             const float* distances,
+                             const float* appMags,
+                             unsigned int count)
+{
+    uint32 visible[StarBatchSize];
+    unsigned int nVisible = CullStarsBehindViewer(stars, indices, distances, count,
+                                                  renderer.obsPos,
+                                                  renderer.viewNormal,
+                                                  renderer.distanceLimit,
+                                                  visible);
+    renderer.nProcessed += count - nVisible;
+
+    for (unsigned int i = 0; i < nVisible; ++i)
+    {
+        uint32 j = visible[i];
+        renderer.process(stars[indices[j]], distances[j], appMags[j]);
+    }
+}
+
+
 class StarRenderer : public ObjectRenderer<Star, float>
 {
  public:
     StarRenderer();
 
     void process(const Star& star, float distance, float appMag);
+    void processBatch(const Star* stars, const uint32* indices,
+                      const float* distances, const float* appMags,
+                      unsigned int count);
 
  public:
     Vector3d obsPos;
@@ -9142,12 +9286,25 @@ void StarRenderer::process(const Star& star, float distance, float appMag)
 }
 
 
+void StarRenderer::processBatch(const Star* stars,
+                                const uint32* indices,
+                                const float* distances,
+                                const float* appMags,
+                                unsigned int count)
+{
+    processStarBatch(*this, stars, indices, distances, appMags, count);
+}
+
+
 class PointStarRenderer : public ObjectRenderer<Star, float>
 {
  public:
     PointStarRenderer();
 
     void process(const Star& star, float distance, float appMag);
+    void processBatch(const Star* stars, const uint32* indices,
+                      const float* distances, const float* appMags,
+                      unsigned int count);
 
  public:
     Vector3d obsPos;
@@ -9370,6 +9527,16 @@ void PointStarRenderer::process(const Star& star, float distance, float appMag)
 }
 
 
+void PointStarRenderer::processBatch(const Star* stars,
+                                     const uint32* indices,
+                                     const float* distances,
+                                     const float* appMags,
+                                     unsigned int count)
+{
+    processStarBatch(*this, stars, indices, distances, appMags, count);
+}
+
+
 // Calculate the maximum field of view (from top left corner to bottom right) of
 // a frustum with the specified aspect ratio (width/height) and vertical field of
 // view. We follow the convention used elsewhere and use units of degrees for
@@ -10621,6 +10788,12 @@ void Renderer::invalidateOrbitCache()
 }
 
 
+const OrbitCache::Statistics& Renderer::getOrbitCacheStatistics() const
+{
+    return orbitCache.getStatistics();
+}
+
+
 bool Renderer::settingsHaveChanged() const
 {
     return settingsChanged;
@@ -20,6 +20,7 @@
 #include <celengine/glcontext.h>
 #include <celengine/starcolors.h>
 #include <celengine/rendcontext.h>
+#include <celengine/orbitcache.h>
 #include <celtxf/texturefont.h>
 #include <vector>
 #include <list>
@@ -30,6 +31,7 @@ class RendererWatcher;
 class FrameTree;
 class ReferenceMark;
 class CurvePlot;
+class WorkerPool;
 
 struct LightSource
 {
@@ -100,6 +102,8 @@ class Renderer
         unsigned int orbitPathSamplePoints;
         unsigned int shadowTextureSize;
         unsigned int eclipseTextureSize;
+        unsigned int virtualTextureMemory;  // megabytes per virtual texture
+        unsigned int orbitCacheMemory;      // megabytes for orbit paths
     };
 
     bool init(GLContext*, int, int, DetailOptions&);
@@ -121,6 +125,19 @@ class Renderer
               float faintestVisible,
               const Selection& sel);
 
+    /*! Build the lists of bodies, orbit paths, and labels to draw for the
+     *  solar systems of the given stars, replacing the lists of the last
+     *  frame. The solar systems are traversed in parallel on the threads
+     *  of the pool when it isn't NULL. This is the part of draw() that
+     *  visits the frame trees; it doesn't require a GL context, and so
+     *  can be timed on its own.
+     */
+    void buildNearSystemsLists(const std::vector<const Star*>& stars,
+                               const Universe& universe,
+                               const Observer& observer,
+                               const Frustum& viewFrustum,
+                               WorkerPool* pool);
+
     enum {
         NoLabels            = 0x000,
         StarLabels          = 0x001,
@@ -302,6 +319,7 @@ class Renderer
 	void clearSortedAnnotations();
 
     void invalidateOrbitCache();
+    const OrbitCache::Statistics& getOrbitCacheStatistics() const;
     
     struct OrbitPathListEntry
     {
@@ -424,6 +442,27 @@ class Renderer
         float farZ;
     };
 
+    // Lists built for the solar system of one star. Each solar system is
+    // traversed independently, possibly on a worker thread, and the lists
+    // are then appended to the renderer's lists in star order, so that
+    // they're identical however many threads are used.
+    struct SystemRenderLists
+    {
+        std::vector<RenderListEntry> renderList;
+        std::vector<SecondaryIlluminator> secondaryIlluminators;
+        std::vector<OrbitPathListEntry> orbitPathList;
+        std::vector<Annotation> labels;
+
+        // Render list entries with geometry, whose opacity can only be
+        // looked up on the main thread
+        std::vector<unsigned int> geometryEntries;
+
+        void clear();
+    };
+
+    class BuildSystemListsTask;
+    friend class BuildSystemListsTask;
+
  private:
     void setFieldOfView(float);
     void renderStars(const StarDatabase& starDB,
@@ -441,24 +480,36 @@ class Renderer
                                 const Frustum& viewFrustum,
                                 const Selection& sel);
 
+    void buildSystemLists(const Eigen::Vector3d& astrocentricObserverPos,
+                          const Frustum& viewFrustum,
+                          const FrameTree* tree,
+                          const Observer& observer,
+                          double now,
+                          SystemRenderLists& lists,
+                          WorkerPool* pool);
     void buildRenderLists(const Eigen::Vector3d& astrocentricObserverPos,
                           const Frustum& viewFrustum,
                           const Eigen::Vector3d& viewPlaneNormal,
                           const Eigen::Vector3d& frameCenter,
                           const FrameTree* tree,
                           const Observer& observer,
-                          double now);
+                          double now,
+                          SystemRenderLists& lists,
+                          WorkerPool* pool);
     void buildOrbitLists(const Eigen::Vector3d& astrocentricObserverPos,
                          const Eigen::Quaterniond& observerOrientation,
                          const Frustum& viewFrustum,
                          const FrameTree* tree,
-                         double now);
+                         double now,
+                         SystemRenderLists& lists);
     void buildLabelLists(const Frustum& viewFrustum,
-                         double now);
+                         double now,
+                         SystemRenderLists& lists);
 
     void addRenderListEntries(RenderListEntry& rle,
                               Body& body,
-                              bool isLabeled);
+                              bool isLabeled,
+                              SystemRenderLists& lists);
 
     void addStarOrbitToRenderList(const Star& star,
                                   const Observer& observer,
@@ -558,6 +609,14 @@ class Renderer
                        LabelAlignment halign = AlignLeft,
                        LabelVerticalAlignment = VerticalAlignBottom,
                        float size = 0.0f);
+    void addSortedAnnotation(std::vector<Annotation>&,
+                             const MarkerRepresentation*,
+                             const std::string& labelText,
+                             Color color,
+                             const Eigen::Vector3f& position,
+                             LabelAlignment halign = AlignLeft,
+                             LabelVerticalAlignment = VerticalAlignBottom,
+                             float size = 0.0f);
     void renderAnnotations(const std::vector<Annotation>&, FontStyle fs);
     void renderBackgroundAnnotations(FontStyle fs);
     void renderForegroundAnnotations(FontStyle fs);
@@ -663,6 +722,7 @@ class Renderer
     std::vector<OrbitPathListEntry> orbitPathList;
     LightingState::EclipseShadowVector eclipseShadows[MaxLights];
     std::vector<const Star*> nearStars;
+    std::vector<SystemRenderLists*> systemRenderLists;
 
     std::vector<LightSource> lightSourceList;
 
@@ -710,9 +770,7 @@ class Renderer
 #endif
 
  private:
-    typedef std::map<const Orbit*, CurvePlot*> OrbitCache;
     OrbitCache orbitCache;
-    uint32 lastOrbitCacheFlush;
 
     float minOrbitSize;
     float distanceLimit;
@@ -314,6 +314,7 @@ void renderGeometry_GLSL(Geometry* geometry,
 
     rc.setCameraOrientation(ri.orientation);
     rc.setPointScale(ri.pointScale);
+    rc.setPixelsPerUnit(ri.pixelsPerUnit);
 
     // Handle extended material attributes (per model only, not per submesh)
     rc.setLunarLambert(ri.lunarLambert);
@@ -360,6 +361,7 @@ void renderGeometry_GLSL_Unlit(Geometry* geometry,
     GLSLUnlit_RenderContext rc(geometryScale);
 
     rc.setPointScale(ri.pointScale);
+    rc.setPixelsPerUnit(ri.pixelsPerUnit);
 
     // Handle material override; a texture specified in an ssc file will
     // override all materials specified in the model file.
@@ -769,6 +771,7 @@ void renderGeometryShadow_GLSL(Geometry* geometry,
     GLSL_RenderContext rc(ls, geometryScale, planetOrientation);
 
     rc.setPointScale(ri.pointScale);
+    rc.setPixelsPerUnit(ri.pixelsPerUnit);
 
     int lightIndex = 0;
     Vector3f viewDir = -ls.lights[lightIndex].direction_obj;
@@ -33,6 +33,7 @@ struct RenderInfo
     Eigen::Quaternionf orientation;
     float pixWidth;
     float pointScale;
+    float pixelsPerUnit;
     bool useTexEnvCombine;
 
     RenderInfo() :
@@ -61,6 +62,7 @@ struct RenderInfo
                    lunarLambert(0.0f),
                    orientation(Eigen::Quaternionf::Identity()),
                    pixWidth(1.0f),
+                   pixelsPerUnit(0.0f),
                    useTexEnvCombine(false)
     {};
 };
@@ -1093,6 +1093,14 @@ bool LoadSolarSystemObjects(istream& in,
                             const std::string& directory)
 {
     Tokenizer tokenizer(&in);
+    return LoadSolarSystemObjects(tokenizer, universe, directory);
+}
+
+
+bool LoadSolarSystemObjects(Tokenizer& tokenizer,
+                            Universe& universe,
+                            const std::string& directory)
+{
     Parser parser(&tokenizer);
 
     while (tokenizer.nextToken() != Tokenizer::TokenEnd)
@@ -17,6 +17,7 @@
 #include <celengine/stardb.h>
 
 class FrameTree;
+class Tokenizer;
 
 class SolarSystem
 {
@@ -41,6 +42,9 @@ class Universe;
 bool LoadSolarSystemObjects(std::istream& in,
                             Universe& universe,
                             const std::string& dir = "");
+bool LoadSolarSystemObjects(Tokenizer& tokenizer,
+                            Universe& universe,
+                            const std::string& dir = "");
 
 #endif // _SOLARSYS_H_
 
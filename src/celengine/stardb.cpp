@@ -14,10 +14,13 @@
 #include <cstdio>
 #include <cassert>
 #include <algorithm>
+#include <fstream>
+#include <iterator>
 #include <celmath/mathlib.h>
 #include <celmath/plane.h>
 #include <celutil/util.h>
 #include <celutil/bytes.h>
+#include <celutil/mappedfile.h>
 #include <celengine/stardb.h>
 #include "celestia.h"
 #include "astro.h"
@@ -53,6 +56,17 @@ static const float STAR_EXTRA_ROOM        = 0.01f; // Reserve 1% capacity for ex
 const char* StarDatabase::FILE_HEADER            = "CELSTARS";
 const char* StarDatabase::CROSSINDEX_FILE_HEADER = "CELINDEX";
 
+// Version 0x0100 files contain just the star records, in any order.
+// Version 0x0200 files additionally contain the prebuilt octree and catalog
+// number index; the stars appear in octree order.
+static const uint16 FILE_VERSION              = 0x0100;
+static const uint16 PREBUILT_FILE_VERSION     = 0x0200;
+
+static const unsigned int PREBUILT_HEADER_SIZE     = 24;
+static const unsigned int BINARY_STAR_RECORD_SIZE  = 20;
+static const unsigned int OCTREE_NODE_RECORD_SIZE  = 28;
+static const uint32       BINARY_STAR_BLOCK_SIZE   = 4096;
+
 
 // Used to sort stars by catalog number
 struct CatalogNumberOrderingPredicate
@@ -95,6 +109,56 @@ struct PtrCatalogNumberOrderingPredicate
 };
 
 
+// Used to order the stars of a prebuilt database by catalog number; the
+// sorted stars carry the index of their source record.
+struct SortedRecordCatalogNumberPredicate
+{
+    const vector<StarDatabase::BinaryStarRecord>& records;
+    const Star* sortedStars;
+
+    SortedRecordCatalogNumberPredicate(const vector<StarDatabase::BinaryStarRecord>& _records,
+                                       const Star* _sortedStars) :
+        records(_records),
+        sortedStars(_sortedStars)
+    {
+    }
+
+    bool operator()(uint32 index0, uint32 index1) const
+    {
+        return records[sortedStars[index0].getCatalogNumber()].catalogNumber <
+               records[sortedStars[index1].getCatalogNumber()].catalogNumber;
+    }
+};
+
+
+static DynamicStarOctree* CreateStarOctreeRoot()
+{
+    float absMag = astro::appToAbsMag(STAR_OCTREE_MAGNITUDE,
+                                      STAR_OCTREE_ROOT_SIZE * (float) sqrt(3.0));
+    return new DynamicStarOctree(Vector3f(1000.0f, 1000.0f, 1000.0f),
+                                 absMag);
+}
+
+
+static void writeUint32(ostream& out, uint32 n)
+{
+    LE_TO_CPU_INT32(n, n);
+    out.write(reinterpret_cast<char*>(&n), sizeof n);
+}
+
+static void writeUint16(ostream& out, uint16 n)
+{
+    LE_TO_CPU_INT16(n, n);
+    out.write(reinterpret_cast<char*>(&n), sizeof n);
+}
+
+static void writeFloat(ostream& out, float f)
+{
+    LE_TO_CPU_FLOAT(f, f);
+    out.write(reinterpret_cast<char*>(&f), sizeof f);
+}
+
+
 static bool parseSimpleCatalogNumber(const string& name,
                                      const string& prefix,
                                      uint32* catalogNumber)
@@ -183,10 +247,13 @@ StarDatabase::StarDatabase():
     nStars               (0),
     stars                (NULL),
     namesDB              (NULL),
+    catalogNumberIndex   (NULL),
     octreeRoot           (NULL),
+    extraOctreeRoot      (NULL),
     nextAutoCatalogNumber(0xfffffffe),
     binFileCatalogNumberIndex(NULL),
-    binFileStarCount(0)
+    binFileStarCount(0),
+    prebuiltStars        (NULL)
 {
     crossIndexes.resize(MaxCatalog);
 }
@@ -197,6 +264,9 @@ StarDatabase::~StarDatabase()
     if (stars != NULL)
         delete [] stars;
 
+    if (prebuiltStars != NULL && prebuiltStars != stars)
+        delete [] prebuiltStars;
+
     if (catalogNumberIndex != NULL)
         delete [] catalogNumberIndex;
 
@@ -331,13 +401,14 @@ Star* StarDatabase::searchCrossIndex(const Catalog catalog, const uint32 number)
 }
 
 
-vector<string> StarDatabase::getCompletion(const string& name) const
+vector<string> StarDatabase::getCompletion(const string& name,
+                                          unsigned int maxCompletions) const
 {
     vector<string> completion;
 
     // only named stars are supported by completion.
     if (!name.empty() && namesDB != NULL)
-        return namesDB->getCompletion(name);
+        return namesDB->getCompletion(name, maxCompletions);
     else
         return completion;
 }
@@ -536,6 +607,14 @@ void StarDatabase::findVisibleStars(StarHandler& starHandler,
                                       frustumPlanes,
                                       limitingMag,
                                       STAR_OCTREE_ROOT_SIZE);
+    if (extraOctreeRoot != NULL)
+    {
+        extraOctreeRoot->processVisibleObjects(starHandler,
+                                               position,
+                                               frustumPlanes,
+                                               limitingMag,
+                                               STAR_OCTREE_ROOT_SIZE);
+    }
 }
 
 
@@ -547,6 +626,13 @@ void StarDatabase::findCloseStars(StarHandler& starHandler,
                                     position,
                                     radius,
                                     STAR_OCTREE_ROOT_SIZE);
+    if (extraOctreeRoot != NULL)
+    {
+        extraOctreeRoot->processCloseObjects(starHandler,
+                                             position,
+                                             radius,
+                                             STAR_OCTREE_ROOT_SIZE);
+    }
 }
 
 
@@ -645,12 +731,21 @@ bool StarDatabase::loadBinary(istream& in)
     }
 
     // Verify the version
+    uint16 version;
+    in.read((char*) &version, sizeof version);
+    LE_TO_CPU_INT16(version, version);
+    if (version == PREBUILT_FILE_VERSION)
     {
-        uint16 version;
-        in.read((char*) &version, sizeof version);
-        LE_TO_CPU_INT16(version, version);
-        if (version != 0x0100)
-            return false;
+        // Prebuilt databases are decoded from memory; read the rest of
+        // the stream and prepend the header that was already consumed.
+        string contents(FILE_HEADER, strlen(FILE_HEADER));
+        contents.append((const char*) &version, sizeof version);
+        contents.append(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+        return loadPrebuilt(contents.data(), contents.size());
+    }
+    else if (version != FILE_VERSION)
+    {
+        return false;
     }
 
     // Read the star count
@@ -659,87 +754,424 @@ bool StarDatabase::loadBinary(istream& in)
     if (!in.good())
         return false;
 
-    unsigned int totalStars = nStars + nStarsInFile;
-
-    while (((unsigned int) nStars) < totalStars)
-    {
-        uint32 catNo = 0;
-        float x = 0.0f, y = 0.0f, z = 0.0f;
-        int16 absMag;
-        uint16 spectralType;
-
-        in.read((char *) &catNo, sizeof catNo);
-        LE_TO_CPU_INT32(catNo, catNo);
-        in.read((char *) &x, sizeof x);
-        LE_TO_CPU_FLOAT(x, x);
-        in.read((char *) &y, sizeof y);
-        LE_TO_CPU_FLOAT(y, y);
-        in.read((char *) &z, sizeof z);
-        LE_TO_CPU_FLOAT(z, z);
-        in.read((char *) &absMag, sizeof absMag);
-        LE_TO_CPU_INT16(absMag, absMag);
-        in.read((char *) &spectralType, sizeof spectralType);
-        LE_TO_CPU_INT16(spectralType, spectralType);
+    // Read the records in large blocks rather than one field at a time
+    vector<char> block(BINARY_STAR_BLOCK_SIZE * BINARY_STAR_RECORD_SIZE);
+    uint32 nRecordsRead = 0;
+    while (nRecordsRead < nStarsInFile)
+    {
+        uint32 nRecords = min(BINARY_STAR_BLOCK_SIZE, nStarsInFile - nRecordsRead);
+        in.read(&block[0], nRecords * BINARY_STAR_RECORD_SIZE);
         if (in.bad())
-        break;
+            return false;
 
-        Star star;
-        star.setPosition(x, y, z);
-        star.setAbsoluteMagnitude((float) absMag / 256.0f);
+        // A truncated file ends the star list without an error
+        uint32 nComplete = (uint32) (in.gcount() / BINARY_STAR_RECORD_SIZE);
+        if (!loadBinaryRecords(&block[0], nComplete))
+            return false;
 
-        StarDetails* details = NULL;
-        StellarClass sc;
-        if (sc.unpack(spectralType))
-            details = StarDetails::GetStarDetails(sc);
+        nRecordsRead += nComplete;
+        if (nComplete < nRecords)
+            break;
+    }
+
+    DPRINTF(0, "StarDatabase::read: nStars = %d\n", nRecordsRead);
+    clog << nStars << _(" stars in binary database\n");
+
+    buildBinFileIndex();
+
+    return true;
+}
+
+
+/*! Load a binary star database, memory mapping the file if possible. This
+ *  is the fastest way to read a prebuilt database, since the star records,
+ *  octree nodes, and catalog number index are decoded directly from the
+ *  mapped pages.
+ */
+bool StarDatabase::loadBinary(const string& filename)
+{
+    MappedFile* file = OpenMappedFile(filename);
+    if (file == NULL)
+    {
+        ifstream in(filename.c_str(), ios::in | ios::binary);
+        if (!in.good())
+            return false;
+        return loadBinary(in);
+    }
+
+    const char* data = file->getData();
+    size_t size = file->getSize();
+    size_t headerLength = strlen(FILE_HEADER);
+
+    bool ok = false;
+    if (size >= headerLength + sizeof(uint16) + sizeof(uint32) &&
+        strncmp(data, FILE_HEADER, headerLength) == 0)
+    {
+        uint16 version;
+        memcpy(&version, data + headerLength, sizeof version);
+        LE_TO_CPU_INT16(version, version);
+
+        if (version == PREBUILT_FILE_VERSION)
+        {
+            ok = loadPrebuilt(data, size);
+        }
+        else if (version == FILE_VERSION)
+        {
+            const char* p = data + headerLength + sizeof version;
+            uint32 nStarsInFile;
+            memcpy(&nStarsInFile, p, sizeof nStarsInFile);
+            LE_TO_CPU_INT32(nStarsInFile, nStarsInFile);
+            p += sizeof nStarsInFile;
+
+            // Tolerate truncated files the same way the stream loader does
+            uint32 nRecords = (uint32) ((size - (p - data)) / BINARY_STAR_RECORD_SIZE);
+            nRecords = min(nRecords, nStarsInFile);
+            ok = loadBinaryRecords(p, nRecords);
+            if (ok)
+            {
+                DPRINTF(0, "StarDatabase::read: nStars = %d\n", nRecords);
+                clog << nStars << _(" stars in binary database\n");
+                buildBinFileIndex();
+            }
+        }
+    }
+
+    delete file;
+
+    return ok;
+}
+
+
+static void decodeStarRecord(const char* data, StarDatabase::BinaryStarRecord& record)
+{
+    memcpy(&record.catalogNumber, data,      sizeof record.catalogNumber);
+    memcpy(&record.x,             data + 4,  sizeof record.x);
+    memcpy(&record.y,             data + 8,  sizeof record.y);
+    memcpy(&record.z,             data + 12, sizeof record.z);
+    memcpy(&record.absMag,        data + 16, sizeof record.absMag);
+    memcpy(&record.spectralType,  data + 18, sizeof record.spectralType);
+    LE_TO_CPU_INT32(record.catalogNumber, record.catalogNumber);
+    LE_TO_CPU_FLOAT(record.x, record.x);
+    LE_TO_CPU_FLOAT(record.y, record.y);
+    LE_TO_CPU_FLOAT(record.z, record.z);
+    LE_TO_CPU_INT16(record.absMag, record.absMag);
+    LE_TO_CPU_INT16(record.spectralType, record.spectralType);
+}
+
+
+static bool initStarFromRecord(Star& star, const StarDatabase::BinaryStarRecord& record)
+{
+    StarDetails* details = NULL;
+    StellarClass sc;
+    if (sc.unpack(record.spectralType))
+        details = StarDetails::GetStarDetails(sc);
+
+    if (details == NULL)
+        return false;
+
+    star.setPosition(record.x, record.y, record.z);
+    star.setAbsoluteMagnitude((float) record.absMag / 256.0f);
+    star.setDetails(details);
+    star.setCatalogNumber(record.catalogNumber);
+
+    return true;
+}
+
+
+bool StarDatabase::loadBinaryRecords(const char* data, uint32 nRecords)
+{
+    for (uint32 i = 0; i < nRecords; i++)
+    {
+        BinaryStarRecord record;
+        decodeStarRecord(data + (size_t) i * BINARY_STAR_RECORD_SIZE, record);
 
-        if (details == NULL)
+        Star star;
+        if (!initStarFromRecord(star, record))
         {
             cerr << _("Bad spectral type in star database, star #") << nStars << "\n";
             return false;
         }
 
-        star.setDetails(details);
-        star.setCatalogNumber(catNo);
         unsortedStars.add(star);
         
         nStars++;
     }
 
-    if (in.bad())
-        return false;
+    return true;
+}
 
-    DPRINTF(0, "StarDatabase::read: nStars = %d\n", nStarsInFile);
-    clog << nStars << _(" stars in binary database\n");
-    
+
+void StarDatabase::buildBinFileIndex()
+{
     // Create the temporary list of stars sorted by catalog number; this
     // will be used to lookup stars during file loading. After loading is
     // complete, the stars are sorted into an octree and this list gets
     // replaced.
     if (unsortedStars.size() > 0)
     {
-        binFileStarCount = unsortedStars.size();
+        unsigned int nPrebuilt = prebuiltCatalogIndex.size();
+
+        delete[] binFileCatalogNumberIndex;
+        binFileStarCount = nPrebuilt + unsortedStars.size();
         binFileCatalogNumberIndex = new Star*[binFileStarCount];
-        for (unsigned int i = 0; i < binFileStarCount; i++)
+        for (unsigned int i = 0; i < nPrebuilt; i++)
+        {
+            binFileCatalogNumberIndex[i] = &prebuiltStars[i];
+        }
+        for (unsigned int i = 0; i < unsortedStars.size(); i++)
         {
-            binFileCatalogNumberIndex[i] = &unsortedStars[i];    
+            binFileCatalogNumberIndex[nPrebuilt + i] = &unsortedStars[i];    
         }
         sort(binFileCatalogNumberIndex, binFileCatalogNumberIndex + binFileStarCount,
              PtrCatalogNumberOrderingPredicate());
     }
-        
+}
+
+
+/*! Load a prebuilt (version 0x0200) star database. The file layout is:
+ *
+ *    char[8]   "CELSTARS"
+ *    uint16    version (0x0200)
+ *    uint16    reserved
+ *    uint32    star count
+ *    uint32    octree node count
+ *    uint32    reserved
+ *    star records, in the spatially sorted order of the octree
+ *    octree node records, breadth-first (see OctreeNodeRecord)
+ *    uint32 star indices, ordered by catalog number
+ *
+ *  All values are little endian, and every section is four byte aligned.
+ */
+bool StarDatabase::loadPrebuilt(const char* data, size_t size)
+{
+    if (size < PREBUILT_HEADER_SIZE)
+        return false;
+
+    uint32 nStarsInFile;
+    uint32 nNodes;
+    memcpy(&nStarsInFile, data + 12, sizeof nStarsInFile);
+    memcpy(&nNodes,       data + 16, sizeof nNodes);
+    LE_TO_CPU_INT32(nStarsInFile, nStarsInFile);
+    LE_TO_CPU_INT32(nNodes, nNodes);
+
+    double expectedSize = (double) PREBUILT_HEADER_SIZE +
+                          (double) nStarsInFile * (BINARY_STAR_RECORD_SIZE + sizeof(uint32)) +
+                          (double) nNodes * OCTREE_NODE_RECORD_SIZE;
+    if (nNodes == 0 || (double) size < expectedSize)
+    {
+        cerr << _("Prebuilt star database is truncated\n");
+        return false;
+    }
+
+    const char* starData  = data + PREBUILT_HEADER_SIZE;
+    const char* nodeData  = starData + (size_t) nStarsInFile * BINARY_STAR_RECORD_SIZE;
+    const char* indexData = nodeData + (size_t) nNodes * OCTREE_NODE_RECORD_SIZE;
+
+    // The prebuilt octree is only usable if this is the first source of
+    // stars; otherwise, treat the file like an unsorted database.
+    if (nStars != 0 || prebuiltStars != NULL)
+    {
+        if (!loadBinaryRecords(starData, nStarsInFile))
+            return false;
+        clog << nStars << _(" stars in binary database\n");
+        buildBinFileIndex();
+        return true;
+    }
+
+    vector<OctreeNodeRecord> nodes(nNodes);
+    vector<bool> isChild(nNodes, false);
+    for (uint32 i = 0; i < nNodes; i++)
+    {
+        OctreeNodeRecord& node = nodes[i];
+        memcpy(&node, nodeData + (size_t) i * OCTREE_NODE_RECORD_SIZE, OCTREE_NODE_RECORD_SIZE);
+        LE_TO_CPU_FLOAT(node.center[0], node.center[0]);
+        LE_TO_CPU_FLOAT(node.center[1], node.center[1]);
+        LE_TO_CPU_FLOAT(node.center[2], node.center[2]);
+        LE_TO_CPU_FLOAT(node.exclusionFactor, node.exclusionFactor);
+        LE_TO_CPU_INT32(node.firstObject, node.firstObject);
+        LE_TO_CPU_INT32(node.nObjects, node.nObjects);
+        LE_TO_CPU_INT32(node.firstChild, node.firstChild);
+
+        // Reject node records that would reference stars or nodes out of
+        // range, or create cycles in the tree. A node may only be the child
+        // of a single parent.
+        bool badNode = node.firstObject > nStarsInFile ||
+                       node.nObjects > nStarsInFile - node.firstObject;
+        if (node.firstChild != 0)
+        {
+            if (node.firstChild <= i || nNodes < 8 || node.firstChild > nNodes - 8)
+            {
+                badNode = true;
+            }
+            else
+            {
+                for (uint32 j = 0; j < 8; j++)
+                {
+                    if (isChild[node.firstChild + j])
+                        badNode = true;
+                    isChild[node.firstChild + j] = true;
+                }
+            }
+        }
+
+        if (badNode)
+        {
+            cerr << _("Bad octree node in prebuilt star database\n");
+            return false;
+        }
+    }
+
+    vector<uint32> catalogIndex(nStarsInFile);
+    for (uint32 i = 0; i < nStarsInFile; i++)
+    {
+        uint32 index;
+        memcpy(&index, indexData + (size_t) i * sizeof(uint32), sizeof index);
+        LE_TO_CPU_INT32(index, index);
+        if (index >= nStarsInFile)
+        {
+            cerr << _("Bad catalog number index in prebuilt star database\n");
+            return false;
+        }
+        catalogIndex[i] = index;
+    }
+
+    Star* sortedStars = new Star[nStarsInFile];
+    for (uint32 i = 0; i < nStarsInFile; i++)
+    {
+        BinaryStarRecord record;
+        decodeStarRecord(starData + (size_t) i * BINARY_STAR_RECORD_SIZE, record);
+        if (!initStarFromRecord(sortedStars[i], record))
+        {
+            cerr << _("Bad spectral type in star database, star #") << i << "\n";
+            delete[] sortedStars;
+            return false;
+        }
+    }
+
+    prebuiltStars = sortedStars;
+    prebuiltNodes.swap(nodes);
+    prebuiltCatalogIndex.swap(catalogIndex);
+    nStars = nStarsInFile;
+
+    // The catalog number ordering is stored in the file, so the temporary
+    // load time index doesn't need to be sorted.
+    binFileStarCount = nStarsInFile;
+    binFileCatalogNumberIndex = new Star*[binFileStarCount];
+    for (uint32 i = 0; i < binFileStarCount; i++)
+        binFileCatalogNumberIndex[i] = &prebuiltStars[prebuiltCatalogIndex[i]];
+
+    DPRINTF(0, "StarDatabase::read: nStars = %d, octree nodes = %d\n", nStarsInFile, nNodes);
+    clog << nStars << _(" stars in binary database\n");
+
     return true;
 }
 
 
+/*! Write a prebuilt (version 0x0200) star database. The octree is built here
+ *  exactly as it would be at load time, so that Celestia can use it without
+ *  any sorting.
+ */
+bool StarDatabase::writeBinary(ostream& out, const vector<BinaryStarRecord>& records)
+{
+    uint32 nRecords = (uint32) records.size();
+
+    // The catalog number of each star is temporarily replaced by its record
+    // index so that the spatially sorted stars can be matched with their
+    // records again.
+    BlockArray<Star> unsorted;
+    for (uint32 i = 0; i < nRecords; i++)
+    {
+        Star star;
+        if (!initStarFromRecord(star, records[i]))
+        {
+            cerr << _("Bad spectral type in star database, star #") << i << "\n";
+            return false;
+        }
+        star.setCatalogNumber(i);
+        unsorted.add(star);
+    }
+
+    DynamicStarOctree* root = CreateStarOctreeRoot();
+    vector<const Star*> objects(nRecords);
+    for (uint32 i = 0; i < nRecords; i++)
+        objects[i] = &unsorted[i];
+    root->insertObjects(objects, STAR_OCTREE_ROOT_SIZE, WorkerPool::getSharedPool());
+
+    Star* sortedStars = new Star[max(nRecords, 1u)];
+    Star* firstStar = sortedStars;
+    StarOctree* octree = NULL;
+    root->rebuildAndSort(octree, firstStar);
+    delete root;
+    unsorted.clear();
+
+    vector<OctreeNodeRecord> nodes;
+    octree->flatten(nodes, sortedStars);
+    delete octree;
+
+    // Header
+    out.write(FILE_HEADER, strlen(FILE_HEADER));
+    writeUint16(out, PREBUILT_FILE_VERSION);
+    writeUint16(out, 0);
+    writeUint32(out, nRecords);
+    writeUint32(out, (uint32) nodes.size());
+    writeUint32(out, 0);
+
+    // Spatially sorted stars
+    vector<uint32> catalogIndex(nRecords);
+    for (uint32 i = 0; i < nRecords; i++)
+    {
+        const BinaryStarRecord& record = records[sortedStars[i].getCatalogNumber()];
+        writeUint32(out, record.catalogNumber);
+        writeFloat(out, record.x);
+        writeFloat(out, record.y);
+        writeFloat(out, record.z);
+        writeUint16(out, (uint16) record.absMag);
+        writeUint16(out, record.spectralType);
+        catalogIndex[i] = i;
+    }
+
+    // Octree nodes
+    for (vector<OctreeNodeRecord>::const_iterator iter = nodes.begin();
+         iter != nodes.end(); iter++)
+    {
+        writeFloat(out, iter->center[0]);
+        writeFloat(out, iter->center[1]);
+        writeFloat(out, iter->center[2]);
+        writeFloat(out, iter->exclusionFactor);
+        writeUint32(out, iter->firstObject);
+        writeUint32(out, iter->nObjects);
+        writeUint32(out, iter->firstChild);
+    }
+
+    // Catalog number index
+    sort(catalogIndex.begin(), catalogIndex.end(),
+         SortedRecordCatalogNumberPredicate(records, sortedStars));
+    for (uint32 i = 0; i < nRecords; i++)
+        writeUint32(out, catalogIndex[i]);
+
+    delete[] sortedStars;
+
+    return out.good();
+}
+
+
 void StarDatabase::finish()
 {
     clog << _("Total star count: ") << nStars << endl;
     
-    buildOctree();
-    buildIndexes();
+    if (prebuiltStars != NULL)
+    {
+        buildPrebuiltOctree();
+    }
+    else
+    {
+        buildOctree();
+        buildIndexes();
+    }
 
     // Delete the temporary indices used only during loading
-    delete binFileCatalogNumberIndex;
+    delete[] binFileCatalogNumberIndex;
+    binFileCatalogNumberIndex = NULL;
     stcFileCatalogNumberIndex.clear();
     
     // Resolve all barycenters; this can't be done before star sorting. There's
@@ -1175,6 +1607,12 @@ bool StarDatabase::createStar(Star* star,
 bool StarDatabase::load(istream& in, const string& resourcePath)
 {
     Tokenizer tokenizer(&in);
+    return load(tokenizer, resourcePath);
+}
+
+
+bool StarDatabase::load(Tokenizer& tokenizer, const string& resourcePath)
+{
     Parser parser(&tokenizer);
 
     while (tokenizer.nextToken() != Tokenizer::TokenEnd)
@@ -1386,14 +1824,13 @@ void StarDatabase::buildOctree()
     // ASSERT(octreeRoot == NULL);
 
     DPRINTF(1, "Sorting stars into octree . . .\n");
-    float absMag = astro::appToAbsMag(STAR_OCTREE_MAGNITUDE,
-                                      STAR_OCTREE_ROOT_SIZE * (float) sqrt(3.0));
-    DynamicStarOctree* root = new DynamicStarOctree(Vector3f(1000.0f, 1000.0f, 1000.0f),
-                                                    absMag);
+    DynamicStarOctree* root = CreateStarOctreeRoot();
+    vector<const Star*> objects(unsortedStars.size());
     for (unsigned int i = 0; i < unsortedStars.size(); ++i)
     {
-        root->insertObject(unsortedStars[i], STAR_OCTREE_ROOT_SIZE);
+        objects[i] = &unsortedStars[i];
     }
+    root->insertObjects(objects, STAR_OCTREE_ROOT_SIZE, WorkerPool::getSharedPool());
     
     DPRINTF(1, "Spatially sorting stars for improved locality of reference . . .\n");
     Star* sortedStars    = new Star[nStars];
@@ -1426,6 +1863,153 @@ void StarDatabase::buildOctree()
 }
 
 
+/*! Check whether a star from a prebuilt database still belongs in the octree
+ *  node it was originally sorted into; stc files may have moved the star,
+ *  brightened it, or given it an orbit. A star must lie (together with its
+ *  orbit) inside the node's cell, and no child node may contain a star
+ *  brighter than the parent's exclusion factor.
+ */
+static bool starFitsOctreeNode(const Star& star,
+                               const OctreeNodeRecord& node,
+                               float scale,
+                               float parentExclusionFactor)
+{
+    if (star.getAbsoluteMagnitude() < parentExclusionFactor)
+        return false;
+
+    Vector3f offset = star.getPosition() - Vector3f(node.center[0], node.center[1], node.center[2]);
+    return offset.cwise().abs().maxCoeff() + star.getOrbitalRadius() <= scale;
+}
+
+
+/*! Build the octree and catalog number index for a prebuilt star database.
+ *  If no stars were added or moved by stc files, the prebuilt octree is used
+ *  as-is. Otherwise, the new and displaced stars are placed in a second,
+ *  much smaller octree that is traversed along with the prebuilt one.
+ */
+void StarDatabase::buildPrebuiltOctree()
+{
+    uint32 nPrebuilt = (uint32) prebuiltCatalogIndex.size();
+    uint32 nNodes = (uint32) prebuiltNodes.size();
+
+    DPRINTF(1, "Checking prebuilt star octree . . .\n");
+
+    // Walk the nodes in breadth-first order, tracking the size of each
+    // node's cell and the exclusion factor of its parent.
+    vector<bool> displaced(nPrebuilt, false);
+    unsigned int nDisplaced = 0;
+    vector<float> nodeScale(nNodes);
+    vector<float> parentExclusionFactor(nNodes);
+    nodeScale[0] = STAR_OCTREE_ROOT_SIZE;
+    for (uint32 i = 0; i < nNodes; i++)
+    {
+        const OctreeNodeRecord& node = prebuiltNodes[i];
+        if (node.firstChild != 0)
+        {
+            for (uint32 j = 0; j < 8; j++)
+            {
+                nodeScale[node.firstChild + j] = nodeScale[i] * 0.5f;
+                parentExclusionFactor[node.firstChild + j] = node.exclusionFactor;
+            }
+        }
+
+        // Any star may be placed in the root node
+        if (i == 0)
+            continue;
+
+        for (uint32 j = node.firstObject; j < node.firstObject + node.nObjects; j++)
+        {
+            if (!starFitsOctreeNode(prebuiltStars[j], node, nodeScale[i], parentExclusionFactor[i]))
+            {
+                displaced[j] = true;
+                nDisplaced++;
+            }
+        }
+    }
+
+    if (nDisplaced == 0 && unsortedStars.size() == 0)
+    {
+        stars = prebuiltStars;
+        prebuiltStars = NULL;
+        octreeRoot = StarOctree::unflatten(&prebuiltNodes[0], nNodes, stars);
+
+        catalogNumberIndex = new Star*[nStars];
+        for (uint32 i = 0; i < nPrebuilt; i++)
+            catalogNumberIndex[i] = &stars[prebuiltCatalogIndex[i]];
+    }
+    else
+    {
+        DPRINTF(1, "%d stars added, %d prebuilt stars displaced\n",
+                unsortedStars.size(), nDisplaced);
+
+        // Compact the prebuilt stars that remain in place, keeping their
+        // order, and move the displaced ones to the list of unsorted stars.
+        Star* sortedStars = new Star[nStars];
+        vector<uint32> newIndex(nPrebuilt + 1);
+        uint32 nKept = 0;
+        for (uint32 i = 0; i < nPrebuilt; i++)
+        {
+            newIndex[i] = nKept;
+            if (displaced[i])
+                unsortedStars.add(prebuiltStars[i]);
+            else
+                sortedStars[nKept++] = prebuiltStars[i];
+        }
+        newIndex[nPrebuilt] = nKept;
+
+        for (uint32 i = 0; i < nNodes; i++)
+        {
+            OctreeNodeRecord& node = prebuiltNodes[i];
+            uint32 first = newIndex[node.firstObject];
+            node.nObjects = newIndex[node.firstObject + node.nObjects] - first;
+            node.firstObject = first;
+        }
+        octreeRoot = StarOctree::unflatten(&prebuiltNodes[0], nNodes, sortedStars);
+
+        DynamicStarOctree* root = CreateStarOctreeRoot();
+        for (unsigned int i = 0; i < unsortedStars.size(); ++i)
+            root->insertObject(unsortedStars[i], STAR_OCTREE_ROOT_SIZE);
+
+        Star* firstStar = sortedStars + nKept;
+        root->rebuildAndSort(extraOctreeRoot, firstStar);
+        delete root;
+        unsortedStars.clear();
+
+        // Merge the prebuilt catalog number ordering with an index of the
+        // extra stars.
+        vector<Star*> prebuiltIndex;
+        prebuiltIndex.reserve(nKept);
+        for (uint32 i = 0; i < nPrebuilt; i++)
+        {
+            uint32 index = prebuiltCatalogIndex[i];
+            if (!displaced[index])
+                prebuiltIndex.push_back(&sortedStars[newIndex[index]]);
+        }
+
+        vector<Star*> extraIndex;
+        for (Star* star = sortedStars + nKept; star != firstStar; star++)
+            extraIndex.push_back(star);
+        sort(extraIndex.begin(), extraIndex.end(), PtrCatalogNumberOrderingPredicate());
+
+        catalogNumberIndex = new Star*[nStars];
+        merge(prebuiltIndex.begin(), prebuiltIndex.end(),
+              extraIndex.begin(), extraIndex.end(),
+              catalogNumberIndex,
+              PtrCatalogNumberOrderingPredicate());
+
+        delete[] prebuiltStars;
+        prebuiltStars = NULL;
+        stars = sortedStars;
+    }
+
+    prebuiltNodes.clear();
+    prebuiltCatalogIndex.clear();
+
+    DPRINTF(1, "Octree has %d nodes and %d stars.\n",
+            1 + octreeRoot->countChildren(), octreeRoot->countObjects());
+}
+
+
 void StarDatabase::buildIndexes()
 {
     // This should only be called once for the database
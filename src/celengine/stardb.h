@@ -114,7 +114,8 @@ class StarDatabase
     Star* find(const std::string&) const;
     uint32 findCatalogNumberByName(const std::string&) const;
 
-    std::vector<std::string> getCompletion(const std::string&) const;
+    std::vector<std::string> getCompletion(const std::string&,
+                                           unsigned int maxCompletions = 0) const;
 
     void findVisibleStars(StarHandler& starHandler,
                           const Eigen::Vector3f& obsPosition,
@@ -135,7 +136,23 @@ class StarDatabase
     void setNameDatabase(StarNameDatabase*);
     
     bool load(std::istream&, const std::string& resourcePath);
+    bool load(Tokenizer&, const std::string& resourcePath);
     bool loadBinary(std::istream&);
+    bool loadBinary(const std::string& filename);
+
+    // Star record as stored in binary star database files; all fields
+    // are little endian.
+    struct BinaryStarRecord
+    {
+        uint32 catalogNumber;
+        float  x;
+        float  y;
+        float  z;
+        int16  absMag;        // absolute magnitude * 256
+        uint16 spectralType;  // packed StellarClass
+    };
+
+    static bool writeBinary(std::ostream&, const std::vector<BinaryStarRecord>&);
 
     enum Catalog
     {
@@ -186,7 +203,12 @@ private:
                     const std::string& path,
                     const bool isBarycenter);
 
+    bool loadBinaryRecords(const char* data, uint32 nRecords);
+    bool loadPrebuilt(const char* data, std::size_t size);
+    void buildBinFileIndex();
+
     void buildOctree();
+    void buildPrebuiltOctree();
     void buildIndexes();
     Star* findWhileLoading(uint32 catalogNumber) const;
 
@@ -196,6 +218,9 @@ private:
     StarNameDatabase* namesDB;
     Star**            catalogNumberIndex;
     StarOctree*       octreeRoot;
+    // Octree for stars added by stc files after a prebuilt database was
+    // loaded; NULL when all stars are in the main octree.
+    StarOctree*       extraOctreeRoot;
     uint32            nextAutoCatalogNumber;
 
     std::vector<CrossIndex*> crossIndexes;
@@ -208,6 +233,11 @@ private:
     unsigned int binFileStarCount;
     // Catalog number -> star mapping for stars loaded from stc files
     std::map<uint32, Star*> stcFileCatalogNumberIndex;    
+    // Spatially sorted stars, octree nodes, and catalog number ordering
+    // read from a prebuilt (version 0x0200) binary database
+    Star* prebuiltStars;
+    std::vector<OctreeNodeRecord> prebuiltNodes;
+    std::vector<uint32> prebuiltCatalogIndex;
 
     struct BarycenterUsage
     {
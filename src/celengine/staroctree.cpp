@@ -11,6 +11,13 @@
 // of the License, or (at your option) any later version.
 
 #include <celengine/staroctree.h>
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define STAR_BATCH_SSE2 1
+#include <emmintrin.h>
+#endif
 
 using namespace Eigen;
 
@@ -24,6 +31,11 @@ using namespace Eigen;
 // render stars with orbits that are closer than MAX_STAR_ORBIT_RADIUS.
 static const float MAX_STAR_ORBIT_RADIUS = 1.0f;
 
+// appMag = absMag + APP_MAG_SCALE * ln(distance) + APP_MAG_OFFSET, which
+// is astro::absToAppMag() rewritten in terms of the natural logarithm.
+static const float APP_MAG_SCALE  = (float) (5.0 / log(10.0));
+static const float APP_MAG_OFFSET = (float) (-5.0 - 5.0 * log10(LY_PER_PARSEC));
+
 
 // The octree node into which a star is placed is dependent on two properties:
 // its obsPosition and its luminosity--the fainter the star, the deeper the node
@@ -83,14 +95,250 @@ template<> DynamicStarOctree::ExclusionFactorDecayFunction*
            DynamicStarOctree::decayFunction = starAbsoluteMagnitudeDecayFunction;
 
 
+#ifdef STAR_BATCH_SSE2
+
+// Natural logarithm of four positive, normal floats. This is the single
+// precision polynomial approximation from the Cephes library; results are
+// within a few ulps of logf().
+static inline __m128 logPS(__m128 x)
+{
+    const __m128 one = _mm_set1_ps(1.0f);
+
+    // Split x into an exponent and a mantissa in [0.5, 1)
+    __m128i e = _mm_sub_epi32(_mm_srli_epi32(_mm_castps_si128(x), 23), _mm_set1_epi32(126));
+    __m128  m = _mm_or_ps(_mm_and_ps(x, _mm_castsi128_ps(_mm_set1_epi32(0x007fffff))),
+                          _mm_set1_ps(0.5f));
+    __m128 fe = _mm_cvtepi32_ps(e);
+
+    // Shift the mantissa into [sqrt(1/2) - 1, sqrt(2) - 1)
+    __m128 small = _mm_cmplt_ps(m, _mm_set1_ps(0.707106781186547524f));
+    fe = _mm_sub_ps(fe, _mm_and_ps(one, small));
+    m  = _mm_add_ps(_mm_sub_ps(m, one), _mm_and_ps(m, small));
+
+    __m128 z = _mm_mul_ps(m, m);
+    __m128 y = _mm_set1_ps(7.0376836292e-2f);
+    y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(-1.1514610310e-1f));
+    y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(1.1676998740e-1f));
+    y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(-1.2420140846e-1f));
+    y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(1.4249322787e-1f));
+    y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(-1.6668057665e-1f));
+    y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(2.0000714765e-1f));
+    y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(-2.4999993993e-1f));
+    y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(3.3333331174e-1f));
+    y = _mm_mul_ps(_mm_mul_ps(y, m), z);
+
+    y = _mm_add_ps(y, _mm_mul_ps(fe, _mm_set1_ps(-2.12194440e-4f)));
+    y = _mm_sub_ps(y, _mm_mul_ps(z, _mm_set1_ps(0.5f)));
+
+    return _mm_add_ps(_mm_add_ps(m, y), _mm_mul_ps(fe, _mm_set1_ps(0.693359375f)));
+}
+
+
+// Load the positions and absolute magnitudes of four stars as columns
+static inline void loadStars(const Star* s0, const Star* s1, const Star* s2, const Star* s3,
+                             __m128& x, __m128& y, __m128& z, __m128& absMag)
+{
+    Vector3f p0 = s0->getPosition();
+    Vector3f p1 = s1->getPosition();
+    Vector3f p2 = s2->getPosition();
+    Vector3f p3 = s3->getPosition();
+    x      = _mm_setr_ps(p0.x(), p1.x(), p2.x(), p3.x());
+    y      = _mm_setr_ps(p0.y(), p1.y(), p2.y(), p3.y());
+    z      = _mm_setr_ps(p0.z(), p1.z(), p2.z(), p3.z());
+    absMag = _mm_setr_ps(s0->getAbsoluteMagnitude(), s1->getAbsoluteMagnitude(),
+                         s2->getAbsoluteMagnitude(), s3->getAbsoluteMagnitude());
+}
+
+// Subtract the double precision values b0, b1 from the low two and the high
+// two elements of a, and round the differences to single precision. Star
+// positions are relative to the solar system, so the observer's position
+// must be subtracted at double precision to get accurate offsets to stars
+// far from the origin.
+static inline __m128 subtractDouble(__m128 a, __m128d b)
+{
+    __m128d lo = _mm_sub_pd(_mm_cvtps_pd(a), b);
+    __m128d hi = _mm_sub_pd(_mm_cvtps_pd(_mm_movehl_ps(a, a)), b);
+    return _mm_movelh_ps(_mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi));
+}
+
+#endif // STAR_BATCH_SSE2
+
+
+unsigned int CullStarsByMagnitude(const Star* stars,
+                                  unsigned int nStars,
+                                  const Vector3f& obsPosition,
+                                  float dimmest,
+                                  float limitingMag,
+                                  uint32* indices,
+                                  float* distances,
+                                  float* appMags)
+{
+    unsigned int count = 0;
+    unsigned int i = 0;
+
+#ifdef STAR_BATCH_SSE2
+    const __m128 obsX       = _mm_set1_ps(obsPosition.x());
+    const __m128 obsY       = _mm_set1_ps(obsPosition.y());
+    const __m128 obsZ       = _mm_set1_ps(obsPosition.z());
+    const __m128 dimmest4   = _mm_set1_ps(dimmest);
+    const __m128 limiting4  = _mm_set1_ps(limitingMag);
+    const __m128 orbitLimit = _mm_set1_ps(MAX_STAR_ORBIT_RADIUS);
+
+    for (; i + 4 <= nStars; i += 4)
+    {
+        __m128 x, y, z, absMag;
+        loadStars(&stars[i], &stars[i + 1], &stars[i + 2], &stars[i + 3], x, y, z, absMag);
+
+        __m128 bright = _mm_cmplt_ps(absMag, dimmest4);
+        if (_mm_movemask_ps(bright) == 0)
+            continue;
+
+        __m128 dx = _mm_sub_ps(obsX, x);
+        __m128 dy = _mm_sub_ps(obsY, y);
+        __m128 dz = _mm_sub_ps(obsZ, z);
+        // Sum in the same order as Eigen, so that the distances are
+        // identical to those computed by Vector3f::norm()
+        __m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx),
+                                                 _mm_add_ps(_mm_mul_ps(dy, dy),
+                                                            _mm_mul_ps(dz, dz))));
+
+        // Clamp the distance to avoid taking the log of zero or a denormal
+        __m128 logDistance = logPS(_mm_max_ps(distance, _mm_set1_ps(1.0e-30f)));
+        __m128 appMag = _mm_add_ps(absMag,
+                                   _mm_add_ps(_mm_mul_ps(logDistance, _mm_set1_ps(APP_MAG_SCALE)),
+                                              _mm_set1_ps(APP_MAG_OFFSET)));
+
+        int visibleMask = _mm_movemask_ps(_mm_and_ps(bright, _mm_cmplt_ps(appMag, limiting4)));
+        int closeMask   = _mm_movemask_ps(_mm_and_ps(bright, _mm_cmplt_ps(distance, orbitLimit)));
+        if ((visibleMask | closeMask) == 0)
+            continue;
+
+        float d[4];
+        float m[4];
+        _mm_storeu_ps(d, distance);
+        _mm_storeu_ps(m, appMag);
+        for (unsigned int j = 0; j < 4; ++j)
+        {
+            // Faint stars this close are kept only if they have an orbit
+            if ((visibleMask & (1 << j)) != 0 ||
+                ((closeMask & (1 << j)) != 0 && stars[i + j].getOrbit() != NULL))
+            {
+                indices[count] = i + j;
+                distances[count] = d[j];
+                appMags[count] = m[j];
+                count++;
+            }
+        }
+    }
+#endif // STAR_BATCH_SSE2
+
+    for (; i < nStars; ++i)
+    {
+        const Star& obj = stars[i];
+
+        if (obj.getAbsoluteMagnitude() < dimmest)
+        {
+            float distance    = (obsPosition - obj.getPosition()).norm();
+            float appMag      = astro::absToAppMag(obj.getAbsoluteMagnitude(), distance);
+
+            if (appMag < limitingMag || (distance < MAX_STAR_ORBIT_RADIUS && obj.getOrbit()))
+            {
+                indices[count] = i;
+                distances[count] = distance;
+                appMags[count] = appMag;
+                count++;
+            }
+        }
+    }
+
+    return count;
+}
+
+
+unsigned int CullStarsBehindViewer(const Star* stars,
+                                   const uint32* indices,
+                                   const float* distances,
+                                   unsigned int count,
+                                   const Vector3d& obsPosition,
+                                   const Vector3f& viewNormal,
+                                   float distanceLimit,
+                                   uint32* visible)
+{
+    unsigned int nVisible = 0;
+    unsigned int i = 0;
+
+#ifdef STAR_BATCH_SSE2
+    const __m128d obsX    = _mm_set1_pd(obsPosition.x());
+    const __m128d obsY    = _mm_set1_pd(obsPosition.y());
+    const __m128d obsZ    = _mm_set1_pd(obsPosition.z());
+    const __m128 normalX  = _mm_set1_ps(viewNormal.x());
+    const __m128 normalY  = _mm_set1_ps(viewNormal.y());
+    const __m128 normalZ  = _mm_set1_ps(viewNormal.z());
+    const __m128 limit    = _mm_set1_ps(distanceLimit);
+    const __m128 zero     = _mm_setzero_ps();
+    const __m128 nearDist = _mm_set1_ps(0.1f);
+
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 x, y, z, absMag;
+        loadStars(&stars[indices[i]], &stars[indices[i + 1]],
+                  &stars[indices[i + 2]], &stars[indices[i + 3]],
+                  x, y, z, absMag);
+
+        __m128 inRange = _mm_cmple_ps(_mm_loadu_ps(&distances[i]), limit);
+
+        __m128 dx = subtractDouble(x, obsX);
+        __m128 dy = subtractDouble(y, obsY);
+        __m128 dz = subtractDouble(z, obsZ);
+        __m128 dot = _mm_add_ps(_mm_mul_ps(dx, normalX),
+                                _mm_add_ps(_mm_mul_ps(dy, normalY),
+                                           _mm_mul_ps(dz, normalZ)));
+        __m128 inFront = _mm_or_ps(_mm_cmpgt_ps(dot, zero),
+                                   _mm_cmplt_ps(_mm_mul_ps(dx, dx), nearDist));
+
+        int inRangeMask = _mm_movemask_ps(inRange);
+        int inFrontMask = _mm_movemask_ps(inFront);
+        for (unsigned int j = 0; j < 4; ++j)
+        {
+            if ((inRangeMask & (1 << j)) == 0)
+                continue;
+
+            // Stars with orbits may be anywhere within their orbital radius
+            if ((inFrontMask & (1 << j)) != 0 || stars[indices[i + j]].getOrbitalRadius() > 0.0f)
+                visible[nVisible++] = i + j;
+        }
+    }
+#endif // STAR_BATCH_SSE2
+
+    for (; i < count; ++i)
+    {
+        if (distances[i] > distanceLimit)
+            continue;
+
+        const Star& star = stars[indices[i]];
+        Vector3f relPos = (star.getPosition().cast<double>() - obsPosition).cast<float>();
+        if (relPos.dot(viewNormal) > 0.0f || relPos.x() * relPos.x() < 0.1f ||
+            star.getOrbitalRadius() > 0.0f)
+        {
+            visible[nVisible++] = i;
+        }
+    }
+
+    return nVisible;
+}
+
+
 // total specialization of the StaticOctree template process*() methods for stars:
 template<>
-void StarOctree::processVisibleObjects(StarHandler&    processor,
-                                       const Vector3f& obsPosition,
-                                       const Hyperplane<float, 3>*   frustumPlanes,
-                                       float           limitingFactor,
-                                       float           scale) const
+void StarOctree::processVisibleNode(uint32          node,
+                                    StarHandler&    processor,
+                                    const Vector3f& obsPosition,
+                                    const Hyperplane<float, 3>*   frustumPlanes,
+                                    float           limitingFactor,
+                                    float           scale) const
 {
+    Vector3f cellCenterPos = cellCenter(node);
+
     // See if this node lies within the view frustum
 
     // Test the cubic octree node against each one of the five
@@ -110,34 +358,38 @@ void StarOctree::processVisibleObjects(StarHandler&    processor,
     // Process the objects in this node
     float dimmest     = minDistance > 0 ? astro::appToAbsMag(limitingFactor, minDistance) : 1000;
 
-    for (unsigned int i=0; i<nObjects; ++i)
-    {
-        const Star& obj = _firstObject[i];
+    const Star* nodeObjects = objects + firstObjects[node];
+    uint32 nObjects = objectCounts[node];
 
-        if (obj.getAbsoluteMagnitude() < dimmest)
-        {
-            float distance    = (obsPosition - obj.getPosition()).norm();
-            float appMag      = astro::absToAppMag(obj.getAbsoluteMagnitude(), distance);
-            
-            if (appMag < limitingFactor || (distance < MAX_STAR_ORBIT_RADIUS && obj.getOrbit()))
-                processor.process(obj, distance, appMag);
-        }
+    uint32 indices[StarBatchSize];
+    float  distances[StarBatchSize];
+    float  appMags[StarBatchSize];
+    for (uint32 first = 0; first < nObjects; first += StarBatchSize)
+    {
+        unsigned int batchSize = std::min(nObjects - first, (uint32) StarBatchSize);
+        unsigned int count = CullStarsByMagnitude(nodeObjects + first, batchSize,
+                                                  obsPosition, dimmest, limitingFactor,
+                                                  indices, distances, appMags);
+        if (count != 0)
+            processor.processBatch(nodeObjects + first, indices, distances, appMags, count);
     }
 
     // See if any of the objects in child nodes are potentially included
     // that we need to recurse deeper.
-    if (minDistance <= 0 || astro::absToAppMag(exclusionFactor, minDistance) <= limitingFactor)
+    if (minDistance <= 0 || astro::absToAppMag(exclusionFactors[node], minDistance) <= limitingFactor)
     {
         // Recurse into the child nodes
-        if (_children != NULL)
+        uint32 firstChild = firstChildren[node];
+        if (firstChild != 0)
         {
-            for (int i=0; i<8; ++i)
+            for (uint32 i = 0; i < 8; ++i)
             {
-                _children[i]->processVisibleObjects(processor,
-                                                    obsPosition,
-                                                    frustumPlanes,
-                                                    limitingFactor,
-                                                    scale * 0.5f);
+                processVisibleNode(firstChild + i,
+                                   processor,
+                                   obsPosition,
+                                   frustumPlanes,
+                                   limitingFactor,
+                                   scale * 0.5f);
             }
         }
     }
@@ -145,11 +397,14 @@ void StarOctree::processVisibleObjects(StarHandler&    processor,
 
 
 template<>
-void StarOctree::processCloseObjects(StarHandler&    processor,
-                                     const Vector3f& obsPosition,
-                                     float           boundingRadius,
-                                     float           scale) const
+void StarOctree::processCloseNode(uint32          node,
+                                  StarHandler&    processor,
+                                  const Vector3f& obsPosition,
+                                  float           boundingRadius,
+                                  float           scale) const
 {
+    Vector3f cellCenterPos = cellCenter(node);
+
     // Compute the distance to node; this is equal to the distance to
     // the cellCenterPos of the node minus the boundingRadius of the node, scale * SQRT3.
     float nodeDistance    = (obsPosition - cellCenterPos).norm() - scale * StarOctree::SQRT3;
@@ -165,9 +420,11 @@ void StarOctree::processCloseObjects(StarHandler&    processor,
     float radiusSquared    = boundingRadius * boundingRadius;
 
     // Check all the objects in the node.
-    for (unsigned int i = 0; i < nObjects; ++i)
+    const Star* nodeObjects = objects + firstObjects[node];
+    uint32 nObjects = objectCounts[node];
+    for (uint32 i = 0; i < nObjects; ++i)
     {
-        Star& obj = _firstObject[i];
+        const Star& obj = nodeObjects[i];
 
         if ((obsPosition - obj.getPosition()).squaredNorm() < radiusSquared)
         {
@@ -179,14 +436,16 @@ void StarOctree::processCloseObjects(StarHandler&    processor,
     }
 
     // Recurse into the child nodes
-    if (_children != NULL)
+    uint32 firstChild = firstChildren[node];
+    if (firstChild != 0)
     {
-        for (int i = 0; i < 8; ++i)
+        for (uint32 i = 0; i < 8; ++i)
         {
-            _children[i]->processCloseObjects(processor,
-                                              obsPosition,
-                                              boundingRadius,
-                                              scale * 0.5f);
+            processCloseNode(firstChild + i,
+                             processor,
+                             obsPosition,
+                             boundingRadius,
+                             scale * 0.5f);
         }
     }
 }
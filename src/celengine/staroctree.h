@@ -21,4 +21,39 @@ typedef DynamicOctree  <Star, float> DynamicStarOctree;
 typedef StaticOctree   <Star, float> StarOctree;
 typedef OctreeProcessor<Star, float> StarHandler;
 
+
+// The stars in an octree node are passed to StarHandler::processBatch() in
+// groups of at most this many.
+static const unsigned int StarBatchSize = 128;
+
+// Compute the distance from obsPosition and the apparent magnitude of
+// nStars stars. The stars that could be visible at limitingMag--those
+// brighter than both limitingMag and the absolute magnitude cutoff dimmest,
+// plus nearby stars with orbits--are written to indices, with their distances
+// and apparent magnitudes. Returns the number of stars written.
+unsigned int CullStarsByMagnitude(const Star* stars,
+                                  unsigned int nStars,
+                                  const Eigen::Vector3f& obsPosition,
+                                  float dimmest,
+                                  float limitingMag,
+                                  uint32* indices,
+                                  float* distances,
+                                  float* appMags);
+
+// Select the stars of a batch that are no farther than distanceLimit and
+// that may be in front of a viewer at obsPosition looking along viewNormal.
+// Stars very close to the viewer and stars with orbits are always kept. The
+// test is the same one that the star renderer makes, with the offset to each
+// star computed at double precision. The positions in the batch of the
+// selected stars are written to visible. Returns the number of stars
+// selected.
+unsigned int CullStarsBehindViewer(const Star* stars,
+                                   const uint32* indices,
+                                   const float* distances,
+                                   unsigned int count,
+                                   const Eigen::Vector3d& obsPosition,
+                                   const Eigen::Vector3f& viewNormal,
+                                   float distanceLimit,
+                                   uint32* visible);
+
 #endif  // _CELENGINE_STAROCTREE_H_
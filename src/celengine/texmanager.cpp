@@ -9,6 +9,7 @@
 
 #include "celestia.h"
 #include <celutil/debug.h>
+#include <celutil/filetype.h>
 #include <iostream>
 #include <fstream>
 #include "multitexture.h"
@@ -114,20 +115,32 @@ string TextureInfo::resolve(const string& baseDir)
 }
 
 
-Texture* TextureInfo::load(const string& name)
+Texture::AddressMode TextureInfo::getAddressMode() const
 {
-    Texture::AddressMode addressMode = Texture::EdgeClamp;
-    Texture::MipMapMode mipMode = Texture::DefaultMipMaps;
-
     if (flags & WrapTexture)
-        addressMode = Texture::Wrap;
+        return Texture::Wrap;
     else if (flags & BorderClamp)
-        addressMode = Texture::BorderClamp;
+        return Texture::BorderClamp;
+    else
+        return Texture::EdgeClamp;
+}
+
 
+Texture::MipMapMode TextureInfo::getMipMapMode() const
+{
     if (flags & NoMipMaps)
-        mipMode = Texture::NoMipMaps;
+        return Texture::NoMipMaps;
     else if (flags & AutoMipMaps)
-        mipMode = Texture::AutoMipMaps;
+        return Texture::AutoMipMaps;
+    else
+        return Texture::DefaultMipMaps;
+}
+
+
+Texture* TextureInfo::load(const string& name)
+{
+    Texture::AddressMode addressMode = getAddressMode();
+    Texture::MipMapMode mipMode = getMipMapMode();
 
     if (bumpHeight == 0.0f)
     {
@@ -147,3 +160,49 @@ Texture* TextureInfo::load(const string& name)
     return NULL;
 }
 
+
+
+// Image files may be decoded in the background; virtual textures are
+// loaded on demand tile by tile anyhow.
+bool TextureInfo::canLoadInBackground(const string& name) const
+{
+    return DetermineFileType(name) != Content_CelestiaTexture;
+}
+
+
+// Load the image and, for bump maps, convert it to a normal map. This is
+// run on a loader thread and so makes no OpenGL calls.
+bool TextureInfo::loadInBackground(const string& name)
+{
+    DPRINTF(0, "Loading texture in background: %s\n", name.c_str());
+
+    image = LoadImageFromFile(name);
+    if (image != NULL && bumpHeight != 0.0f)
+    {
+        Image* normalMap = image->computeNormalMap(bumpHeight,
+                                                   getAddressMode() == Texture::Wrap);
+        delete image;
+        image = normalMap;
+    }
+
+    return image != NULL;
+}
+
+
+// Create the texture from the image loaded in the background.
+Texture* TextureInfo::finishLoad(const string& name)
+{
+    if (image == NULL)
+        return NULL;
+
+    Texture* tex = NULL;
+    if (bumpHeight == 0.0f)
+        tex = CreateTextureFromFileImage(*image, name, getAddressMode(), getMipMapMode());
+    else
+        tex = CreateTextureFromFileImage(*image, name, getAddressMode(), Texture::DefaultMipMaps);
+
+    delete image;
+    image = NULL;
+
+    return tex;
+}
@@ -43,7 +43,8 @@ class TextureInfo : public ResourceInfo<Texture>
         path(_path),
         flags(_flags),
         bumpHeight(0.0f),
-        resolution(_resolution) {};
+        resolution(_resolution),
+        image(NULL) {};
 
     TextureInfo(const std::string _source,
                 const std::string _path,
@@ -54,7 +55,8 @@ class TextureInfo : public ResourceInfo<Texture>
         path(_path),
         flags(_flags),
         bumpHeight(_bumpHeight),
-        resolution(_resolution) {};
+        resolution(_resolution),
+        image(NULL) {};
 
     TextureInfo(const std::string _source,
                 unsigned int _flags,
@@ -63,10 +65,22 @@ class TextureInfo : public ResourceInfo<Texture>
         path(""),
         flags(_flags),
         bumpHeight(0.0f),
-        resolution(_resolution) {};
+        resolution(_resolution),
+        image(NULL) {};
 
     virtual std::string resolve(const std::string&);
     virtual Texture* load(const std::string&);
+
+    virtual bool canLoadInBackground(const std::string&) const;
+    virtual bool loadInBackground(const std::string&);
+    virtual Texture* finishLoad(const std::string&);
+
+ private:
+    Texture::AddressMode getAddressMode() const;
+    Texture::MipMapMode getMipMapMode() const;
+
+    // Image loaded in the background, owned by finishLoad()
+    Image* image;
 };
 
 inline bool operator<(const TextureInfo& ti0, const TextureInfo& ti1)
@@ -1062,22 +1062,36 @@ Texture* LoadTextureFromFile(const string& filename,
     if (img == NULL)
         return NULL;
 
-    Texture* tex = CreateTextureFromImage(*img, addressMode, mipMode);
+    Texture* tex = CreateTextureFromFileImage(*img, filename, addressMode, mipMode);
 
-    if (contentType == Content_DXT5NormalMap)
+    delete img;
+
+    return tex;
+}
+
+
+// Create a texture from an image loaded from the named file. This is the
+// part of LoadTextureFromFile() that requires an OpenGL context, separated
+// so that images may be loaded on a different thread.
+Texture* CreateTextureFromFileImage(Image& img,
+                                    const string& filename,
+                                    Texture::AddressMode addressMode,
+                                    Texture::MipMapMode mipMode)
+{
+    Texture* tex = CreateTextureFromImage(img, addressMode, mipMode);
+
+    if (DetermineFileType(filename) == Content_DXT5NormalMap)
     {
         // If the texture came from a .dxt5nm file then mark it as a dxt5
         // compressed normal map. There's no separate OpenGL format for dxt5
         // normal maps, so the file extension is the only thing that
         // distinguishes it from a plain old dxt5 texture.
-        if (img->getFormat() == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT)
+        if (img.getFormat() == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT)
         {
             tex->setFormatOptions(Texture::DXT5NormalMap);
         }
     }
 
-    delete img;
-
     return tex;
 }
 
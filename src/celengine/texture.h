@@ -188,5 +188,10 @@ extern Texture* LoadHeightMapFromFile(const std::string& filename,
                                       float height,
                                       Texture::AddressMode addressMode = Texture::EdgeClamp);
 
+extern Texture* CreateTextureFromFileImage(Image& img,
+                                           const std::string& filename,
+                                           Texture::AddressMode addressMode = Texture::EdgeClamp,
+                                           Texture::MipMapMode mipMode = Texture::DefaultMipMaps);
+
 
 #endif // _CELENGINE_TEXTURE_H_
@@ -10,26 +10,142 @@
 
 #include <cctype>
 #include <cmath>
+#include <cstring>
 #include <iomanip>
 #include <celutil/utf8.h>
+#include <celutil/basictypes.h>
 #include "tokenizer.h"
 
 
-static bool issep(char c)
+// Record tags. Each record is a tag byte followed by its data; strings
+// are stored as a 32-bit length and the characters. Numbers, lengths, and
+// line numbers are in native byte order, as recordings are only read back
+// on the machine that made them.
+enum
 {
-    return !isdigit(c) && !isalpha(c) && c != '.';
+    LineRecord   = 'L',   // line number after the next token
+    NameRecord   = 'N',
+    StringRecord = 'S',
+    NumberRecord = 'D',
+    TokenRecord  = 'T',   // token type of any other token
+    ValueRecord  = 'V',   // token type, then a value encoded by the parser
+};
+
+
+static const unsigned int BufferSize = 16384;
+
+
+enum
+{
+    SpaceClass = 0x1,
+    DigitClass = 0x2,
+    AlphaClass = 0x4,
+};
+
+
+void Tokenizer::initCharClasses()
+{
+    charClasses[0] = 0;
+    for (int c = 0; c < 256; c++)
+    {
+        charClasses[c + 1] = (isspace(c) ? SpaceClass : 0) |
+                             (isdigit(c) ? DigitClass : 0) |
+                             (isalpha(c) ? AlphaClass : 0);
+    }
+}
+
+
+inline bool Tokenizer::isSpace(int c) const
+{
+    return (charClasses[c + 1] & SpaceClass) != 0;
+}
+
+
+inline bool Tokenizer::isDigit(int c) const
+{
+    return (charClasses[c + 1] & DigitClass) != 0;
+}
+
+
+inline bool Tokenizer::isAlpha(int c) const
+{
+    return (charClasses[c + 1] & AlphaClass) != 0;
+}
+
+
+inline bool Tokenizer::isNameChar(int c) const
+{
+    return (charClasses[c + 1] & (AlphaClass | DigitClass)) != 0 || c == '_';
+}
+
+
+inline bool Tokenizer::isSeparator(int c) const
+{
+    return (charClasses[c + 1] & (AlphaClass | DigitClass)) == 0 && c != '.';
+}
+
+
+inline int Tokenizer::readChar()
+{
+    if (bufferPos == bufferEnd && refill() == 0)
+        return -1;
+
+    int c = (unsigned char) *bufferPos++;
+    if (c == '\n')
+        lineNum++;
+
+    return c;
 }
 
 
 Tokenizer::Tokenizer(istream* _in) :
     in(_in),
+    buffer(new char[BufferSize]),
+    bufferPos(buffer),
+    bufferEnd(buffer),
     tokenType(TokenBegin),
     haveValidNumber(false),
     haveValidName(false),
     haveValidString(false),
     pushedBack(false),
-    lineNum(1)
+    lineNum(1),
+    recording(NULL),
+    lastRecordStart(0),
+    recordedLineNum(1),
+    replayPos(NULL),
+    replayEnd(NULL),
+    valueRecord(NULL),
+    valueRecordSize(0)
 {
+    initCharClasses();
+}
+
+
+Tokenizer::Tokenizer(const char* _recording, std::size_t size) :
+    in(NULL),
+    buffer(NULL),
+    bufferPos(NULL),
+    bufferEnd(NULL),
+    tokenType(TokenBegin),
+    haveValidNumber(false),
+    haveValidName(false),
+    haveValidString(false),
+    pushedBack(false),
+    lineNum(1),
+    recording(NULL),
+    lastRecordStart(0),
+    recordedLineNum(1),
+    replayPos(_recording),
+    replayEnd(_recording + size),
+    valueRecord(NULL),
+    valueRecordSize(0)
+{
+}
+
+
+Tokenizer::~Tokenizer()
+{
+    delete[] buffer;
 }
 
 
@@ -43,7 +159,10 @@ Tokenizer::TokenType Tokenizer::nextToken()
         return tokenType;
     }
 
-    textToken = "";
+    if (replayPos != NULL)
+        return replayToken();
+
+    textToken.clear();
     haveValidNumber = false;
     haveValidName = false;
     haveValidString = false;
@@ -51,7 +170,7 @@ Tokenizer::TokenType Tokenizer::nextToken()
     if (tokenType == TokenBegin)
     {
         nextChar = readChar();
-        if (in->eof())
+        if (nextChar == -1)
             return TokenEnd;
     }
     else if (tokenType == TokenEnd)
@@ -72,11 +191,22 @@ Tokenizer::TokenType Tokenizer::nextToken()
         switch (state)
         {
         case StartState:
-            if (isspace(nextChar))
+            if (isSpace(nextChar))
             {
                 state = StartState;
+                while (bufferPos != bufferEnd && isSpace((unsigned char) *bufferPos))
+                {
+                    if (*bufferPos == '\n')
+                        lineNum++;
+                    bufferPos++;
+                }
+            }
+            else if ((isDigit(nextChar) || nextChar == '-' || nextChar == '+' || nextChar == '.') &&
+                     readBufferedNumber())
+            {
+                newToken = TokenNumber;
             }
-            else if (isdigit(nextChar))
+            else if (isDigit(nextChar))
             {
                 state = NumberState;
                 integerValue = (int) nextChar - (int) '0';
@@ -99,7 +229,7 @@ Tokenizer::TokenType Tokenizer::nextToken()
                 sign = +1;
                 integerValue = 0;
             }
-            else if (isalpha(nextChar) || nextChar == '_')
+            else if (isAlpha(nextChar) || nextChar == '_')
             {
                 state = NameState;
                 textToken += (char) nextChar;
@@ -164,10 +294,15 @@ Tokenizer::TokenType Tokenizer::nextToken()
             break;
 
         case NameState:
-            if (isalpha(nextChar) || isdigit(nextChar) || nextChar == '_')
+            if (isNameChar(nextChar))
             {
                 state = NameState;
                 textToken += (char) nextChar;
+
+                const char* start = bufferPos;
+                while (bufferPos != bufferEnd && isNameChar((unsigned char) *bufferPos))
+                    bufferPos++;
+                textToken.append(start, bufferPos - start);
             }
             else
             {
@@ -178,7 +313,14 @@ Tokenizer::TokenType Tokenizer::nextToken()
 
         case CommentState:
             if (nextChar == '\n' || nextChar == '\r' || nextChar == char_traits<char>::eof())
+            {
                 state = StartState;
+            }
+            else
+            {
+                while (bufferPos != bufferEnd && *bufferPos != '\n' && *bufferPos != '\r')
+                    bufferPos++;
+            }
             break;
 
         case StringState:
@@ -201,6 +343,12 @@ Tokenizer::TokenType Tokenizer::nextToken()
             {
                 state = StringState;
                 textToken += (char) nextChar;
+
+                // Newlines are left to readChar() so that they're counted
+                const char* start = bufferPos;
+                while (bufferPos != bufferEnd && *bufferPos != '"' && *bufferPos != '\\' && *bufferPos != '\n')
+                    bufferPos++;
+                textToken.append(start, bufferPos - start);
             }
             break;
 
@@ -235,7 +383,7 @@ Tokenizer::TokenType Tokenizer::nextToken()
             break;
 
         case NumberState:
-            if (isdigit(nextChar))
+            if (isDigit(nextChar))
             {
                 state = NumberState;
                 integerValue = integerValue * 10 + (int) nextChar - (int) '0';
@@ -248,7 +396,7 @@ Tokenizer::TokenType Tokenizer::nextToken()
             {
                 state = ExponentFirstState;
             }
-            else if (issep(nextChar))
+            else if (isSeparator(nextChar))
             {
                 newToken = TokenNumber;
                 haveValidNumber = true;
@@ -261,7 +409,7 @@ Tokenizer::TokenType Tokenizer::nextToken()
             break;
 
         case FractionState:
-            if (isdigit(nextChar))
+            if (isDigit(nextChar))
             {
                 state = FractionState;
                 fractionValue = fractionValue * 10 + nextChar - (int) '0';
@@ -271,7 +419,7 @@ Tokenizer::TokenType Tokenizer::nextToken()
             {
                 state = ExponentFirstState;
             }
-            else if (issep(nextChar))
+            else if (isSeparator(nextChar))
             {
                 newToken = TokenNumber;
                 haveValidNumber = true;
@@ -282,7 +430,7 @@ Tokenizer::TokenType Tokenizer::nextToken()
             break;
 
         case ExponentFirstState:
-            if (isdigit(nextChar))
+            if (isDigit(nextChar))
             {
                 state = ExponentState;
                 exponentValue = (int) nextChar - (int) '0';
@@ -304,12 +452,12 @@ Tokenizer::TokenType Tokenizer::nextToken()
             break;
 
         case ExponentState:
-            if (isdigit(nextChar))
+            if (isDigit(nextChar))
             {
                 state = ExponentState;
                 exponentValue = exponentValue * 10 + (int) nextChar - (int) '0';
             }
-            else if (issep(nextChar))
+            else if (isSeparator(nextChar))
             {
                 newToken = TokenNumber;
                 haveValidNumber = true;
@@ -322,7 +470,7 @@ Tokenizer::TokenType Tokenizer::nextToken()
             break;
 
         case DotState:
-            if (isdigit(nextChar))
+            if (isDigit(nextChar))
             {
                 state = FractionState;
                 fractionValue = fractionValue * 10 + (int) nextChar - (int) '0';
@@ -373,7 +521,9 @@ Tokenizer::TokenType Tokenizer::nextToken()
     }
 
     tokenType = newToken;
-    if (haveValidNumber)
+
+    // Numbers read by readBufferedNumber() are complete already
+    if (haveValidNumber && state != StartState)
     {
         numberValue = integerValue + fractionValue / fracExp;
         if (exponentValue != 0)
@@ -381,6 +531,9 @@ Tokenizer::TokenType Tokenizer::nextToken()
         numberValue *= sign;
     }
 
+    if (recording != NULL && tokenType != TokenEnd)
+        recordToken();
+
     return tokenType;
 }
 
@@ -403,27 +556,110 @@ double Tokenizer::getNumberValue()
 }
 
 
-string Tokenizer::getNameValue()
+const string& Tokenizer::getNameValue()
 {
     return textToken;
 }
 
 
-string Tokenizer::getStringValue()
+const string& Tokenizer::getStringValue()
 {
     return textToken;
 }
 
 
-int Tokenizer::readChar()
+/*! Read a number that lies entirely within the buffer, starting with the
+ *  character in nextChar, without stepping through the number states for
+ *  each digit. The value is computed exactly as the states would compute
+ *  it. Returns false without consuming anything if the number runs to the
+ *  end of the buffer or is malformed; the states then read it instead.
+ */
+bool Tokenizer::readBufferedNumber()
 {
-    int c = (int) in->get();
-    if (c == '\n')
-        lineNum++;
+    double integerValue = 0;
+    double fractionValue = 0;
+    double sign = 1;
+    double fracExp = 1;
+    double exponentValue = 0;
+    double exponentSign = 1;
+    bool fraction = false;
 
-    return c;
+    if (nextChar == '-')
+        sign = -1;
+    else if (nextChar == '.')
+        fraction = true;
+    else if (nextChar != '+')
+        integerValue = (int) nextChar - (int) '0';
+
+    const char* p = bufferPos;
+    if (!fraction)
+    {
+        while (p != bufferEnd && isDigit((unsigned char) *p))
+            integerValue = integerValue * 10 + (int) (unsigned char) *p++ - (int) '0';
+        if (p != bufferEnd && *p == '.')
+        {
+            fraction = true;
+            p++;
+        }
+    }
+
+    if (fraction)
+    {
+        while (p != bufferEnd && isDigit((unsigned char) *p))
+        {
+            fractionValue = fractionValue * 10 + (int) (unsigned char) *p++ - (int) '0';
+            fracExp *= 10;
+        }
+    }
+
+    if (p != bufferEnd && (*p == 'e' || *p == 'E'))
+    {
+        p++;
+        if (p == bufferEnd)
+            return false;
+
+        if (isDigit((unsigned char) *p))
+            exponentValue = (int) (unsigned char) *p++ - (int) '0';
+        else if (*p == '-')
+        {
+            exponentSign = -1;
+            p++;
+        }
+        else if (*p == '+')
+            p++;
+        else
+            return false;
+
+        while (p != bufferEnd && isDigit((unsigned char) *p))
+            exponentValue = exponentValue * 10 + (int) (unsigned char) *p++ - (int) '0';
+    }
+
+    if (p == bufferEnd || !isSeparator((unsigned char) *p))
+        return false;
+
+    bufferPos = p;
+    nextChar = readChar();
+
+    numberValue = integerValue + fractionValue / fracExp;
+    if (exponentValue != 0)
+        numberValue *= pow(10.0, exponentValue * exponentSign);
+    numberValue *= sign;
+    haveValidNumber = true;
+
+    return true;
+}
+
+
+int Tokenizer::refill()
+{
+    in->read(buffer, BufferSize);
+    bufferPos = buffer;
+    bufferEnd = buffer + in->gcount();
+
+    return (int) (bufferEnd - bufferPos);
 }
 
+
 void Tokenizer::syntaxError(const char* message)
 {
     cerr << message << '\n';
@@ -435,6 +671,202 @@ int Tokenizer::getLineNumber() const
     return lineNum;
 }
 
+
+void Tokenizer::setRecording(string* _recording)
+{
+    recording = _recording;
+    if (recording != NULL)
+        lastRecordStart = recording->size();
+}
+
+
+string* Tokenizer::getRecording() const
+{
+    return recording;
+}
+
+
+static void appendUint32(string& s, uint32 n)
+{
+    s.append(reinterpret_cast<const char*>(&n), sizeof(n));
+}
+
+
+void Tokenizer::recordLineNumber()
+{
+    lastRecordStart = recording->size();
+    if (lineNum != recordedLineNum)
+    {
+        *recording += (char) LineRecord;
+        appendUint32(*recording, (uint32) lineNum);
+        recordedLineNum = lineNum;
+    }
+}
+
+
+void Tokenizer::recordToken()
+{
+    recordLineNumber();
+
+    switch (tokenType)
+    {
+    case TokenName:
+    case TokenString:
+        *recording += (char) (tokenType == TokenName ? NameRecord : StringRecord);
+        appendUint32(*recording, (uint32) textToken.size());
+        *recording += textToken;
+        break;
+
+    case TokenNumber:
+        *recording += (char) NumberRecord;
+        recording->append(reinterpret_cast<const char*>(&numberValue), sizeof(numberValue));
+        break;
+
+    default:
+        *recording += (char) TokenRecord;
+        *recording += (char) tokenType;
+        break;
+    }
+}
+
+
+/*! Remove the record of the token that was pushed back, so that the value
+ *  the parser is about to read can be recorded in its place.
+ */
+void Tokenizer::unrecordPushedBack()
+{
+    if (recording != NULL && pushedBack)
+    {
+        recording->resize(lastRecordStart);
+
+        // The line number record may have been removed too
+        recordedLineNum = -1;
+    }
+}
+
+
+void Tokenizer::recordValue(TokenType firstToken, const string& encodedValue)
+{
+    recordLineNumber();
+    *recording += (char) ValueRecord;
+    *recording += (char) firstToken;
+    appendUint32(*recording, (uint32) encodedValue.size());
+    *recording += encodedValue;
+}
+
+
+/*! If the token pushed back or the next record is a value recorded by the
+ *  parser, consume it and return its encoding.
+ */
+bool Tokenizer::replayValue(const char*& encodedValue, std::size_t& size)
+{
+    if (replayPos == NULL)
+        return false;
+
+    if (!pushedBack)
+    {
+        const char* p = replayPos;
+        while (p + 1 + sizeof(uint32) <= replayEnd && *p == LineRecord)
+            p += 1 + sizeof(uint32);
+        if (p == replayEnd || *p != ValueRecord)
+            return false;
+        nextToken();
+    }
+
+    if (valueRecord == NULL)
+        return false;
+
+    pushedBack = false;
+    encodedValue = valueRecord;
+    size = valueRecordSize;
+    valueRecord = NULL;
+
+    return true;
+}
+
+
+Tokenizer::TokenType Tokenizer::replayToken()
+{
+    textToken.clear();
+    haveValidNumber = false;
+    haveValidName = false;
+    haveValidString = false;
+    valueRecord = NULL;
+
+    uint32 n = 0;
+    while (replayPos != replayEnd && *replayPos == LineRecord)
+    {
+        if (replayEnd - replayPos < 1 + (ptrdiff_t) sizeof(n))
+            break;
+        memcpy(&n, replayPos + 1, sizeof(n));
+        lineNum = (int) n;
+        replayPos += 1 + sizeof(n);
+    }
+
+    if (replayPos == replayEnd)
+    {
+        tokenType = TokenEnd;
+        return tokenType;
+    }
+
+    char tag = *replayPos++;
+    std::size_t remaining = replayEnd - replayPos;
+    tokenType = TokenError;
+
+    switch (tag)
+    {
+    case ValueRecord:
+        // Replay the first token of the value, in case it's pushed back
+        // before the parser reads the value.
+        if (remaining < 1 + sizeof(n))
+            break;
+        memcpy(&n, replayPos + 1, sizeof(n));
+        if (remaining - 1 - sizeof(n) < n)
+            break;
+        tokenType = (TokenType) *replayPos;
+        valueRecord = replayPos + 1 + sizeof(n);
+        valueRecordSize = n;
+        replayPos = valueRecord + n;
+        return tokenType;
+
+    case NameRecord:
+    case StringRecord:
+        if (remaining < sizeof(n))
+            break;
+        memcpy(&n, replayPos, sizeof(n));
+        replayPos += sizeof(n);
+        if (remaining - sizeof(n) < n)
+            break;
+
+        textToken.assign(replayPos, n);
+        haveValidName = tag == NameRecord;
+        haveValidString = tag == StringRecord;
+        tokenType = tag == NameRecord ? TokenName : TokenString;
+        replayPos += n;
+        return tokenType;
+
+    case NumberRecord:
+        if (remaining < sizeof(numberValue))
+            break;
+        memcpy(&numberValue, replayPos, sizeof(numberValue));
+        replayPos += sizeof(numberValue);
+        haveValidNumber = true;
+        tokenType = TokenNumber;
+        return tokenType;
+
+    case TokenRecord:
+        if (remaining < 1)
+            break;
+        tokenType = (TokenType) *replayPos++;
+        return tokenType;
+    }
+
+    syntaxError("Bad record in token recording");
+    replayPos = replayEnd;
+
+    return tokenType;
+}
+
 #if 0
 // Tokenizer test
 int main(int argc, char *argv[])
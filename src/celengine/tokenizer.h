@@ -13,6 +13,7 @@
 
 #include <string>
 #include <iostream>
+#include <cstddef>
 
 using namespace std;
 
@@ -41,15 +42,33 @@ public:
 
     Tokenizer(istream*);
 
+    // Replay the tokens of a recording made by another tokenizer
+    Tokenizer(const char* recording, std::size_t size);
+    ~Tokenizer();
+
     TokenType nextToken();
     TokenType getTokenType();
     void pushBack();
     double getNumberValue();
-    string getNameValue();
-    string getStringValue();
+    const string& getNameValue();
+    const string& getStringValue();
 
     int getLineNumber() const;
 
+    /*! The tokens read may be recorded in a compact binary form, which is
+     *  replayed much faster than text can be tokenized. The Parser stores
+     *  whole hashes and arrays read at the top level in place of their
+     *  tokens, so that they can be rebuilt without parsing. Recording
+     *  stops when the recording is set to NULL; see CatalogCache.
+     */
+    void setRecording(string* recording);
+    string* getRecording() const;
+
+    // Used by the Parser to record and replay values
+    void unrecordPushedBack();
+    void recordValue(TokenType firstToken, const string& encodedValue);
+    bool replayValue(const char*& encodedValue, std::size_t& size);
+
 private:
     enum State
     {
@@ -69,6 +88,17 @@ private:
 
     istream* in;
 
+    // Characters are read from the stream in blocks. The name, string, and
+    // comment states scan the buffer directly rather than calling
+    // readChar() for every character.
+    char* buffer;
+    const char* bufferPos;
+    const char* bufferEnd;
+
+    // Character classes from <cctype> for the current locale, indexed by
+    // character + 1 so that EOF can be looked up too
+    unsigned char charClasses[257];
+
     int nextChar;
     TokenType tokenType;
     bool haveValidNumber;
@@ -81,13 +111,35 @@ private:
     bool pushedBack;
 
     int readChar();
+    int refill();
+    bool readBufferedNumber();
+
+    void initCharClasses();
+    bool isSpace(int c) const;
+    bool isDigit(int c) const;
+    bool isAlpha(int c) const;
+    bool isNameChar(int c) const;
+    bool isSeparator(int c) const;
     void syntaxError(const char*);
 
+    void recordToken();
+    void recordLineNumber();
+    TokenType replayToken();
+
     double numberValue;
 
     string textToken;
 
     int lineNum;
+
+    string* recording;
+    std::size_t lastRecordStart;
+    int recordedLineNum;
+
+    const char* replayPos;
+    const char* replayEnd;
+    const char* valueRecord;
+    std::size_t valueRecordSize;
 };
 
 #endif // _TOKENIZER_H_
@@ -62,7 +62,12 @@ Orbit* TrajectoryInfo::load(const string& filename)
 
     Orbit* sampTrajectory = NULL;
 
-    if (filetype == Content_CelestiaXYZVTrajectory)
+    if (filetype == Content_CelestiaBinaryTrajectory)
+    {
+        // Binary trajectories are always double precision
+        sampTrajectory = LoadBinaryTrajectory(strippedFilename, interpolation);
+    }
+    else if (filetype == Content_CelestiaXYZVTrajectory)
     {
         switch (precision)
         {
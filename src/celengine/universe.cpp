@@ -1096,13 +1096,33 @@ Selection Universe::findPath(const string& s,
 }
 
 
+// Return true if a list of completions limited to maxCompletions entries
+// (no limit if zero) is full. Otherwise, set remaining to the number of
+// completions that may still be added, or zero if there's no limit.
+static bool completionsFull(const vector<string>& completion,
+                            unsigned int maxCompletions,
+                            unsigned int& remaining)
+{
+    remaining = 0;
+    if (maxCompletions == 0)
+        return false;
+    if (completion.size() >= maxCompletions)
+        return true;
+
+    remaining = maxCompletions - completion.size();
+    return false;
+}
+
+
 vector<string> Universe::getCompletion(const string& s,
                                                  Selection* contexts,
                                                  int nContexts,
-                                                 bool withLocations)
+                                                 bool withLocations,
+                                                 unsigned int maxCompletions)
 {
     vector<string> completion;
     int s_length = UTF8Length(s);
+    unsigned int remaining = 0;
 
     // Solar bodies first:
     for (int i = 0; i < nContexts; i++)
@@ -1116,7 +1136,11 @@ vector<string> Universe::getCompletion(const string& s,
                      iter != locations->end(); iter++)
                 {
                     if (!UTF8StringCompare(s, (*iter)->getName(true), s_length))
+                    {
+                        if (completionsFull(completion, maxCompletions, remaining))
+                            return completion;
                         completion.push_back((*iter)->getName(true));
+                    }
                 }
             }
         }
@@ -1127,7 +1151,9 @@ vector<string> Universe::getCompletion(const string& s,
             PlanetarySystem* planets = sys->getPlanets();
             if (planets != NULL)
             {
-                vector<string> bodies = planets->getCompletion(s);
+                if (completionsFull(completion, maxCompletions, remaining))
+                    return completion;
+                vector<string> bodies = planets->getCompletion(s, true, remaining);
                 completion.insert(completion.end(),
                                   bodies.begin(), bodies.end());
             }
@@ -1137,14 +1163,18 @@ vector<string> Universe::getCompletion(const string& s,
     // Deep sky objects:
     if (dsoCatalog != NULL)
     {
-        vector<string> dsos  = dsoCatalog->getCompletion(s);
+        if (completionsFull(completion, maxCompletions, remaining))
+            return completion;
+        vector<string> dsos  = dsoCatalog->getCompletion(s, remaining);
         completion.insert(completion.end(), dsos.begin(), dsos.end());
     }
 
     // and finally stars;
     if (starCatalog != NULL)
     {
-        vector<string> stars  = starCatalog->getCompletion(s);
+        if (completionsFull(completion, maxCompletions, remaining))
+            return completion;
+        vector<string> stars  = starCatalog->getCompletion(s, remaining);
         completion.insert(completion.end(), stars.begin(), stars.end());
     }
 
@@ -1155,14 +1185,15 @@ vector<string> Universe::getCompletion(const string& s,
 vector<string> Universe::getCompletionPath(const string& s,
                                            Selection* contexts,
                                            int nContexts,
-                                           bool withLocations)
+                                           bool withLocations,
+                                           unsigned int maxCompletions)
 {
     vector<string> completion;
     vector<string> locationCompletion;
     string::size_type pos = s.rfind('/', s.length());
 
     if (pos == string::npos)
-        return getCompletion(s, contexts, nContexts, withLocations);
+        return getCompletion(s, contexts, nContexts, withLocations, maxCompletions);
 
     string base(s, 0, pos);
     Selection sel = findPath(base, contexts, nContexts, true);
@@ -1205,9 +1236,11 @@ vector<string> Universe::getCompletionPath(const string& s,
     }
 
     if (worlds != NULL)
-        completion = worlds->getCompletion(s.substr(pos + 1), false);
+        completion = worlds->getCompletion(s.substr(pos + 1), false, maxCompletions);
 
     completion.insert(completion.end(), locationCompletion.begin(), locationCompletion.end());
+    if (maxCompletions != 0 && completion.size() > maxCompletions)
+        completion.resize(maxCompletions);
 
     return completion;
 }
@@ -13,6 +13,7 @@
 #include <cmath>
 #include <cassert>
 #include <cstdio>
+#include <algorithm>
 #include "celutil/debug.h"
 #include "celutil/directory.h"
 #include "celutil/filetype.h"
@@ -24,6 +25,31 @@ using namespace std;
 
 static const int MaxResolutionLevels = 13;
 
+// Number of threads used to read and decode tiles
+static const unsigned int TileLoaderThreadCount = 2;
+
+// Limits on how much work is done for a virtual texture in a single frame:
+// decoded tiles uploaded to the graphics card, tiles queued for prefetching,
+// and the loads that may be outstanding before prefetching is skipped.
+static const unsigned int MaxTileUploadsPerFrame = 4;
+static const unsigned int MaxTilePrefetchesPerFrame = 4;
+static const unsigned int MaxPendingTileLoads = 8;
+
+// Prefetching stops when the resident tiles use more than this fraction of
+// the memory budget, so that prefetched tiles don't evict ones in use.
+static const float PrefetchMemoryFraction = 0.75f;
+
+static size_t tileMemoryBudget = 128 * 1024 * 1024;
+
+static WorkerPool* tileLoaderPool = NULL;
+
+static WorkerPool* getTileLoaderPool()
+{
+    if (tileLoaderPool == NULL)
+        tileLoaderPool = new WorkerPool(TileLoaderThreadCount);
+    return tileLoaderPool;
+}
+
 
 // Virtual textures are composed of tiles that are loaded from the hard drive
 // as they become visible.  Hidden tiles may be evicted from graphics memory
@@ -35,6 +61,35 @@ static const int MaxResolutionLevels = 13;
 // a power of two, with width = 2 * height.  The baseSplit determines the
 // number of tiles at the lowest LOD.  It is the log base 2 of the width in
 // tiles of LOD zero.  Though it's not required
+//
+// Tiles in LOD zero are loaded immediately, and always stay resident so
+// that there's something to show while the more detailed tiles are loading.
+// The more detailed tiles are read and decoded by loader threads, then
+// uploaded a few at a time in beginUsage(). The resident tiles are kept in
+// a cache limited by the memory budget: once the budget is exceeded, the
+// least recently used tiles are evicted. When the loaders are idle, tiles
+// that are likely to be needed soon are prefetched--those next to the
+// visible tiles in the direction that the view is moving, and those at the
+// next higher level of detail.
+
+
+// Reads and decodes a tile image on a loader thread
+class VirtualTexture::TileLoadTask : public Task
+{
+ public:
+    TileLoadTask(VirtualTexture* _texture, Tile* _tile, const string& _filename) :
+        texture(_texture), tile(_tile), filename(_filename) {};
+
+    void run()
+    {
+        texture->tileLoaded(tile, LoadImageFromFile(filename));
+    }
+
+ private:
+    VirtualTexture* texture;
+    Tile* tile;
+    string filename;
+};
 
 static bool isPow2(int x)
 {
@@ -63,7 +118,14 @@ VirtualTexture::VirtualTexture(const string& _tilePath,
     baseSplit(_baseSplit),
     tileSize(_tileSize),
     ticks(0),
-    nResolutionLevels(0)
+    nResolutionLevels(0),
+    residentMemory(0),
+    pendingLoads(0),
+    lastCenterU(0.0f),
+    lastCenterV(0.0f),
+    haveLastCenter(false),
+    loadedTilesMutex(NewMutex()),
+    loadGroup(new TaskGroup())
 {
     assert(tileSize != 0 && isPow2(tileSize));
     tileTree[0] = new TileQuadtreeNode();
@@ -78,6 +140,21 @@ VirtualTexture::VirtualTexture(const string& _tilePath,
 
 VirtualTexture::~VirtualTexture()
 {
+    // Loads still in progress refer to this texture
+    if (tileLoaderPool != NULL)
+        tileLoaderPool->wait(*loadGroup);
+
+    for (unsigned int i = 0; i < loadedTiles.size(); i++)
+        delete loadedTiles[i].image;
+
+    delete loadGroup;
+    delete loadedTilesMutex;
+}
+
+
+void VirtualTexture::setMemoryBudget(size_t bytes)
+{
+    tileMemoryBudget = bytes;
 }
 
 
@@ -102,6 +179,19 @@ const TextureTile VirtualTexture::getTile(int lod, int u, int v)
         Tile* tile = node->tile;
         uint tileLOD = 0;
 
+        // Track the most detailed tile that's already resident; it's used
+        // in place of the requested tile until that has been loaded. Tiles
+        // from the lowest LOD are loaded immediately so that there's always
+        // a resident tile to fall back on.
+        Tile* residentTile = NULL;
+        uint residentLOD = 0;
+        if (tile != NULL)
+        {
+            makeResident(tile, 0, u >> lod, v >> lod);
+            if (tile->tex != NULL)
+                residentTile = tile;
+        }
+
         for (int n = 0; n < lod; n++)
         {
             uint mask = 1 << (lod - n - 1);
@@ -118,6 +208,13 @@ const TextureTile VirtualTexture::getTile(int lod, int u, int v)
                 {
                     tile = node->tile;
                     tileLOD = n + 1;
+                    if (tileLOD <= baseSplit)
+                        makeResident(tile, tileLOD, u >> (lod - tileLOD), v >> (lod - tileLOD));
+                    if (tile->tex != NULL)
+                    {
+                        residentTile = tile;
+                        residentLOD = tileLOD;
+                    }
                 }
             }
         }
@@ -128,10 +225,25 @@ const TextureTile VirtualTexture::getTile(int lod, int u, int v)
             return TextureTile(0);
         }
 
-        // Make the tile resident.
+        TileRequest request;
+        request.lod = lod;
+        request.u = u;
+        request.v = v;
+        requests.push_back(request);
+
+        // Make the tile resident; unless it's part of the lowest LOD, this
+        // just queues it for loading.
         uint tileU = u >> (lod - tileLOD);
         uint tileV = v >> (lod - tileLOD);
         makeResident(tile, tileLOD, tileU, tileV);
+        tile->lastUsed = ticks;
+
+        if (tile->tex == NULL && residentTile != NULL)
+        {
+            tile = residentTile;
+            tileLOD = residentLOD;
+            tile->lastUsed = ticks;
+        }
 
         // It's possible that we failed to make the tile resident, either
         // because the texture file was bad, or there was an unresolvable
@@ -196,11 +308,16 @@ void VirtualTexture::beginUsage()
 {
     ticks++;
     tilesRequested = 0;
+    requests.clear();
+
+    uploadLoadedTiles();
+    evictTiles();
 }
 
 
 void VirtualTexture::endUsage()
 {
+    prefetchTiles();
 }
 
 
@@ -214,35 +331,34 @@ uint VirtualTexture::tileIndex(unsigned int lod,
 #endif
 
 
-ImageTexture* VirtualTexture::loadTileTexture(uint lod, uint u, uint v)
+string VirtualTexture::tileFilename(uint lod, uint u, uint v) const
 {
-    lod >>= baseSplit;
+    lod -= baseSplit;
 
     assert(lod < (unsigned)MaxResolutionLevels);
 
     char filename[64];
     sprintf(filename, "level%d/%s%d_%d", lod, tilePrefix.c_str(), u, v);
 
-    string pathname = tilePath + filename + tileExt;
-    Image* img = LoadImageFromFile(pathname);
-    if (img == NULL)
-        return NULL;
+    return tilePath + filename + tileExt;
+}
+
 
+ImageTexture* VirtualTexture::createTileTexture(Image& img, uint lod)
+{
     ImageTexture* tex = NULL;
 
     // Only use mip maps for the LOD 0; for higher LODs, the function of mip
     // mapping is built into the texture.
-    MipMapMode mipMapMode = lod == 0 ? DefaultMipMaps : NoMipMaps;
+    MipMapMode mipMapMode = lod == baseSplit ? DefaultMipMaps : NoMipMaps;
 
-    if (isPow2(img->getWidth()) && isPow2(img->getHeight()))
-        tex = new ImageTexture(*img, EdgeClamp, mipMapMode);
+    if (isPow2(img.getWidth()) && isPow2(img.getHeight()))
+        tex = new ImageTexture(img, EdgeClamp, mipMapMode);
 
     // TODO: Virtual textures can have tiles in different formats, some
     // compressed and some not. The compression flag doesn't make much
     // sense for them.
-    compressed = img->isCompressed();
-
-    delete img;
+    compressed = img.isCompressed();
 
     return tex;
 }
@@ -250,16 +366,254 @@ ImageTexture* VirtualTexture::loadTileTexture(uint lod, uint u, uint v)
 
 void VirtualTexture::makeResident(Tile* tile, uint lod, uint u, uint v)
 {
-    if (tile->tex == NULL && !tile->loadFailed)
+    if (tile->tex != NULL || tile->loadFailed || tile->loading)
+        return;
+
+    if (lod <= baseSplit)
     {
-        // Potentially evict other tiles in order to make this one fit
-        tile->tex = loadTileTexture(lod, u, v);
-        if (tile->tex == NULL)
+        setTileTexture(tile, LoadImageFromFile(tileFilename(lod, u, v)));
+    }
+    else
+    {
+        requestTile(tile, lod, u, v);
+    }
+}
+
+
+// Queue a tile to be loaded by the loader threads
+void VirtualTexture::requestTile(Tile* tile, uint lod, uint u, uint v)
+{
+    tile->loading = true;
+    pendingLoads++;
+    getTileLoaderPool()->submit(new TileLoadTask(this, tile, tileFilename(lod, u, v)),
+                                loadGroup);
+}
+
+
+// Called from a loader thread when a tile image has been decoded
+void VirtualTexture::tileLoaded(Tile* tile, Image* image)
+{
+    MutexLock lock(loadedTilesMutex);
+    LoadedTile loaded;
+    loaded.tile = tile;
+    loaded.image = image;
+    loadedTiles.push_back(loaded);
+}
+
+
+void VirtualTexture::uploadLoadedTiles()
+{
+    vector<LoadedTile> uploads;
+    {
+        MutexLock lock(loadedTilesMutex);
+        unsigned int nUploads = min((unsigned int) loadedTiles.size(), MaxTileUploadsPerFrame);
+        uploads.insert(uploads.end(), loadedTiles.begin(), loadedTiles.begin() + nUploads);
+        loadedTiles.erase(loadedTiles.begin(), loadedTiles.begin() + nUploads);
+    }
+
+    for (unsigned int i = 0; i < uploads.size(); i++)
+    {
+        Tile* tile = uploads[i].tile;
+        tile->loading = false;
+        pendingLoads--;
+        setTileTexture(tile, uploads[i].image);
+
+        // Give newly loaded tiles a chance to be used before they're
+        // considered for eviction.
+        tile->lastUsed = ticks;
+    }
+}
+
+
+// Create the texture for a tile from its image, and add it to the
+// resident tiles. The image is deleted.
+void VirtualTexture::setTileTexture(Tile* tile, Image* image)
+{
+    if (image != NULL)
+    {
+        tile->tex = createTileTexture(*image, tile->lod);
+        if (tile->tex != NULL)
+        {
+            tile->memoryUsed = image->getSize();
+            if (tile->lod == baseSplit)
+                tile->memoryUsed += tile->memoryUsed / 3;  // mipmaps
+        }
+        delete image;
+    }
+
+    if (tile->tex == NULL)
+    {
+        tile->loadFailed = true;
+    }
+    else
+    {
+        residentTiles.push_back(tile);
+        residentMemory += tile->memoryUsed;
+    }
+}
+
+
+struct TileLRUPredicate
+{
+    template<class T> bool operator()(const T* a, const T* b) const
+    {
+        return a->lastUsed < b->lastUsed;
+    }
+};
+
+
+// Evict the least recently used tiles until the resident tiles fit within
+// the memory budget. Tiles used in the previous frame and tiles from the
+// lowest LOD are never evicted.
+void VirtualTexture::evictTiles()
+{
+    if (residentMemory <= tileMemoryBudget)
+        return;
+
+    sort(residentTiles.begin(), residentTiles.end(), TileLRUPredicate());
+
+    vector<Tile*>::iterator keep = residentTiles.begin();
+    for (vector<Tile*>::iterator iter = residentTiles.begin();
+         iter != residentTiles.end(); iter++)
+    {
+        Tile* tile = *iter;
+        if (residentMemory > tileMemoryBudget &&
+            tile->lod > baseSplit && tile->lastUsed + 1 < ticks)
+        {
+            delete tile->tex;
+            tile->tex = NULL;
+            residentMemory -= tile->memoryUsed;
+            tile->memoryUsed = 0;
+        }
+        else
+        {
+            *keep++ = tile;
+        }
+    }
+    residentTiles.erase(keep, residentTiles.end());
+}
+
+
+// Queue tiles that will probably be needed soon, as long as the loaders
+// are idle and there's room in the cache. The tiles next to the visible
+// ones in the direction that the view is moving across the texture come
+// first, followed by the tiles at the next level of detail.
+void VirtualTexture::prefetchTiles()
+{
+    if (requests.empty())
+        return;
+
+    // Find the center of the visible tiles in texture coordinates, and the
+    // direction it has moved in since the previous frame.
+    float centerU = 0.0f;
+    float centerV = 0.0f;
+    for (unsigned int i = 0; i < requests.size(); i++)
+    {
+        centerU += ((float) requests[i].u + 0.5f) / (float) (2 << requests[i].lod);
+        centerV += ((float) requests[i].v + 0.5f) / (float) (1 << requests[i].lod);
+    }
+    centerU /= (float) requests.size();
+    centerV /= (float) requests.size();
+
+    int stepU = 0;
+    int stepV = 0;
+    if (haveLastCenter)
+    {
+        float du = centerU - lastCenterU;
+        float dv = centerV - lastCenterV;
+
+        // The texture wraps around in u
+        if (du > 0.5f)
+            du -= 1.0f;
+        else if (du < -0.5f)
+            du += 1.0f;
+
+        if (du != 0.0f || dv != 0.0f)
         {
-            // cout << "Texture load failed!\n";
-            tile->loadFailed = true;
+            float maxStep = max(fabs(du), fabs(dv));
+            if (fabs(du) > 0.5f * maxStep)
+                stepU = du > 0.0f ? 1 : -1;
+            if (fabs(dv) > 0.5f * maxStep)
+                stepV = dv > 0.0f ? 1 : -1;
         }
     }
+    lastCenterU = centerU;
+    lastCenterV = centerV;
+    haveLastCenter = true;
+
+    unsigned int nPrefetched = 0;
+    for (int pass = 0; pass < 2; pass++)
+    {
+        if (pass == 0 && stepU == 0 && stepV == 0)
+            continue;
+
+        for (unsigned int i = 0; i < requests.size(); i++)
+        {
+            if (nPrefetched >= MaxTilePrefetchesPerFrame ||
+                pendingLoads >= MaxPendingTileLoads ||
+                (float) residentMemory > PrefetchMemoryFraction * (float) tileMemoryBudget)
+            {
+                return;
+            }
+
+            uint lod = requests[i].lod;
+            int u = (int) requests[i].u;
+            int v = (int) requests[i].v;
+            if (pass == 0)
+            {
+                int uTiles = 2 << lod;
+                u = (u + stepU + uTiles) % uTiles;
+                v += stepV;
+                if (v < 0 || v >= (1 << lod))
+                    continue;
+            }
+            else
+            {
+                if (lod + 1 >= nResolutionLevels)
+                    continue;
+                lod++;
+                u = u * 2 + (ticks & 1);
+                v = v * 2 + ((ticks >> 1) & 1);
+            }
+
+            uint tileLOD = 0;
+            Tile* tile = findTile(lod, (uint) u, (uint) v, tileLOD);
+            if (tile != NULL && tile->tex == NULL && !tile->loading && !tile->loadFailed)
+            {
+                makeResident(tile, tileLOD, (uint) u >> (lod - tileLOD), (uint) v >> (lod - tileLOD));
+                nPrefetched++;
+            }
+        }
+    }
+}
+
+
+// Find the most detailed tile available that covers the specified tile.
+// The level of detail of the tile found is returned in tileLOD.
+VirtualTexture::Tile* VirtualTexture::findTile(unsigned int lod,
+                                               unsigned int u, unsigned int v,
+                                               unsigned int& tileLOD)
+{
+    TileQuadtreeNode* node = tileTree[u >> lod];
+    Tile* tile = node->tile;
+    tileLOD = 0;
+
+    for (uint n = 0; n < lod; n++)
+    {
+        uint mask = 1 << (lod - n - 1);
+        uint child = (((v & mask) << 1) | (u & mask)) >> (lod - n - 1);
+        node = node->children[child];
+        if (node == NULL)
+            break;
+
+        if (node->tile != NULL)
+        {
+            tile = node->tile;
+            tileLOD = n + 1;
+        }
+    }
+
+    return tile;
 }
 
 
@@ -327,7 +681,10 @@ void VirtualTexture::addTileToTree(Tile* tile, uint lod, uint u, uint v)
 
     // Verify that the tile doesn't already exist
     if (node->tile == NULL)
+    {
+        tile->lod = lod;
         node->tile = tile;
+    }
 }
 
 
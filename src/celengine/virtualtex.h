@@ -11,8 +11,10 @@
 #define _CELENGINE_VIRTUALTEX_H_
 
 #include <string>
+#include <vector>
 #include "celutil/basictypes.h"
 #include <celengine/texture.h>
+#include <celutil/workerpool.h>
 
 
 class VirtualTexture : public Texture
@@ -34,13 +36,21 @@ class VirtualTexture : public Texture
     virtual void beginUsage();
     virtual void endUsage();
 
+    // Set the amount of texture memory in bytes that each virtual texture
+    // may use for resident tiles. Tiles that haven't been used recently
+    // are evicted when the budget is exceeded.
+    static void setMemoryBudget(size_t bytes);
+
  private:
     struct Tile
     {
-        Tile() : lastUsed(0), tex(NULL), loadFailed(false) {};
+        Tile() : lastUsed(0), tex(NULL), loadFailed(false), loading(false), memoryUsed(0) {};
         unsigned int lastUsed;
         ImageTexture* tex;
         bool loadFailed;
+        bool loading;
+        size_t memoryUsed;
+        unsigned int lod;
     };
 
     struct TileQuadtreeNode
@@ -56,14 +66,38 @@ class VirtualTexture : public Texture
         TileQuadtreeNode* children[4];
     };
 
+    struct TileRequest
+    {
+        uint lod;
+        uint u;
+        uint v;
+    };
+
+    struct LoadedTile
+    {
+        Tile* tile;
+        Image* image;
+    };
+
+    class TileLoadTask;
+    friend class TileLoadTask;
+
     void populateTileTree();
     void addTileToTree(Tile* tile, uint lod, uint v, uint u);
     void makeResident(Tile* tile, uint lod, uint v, uint u);
-    ImageTexture* loadTileTexture(uint lod, uint u, uint v);
+    void requestTile(Tile* tile, uint lod, uint u, uint v);
+    void tileLoaded(Tile* tile, Image* image);
+    void uploadLoadedTiles();
+    void setTileTexture(Tile* tile, Image* image);
+    void evictTiles();
+    void prefetchTiles();
+    std::string tileFilename(uint lod, uint u, uint v) const;
+    ImageTexture* createTileTexture(Image& img, uint lod);
 
     Tile* tiles;
     Tile* findTile(unsigned int lod,
-                   unsigned int u, unsigned int v);
+                   unsigned int u, unsigned int v,
+                   unsigned int& tileLOD);
 
  private:
     std::string tilePath;
@@ -75,6 +109,20 @@ class VirtualTexture : public Texture
     unsigned int tilesRequested;
     unsigned int nResolutionLevels;
 
+    // Tile cache state
+    std::vector<Tile*> residentTiles;
+    size_t residentMemory;
+    unsigned int pendingLoads;
+    std::vector<TileRequest> requests;
+    float lastCenterU;
+    float lastCenterV;
+    bool haveLastCenter;
+
+    // Tiles decoded by the loader threads and waiting to be uploaded
+    std::vector<LoadedTile> loadedTiles;
+    Mutex* loadedTilesMutex;
+    TaskGroup* loadGroup;
+
     enum {
         TileNotLoaded  = -1,
         TileLoadFailed = -2,
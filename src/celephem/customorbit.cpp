@@ -3156,9 +3156,7 @@ Orbit* GetCustomOrbit(const string& name)
     if (!jplephInitialized)
     {
         jplephInitialized = true;
-        ifstream in("data/jpleph.dat", ios::in | ios::binary);
-        if (in.good())
-            jpleph = JPLEphemeris::load(in);
+        jpleph = JPLEphemeris::load(string("data/jpleph.dat"));
         if (jpleph != NULL)
         {
             clog << "Loaded DE" << jpleph->getDENumber() <<
@@ -11,8 +11,10 @@
 // positions.
 
 #include <fstream>
+#include <sstream>
 #include <iomanip>
 #include <cstdio>
+#include <cstring>
 #include <cassert>
 #include <celutil/bytes.h>
 #include <celutil/basictypes.h>
@@ -30,6 +32,12 @@ static const unsigned int ConstantNameLength =  6;
 
 static const unsigned int MaxChebyshevCoeffs = 32;
 
+// Number of decoded records kept for a memory mapped ephemeris. All items
+// for a given time come from a single record, so only a few are needed
+// unless positions are computed over a span of many years, such as when
+// plotting an orbit.
+static const unsigned int RecordCacheSize    = 16;
+
 static const int LabelSize = 84;
 
 
@@ -52,22 +60,38 @@ static double readDouble(istream& in)
     return d;
 }
 
+// Decode a big-endian double from memory
+static double decodeDouble(const char* p)
+{
+    double d;
+    memcpy(&d, p, sizeof(double));
+    BE_TO_CPU_DOUBLE(d, d);
+    return d;
+}
+
 
 JPLEphRecord::~JPLEphRecord()
 {
     if (coeffs != NULL)
-	delete coeffs;
+	delete[] coeffs;
 }
 
 
 
-JPLEphemeris::JPLEphemeris()
+JPLEphemeris::JPLEphemeris() :
+    nRecords(0),
+    mappedFile(NULL),
+    cacheMutex(NULL),
+    cacheTicks(0),
+    lastCacheEntry(0)
 {
 }
 
 
 JPLEphemeris::~JPLEphemeris()
 {
+    delete mappedFile;
+    delete cacheMutex;
 }
 
 
@@ -120,10 +144,28 @@ Vector3d JPLEphemeris::getPlanetPosition(JPLEphemItem planet, double tjd) const
     // recNo is always >= 0:
     unsigned int recNo = (unsigned int) ((tjd - startDate) / daysPerInterval);
     // Make sure we don't go past the end of the array if t == endDate
-    if (recNo >= records.size())
-        recNo = records.size() - 1;
-    const JPLEphRecord* rec = &records[recNo];
+    if (recNo >= nRecords)
+        recNo = nRecords - 1;
+
+    if (mappedFile == NULL)
+    {
+        const JPLEphRecord* rec = &records[recNo];
+        return evaluate(planet, tjd, rec->t0, rec->coeffs);
+    }
+    else
+    {
+        MutexLock lock(cacheMutex);
+        const CachedRecord& rec = getMappedRecord(recNo);
+        return evaluate(planet, tjd, rec.t0, &rec.coeffs[0]);
+    }
+}
 
+
+// Evaluate the Chebyshev polynomials for an item from the record beginning
+// at time t0.
+Vector3d JPLEphemeris::evaluate(JPLEphemItem planet, double tjd,
+                                double t0, const double* recCoeffs) const
+{
     assert(coeffInfo[planet].nGranules >= 1);
     assert(coeffInfo[planet].nGranules <= 32);
     assert(coeffInfo[planet].nCoeffs <= MaxChebyshevCoeffs);
@@ -131,20 +173,20 @@ Vector3d JPLEphemeris::getPlanetPosition(JPLEphemItem planet, double tjd) const
     // u is the normalized time (in [-1, 1]) for interpolating
     // coeffs is a pointer to the Chebyshev coefficients
     double u = 0.0;
-    double* coeffs = NULL;
+    const double* coeffs = NULL;
 
     // nGranules is unsigned int so it will be compared against FFFFFFFF:
     if (coeffInfo[planet].nGranules == (unsigned int) -1)
     {
-    	coeffs = rec->coeffs + coeffInfo[planet].offset;
-    	u = 2.0 * (tjd - rec->t0) / daysPerInterval - 1.0;
+    	coeffs = recCoeffs + coeffInfo[planet].offset;
+    	u = 2.0 * (tjd - t0) / daysPerInterval - 1.0;
     }
     else
     {
 	double daysPerGranule = daysPerInterval / coeffInfo[planet].nGranules;
-	int granule = (int) ((tjd - rec->t0) / daysPerGranule);
-	double granuleStartDate = rec->t0 + daysPerGranule * (double) granule;
-	coeffs = rec->coeffs + coeffInfo[planet].offset +
+	int granule = (int) ((tjd - t0) / daysPerGranule);
+	double granuleStartDate = t0 + daysPerGranule * (double) granule;
+	coeffs = recCoeffs + coeffInfo[planet].offset +
             granule * coeffInfo[planet].nCoeffs * 3;
 	u = 2.0 * (tjd - granuleStartDate) / daysPerGranule - 1.0;
     }
@@ -169,7 +211,62 @@ Vector3d JPLEphemeris::getPlanetPosition(JPLEphemItem planet, double tjd) const
 }
 
 
-JPLEphemeris* JPLEphemeris::load(istream& in)
+// Return the cached copy of a record from a memory mapped ephemeris,
+// decoding it if necessary. The cache mutex must be held.
+const JPLEphemeris::CachedRecord& JPLEphemeris::getMappedRecord(unsigned int recNo) const
+{
+    cacheTicks++;
+
+    // Successive positions are usually computed from the same record
+    if (lastCacheEntry < recordCache.size() &&
+        recordCache[lastCacheEntry].recNo == recNo)
+    {
+        recordCache[lastCacheEntry].lastUsed = cacheTicks;
+        return recordCache[lastCacheEntry];
+    }
+
+    unsigned int lru = 0;
+    for (unsigned int i = 0; i < recordCache.size(); i++)
+    {
+        if (recordCache[i].recNo == recNo)
+        {
+            recordCache[i].lastUsed = cacheTicks;
+            lastCacheEntry = i;
+            return recordCache[i];
+        }
+
+        if (recordCache[i].lastUsed < recordCache[lru].lastUsed)
+            lru = i;
+    }
+
+    if (recordCache.size() < RecordCacheSize)
+    {
+        recordCache.push_back(CachedRecord());
+        lru = recordCache.size() - 1;
+    }
+
+    // Decode the record, skipping the two header records. The first two
+    // values are the start and end time.
+    const char* data = mappedFile->getData() +
+        (size_t) (recNo + 2) * recordSize * sizeof(double);
+
+    CachedRecord& entry = recordCache[lru];
+    entry.recNo = recNo;
+    entry.lastUsed = cacheTicks;
+    entry.t0 = decodeDouble(data);
+    entry.coeffs.resize(recordSize - 2);
+    for (unsigned int j = 0; j < recordSize - 2; j++)
+        entry.coeffs[j] = decodeDouble(data + (j + 2) * sizeof(double));
+
+    lastCacheEntry = lru;
+
+    return entry;
+}
+
+
+// Read the two header records, leaving the stream positioned at the start
+// of the first data record.
+JPLEphemeris* JPLEphemeris::loadHeader(istream& in)
 {
     JPLEphemeris* eph = NULL;
 
@@ -254,10 +351,26 @@ JPLEphemeris* JPLEphemeris::load(istream& in)
         return NULL;
     }
 
-    unsigned int nRecords = (unsigned int) ((eph->endDate - eph->startDate) /
-					    eph->daysPerInterval);
-    eph->records.resize(nRecords);
-    for (i = 0; i < nRecords; i++)
+    eph->nRecords = (unsigned int) ((eph->endDate - eph->startDate) /
+                                    eph->daysPerInterval);
+    if (eph->nRecords == 0)
+    {
+        delete eph;
+        return NULL;
+    }
+
+    return eph;
+}
+
+
+JPLEphemeris* JPLEphemeris::load(istream& in)
+{
+    JPLEphemeris* eph = loadHeader(in);
+    if (eph == NULL)
+        return NULL;
+
+    eph->records.resize(eph->nRecords);
+    for (unsigned int i = 0; i < eph->nRecords; i++)
     {
     	eph->records[i].t0 = readDouble(in);
     	eph->records[i].t1 = readDouble(in);
@@ -278,3 +391,42 @@ JPLEphemeris* JPLEphemeris::load(istream& in)
 
     return eph;
 }
+
+
+JPLEphemeris* JPLEphemeris::load(const string& filename)
+{
+    MappedFile* file = OpenMappedFile(filename);
+    if (file == NULL)
+    {
+        ifstream in(filename.c_str(), ios::in | ios::binary);
+        if (!in.good())
+            return NULL;
+        return load(in);
+    }
+
+    // The header occupies the first two records; parse it from a copy
+    // large enough for the largest record size.
+    size_t headerSize = min(file->getSize(), (size_t) DE405RecordSize * sizeof(double) * 2);
+    istringstream in(string(file->getData(), headerSize));
+
+    JPLEphemeris* eph = loadHeader(in);
+    if (eph == NULL)
+    {
+        delete file;
+        return NULL;
+    }
+
+    // Make sure that the file is large enough for all the records
+    size_t recordBytes = eph->recordSize * sizeof(double);
+    if (file->getSize() < (size_t) (eph->nRecords + 2) * recordBytes)
+    {
+        delete file;
+        delete eph;
+        return NULL;
+    }
+
+    eph->mappedFile = file;
+    eph->cacheMutex = NewMutex();
+
+    return eph;
+}
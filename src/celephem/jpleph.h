@@ -14,8 +14,11 @@
 #define _CELENGINE_JPLEPH_H_
 
 #include <iostream>
+#include <string>
 #include <vector>
 #include <Eigen/Core>
+#include <celutil/mappedfile.h>
+#include <celutil/thread.h>
 
 enum JPLEphemItem
 {
@@ -66,13 +69,32 @@ public:
 
     Eigen::Vector3d getPlanetPosition(JPLEphemItem, double t) const;
 
+    // Read the complete ephemeris from a stream
     static JPLEphemeris* load(std::istream&);
 
+    // Memory map an ephemeris file. Records are read and decoded only when
+    // they're needed, and a few recently used records are kept decoded.
+    // Falls back to reading the complete file if it can't be mapped.
+    static JPLEphemeris* load(const std::string& filename);
+
     unsigned int getDENumber() const;
     double getStartDate() const;
     double getEndDate() const;
 
 private:
+    struct CachedRecord
+    {
+        unsigned int recNo;
+        unsigned int lastUsed;
+        double t0;
+        std::vector<double> coeffs;
+    };
+
+    static JPLEphemeris* loadHeader(std::istream&);
+    Eigen::Vector3d evaluate(JPLEphemItem, double t,
+                             double t0, const double* coeffs) const;
+    const CachedRecord& getMappedRecord(unsigned int recNo) const;
+
     JPLEphCoeffInfo coeffInfo[JPLEph_NItems];
     JPLEphCoeffInfo librationCoeffInfo;
 
@@ -85,8 +107,17 @@ private:
 
     unsigned int DENum;       // ephemeris version
     unsigned int recordSize;  // number of doubles per record
+    unsigned int nRecords;
 
     std::vector<JPLEphRecord> records;
+
+    // When the ephemeris is memory mapped, records holds nothing and the
+    // records are decoded from the mapped file into a small LRU cache.
+    MappedFile* mappedFile;
+    Mutex* cacheMutex;
+    mutable std::vector<CachedRecord> recordCache;
+    mutable unsigned int cacheTicks;
+    mutable unsigned int lastCacheEntry;
 };
 
 #endif // _CELENGINE_JPLEPH_H_
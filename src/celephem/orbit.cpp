@@ -13,6 +13,7 @@
 #include <celmath/mathlib.h>
 #include <celmath/solve.h>
 #include <celmath/geomutil.h>
+#include <celmath/sse2math.h>
 #include <functional>
 #include <algorithm>
 #include <cmath>
@@ -37,13 +38,21 @@ static Vector3d cubicInterpolate(const Vector3d& p0, const Vector3d& v0,
 }
 
 
+void Orbit::positionsAtTimes(const double* tdb,
+                             Vector3d* positions,
+                             unsigned int count) const
+{
+    for (unsigned int i = 0; i < count; i++)
+        positions[i] = positionAtTime(tdb[i]);
+}
+
+
 /** Sample the orbit over the time range [ startTime, endTime ] using the
   * default sampling parameters for the orbit type.
   *
   * Subclasses of orbit should override this method as necessary. The default
   * implementation uses an adaptive sampling scheme with the following defaults:
   *    tolerance: 1 km
-  *    start step: T / 1e5
   *    min step: T / 1e7
   *    max step: T / 100
   *
@@ -76,22 +85,33 @@ void Orbit::sample(double startTime, double endTime, OrbitSampleProc& proc) cons
     samplingParams.tolerance = 1.0; // kilometers
     samplingParams.maxStep = span / 100.0;
     samplingParams.minStep = span / 1.0e7;
-    samplingParams.startStep = span / 1.0e5;
 
     adaptiveSample(startTime, endTime, proc, samplingParams);
 }
 
 
-/** Adaptively sample the orbit over the range [ startTime, endTime ].
+/** Adaptively sample the orbit over the range [ startTime, endTime ]. The
+  * error of each step is measured as the distance between the orbit and
+  * the cubic Hermite curve through the step's end points--the curve drawn
+  * between two samples--at the middle of the step. Since the error grows
+  * as the fourth power of the step size, each measurement predicts the
+  * largest step that will stay within the tolerance; steps that exceed
+  * the tolerance are retried at the predicted size. This needs only a few
+  * more position and velocity calculations than there are samples.
   */
 void Orbit::adaptiveSample(double startTime, double endTime, OrbitSampleProc& proc, const AdaptiveSamplingParameters& samplingParams) const
 {
-    double startStepSize = samplingParams.startStep;
     double maxStepSize   = samplingParams.maxStep;
     double minStepSize   = samplingParams.minStep;
     double tolerance     = samplingParams.tolerance;
     double t = startTime;
-    const double stepFactor = 1.25;
+
+    // Steps are made a bit smaller than predicted so that few are rejected,
+    // and the step may grow by at most a factor of two from one sample to
+    // the next.
+    const double safetyFactor = 0.9;
+    const double maxGrowth = 2.0;
+    const double minShrink = 0.2;
 
     Vector3d lastP = positionAtTime(t);
     Vector3d lastV = velocityAtTime(t);
@@ -99,65 +119,28 @@ void Orbit::adaptiveSample(double startTime, double endTime, OrbitSampleProc& pr
     int sampCount = 0;
     int nTests = 0;
 
-    while (t < endTime)
+    double dt = maxStepSize;
+    while (t < endTime && maxStepSize > 0.0)
     {
         // Make sure that we don't go past the end of the sample interval
-        maxStepSize = min(maxStepSize, endTime - t);
-        double dt = min(maxStepSize, startStepSize * 2.0);
+        dt = min(dt, min(maxStepSize, endTime - t));
 
         Vector3d p1 = positionAtTime(t + dt);
         Vector3d v1 = velocityAtTime(t + dt);
-
-        double tmid = t + dt / 2.0;
-        Vector3d pTest = positionAtTime(tmid);
+        Vector3d pTest = positionAtTime(t + dt / 2.0);
         Vector3d pInterp = cubicInterpolate(lastP, lastV * dt,
                                             p1, v1 * dt,
                                             0.5);
         nTests++;
 
         double positionError = (pInterp - pTest).norm();
+        double scale = positionError > 0.0 ? safetyFactor * pow(tolerance / positionError, 0.25) : maxGrowth;
 
-        // Error is greater than tolerance; decrease the step until the
-        // error is within the tolerance.
-        if (positionError > tolerance)
+        if (positionError > tolerance && dt > minStepSize)
         {
-            while (positionError > tolerance && dt > minStepSize)
-            {
-                dt /= stepFactor;
-
-                p1 = positionAtTime(t + dt);
-                v1 = velocityAtTime(t + dt);
-
-                tmid = t + dt / 2.0;
-                pTest = positionAtTime(tmid);
-                pInterp = cubicInterpolate(lastP, lastV * dt,
-                                           p1, v1 * dt,
-                                           0.5);
-                nTests++;
-
-                positionError = (pInterp - pTest).norm();
-            }
-        }
-        else
-        {
-            // Error is less than the tolerance; increase the step size until the
-            // tolerance is just exceeded.
-            while (positionError < tolerance && dt < maxStepSize)
-            {
-                dt *= stepFactor;
-
-                p1 = positionAtTime(t + dt);
-                v1 = velocityAtTime(t + dt);
-
-                tmid = t + dt / 2.0;
-                pTest = positionAtTime(tmid);
-                pInterp = cubicInterpolate(lastP, lastV * dt,
-                                           p1, v1 * dt,
-                                           0.5);
-                nTests++;
-
-                positionError = (pInterp - pTest).norm();
-            }
+            // Retry with the step that's predicted to meet the tolerance
+            dt = max(minStepSize, dt * max(scale, minShrink));
+            continue;
         }
 
         t = t + dt;
@@ -166,6 +149,10 @@ void Orbit::adaptiveSample(double startTime, double endTime, OrbitSampleProc& pr
 
         proc.sample(t, lastP, lastV);
         sampCount++;
+
+        // A step at the minimum size is accepted even if it exceeds the
+        // tolerance; don't let the next one shrink below the minimum.
+        dt = max(minStepSize, dt * max(minShrink, min(scale, maxGrowth)));
     }
 
     // Statistics for debugging
@@ -173,6 +160,112 @@ void Orbit::adaptiveSample(double startTime, double endTime, OrbitSampleProc& pr
 }
 
 
+// Longest run of samples that may be replaced by a single curve; this
+// bounds the work done for each sample.
+static const unsigned int MaxDecimatedRun = 64;
+
+
+// Evaluate the cubic Hermite curve between two samples at time t
+static Vector3d hermiteAtTime(double t0, const Vector3d& p0, const Vector3d& v0,
+                              double t1, const Vector3d& p1, const Vector3d& v1,
+                              double t)
+{
+    double dt = t1 - t0;
+    return cubicInterpolate(p0, v0 * dt, p1, v1 * dt, (t - t0) / dt);
+}
+
+
+OrbitSampleDecimator::OrbitSampleDecimator(OrbitSampleProc& _proc, double _tolerance) :
+    proc(_proc),
+    tolerance(_tolerance),
+    started(false)
+{
+}
+
+
+void OrbitSampleDecimator::sample(double t, const Vector3d& position, const Vector3d& velocity)
+{
+    const Sample& last = pending.empty() ? anchor : pending.back();
+    if (started && t <= last.t)
+        return;
+
+    Sample s;
+    s.t = t;
+    s.position = position;
+    s.velocity = velocity;
+
+    if (!started)
+    {
+        s.midTime = t;
+        s.midPosition = position;
+        anchor = s;
+        started = true;
+        proc.sample(t, position, velocity);
+        return;
+    }
+
+    s.midTime = (last.t + t) * 0.5;
+    s.midPosition = hermiteAtTime(last.t, last.position, last.velocity,
+                                  t, position, velocity, s.midTime);
+
+    // Extend the current run if a curve from the anchor to the new sample
+    // still follows all of the samples in it; otherwise, keep the last
+    // sample of the run and start a new run there.
+    if (!pending.empty() && (pending.size() >= MaxDecimatedRun || !canSkipPending(s)))
+    {
+        anchor = pending.back();
+        pending.clear();
+        proc.sample(anchor.t, anchor.position, anchor.velocity);
+    }
+
+    pending.push_back(s);
+}
+
+
+/*! Pass on the last sample; the decimator may then be reused for another
+ *  set of samples.
+ */
+void OrbitSampleDecimator::finish()
+{
+    if (!pending.empty())
+    {
+        const Sample& last = pending.back();
+        proc.sample(last.t, last.position, last.velocity);
+        pending.clear();
+    }
+
+    started = false;
+}
+
+
+// Return true if the curve from the anchor to next stays within the
+// tolerance of all the pending samples, and of the points midway between
+// them.
+bool OrbitSampleDecimator::canSkipPending(const Sample& next) const
+{
+    for (unsigned int i = 0; i <= pending.size(); i++)
+    {
+        const Sample& s = i < pending.size() ? pending[i] : next;
+        Vector3d p = hermiteAtTime(anchor.t, anchor.position, anchor.velocity,
+                                   next.t, next.position, next.velocity,
+                                   s.midTime);
+        if ((p - s.midPosition).squaredNorm() > tolerance * tolerance)
+            return false;
+
+        if (i < pending.size())
+        {
+            p = hermiteAtTime(anchor.t, anchor.position, anchor.velocity,
+                              next.t, next.position, next.velocity,
+                              s.t);
+            if ((p - s.position).squaredNorm() > tolerance * tolerance)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+
 EllipticalOrbit::EllipticalOrbit(double _pericenterDistance,
                                  double _eccentricity,
                                  double _inclination,
@@ -277,60 +370,102 @@ Vector3d Orbit::velocityAtTime(double tdb) const
 }
 
 
-double EllipticalOrbit::eccentricAnomaly(double M) const
+// The Kepler's equation solvers, in order of increasing eccentricity
+enum KeplerSolver
+{
+    CircularSolver,
+    LowEccentricitySolver,
+    HighEccentricitySolver,
+    LaguerreConwaySolver,
+    ParabolicSolver,
+    HyperbolicSolver
+};
+
+
+static KeplerSolver keplerSolver(double eccentricity)
 {
     if (eccentricity == 0.0)
-    {
-        // Circular orbit
-        return M;
-    }
+        return CircularSolver;
     else if (eccentricity < 0.2)
-    {
-        // Low eccentricity, so use the standard iteration technique
-        Solution sol = solve_iteration_fixed(SolveKeplerFunc1(eccentricity, M), M, 5);
-        return sol.first;
-    }
+        return LowEccentricitySolver;
     else if (eccentricity < 0.9)
-    {
-        // Higher eccentricity elliptical orbit; use a more complex but
-        // much faster converging iteration.
-        Solution sol = solve_iteration_fixed(SolveKeplerFunc2(eccentricity, M), M, 6);
-        // Debugging
-        // printf("ecc: %f, error: %f mas\n",
-        //        eccentricity, radToDeg(sol.second) * 3600000);
-        return sol.first;
-    }
+        return HighEccentricitySolver;
     else if (eccentricity < 1.0)
-    {
-        // Extremely stable Laguerre-Conway method for solving Kepler's
-        // equation.  Only use this for high-eccentricity orbits, as it
-        // requires more calcuation.
-        double E = M + 0.85 * eccentricity * sign(sin(M));
-        Solution sol = solve_iteration_fixed(SolveKeplerLaguerreConway(eccentricity, M), E, 8);
-        return sol.first;
-    }
+        return LaguerreConwaySolver;
     else if (eccentricity == 1.0)
+        return ParabolicSolver;
+    else
+        return HyperbolicSolver;
+}
+
+
+// Solve Kepler's equation for the eccentric anomaly, given the mean anomaly
+// M. A different solver is used depending on the eccentricity.
+static double solveKepler(double eccentricity, double M)
+{
+    switch (keplerSolver(eccentricity))
     {
+    case CircularSolver:
+        // Circular orbit
+        return M;
+
+    case LowEccentricitySolver:
+        {
+            // Low eccentricity, so use the standard iteration technique
+            Solution sol = solve_iteration_fixed(SolveKeplerFunc1(eccentricity, M), M, 5);
+            return sol.first;
+        }
+
+    case HighEccentricitySolver:
+        {
+            // Higher eccentricity elliptical orbit; use a more complex but
+            // much faster converging iteration.
+            Solution sol = solve_iteration_fixed(SolveKeplerFunc2(eccentricity, M), M, 6);
+            // Debugging
+            // printf("ecc: %f, error: %f mas\n",
+            //        eccentricity, radToDeg(sol.second) * 3600000);
+            return sol.first;
+        }
+
+    case LaguerreConwaySolver:
+        {
+            // Extremely stable Laguerre-Conway method for solving Kepler's
+            // equation.  Only use this for high-eccentricity orbits, as it
+            // requires more calcuation.
+            double E = M + 0.85 * eccentricity * sign(sin(M));
+            Solution sol = solve_iteration_fixed(SolveKeplerLaguerreConway(eccentricity, M), E, 8);
+            return sol.first;
+        }
+
+    case ParabolicSolver:
         // Nearly parabolic orbit; very common for comets
         // TODO: handle this
         return M;
-    }
-    else
-    {
-        // Laguerre-Conway method for hyperbolic (ecc > 1) orbits.
-        double E = log(2 * M / eccentricity + 1.85);
-        Solution sol = solve_iteration_fixed(SolveKeplerLaguerreConwayHyp(eccentricity, M), E, 30);
-        return sol.first;
+
+    default:
+        {
+            // Laguerre-Conway method for hyperbolic (ecc > 1) orbits.
+            double E = log(2 * M / eccentricity + 1.85);
+            Solution sol = solve_iteration_fixed(SolveKeplerLaguerreConwayHyp(eccentricity, M), E, 30);
+            return sol.first;
+        }
     }
 }
 
 
-// Compute the position at the specified eccentric
-// anomaly E.
-Vector3d EllipticalOrbit::positionAtE(double E) const
+double EllipticalOrbit::eccentricAnomaly(double M) const
 {
-    double x, y;
+    return solveKepler(eccentricity, M);
+}
+
 
+// Compute the position in the orbit plane at the specified eccentric
+// anomaly E.
+static void orbitPlanePosition(double pericenterDistance,
+                               double eccentricity,
+                               double E,
+                               double& x, double& y)
+{
     if (eccentricity < 1.0)
     {
         double a = pericenterDistance / (1.0 - eccentricity);
@@ -349,6 +484,15 @@ Vector3d EllipticalOrbit::positionAtE(double E) const
         x = 0.0;
         y = 0.0;
     }
+}
+
+
+// Compute the position at the specified eccentric
+// anomaly E.
+Vector3d EllipticalOrbit::positionAtE(double E) const
+{
+    double x, y;
+    orbitPlanePosition(pericenterDistance, eccentricity, E, x, y);
 
     Vector3d p = orbitPlaneRotation * Vector3d(x, y, 0);
 
@@ -432,6 +576,273 @@ double EllipticalOrbit::getBoundingRadius() const
 }
 
 
+void EllipticalOrbitArray::clear()
+{
+    pericenterDistance.clear();
+    eccentricity.clear();
+    meanAnomalyAtEpoch.clear();
+    meanMotion.clear();
+    epoch.clear();
+    rotation.clear();
+}
+
+
+void EllipticalOrbitArray::add(const EllipticalOrbit& orbit)
+{
+    pericenterDistance.push_back(orbit.pericenterDistance);
+    eccentricity.push_back(orbit.eccentricity);
+    meanAnomalyAtEpoch.push_back(orbit.meanAnomalyAtEpoch);
+    meanMotion.push_back(2.0 * PI / orbit.period);
+    epoch.push_back(orbit.epoch);
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 3; j++)
+            rotation.push_back(orbit.orbitPlaneRotation(i, j));
+    }
+}
+
+
+// Compute the position of orbit i at time tdb; this is the same calculation
+// as EllipticalOrbit::positionAtTime().
+Vector3d EllipticalOrbitArray::positionAtTime(double tdb, unsigned int i) const
+{
+    double meanAnomaly = meanAnomalyAtEpoch[i] + (tdb - epoch[i]) * meanMotion[i];
+    double E = solveKepler(eccentricity[i], meanAnomaly);
+
+    double x, y;
+    orbitPlanePosition(pericenterDistance[i], eccentricity[i], E, x, y);
+
+    // Rotate into the reference plane, and convert to Celestia's
+    // coordinate system. The terms are summed in the same order as
+    // in EllipticalOrbit::positionAtE().
+    const double* r = &rotation[i * 9];
+    double px = r[0] * x + r[1] * y + r[2] * 0.0;
+    double py = r[3] * x + r[4] * y + r[5] * 0.0;
+    double pz = r[6] * x + r[7] * y + r[8] * 0.0;
+
+    return Vector3d(px, pz, -py);
+}
+
+
+#ifdef CELMATH_SSE2
+
+// Mean anomalies larger than this are beyond the range of sinCosPD(); they
+// only occur for orbits evaluated very far from their epochs.
+static const double MaxVectorMeanAnomaly = 1.0e8;
+
+
+static inline __m128d signPD(__m128d x)
+{
+    __m128d zero = _mm_setzero_pd();
+    return _mm_or_pd(_mm_and_pd(_mm_cmpgt_pd(x, zero), _mm_set1_pd(1.0)),
+                     _mm_and_pd(_mm_cmplt_pd(x, zero), _mm_set1_pd(-1.0)));
+}
+
+
+// Solve Kepler's equation for two orbits that use the same solver. The
+// iterations are the same as the ones in solveKepler().
+static __m128d solveKeplerPD(KeplerSolver solver, __m128d ecc, __m128d M)
+{
+    __m128d x = M;
+    __m128d s, c;
+
+    switch (solver)
+    {
+    case LowEccentricitySolver:
+        for (int i = 0; i < 5; i++)
+            x = _mm_add_pd(M, _mm_mul_pd(ecc, sinPD(x)));
+        break;
+
+    case HighEccentricitySolver:
+        for (int i = 0; i < 6; i++)
+        {
+            sinCosPD(x, s, c);
+            x = _mm_add_pd(x, _mm_div_pd(_mm_sub_pd(_mm_add_pd(M, _mm_mul_pd(ecc, s)), x),
+                                         _mm_sub_pd(_mm_set1_pd(1.0), _mm_mul_pd(ecc, c))));
+        }
+        break;
+
+    case LaguerreConwaySolver:
+        x = _mm_add_pd(M, _mm_mul_pd(_mm_mul_pd(_mm_set1_pd(0.85), ecc), signPD(sinPD(M))));
+        for (int i = 0; i < 8; i++)
+        {
+            sinCosPD(x, s, c);
+            s = _mm_mul_pd(ecc, s);
+            c = _mm_mul_pd(ecc, c);
+            __m128d f = _mm_sub_pd(_mm_sub_pd(x, s), M);
+            __m128d f1 = _mm_sub_pd(_mm_set1_pd(1.0), c);
+            __m128d f2 = s;
+            __m128d d = _mm_sub_pd(_mm_mul_pd(_mm_mul_pd(_mm_set1_pd(16.0), f1), f1),
+                                   _mm_mul_pd(_mm_mul_pd(_mm_set1_pd(20.0), f), f2));
+            d = _mm_sqrt_pd(_mm_andnot_pd(_mm_set1_pd(-0.0), d));
+            x = _mm_add_pd(x, _mm_div_pd(_mm_mul_pd(_mm_set1_pd(-5.0), f),
+                                         _mm_add_pd(f1, _mm_mul_pd(signPD(f1), d))));
+        }
+        break;
+
+    case HyperbolicSolver:
+        {
+            double m[2];
+            double e[2];
+            _mm_storeu_pd(m, M);
+            _mm_storeu_pd(e, ecc);
+            x = _mm_set_pd(log(2 * m[1] / e[1] + 1.85), log(2 * m[0] / e[0] + 1.85));
+        }
+        for (int i = 0; i < 30; i++)
+        {
+            __m128d ex = expPD(x);
+            __m128d invEx = _mm_div_pd(_mm_set1_pd(1.0), ex);
+            s = _mm_mul_pd(ecc, _mm_mul_pd(_mm_set1_pd(0.5), _mm_sub_pd(ex, invEx)));
+            c = _mm_mul_pd(ecc, _mm_mul_pd(_mm_set1_pd(0.5), _mm_add_pd(ex, invEx)));
+            __m128d f = _mm_sub_pd(_mm_sub_pd(s, x), M);
+            __m128d f1 = _mm_sub_pd(c, _mm_set1_pd(1.0));
+            __m128d f2 = s;
+            __m128d d = _mm_sub_pd(_mm_mul_pd(_mm_mul_pd(_mm_set1_pd(16.0), f1), f1),
+                                   _mm_mul_pd(_mm_mul_pd(_mm_set1_pd(20.0), f), f2));
+            d = _mm_sqrt_pd(_mm_andnot_pd(_mm_set1_pd(-0.0), d));
+            x = _mm_add_pd(x, _mm_div_pd(_mm_mul_pd(_mm_set1_pd(-5.0), f),
+                                         _mm_add_pd(f1, _mm_mul_pd(signPD(f1), d))));
+        }
+        break;
+
+    default:
+        // Circular orbits
+        break;
+    }
+
+    return x;
+}
+
+
+/* Compute the positions of orbits i and j together. Return false without
+ * computing anything if the orbits use different solvers or their mean
+ * anomalies are out of range of the vector functions.
+ */
+bool EllipticalOrbitArray::positionPairAtTime(double tdb,
+                                              unsigned int i,
+                                              unsigned int j,
+                                              Vector3d& pi,
+                                              Vector3d& pj) const
+{
+    KeplerSolver solver = keplerSolver(eccentricity[i]);
+    if (solver != keplerSolver(eccentricity[j]) || solver == ParabolicSolver)
+        return false;
+
+    __m128d ecc = _mm_set_pd(eccentricity[j], eccentricity[i]);
+    __m128d M = _mm_add_pd(_mm_set_pd(meanAnomalyAtEpoch[j], meanAnomalyAtEpoch[i]),
+                           _mm_mul_pd(_mm_sub_pd(_mm_set1_pd(tdb), _mm_set_pd(epoch[j], epoch[i])),
+                                      _mm_set_pd(meanMotion[j], meanMotion[i])));
+    __m128d absM = _mm_andnot_pd(_mm_set1_pd(-0.0), M);
+    if (_mm_movemask_pd(_mm_cmplt_pd(absM, _mm_set1_pd(MaxVectorMeanAnomaly))) != 3)
+        return false;
+
+    __m128d E = solveKeplerPD(solver, ecc, M);
+
+    // Position in the orbit plane, as in orbitPlanePosition()
+    __m128d a = _mm_div_pd(_mm_set_pd(pericenterDistance[j], pericenterDistance[i]),
+                           _mm_sub_pd(_mm_set1_pd(1.0), ecc));
+    double x[2];
+    double y[2];
+    if (solver == HyperbolicSolver)
+    {
+        __m128d ex = expPD(E);
+        __m128d invEx = _mm_div_pd(_mm_set1_pd(1.0), ex);
+        __m128d sinhE = _mm_mul_pd(_mm_set1_pd(0.5), _mm_sub_pd(ex, invEx));
+        __m128d coshE = _mm_mul_pd(_mm_set1_pd(0.5), _mm_add_pd(ex, invEx));
+        __m128d minusA = _mm_xor_pd(a, _mm_set1_pd(-0.0));
+        __m128d b = _mm_mul_pd(minusA, _mm_sqrt_pd(_mm_sub_pd(_mm_mul_pd(ecc, ecc), _mm_set1_pd(1.0))));
+        _mm_storeu_pd(x, _mm_mul_pd(minusA, _mm_sub_pd(ecc, coshE)));
+        _mm_storeu_pd(y, _mm_mul_pd(b, sinhE));
+    }
+    else
+    {
+        __m128d sinE, cosE;
+        sinCosPD(E, sinE, cosE);
+        __m128d b = _mm_mul_pd(a, _mm_sqrt_pd(_mm_sub_pd(_mm_set1_pd(1.0), _mm_mul_pd(ecc, ecc))));
+        _mm_storeu_pd(x, _mm_mul_pd(a, _mm_sub_pd(cosE, ecc)));
+        _mm_storeu_pd(y, _mm_mul_pd(b, sinE));
+    }
+
+    Vector3d* p[2] = { &pi, &pj };
+    unsigned int index[2] = { i, j };
+    for (unsigned int k = 0; k < 2; k++)
+    {
+        const double* r = &rotation[index[k] * 9];
+        double px = r[0] * x[k] + r[1] * y[k] + r[2] * 0.0;
+        double py = r[3] * x[k] + r[4] * y[k] + r[5] * 0.0;
+        double pz = r[6] * x[k] + r[7] * y[k] + r[8] * 0.0;
+        *p[k] = Vector3d(px, pz, -py);
+    }
+
+    return true;
+}
+
+#endif // CELMATH_SSE2
+
+
+void EllipticalOrbitArray::positionsAtTime(double tdb,
+                                           Vector3d* positions,
+                                           unsigned int first,
+                                           unsigned int count) const
+{
+    assert(first + count <= size());
+
+    unsigned int end = first + count;
+    unsigned int i = first;
+
+#ifdef CELMATH_SSE2
+    // Pairs of orbits that use the same solver are computed together;
+    // everything else falls through to the scalar code.
+    while (i + 1 < end)
+    {
+        if (positionPairAtTime(tdb, i, i + 1, positions[i - first], positions[i + 1 - first]))
+        {
+            i += 2;
+        }
+        else
+        {
+            positions[i - first] = positionAtTime(tdb, i);
+            i++;
+        }
+    }
+#endif
+
+    for (; i < end; i++)
+        positions[i - first] = positionAtTime(tdb, i);
+}
+
+
+void EllipticalOrbitArray::indexedPositionsAtTime(double tdb,
+                                                  Vector3d* positions,
+                                                  const unsigned int* indices,
+                                                  unsigned int count) const
+{
+    unsigned int i = 0;
+
+#ifdef CELMATH_SSE2
+    while (i + 1 < count)
+    {
+        assert(indices[i] < size() && indices[i + 1] < size());
+        if (positionPairAtTime(tdb, indices[i], indices[i + 1], positions[i], positions[i + 1]))
+        {
+            i += 2;
+        }
+        else
+        {
+            positions[i] = positionAtTime(tdb, indices[i]);
+            i++;
+        }
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        assert(indices[i] < size());
+        positions[i] = positionAtTime(tdb, indices[i]);
+    }
+}
+
+
 
 
 CachingOrbit::CachingOrbit() :
@@ -621,6 +1032,38 @@ Vector3d MixedOrbit::velocityAtTime(double jd) const
 }
 
 
+// Return the orbit used to compute positions at the specified time
+const Orbit* MixedOrbit::orbitAtTime(double jd) const
+{
+    if (jd < begin)
+        return beforeApprox;
+    else if (jd < end)
+        return primary;
+    else
+        return afterApprox;
+}
+
+
+void MixedOrbit::positionsAtTimes(const double* tdb,
+                                  Vector3d* positions,
+                                  unsigned int count) const
+{
+    // Pass each run of times that fall within the span of a single orbit
+    // on to that orbit as a batch.
+    unsigned int first = 0;
+    while (first < count)
+    {
+        const Orbit* o = orbitAtTime(tdb[first]);
+        unsigned int last = first + 1;
+        while (last < count && orbitAtTime(tdb[last]) == o)
+            last++;
+
+        o->positionsAtTimes(tdb + first, positions + first, last - first);
+        first = last;
+    }
+}
+
+
 double MixedOrbit::getPeriod() const
 {
     return primary->getPeriod();
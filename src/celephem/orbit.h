@@ -10,10 +10,12 @@
 #ifndef _CELENGINE_ORBIT_H_
 #define _CELENGINE_ORBIT_H_
 
+#include <vector>
 #include <Eigen/Core>
 
 
 class OrbitSampleProc;
+class EllipticalOrbit;
 
 class Orbit
 {
@@ -32,6 +34,15 @@ class Orbit
      */
     virtual Eigen::Vector3d velocityAtTime(double) const;
 
+    /*! Compute the positions at count times (TDB), storing them in the
+     * positions array. Orbits that are expensive to evaluate may override
+     * this to process the whole batch at once; the default implementation
+     * calls positionAtTime() for each time.
+     */
+    virtual void positionsAtTimes(const double* tdb,
+                                  Eigen::Vector3d* positions,
+                                  unsigned int count) const;
+
     virtual double getPeriod() const = 0;
     virtual double getBoundingRadius() const = 0;
 
@@ -39,6 +50,12 @@ class Orbit
 
     virtual bool isPeriodic() const { return true; };
 
+    /*! Return the orbit as an EllipticalOrbit if it is one, so that callers
+     *  with many orbits to evaluate can batch the elliptical ones in an
+     *  EllipticalOrbitArray.
+     */
+    virtual const EllipticalOrbit* getEllipticalOrbit() const { return NULL; };
+
     // Return the time range over which the orbit is valid; if the orbit
     // is always valid, begin and end should be equal.
     virtual void getValidRange(double& begin, double& end) const
@@ -47,7 +64,6 @@ class Orbit
     struct AdaptiveSamplingParameters
     {
         double tolerance;
-        double startStep;
         double minStep;
         double maxStep;
     };
@@ -68,6 +84,9 @@ class EllipticalOrbit : public Orbit
     virtual Eigen::Vector3d velocityAtTime(double) const;
     double getPeriod() const;
     double getBoundingRadius() const;
+    double getEccentricity() const { return eccentricity; };
+
+    virtual const EllipticalOrbit* getEllipticalOrbit() const { return this; };
 
  private:
     double eccentricAnomaly(double) const;
@@ -84,6 +103,66 @@ class EllipticalOrbit : public Orbit
     double epoch;
 
     Eigen::Matrix3d orbitPlaneRotation;
+
+    friend class EllipticalOrbitArray;
+};
+
+
+/*! A set of elliptical and hyperbolic orbits with their elements stored as
+ *  structure of arrays. Positions for all of the orbits at one time are
+ *  computed in a single pass without virtual calls. Where SSE2 is available,
+ *  adjacent orbits that use the same Kepler equation solver are computed
+ *  two at a time, so orbits should be added in order of eccentricity; the
+ *  positions then differ from EllipticalOrbit::positionAtTime() only by
+ *  rounding in the trigonometric and hyperbolic functions.
+ */
+class EllipticalOrbitArray
+{
+ public:
+    EllipticalOrbitArray() {};
+
+    void clear();
+    void add(const EllipticalOrbit& orbit);
+
+    unsigned int size() const
+    {
+        return eccentricity.size();
+    }
+
+    /*! Compute the positions at time tdb of count orbits starting with
+     *  the orbit at index first.
+     */
+    void positionsAtTime(double tdb,
+                         Eigen::Vector3d* positions,
+                         unsigned int first,
+                         unsigned int count) const;
+
+    /*! Compute the positions at time tdb of the count orbits with the
+     *  specified indices. Indices should be in increasing order, so that
+     *  adjacent orbits are likely to use the same solver.
+     */
+    void indexedPositionsAtTime(double tdb,
+                                Eigen::Vector3d* positions,
+                                const unsigned int* indices,
+                                unsigned int count) const;
+
+ private:
+    Eigen::Vector3d positionAtTime(double tdb, unsigned int i) const;
+    bool positionPairAtTime(double tdb,
+                            unsigned int i,
+                            unsigned int j,
+                            Eigen::Vector3d& pi,
+                            Eigen::Vector3d& pj) const;
+
+    std::vector<double> pericenterDistance;
+    std::vector<double> eccentricity;
+    std::vector<double> meanAnomalyAtEpoch;
+    std::vector<double> meanMotion;
+    std::vector<double> epoch;
+
+    // Orbit plane rotation matrices, nine elements per orbit in row
+    // major order
+    std::vector<double> rotation;
 };
 
 
@@ -96,6 +175,45 @@ class OrbitSampleProc
 };
 
 
+/*! An OrbitSampleProc that passes on to another proc only the samples
+ *  needed to follow the path within a tolerance. A sample is dropped when
+ *  the cubic Hermite curve between the samples kept on either side of it
+ *  stays within the tolerance of the curve through all of the samples.
+ *  This thins densely sampled trajectories, which are otherwise plotted
+ *  with every one of their samples. Samples must arrive in order of
+ *  increasing time, and finish() must be called after the last one.
+ */
+class OrbitSampleDecimator : public OrbitSampleProc
+{
+ public:
+    OrbitSampleDecimator(OrbitSampleProc& _proc, double _tolerance);
+
+    void sample(double t, const Eigen::Vector3d& position, const Eigen::Vector3d& velocity);
+    void finish();
+
+ private:
+    struct Sample
+    {
+        double t;
+        Eigen::Vector3d position;
+        Eigen::Vector3d velocity;
+
+        // Point halfway between this sample and the one before it on
+        // the curve through all of the samples
+        double midTime;
+        Eigen::Vector3d midPosition;
+    };
+
+    bool canSkipPending(const Sample& next) const;
+
+    OrbitSampleProc& proc;
+    double tolerance;
+    bool started;
+    Sample anchor;
+    std::vector<Sample> pending;
+};
+
+
 
 /*! Custom orbit classes should be derived from CachingOrbit.  The custom
  * orbits can be expensive to compute, with more than 50 periodic terms.
@@ -141,10 +259,16 @@ class MixedOrbit : public Orbit
 
     virtual Eigen::Vector3d positionAtTime(double jd) const;
     virtual Eigen::Vector3d velocityAtTime(double jd) const;
+    virtual void positionsAtTimes(const double* tdb,
+                                  Eigen::Vector3d* positions,
+                                  unsigned int count) const;
     virtual double getPeriod() const;
     virtual double getBoundingRadius() const;
     virtual void sample(double startTime, double endTime, OrbitSampleProc& proc) const;
 
+ private:
+    const Orbit* orbitAtTime(double jd) const;
+
  private:
     Orbit* primary;
     EllipticalOrbit* afterApprox;
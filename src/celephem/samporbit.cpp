@@ -14,7 +14,11 @@
 #include "samporbit.h"
 #include <celengine/astro.h>
 #include <celmath/mathlib.h>
+#include <celutil/basictypes.h>
+#include <celutil/bytes.h>
+#include <celutil/mappedfile.h>
 #include <cmath>
+#include <cstring>
 #include <string>
 #include <algorithm>
 #include <vector>
@@ -60,13 +64,316 @@ template <typename T> bool operator<(const SampleXYZV<T>& a, const SampleXYZV<T>
 }
 
 
-template <typename T> class SampledOrbit : public CachingOrbit
+// Index of the samples of a trajectory by time. The time span of the
+// trajectory is divided into equal width buckets, and the index records the
+// first sample in each bucket. Finding the sample interval containing a time
+// then requires only a search through the samples in a single bucket, which
+// for trajectories with roughly even sample spacing is just one or two
+// samples; random access and jumps in time are amortized O(1) rather than
+// O(log n).
+class SampleTimeIndex
+{
+public:
+    SampleTimeIndex() :
+        startTime(0.0),
+        invBucketWidth(0.0)
+    {
+    }
+
+    template <typename SAMPLE> void build(const vector<SAMPLE>& samples)
+    {
+        bucketStart.clear();
+        if (samples.empty())
+            return;
+
+        // One bucket per sample keeps the index small relative to the
+        // samples themselves.
+        int nBuckets = (int) samples.size();
+        double span = samples[samples.size() - 1].t - samples[0].t;
+        startTime = samples[0].t;
+        invBucketWidth = span > 0.0 ? (double) nBuckets / span : 0.0;
+
+        // bucketStart[b] is the number of samples in buckets before b. The
+        // same bucket() function is used here and for lookups so that the
+        // index is consistent with queries despite roundoff.
+        bucketStart.resize(nBuckets + 1, 0);
+        for (unsigned int i = 0; i < samples.size(); i++)
+            bucketStart[bucket(samples[i].t) + 1]++;
+        for (int b = 0; b < nBuckets; b++)
+            bucketStart[b + 1] += bucketStart[b];
+    }
+
+    // Return the index of the first sample with a time not earlier than t,
+    // or samples.size() if there is no such sample; this is the same result
+    // that lower_bound() would produce.
+    template <typename SAMPLE> int find(const vector<SAMPLE>& samples, double t) const
+    {
+        SAMPLE samp;
+        samp.t = t;
+
+        if (bucketStart.size() != samples.size() + 1)
+        {
+            // No index (or a stale one); search all samples
+            return lower_bound(samples.begin(), samples.end(), samp) - samples.begin();
+        }
+
+        // Samples in earlier buckets are all before t, and samples in later
+        // buckets are all after it.
+        int b = bucket(t);
+        return lower_bound(samples.begin() + bucketStart[b],
+                           samples.begin() + bucketStart[b + 1],
+                           samp) - samples.begin();
+    }
+
+private:
+    int bucket(double t) const
+    {
+        int nBuckets = (int) bucketStart.size() - 1;
+        double x = (t - startTime) * invBucketWidth;
+        if (!(x >= 0.0))
+            return 0;
+        else if (x >= (double) nBuckets)
+            return nBuckets - 1;
+        else
+            return (int) x;
+    }
+
+private:
+    double startTime;
+    double invBucketWidth;
+    vector<int> bucketStart;
+};
+
+
+// Samples of a trajectory held in memory, as read from a text trajectory
+// file.
+template <typename SAMPLE> class SampleArray
+{
+public:
+    void add(const SAMPLE& samp)
+    {
+        samples.push_back(samp);
+    }
+
+    void buildTimeIndex()
+    {
+        timeIndex.build(samples);
+    }
+
+    unsigned int size() const
+    {
+        return samples.size();
+    }
+
+    bool empty() const
+    {
+        return samples.empty();
+    }
+
+    const SAMPLE& operator[](int n) const
+    {
+        return samples[n];
+    }
+
+    int find(double t) const
+    {
+        return timeIndex.find(samples, t);
+    }
+
+private:
+    vector<SAMPLE> samples;
+    SampleTimeIndex timeIndex;
+};
+
+
+// Binary trajectory files contain double precision samples in fixed size
+// blocks, followed by an index of the time of the first sample in each
+// block. The file is memory mapped, and samples are decoded as they are
+// accessed; apart from the check of sample times when the file is loaded,
+// only the samples for the times actually used are read. See
+// LoadBinaryTrajectory() for the file layout.
+static const char BinaryTrajectoryFileHeader[] = "CELTRAJ";
+static const uint16 BinaryTrajectoryFileVersion = 0x0100;
+static const unsigned int BinaryTrajectoryHeaderSize = 56;
+
+enum BinaryTrajectorySampleType
+{
+    BinaryTrajectoryXYZ  = 0,
+    BinaryTrajectoryXYZV = 1,
+};
+
+
+static inline double decodeDouble(const char* data)
+{
+    double d;
+    memcpy(&d, data, sizeof d);
+    LE_TO_CPU_DOUBLE(d, d);
+    return d;
+}
+
+
+static void decodeSample(const char* data, Sample<double>& samp)
+{
+    samp.t = decodeDouble(data);
+    samp.x = decodeDouble(data + 8);
+    samp.y = decodeDouble(data + 16);
+    samp.z = decodeDouble(data + 24);
+}
+
+
+// Velocities are stored in km/sec, as in xyzv files, and converted to
+// km/Julian day.
+static void decodeSample(const char* data, SampleXYZV<double>& samp)
+{
+    samp.t = decodeDouble(data);
+    samp.position = Vector3d(decodeDouble(data + 8),
+                             decodeDouble(data + 16),
+                             decodeDouble(data + 24));
+    samp.velocity = Vector3d(decodeDouble(data + 32),
+                             decodeDouble(data + 40),
+                             decodeDouble(data + 48)) * astro::daysToSecs(1.0);
+}
+
+
+// Samples of a trajectory read from a memory mapped binary trajectory file.
+// The time index of blocks is small enough to keep in memory (one entry per
+// block of samples), while the samples themselves stay in the mapped file.
+template <typename SAMPLE> class MappedSampleArray
+{
+public:
+    MappedSampleArray() :
+        file(NULL),
+        sampleData(NULL),
+        recordSize(0),
+        nSamples(0),
+        blockSize(1)
+    {
+    }
+
+    ~MappedSampleArray()
+    {
+        delete file;
+    }
+
+    // The sample array takes ownership of the mapped file.
+    void setData(MappedFile* _file,
+                 const char* _sampleData,
+                 unsigned int _recordSize,
+                 unsigned int _nSamples,
+                 unsigned int _blockSize,
+                 const vector<double>& _blockStartTimes)
+    {
+        file = _file;
+        sampleData = _sampleData;
+        recordSize = _recordSize;
+        nSamples = _nSamples;
+        blockSize = _blockSize;
+        blockStartTimes = _blockStartTimes;
+    }
+
+    unsigned int size() const
+    {
+        return nSamples;
+    }
+
+    bool empty() const
+    {
+        return nSamples == 0;
+    }
+
+    SAMPLE operator[](int n) const
+    {
+        SAMPLE samp;
+        decodeSample(sampleData + (size_t) n * recordSize, samp);
+        return samp;
+    }
+
+    // Return the index of the first sample with a time not earlier than t,
+    // or the sample count if there is no such sample.
+    int find(double t) const
+    {
+        // Samples in blocks starting at or after t are all at or after t,
+        // and blocks starting before t contain at least one sample before
+        // it; the result is thus in the last block that starts before t, or
+        // is the first sample of the next block.
+        unsigned int block = lower_bound(blockStartTimes.begin(), blockStartTimes.end(), t) -
+                             blockStartTimes.begin();
+        unsigned int first = block == 0 ? 0 : (block - 1) * blockSize;
+        unsigned int count = min(block * blockSize, nSamples) - first;
+
+        while (count > 0)
+        {
+            unsigned int half = count / 2;
+            if (decodeDouble(sampleData + (size_t) (first + half) * recordSize) < t)
+            {
+                first += half + 1;
+                count -= half + 1;
+            }
+            else
+            {
+                count = half;
+            }
+        }
+
+        return (int) first;
+    }
+
+private:
+    // Mapped sample arrays may not be copied
+    MappedSampleArray(const MappedSampleArray&);
+    MappedSampleArray& operator=(const MappedSampleArray&);
+
+private:
+    MappedFile* file;
+    const char* sampleData;
+    unsigned int recordSize;
+    unsigned int nSamples;
+    unsigned int blockSize;
+    vector<double> blockStartTimes;
+};
+
+
+// Find the samples needed to plot a trajectory from startTime to endTime:
+// the last sample at or before startTime through the first sample after
+// endTime, so that the plotted path covers the whole span. The range is
+// returned as [first, last); returns false if there are no samples. Only
+// the samples in the range are read, so plotting part of a mapped
+// trajectory doesn't read the rest of the file.
+template <typename SAMPLES> static bool findSampleRange(const SAMPLES& samples,
+                                                        double startTime,
+                                                        double endTime,
+                                                        unsigned int& first,
+                                                        unsigned int& last)
+{
+    if (samples.empty())
+        return false;
+
+    unsigned int n = samples.size();
+    first = (unsigned int) samples.find(startTime);
+    if (first > 0 && (first == n || samples[first].t > startTime))
+        first--;
+
+    last = (unsigned int) samples.find(endTime);
+    while (last < n && samples[last].t <= endTime)
+        last++;
+    if (last < n)
+        last++;
+    last = max(last, first + 1);
+
+    return true;
+}
+
+
+template <typename T, typename SAMPLES = SampleArray<Sample<T> > > class SampledOrbit : public CachingOrbit
 {
 public:
     SampledOrbit(TrajectoryInterpolation);
     virtual ~SampledOrbit();
 
     void addSample(double t, double x, double y, double z);
+    void buildTimeIndex();
+    void setBoundingRadius(double r) { boundingRadius = r; }
+    SAMPLES& getSamples() { return samples; }
     void setPeriod();
 
     double getPeriod() const;
@@ -80,7 +387,7 @@ public:
     virtual void sample(double startTime, double endTime, OrbitSampleProc& proc) const;
 
 private:
-    vector<Sample<T> > samples;
+    SAMPLES samples;
     double boundingRadius;
     double period;
     mutable int lastSample;
@@ -89,7 +396,7 @@ private:
 };
 
 
-template <typename T> SampledOrbit<T>::SampledOrbit(TrajectoryInterpolation _interpolation) :
+template <typename T, typename SAMPLES> SampledOrbit<T, SAMPLES>::SampledOrbit(TrajectoryInterpolation _interpolation) :
     boundingRadius(0.0),
     period(1.0),
     lastSample(0),
@@ -98,12 +405,12 @@ template <typename T> SampledOrbit<T>::SampledOrbit(TrajectoryInterpolation _int
 }
 
 
-template <typename T> SampledOrbit<T>::~SampledOrbit()
+template <typename T, typename SAMPLES> SampledOrbit<T, SAMPLES>::~SampledOrbit()
 {
 }
 
 
-template <typename T> void SampledOrbit<T>::addSample(double t, double x, double y, double z)
+template <typename T, typename SAMPLES> void SampledOrbit<T, SAMPLES>::addSample(double t, double x, double y, double z)
 {
     double r = sqrt(x * x + y * y + z * z);
     if (r > boundingRadius)
@@ -114,29 +421,38 @@ template <typename T> void SampledOrbit<T>::addSample(double t, double x, double
     samp.y = (T) y;
     samp.z = (T) z;
     samp.t = t;
-    samples.insert(samples.end(), samp);
+    samples.add(samp);
 }
 
-template <typename T> double SampledOrbit<T>::getPeriod() const
+
+// Build the index used to find the samples bracketing a time. This should be
+// called after all samples have been added; without an up to date index,
+// lookups fall back to a binary search over the whole trajectory.
+template <typename T, typename SAMPLES> void SampledOrbit<T, SAMPLES>::buildTimeIndex()
+{
+    samples.buildTimeIndex();
+}
+
+template <typename T, typename SAMPLES> double SampledOrbit<T, SAMPLES>::getPeriod() const
 {
     return samples[samples.size() - 1].t - samples[0].t;
 }
 
 
-template <typename T> bool SampledOrbit<T>::isPeriodic() const
+template <typename T, typename SAMPLES> bool SampledOrbit<T, SAMPLES>::isPeriodic() const
 {
     return false;
 }
 
 
-template <typename T> void SampledOrbit<T>::getValidRange(double& begin, double& end) const
+template <typename T, typename SAMPLES> void SampledOrbit<T, SAMPLES>::getValidRange(double& begin, double& end) const
 {
     begin = samples[0].t;
     end = samples[samples.size() - 1].t;
 }
 
 
-template <typename T> double SampledOrbit<T>::getBoundingRadius() const
+template <typename T, typename SAMPLES> double SampledOrbit<T, SAMPLES>::getBoundingRadius() const
 {
     return boundingRadius;
 }
@@ -162,7 +478,7 @@ static Vector3d cubicInterpolateVelocity(const Vector3d& p0, const Vector3d& v0,
 }
 
 
-template <typename T> Vector3d SampledOrbit<T>::computePosition(double jd) const
+template <typename T, typename SAMPLES> Vector3d SampledOrbit<T, SAMPLES>::computePosition(double jd) const
 {
     Vector3d pos;
     if (samples.size() == 0)
@@ -175,20 +491,11 @@ template <typename T> Vector3d SampledOrbit<T>::computePosition(double jd) const
     }
     else
     {
-        Sample<T> samp;
-        samp.t = jd;
         int n = lastSample;
 
         if (n < 1 || n >= (int) samples.size() || jd < samples[n - 1].t || jd > samples[n].t)
         {
-            typename vector<Sample<T> >::const_iterator iter = lower_bound(samples.begin(),
-                                                                           samples.end(),
-                                                                           samp);
-            if (iter == samples.end())
-                n = samples.size();
-            else
-                n = iter - samples.begin();
-
+            n = samples.find(jd);
             lastSample = n;
         }
 
@@ -281,7 +588,7 @@ template <typename T> Vector3d SampledOrbit<T>::computePosition(double jd) const
 }
 
 
-template <typename T> Vector3d SampledOrbit<T>::computeVelocity(double jd) const
+template <typename T, typename SAMPLES> Vector3d SampledOrbit<T, SAMPLES>::computeVelocity(double jd) const
 {
     Vector3d vel;
     if (samples.size() < 2)
@@ -290,19 +597,11 @@ template <typename T> Vector3d SampledOrbit<T>::computeVelocity(double jd) const
     }
     else
     {
-        Sample<T> samp;
-        samp.t = jd;
         int n = lastSample;
 
         if (n < 1 || n >= (int) samples.size() || jd < samples[n - 1].t || jd > samples[n].t)
         {
-            typename vector<Sample<T> >::const_iterator iter = lower_bound(samples.begin(),
-                                                                           samples.end(),
-                                                                           samp);
-            if (iter == samples.end())
-                n = samples.size();
-            else
-                n = iter - samples.begin();
+            n = samples.find(jd);
             lastSample = n;
         }
 
@@ -393,10 +692,14 @@ template <typename T> Vector3d SampledOrbit<T>::computeVelocity(double jd) const
 }
 
 
-template <typename T> void SampledOrbit<T>::sample(double /* startTime */, double /* endTime */,
+template <typename T, typename SAMPLES> void SampledOrbit<T, SAMPLES>::sample(double startTime, double endTime,
                                                    OrbitSampleProc& proc) const
 {
-    for (unsigned int i = 0; i < samples.size(); i++)
+    unsigned int first, last;
+    if (!findSampleRange(samples, startTime, endTime, first, last))
+        return;
+
+    for (unsigned int i = first; i < last; i++)
     {
         Vector3d v;
         Vector3d p(samples[i].x, samples[i].y, samples[i].z);
@@ -430,13 +733,16 @@ template <typename T> void SampledOrbit<T>::sample(double /* startTime */, doubl
 
 
 // Sampled orbit with positions and velocities
-template <typename T> class SampledOrbitXYZV : public CachingOrbit
+template <typename T, typename SAMPLES = SampleArray<SampleXYZV<T> > > class SampledOrbitXYZV : public CachingOrbit
 {
 public:
     SampledOrbitXYZV(TrajectoryInterpolation);
     virtual ~SampledOrbitXYZV();
 
     void addSample(double t, const Vector3d& position, const Vector3d& velocity);
+    void buildTimeIndex();
+    void setBoundingRadius(double r) { boundingRadius = r; }
+    SAMPLES& getSamples() { return samples; }
     void setPeriod();
 
     double getPeriod() const;
@@ -450,7 +756,7 @@ public:
     virtual void sample(double startTime, double endTime, OrbitSampleProc& proc) const;
 
 private:
-    vector<SampleXYZV<T> > samples;
+    SAMPLES samples;
     double boundingRadius;
     double period;
     mutable int lastSample;
@@ -459,7 +765,7 @@ private:
 };
 
 
-template <typename T> SampledOrbitXYZV<T>::SampledOrbitXYZV(TrajectoryInterpolation _interpolation) :
+template <typename T, typename SAMPLES> SampledOrbitXYZV<T, SAMPLES>::SampledOrbitXYZV(TrajectoryInterpolation _interpolation) :
     boundingRadius(0.0),
     period(1.0),
     lastSample(0),
@@ -468,7 +774,7 @@ template <typename T> SampledOrbitXYZV<T>::SampledOrbitXYZV(TrajectoryInterpolat
 }
 
 
-template <typename T> SampledOrbitXYZV<T>::~SampledOrbitXYZV()
+template <typename T, typename SAMPLES> SampledOrbitXYZV<T, SAMPLES>::~SampledOrbitXYZV()
 {
 }
 
@@ -476,7 +782,7 @@ template <typename T> SampledOrbitXYZV<T>::~SampledOrbitXYZV()
 // Add a new sample to the trajectory:
 //    Position in km
 //    Velocity in km/Julian day
-template <typename T> void SampledOrbitXYZV<T>::addSample(double t, const Vector3d& position, const Vector3d& velocity)
+template <typename T, typename SAMPLES> void SampledOrbitXYZV<T, SAMPLES>::addSample(double t, const Vector3d& position, const Vector3d& velocity)
 {
     double r = position.norm();
     if (r > boundingRadius)
@@ -488,10 +794,16 @@ template <typename T> void SampledOrbitXYZV<T>::addSample(double t, const Vector
     //samp.velocity = Matrix<T, 3, 1>((T) velocity.x, (T) velocity.y, (T) velocity.z);
     samp.position = position.cast<T>();
     samp.velocity = velocity.cast<T>();
-    samples.push_back(samp);
+    samples.add(samp);
+}
+
+
+template <typename T, typename SAMPLES> void SampledOrbitXYZV<T, SAMPLES>::buildTimeIndex()
+{
+    samples.buildTimeIndex();
 }
 
-template <typename T> double SampledOrbitXYZV<T>::getPeriod() const
+template <typename T, typename SAMPLES> double SampledOrbitXYZV<T, SAMPLES>::getPeriod() const
 {
     if (samples.empty())
         return 0.0;
@@ -500,26 +812,26 @@ template <typename T> double SampledOrbitXYZV<T>::getPeriod() const
 }
 
 
-template <typename T> bool SampledOrbitXYZV<T>::isPeriodic() const
+template <typename T, typename SAMPLES> bool SampledOrbitXYZV<T, SAMPLES>::isPeriodic() const
 {
     return false;
 }
 
 
-template <typename T> void SampledOrbitXYZV<T>::getValidRange(double& begin, double& end) const
+template <typename T, typename SAMPLES> void SampledOrbitXYZV<T, SAMPLES>::getValidRange(double& begin, double& end) const
 {
     begin = samples[0].t;
     end = samples[samples.size() - 1].t;
 }
 
 
-template <typename T> double SampledOrbitXYZV<T>::getBoundingRadius() const
+template <typename T, typename SAMPLES> double SampledOrbitXYZV<T, SAMPLES>::getBoundingRadius() const
 {
     return boundingRadius;
 }
 
 
-template <typename T> Vector3d SampledOrbitXYZV<T>::computePosition(double jd) const
+template <typename T, typename SAMPLES> Vector3d SampledOrbitXYZV<T, SAMPLES>::computePosition(double jd) const
 {
     Vector3d pos;
     if (samples.size() == 0)
@@ -532,20 +844,11 @@ template <typename T> Vector3d SampledOrbitXYZV<T>::computePosition(double jd) c
     }
     else
     {
-        SampleXYZV<T> samp;
-        samp.t = jd;
         int n = lastSample;
 
         if (n < 1 || n >= (int) samples.size() || jd < samples[n - 1].t || jd > samples[n].t)
         {
-            typename vector<SampleXYZV<T> >::const_iterator iter = lower_bound(samples.begin(),
-                                                                               samples.end(),
-                                                                               samp);
-            if (iter == samples.end())
-                n = samples.size();
-            else
-                n = iter - samples.begin();
-
+            n = samples.find(jd);
             lastSample = n;
         }
 
@@ -597,26 +900,17 @@ template <typename T> Vector3d SampledOrbitXYZV<T>::computePosition(double jd) c
 
 // Velocity is computed as the derivative of the interpolating function
 // for position.
-template <typename T> Vector3d SampledOrbitXYZV<T>::computeVelocity(double jd) const
+template <typename T, typename SAMPLES> Vector3d SampledOrbitXYZV<T, SAMPLES>::computeVelocity(double jd) const
 {
     Vector3d vel(Vector3d::Zero());
 
     if (samples.size() >= 2)
     {
-        SampleXYZV<T> samp;
-        samp.t = jd;
         int n = lastSample;
 
         if (n < 1 || n >= (int) samples.size() || jd < samples[n - 1].t || jd > samples[n].t)
         {
-            typename vector<SampleXYZV<T> >::const_iterator iter = lower_bound(samples.begin(),
-                                                                               samples.end(),
-                                                                               samp);
-            if (iter == samples.end())
-                n = samples.size();
-            else
-                n = iter - samples.begin();
-
+            n = samples.find(jd);
             lastSample = n;
         }
 
@@ -658,15 +952,19 @@ template <typename T> Vector3d SampledOrbitXYZV<T>::computeVelocity(double jd) c
 }
 
 
-template <typename T> void SampledOrbitXYZV<T>::sample(double /* startTime */, double /* endTime */,
+template <typename T, typename SAMPLES> void SampledOrbitXYZV<T, SAMPLES>::sample(double startTime, double endTime,
                                                        OrbitSampleProc& proc) const
 {
-    for (typename vector<SampleXYZV<T> >::const_iterator iter = samples.begin();
-         iter != samples.end(); iter++)
+    unsigned int first, last;
+    if (!findSampleRange(samples, startTime, endTime, first, last))
+        return;
+
+    for (unsigned int i = first; i < last; i++)
     {
-        proc.sample(iter->t,
-                    Vector3d(iter->position.x(), iter->position.z(), -iter->position.y()),
-                    Vector3d(iter->velocity.x(), iter->velocity.z(), -iter->velocity.y()));
+        SampleXYZV<T> s = samples[i];
+        proc.sample(s.t,
+                    Vector3d(s.position.x(), s.position.z(), -s.position.y()),
+                    Vector3d(s.velocity.x(), s.velocity.z(), -s.velocity.y()));
     }
 }
 
@@ -763,6 +1061,8 @@ template <typename T> SampledOrbit<T>* LoadSampledOrbit(const string& filename,
         }
     }
 
+    orbit->buildTimeIndex();
+
     return orbit;
 }
 
@@ -825,10 +1125,154 @@ template <typename T> SampledOrbitXYZV<T>* LoadSampledOrbitXYZV(const string& fi
         }
     }
 
+    orbit->buildTimeIndex();
+
     return orbit;
 }
 
 
+template <typename ORBIT> static Orbit* CreateMappedOrbit(MappedFile* file,
+                                                          const char* sampleData,
+                                                          unsigned int recordSize,
+                                                          unsigned int nSamples,
+                                                          unsigned int blockSize,
+                                                          const vector<double>& blockStartTimes,
+                                                          double boundingRadius,
+                                                          TrajectoryInterpolation interpolation)
+{
+    ORBIT* orbit = new ORBIT(interpolation);
+    orbit->getSamples().setData(file, sampleData, recordSize, nSamples, blockSize, blockStartTimes);
+    orbit->setBoundingRadius(boundingRadius);
+    return orbit;
+}
+
+
+/*! Load a binary trajectory file, as produced by the xyzv2bin tool. The file
+ *  layout is:
+ *
+ *    char[8]   "CELTRAJ\0"
+ *    uint16    version (0x0100)
+ *    uint16    sample type: 0 = positions (xyz), 1 = positions and velocities (xyzv)
+ *    uint16    interpolation recommended by the file creator: 0 = linear, 1 = cubic
+ *    uint16    reserved
+ *    uint32    sample count
+ *    uint32    samples per block
+ *    uint32    block count
+ *    uint32    reserved
+ *    double    time of the first sample (TDB)
+ *    double    time of the last sample (TDB)
+ *    double    bounding radius (km)
+ *    sample records, in order of increasing time
+ *    double    time of the first sample in each block
+ *
+ *  Each sample record contains a time followed by the position in km, and
+ *  for sample type 1, the velocity in km/sec, all as doubles. All values are
+ *  little endian. The block index follows the samples so that the file can
+ *  be written in a single pass.
+ *
+ *  The interpolation used is always the one requested by the catalog file;
+ *  the recommendation in the file is only informational.
+ */
+Orbit* LoadBinaryTrajectory(const string& filename, TrajectoryInterpolation interpolation)
+{
+    MappedFile* file = OpenMappedFile(filename);
+    if (file == NULL)
+        return NULL;
+
+    const char* data = file->getData();
+    size_t size = file->getSize();
+
+    if (size < BinaryTrajectoryHeaderSize ||
+        memcmp(data, BinaryTrajectoryFileHeader, sizeof BinaryTrajectoryFileHeader) != 0)
+    {
+        cerr << "Bad header for binary trajectory file " << filename << '\n';
+        delete file;
+        return NULL;
+    }
+
+    uint16 version;
+    uint16 sampleType;
+    uint32 nSamples;
+    uint32 blockSize;
+    uint32 nBlocks;
+    memcpy(&version,    data + 8,  sizeof version);
+    memcpy(&sampleType, data + 10, sizeof sampleType);
+    memcpy(&nSamples,   data + 16, sizeof nSamples);
+    memcpy(&blockSize,  data + 20, sizeof blockSize);
+    memcpy(&nBlocks,    data + 24, sizeof nBlocks);
+    LE_TO_CPU_INT16(version, version);
+    LE_TO_CPU_INT16(sampleType, sampleType);
+    LE_TO_CPU_INT32(nSamples, nSamples);
+    LE_TO_CPU_INT32(blockSize, blockSize);
+    LE_TO_CPU_INT32(nBlocks, nBlocks);
+    double boundingRadius = decodeDouble(data + 48);
+
+    if (version != BinaryTrajectoryFileVersion)
+    {
+        cerr << "Unsupported version of binary trajectory file " << filename << '\n';
+        delete file;
+        return NULL;
+    }
+
+    unsigned int recordSize = 0;
+    if (sampleType == BinaryTrajectoryXYZ)
+        recordSize = 4 * sizeof(double);
+    else if (sampleType == BinaryTrajectoryXYZV)
+        recordSize = 7 * sizeof(double);
+
+    double expectedSize = (double) BinaryTrajectoryHeaderSize +
+                          (double) nBlocks * sizeof(double) +
+                          (double) nSamples * recordSize;
+    if (recordSize == 0 || nSamples == 0 || blockSize == 0 ||
+        nBlocks != (nSamples - 1) / blockSize + 1 ||
+        (double) size < expectedSize)
+    {
+        cerr << "Binary trajectory file " << filename << " is truncated or corrupt\n";
+        delete file;
+        return NULL;
+    }
+
+    const char* sampleData = data + BinaryTrajectoryHeaderSize;
+    const char* indexData = sampleData + (size_t) nSamples * recordSize;
+
+    // Sample lookups binary search both the block index and the samples
+    // within a block, so the times must be in order. Each block index entry
+    // must also be the time of the block's first sample.
+    vector<double> blockStartTimes(nBlocks);
+    bool ordered = true;
+    double lastTime = 0.0;
+    for (uint32 i = 0; i < nSamples && ordered; i++)
+    {
+        double t = decodeDouble(sampleData + (size_t) i * recordSize);
+        if (i % blockSize == 0)
+        {
+            blockStartTimes[i / blockSize] = decodeDouble(indexData + (i / blockSize) * sizeof(double));
+            ordered = t == blockStartTimes[i / blockSize];
+        }
+        ordered = ordered && (i == 0 || t >= lastTime);
+        lastTime = t;
+    }
+
+    if (!ordered)
+    {
+        cerr << "Samples in binary trajectory file " << filename << " are not in time order\n";
+        delete file;
+        return NULL;
+    }
+
+    if (sampleType == BinaryTrajectoryXYZ)
+    {
+        return CreateMappedOrbit<SampledOrbit<double, MappedSampleArray<Sample<double> > > >
+            (file, sampleData, recordSize, nSamples, blockSize, blockStartTimes, boundingRadius, interpolation);
+    }
+    else
+    {
+        return CreateMappedOrbit<SampledOrbitXYZV<double, MappedSampleArray<SampleXYZV<double> > > >
+            (file, sampleData, recordSize, nSamples, blockSize, blockStartTimes, boundingRadius, interpolation);
+    }
+}
+
+
 /*! Load a trajectory file containing single precision positions.
  */
 Orbit* LoadSampledTrajectorySinglePrec(const string& filename, TrajectoryInterpolation interpolation)
@@ -99,23 +99,23 @@ SetLuaVariables(lua_State* state, Hash* parameters)
     for (HashIterator iter = parameters->begin(); iter != parameters->end();
          iter++)
     {
-        size_t percentPos = iter->first.find('%');
+        size_t percentPos = iter->first->find('%');
         if (percentPos == string::npos)
         {
             switch (iter->second->getType())
             {
             case Value::NumberType:
-                lua_pushstring(state, iter->first.c_str());
+                lua_pushstring(state, iter->first->c_str());
                 lua_pushnumber(state, iter->second->getNumber());
                 lua_settable(state, -3);
                 break;
             case Value::StringType:
-                lua_pushstring(state, iter->first.c_str());
+                lua_pushstring(state, iter->first->c_str());
                 lua_pushstring(state, iter->second->getString().c_str());
                 lua_settable(state, -3);
                 break;
             case Value::BooleanType:
-                lua_pushstring(state, iter->first.c_str());
+                lua_pushstring(state, iter->first->c_str());
                 lua_pushboolean(state, iter->second->getBoolean());
                 lua_settable(state, -3);
                 break;
@@ -13,8 +13,12 @@
 // of the License, or (at your option) any later version.
 
 #include <cmath>
+#include <vector>
+#include <algorithm>
 #include <celmath/mathlib.h>
+#include <celmath/sse2math.h>
 #include <celengine/astro.h>
+#include <celutil/workerpool.h>
 #include "vsop87.h"
 
 using namespace Eigen;
@@ -10998,28 +11002,155 @@ static VSOPSeries sun_Z[] = {
 };
 
 
-static double SumSeries(const VSOPSeries& series, double t)
+// A VSOP87 series rearranged as a structure of arrays, so that several terms
+// can be evaluated at once with SIMD instructions. The arrays are padded with
+// zero amplitude terms to a multiple of VSOP_PACKET_SIZE.
+struct PackedVSOPSeries
 {
-    if (series.nTerms < 1)
+    vector<double> A;
+    vector<double> B;
+    vector<double> C;
+};
+
+static const unsigned int VSOP_PACKET_SIZE = 2;
+
+
+static void PackSeries(const VSOPSeries* series,
+                       int nSeries,
+                       vector<PackedVSOPSeries>& packed)
+{
+    packed.resize(nSeries);
+    for (int i = 0; i < nSeries; i++)
+    {
+        unsigned int nTerms = (unsigned int) max(series[i].nTerms, 0);
+        unsigned int nPadded = (nTerms + VSOP_PACKET_SIZE - 1) / VSOP_PACKET_SIZE * VSOP_PACKET_SIZE;
+
+        PackedVSOPSeries& p = packed[i];
+        p.A.assign(nPadded, 0.0);
+        p.B.assign(nPadded, 0.0);
+        p.C.assign(nPadded, 0.0);
+        for (unsigned int j = 0; j < nTerms; j++)
+        {
+            p.A[j] = series[i].terms[j].A;
+            p.B[j] = series[i].terms[j].B;
+            p.C[j] = series[i].terms[j].C;
+        }
+    }
+}
+
+
+static double SumSeries(const PackedVSOPSeries& series, double t)
+{
+    unsigned int nTerms = series.A.size();
+    if (nTerms < 1)
         return 0.0;
 
+    const double* A = &series.A[0];
+    const double* B = &series.B[0];
+    const double* C = &series.C[0];
+
+#ifdef CELMATH_SSE2
+    __m128d t2  = _mm_set1_pd(t);
+    __m128d sum = _mm_setzero_pd();
+    for (unsigned int i = 0; i < nTerms; i += 2)
+    {
+        __m128d arg = _mm_add_pd(_mm_loadu_pd(B + i), _mm_mul_pd(_mm_loadu_pd(C + i), t2));
+        sum = _mm_add_pd(sum, _mm_mul_pd(_mm_loadu_pd(A + i), cosPD(arg)));
+    }
+
+    double partialSums[2];
+    _mm_storeu_pd(partialSums, sum);
+    return partialSums[0] + partialSums[1];
+#else
+    double x = 0.0;
+    for (unsigned int i = 0; i < nTerms; i++)
+        x += A[i] * cos(B[i] + C[i] * t);
+
+    return x;
+#endif
+};
+
+
+// Evaluate a polynomial in t whose coefficients are VSOP87 series
+static double SumSeriesPolynomial(const vector<PackedVSOPSeries>& series, double t)
+{
     double x = 0.0;
-    VSOPTerm* term = &series.terms[0];
-    for (int i = 0; i < series.nTerms; i++, term++)
-        x += term->A * cos(term->B + term->C * t);
+    double T = 1;
+    for (unsigned int i = 0; i < series.size(); i++)
+    {
+        x += SumSeries(series[i], t) * T;
+        T = t * T;
+    }
 
     return x;
+}
+
+
+// Time step used when computing velocities by differentiation; this is the
+// same step used by CachingOrbit::computeVelocity().
+static const double VELOCITY_DIFF_DELTA = 1.0 / 1440.0;
+
+// Batches of positions shorter than this are always computed on the
+// calling thread.
+static const unsigned int MIN_PARALLEL_BATCH = 64;
+
+template <class ORBIT> class PositionBatchTask : public Task
+{
+ public:
+    PositionBatchTask(const ORBIT& _orbit, const double* _tdb, Vector3d* _positions, unsigned int _count) :
+        orbit(_orbit), tdb(_tdb), positions(_positions), count(_count) {};
+
+    void run()
+    {
+        for (unsigned int i = 0; i < count; i++)
+            positions[i] = orbit.computePosition(tdb[i]);
+    }
+
+ private:
+    const ORBIT& orbit;
+    const double* tdb;
+    Vector3d* positions;
+    unsigned int count;
 };
 
+
+// Compute the positions of a VSOP87 orbit at many times, dividing large
+// batches among the threads of the shared worker pool. computePosition()
+// doesn't touch the position cache, so it's safe to call concurrently.
+template <class ORBIT>
+static void ComputePositions(const ORBIT& orbit,
+                             const double* tdb,
+                             Vector3d* positions,
+                             unsigned int count)
+{
+    WorkerPool* pool = WorkerPool::getSharedPool();
+    if (count < MIN_PARALLEL_BATCH || pool->getThreadCount() == 0)
+    {
+        PositionBatchTask<ORBIT>(orbit, tdb, positions, count).run();
+        return;
+    }
+
+    // The calling thread works through the queue too while it waits
+    unsigned int nTasks = pool->getThreadCount() + 1;
+    unsigned int taskSize = (count + nTasks - 1) / nTasks;
+
+    TaskGroup group;
+    for (unsigned int first = 0; first < count; first += taskSize)
+    {
+        unsigned int n = min(taskSize, count - first);
+        pool->submit(new PositionBatchTask<ORBIT>(orbit, tdb + first, positions + first, n),
+                     &group);
+    }
+    pool->wait(group);
+}
+
+
 class VSOP87Orbit : public CachingOrbit
 {
  private:
-    VSOPSeries* vsL;
-    int nL;
-    VSOPSeries* vsB;
-    int nB;
-    VSOPSeries* vsR;
-    int nR;
+    vector<PackedVSOPSeries> vsL;
+    vector<PackedVSOPSeries> vsB;
+    vector<PackedVSOPSeries> vsR;
     double period;
     double boundingRadius;
 
@@ -11029,12 +11160,12 @@ class VSOP87Orbit : public CachingOrbit
                 VSOPSeries* _vsR, int _nR,
                 double _period,
                 double _boundingRadius) :
-        vsL(_vsL), nL(_nL),
-        vsB(_vsB), nB(_nB),
-        vsR(_vsR), nR(_nR),
         period(_period),
         boundingRadius(_boundingRadius)
     {
+        PackSeries(_vsL, _nL, vsL);
+        PackSeries(_vsB, _nB, vsB);
+        PackSeries(_vsR, _nR, vsR);
     };
     virtual ~VSOP87Orbit() {};
 
@@ -11054,36 +11185,9 @@ class VSOP87Orbit : public CachingOrbit
         double t = (jd - 2451545.0) / 365250.0;
 
         // Heliocentric coordinates
-        double l = 0.0; // longitude
-        double b = 0.0; // latitude
-        double r = 0.0; // radius
-
-        int i;
-        double T;
-
-        // Evaluate series for l
-        T = 1;
-        for (i = 0; i < nL; i++)
-        {
-            l += SumSeries(vsL[i], t) * T;
-            T = t * T;
-        }
-
-        // Evaluate series for b
-        T = 1;
-        for (i = 0; i < nB; i++)
-        {
-            b += SumSeries(vsB[i], t) * T;
-            T = t * T;
-        }
-
-        // Evaluate series for r
-        T = 1;
-        for (i = 0; i < nR; i++)
-        {
-            r += SumSeries(vsR[i], t) * T;
-            T = t * T;
-        }
+        double l = SumSeriesPolynomial(vsL, t); // longitude
+        double b = SumSeriesPolynomial(vsB, t); // latitude
+        double r = SumSeriesPolynomial(vsR, t); // radius
 
         r *= KM_PER_AU;
 
@@ -11096,25 +11200,48 @@ class VSOP87Orbit : public CachingOrbit
                         -sin(l) * sin(b) * r);
     }
 
+    void positionsAtTimes(const double* tdb, Vector3d* positions, unsigned int count) const
+    {
+        ComputePositions(*this, tdb, positions, count);
+    }
+
 
     /** Custom implementation of sample() for VSOP87 orbits. The default
       * implementation runs too slowly and produces too many samples.
+      * The orbit is sampled uniformly, with the velocity at each sample
+      * computed by differentiation; all of the positions are computed
+      * in a single batch.
       */
     void sample(double startTime, double endTime, OrbitSampleProc& proc) const
     {
-        double span = getPeriod();
+        double step = getPeriod() / 150.0;
 
-        AdaptiveSamplingParameters samplingParams;
-        samplingParams.tolerance = 1.0; // kilometers
+        vector<double> sampleTimes;
+        double t = startTime;
+        sampleTimes.push_back(t);
+        while (t < endTime)
+        {
+            t += min(step, endTime - t);
+            sampleTimes.push_back(t);
+        }
+
+        unsigned int nSamples = sampleTimes.size();
+        vector<double> times(nSamples * 2);
+        for (unsigned int i = 0; i < nSamples; i++)
+        {
+            times[i * 2]     = sampleTimes[i];
+            times[i * 2 + 1] = sampleTimes[i] + VELOCITY_DIFF_DELTA;
+        }
 
-        // startStep, minStep, and maxStep are all set to identical values,
-        // so the adaptive sampling function actuall behaves like uniform
-        // sampling.
-        samplingParams.startStep = span / 150.0;
-        samplingParams.minStep   = samplingParams.startStep;
-        samplingParams.maxStep   = samplingParams.startStep;
+        vector<Vector3d> positions(times.size());
+        positionsAtTimes(&times[0], &positions[0], times.size());
 
-        adaptiveSample(startTime, endTime, proc, samplingParams);
+        for (unsigned int i = 0; i < nSamples; i++)
+        {
+            const Vector3d& p0 = positions[i * 2];
+            const Vector3d& p1 = positions[i * 2 + 1];
+            proc.sample(sampleTimes[i], p0, (p1 - p0) * (1.0 / VELOCITY_DIFF_DELTA));
+        }
     }
 
 };
@@ -11124,12 +11251,9 @@ class VSOP87Orbit : public CachingOrbit
 class VSOP87OrbitRect : public CachingOrbit
 {
  private:
-    VSOPSeries* vsX;
-    int nX;
-    VSOPSeries* vsY;
-    int nY;
-    VSOPSeries* vsZ;
-    int nZ;
+    vector<PackedVSOPSeries> vsX;
+    vector<PackedVSOPSeries> vsY;
+    vector<PackedVSOPSeries> vsZ;
     double period;
     double boundingRadius;
 
@@ -11139,12 +11263,12 @@ class VSOP87OrbitRect : public CachingOrbit
                     VSOPSeries* _vsZ, int _nZ,
                     double _period,
                     double _boundingRadius) :
-        vsX(_vsX), nX(_nX),
-        vsY(_vsY), nY(_nY),
-        vsZ(_vsZ), nZ(_nZ),
         period(_period),
         boundingRadius(_boundingRadius)
     {
+        PackSeries(_vsX, _nX, vsX);
+        PackSeries(_vsY, _nY, vsY);
+        PackSeries(_vsZ, _nZ, vsZ);
     };
     virtual ~VSOP87OrbitRect() {};
 
@@ -11168,40 +11292,20 @@ class VSOP87OrbitRect : public CachingOrbit
         // t is Julian millenia since J2000.0
         double t = (jd - 2451545.0) / 365250.0;
 
-        Vector3d v(Vector3d::Zero());
-
-        int i;
-        double T;
-
-        // Evaluate series for x
-        T = 1;
-        for (i = 0; i < nX; i++)
-        {
-            v.x() += SumSeries(vsX[i], t) * T;
-            T = t * T;
-        }
-
-        // Evaluate series for y
-        T = 1;
-        for (i = 0; i < nY; i++)
-        {
-            v.y() += SumSeries(vsY[i], t) * T;
-            T = t * T;
-        }
-
-        // Evaluate series for z
-        T = 1;
-        for (i = 0; i < nZ; i++)
-        {
-            v.z() += SumSeries(vsZ[i], t) * T;
-            T = t * T;
-        }
+        Vector3d v(SumSeriesPolynomial(vsX, t),
+                   SumSeriesPolynomial(vsY, t),
+                   SumSeriesPolynomial(vsZ, t));
 
         v *= KM_PER_AU;
 
         // Corrections for internal coordinate system
         return Vector3d(v.x(), v.z(), -v.y());
     }
+
+    void positionsAtTimes(const double* tdb, Vector3d* positions, unsigned int count) const
+    {
+        ComputePositions(*this, tdb, positions, count);
+    }
 };
 
 
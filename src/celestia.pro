@@ -16,7 +16,8 @@ UTIL_SOURCES = \
     celutil/filetype.cpp \
     celutil/formatnum.cpp \
     celutil/utf8.cpp \
-    celutil/util.cpp
+    celutil/util.cpp \
+    celutil/workerpool.cpp
 
 UTIL_HEADERS = \
     celutil/basictypes.h \
@@ -27,20 +28,23 @@ UTIL_HEADERS = \
     celutil/directory.h \
     celutil/filetype.h \
     celutil/formatnum.h \
+    celutil/mappedfile.h \
     celutil/reshandle.h \
     celutil/resmanager.h \
+    celutil/thread.h \
     celutil/timer.h \
     celutil/utf8.h \
     celutil/util.h \
-    celutil/watcher.h
+    celutil/watcher.h \
+    celutil/workerpool.h
 
 win32 {
-    UTIL_SOURCES += celutil/windirectory.cpp celutil/wintimer.cpp
+    UTIL_SOURCES += celutil/windirectory.cpp celutil/winmappedfile.cpp celutil/winthread.cpp celutil/wintimer.cpp
     UTIL_HEADERS += celutil/winutil.h
 }
 
 unix {
-    UTIL_SOURCES += celutil/unixdirectory.cpp celutil/unixtimer.cpp
+    UTIL_SOURCES += celutil/unixdirectory.cpp celutil/unixmappedfile.cpp celutil/unixthread.cpp celutil/unixtimer.cpp
 }
 
 #### Math library ####
@@ -63,6 +67,7 @@ MATH_HEADERS = \
     celmath/quaternion.h \
     celmath/ray.h \
     celmath/solve.h \
+    celmath/sse2math.h \
     celmath/sphere.h \
     celmath/vecmath.h
 
@@ -144,6 +149,7 @@ ENGINE_SOURCES = \
     celengine/axisarrow.cpp \
     celengine/body.cpp \
     celengine/boundaries.cpp \
+    celengine/catalogcache.cpp \
     celengine/catalogxref.cpp \
     celengine/cmdparser.cpp \
     celengine/command.cpp \
@@ -173,6 +179,7 @@ ENGINE_SOURCES = \
     celengine/nebula.cpp \
     celengine/observer.cpp \
     celengine/opencluster.cpp \
+    celengine/orbitcache.cpp \
     celengine/overlay.cpp \
     celengine/parseobject.cpp \
     celengine/parser.cpp \
@@ -213,6 +220,7 @@ ENGINE_HEADERS = \
     celengine/axisarrow.h \
     celengine/body.h \
     celengine/boundaries.h \
+    celengine/catalogcache.h \
     celengine/catalogxref.h \
     celengine/celestia.h \
     celengine/cmdparser.h \
@@ -246,6 +254,7 @@ ENGINE_HEADERS = \
     celengine/observer.h \
     celengine/octree.h \
     celengine/opencluster.h \
+    celengine/orbitcache.h \
     celengine/overlay.h \
     celengine/parseobject.h \
     celengine/parser.h \
@@ -301,6 +310,7 @@ APP_SOURCES = \
     celestia/destination.cpp \
     celestia/eclipsefinder.cpp \
     celestia/favorites.cpp \
+    celestia/framereader.cpp \
     celestia/imagecapture.cpp \
     celestia/scriptmenu.cpp \
     celestia/url.cpp \
@@ -321,6 +331,7 @@ APP_HEADERS = \
     celestia/destination.h \
     celestia/eclipsefinder.h \
     celestia/favorites.h \
+    celestia/framereader.h \
     celestia/imagecapture.h \
     celestia/scriptmenu.h \
     celestia/url.h \
@@ -564,7 +575,7 @@ win32 {
 
 unix {
     INCLUDEPATH += /usr/local/cspice/include
-    LIBS += -ljpeg -llua  /usr/local/cspice/lib/cspice.a
+    LIBS += -ljpeg -llua -lpthread /usr/local/cspice/lib/cspice.a
 }
 
 macx {
@@ -26,6 +26,7 @@ OBJS=\
 	$(INTDIR)\destination.obj \
 	$(INTDIR)\eclipsefinder.obj \
 	$(INTDIR)\favorites.obj \
+	$(INTDIR)\framereader.obj \
 	$(INTDIR)\imagecapture.obj \
 	$(INTDIR)\ODMenu.obj \
 	$(INTDIR)\scriptmenu.obj \
@@ -29,6 +29,7 @@
 #include <celengine/planetgrid.h>
 #include <celengine/visibleregion.h>
 #include <celengine/eigenport.h>
+#include <celengine/catalogcache.h>
 #include <celmath/geomutil.h>
 #include <celutil/util.h>
 #include <celutil/filetype.h>
@@ -80,6 +81,9 @@ static float KeyRotationAccel = degToRad(120.0f);
 static float MouseRotationSensitivity = degToRad(1.0f);
 
 static const int ConsolePageRows = 10;
+
+// Maximum number of names offered when completing a typed object name
+static const unsigned int MaxNameCompletions = 1000;
 static Console console(200, 120);
 
 
@@ -1272,7 +1276,7 @@ void CelestiaCore::charEntered(const char *c_p, int modifiers)
 #endif
         {
             typedText += string(c_p);
-            typedTextCompletion = sim->getObjectCompletion(typedText, (renderer->getLabelMode() & Renderer::LocationLabels) != 0);
+            typedTextCompletion = sim->getObjectCompletion(typedText, (renderer->getLabelMode() & Renderer::LocationLabels) != 0, MaxNameCompletions);
             typedTextCompletionIdx = -1;
 #ifdef AUTO_COMPLETION
             if (typedTextCompletion.size() == 1)
@@ -1303,7 +1307,7 @@ void CelestiaCore::charEntered(const char *c_p, int modifiers)
                     typedText = string(typedText, 0, typedText.size() - 1);
                     if (typedText.size() > 0)
                     {
-                        typedTextCompletion = sim->getObjectCompletion(typedText, (renderer->getLabelMode() & Renderer::LocationLabels) != 0);
+                        typedTextCompletion = sim->getObjectCompletion(typedText, (renderer->getLabelMode() & Renderer::LocationLabels) != 0, MaxNameCompletions);
                     } else {
                         typedTextCompletion.clear();
                     }
@@ -4002,7 +4006,9 @@ class SolarSystemLoader : public EnumFilesHandler
  public:
     Universe* universe;
     ProgressNotifier* notifier;
-    SolarSystemLoader(Universe* u, ProgressNotifier* pn) : universe(u), notifier(pn) {};
+    CatalogCache* cache;
+    SolarSystemLoader(Universe* u, ProgressNotifier* pn, CatalogCache* c) :
+        universe(u), notifier(pn), cache(c) {};
 
     bool process(const string& filename)
     {
@@ -4013,12 +4019,13 @@ class SolarSystemLoader : public EnumFilesHandler
             if (notifier)
                 notifier->update(filename);
 
-            ifstream solarSysFile(fullname.c_str(), ios::in);
-            if (solarSysFile.good())
+            CatalogReader reader(fullname, cache);
+            if (reader.good())
             {
-                LoadSolarSystemObjects(solarSysFile,
-                                       *universe,
-                                       getPath());
+                bool success = LoadSolarSystemObjects(reader.getTokenizer(),
+                                                      *universe,
+                                                      getPath());
+                reader.finish(success);
             }
         }
 
@@ -4033,15 +4040,18 @@ public:
     string      typeDesc;
     ContentType contentType;
     ProgressNotifier* notifier;
+    CatalogCache* cache;
 
     CatalogLoader(OBJDB* db,
                   const std::string& typeDesc,
                   const ContentType& contentType,
-                  ProgressNotifier* pn) :
+                  ProgressNotifier* pn,
+                  CatalogCache* c) :
         objDB      (db),
         typeDesc   (typeDesc),
         contentType(contentType),
-        notifier(pn)
+        notifier(pn),
+        cache(c)
     {
     }
 
@@ -4054,10 +4064,11 @@ public:
             if (notifier)
                 notifier->update(filename);
 
-            ifstream catalogFile(fullname.c_str(), ios::in);
-            if (catalogFile.good())
+            CatalogReader reader(fullname, cache);
+            if (reader.good())
             {
-                bool success = objDB->load(catalogFile, getPath());
+                bool success = objDB->load(reader.getTokenizer(), getPath());
+                reader.finish(success);
                 if (!success)
                 {
                     //DPRINTF(0, _("Error reading star file: %s\n"), fullname.c_str());
@@ -4159,11 +4170,23 @@ bool CelestiaCore::initSimulation(const string* configFileName,
 
     universe = new Universe();
 
+    // Recordings of the catalog files are kept in the catalog cache
+    // directory, if there is one, so that they can be loaded quickly.
+    CatalogCache* catalogCache = NULL;
+    if (!config->catalogCacheDirectory.empty())
+    {
+        if (IsDirectory(config->catalogCacheDirectory))
+            catalogCache = new CatalogCache(config->catalogCacheDirectory);
+        else
+            clog << "Catalog cache directory " << config->catalogCacheDirectory << " does not exist\n";
+    }
+
 
     /***** Load star catalogs *****/
 
-    if (!readStars(*config, progressNotifier))
+    if (!readStars(*config, progressNotifier, catalogCache))
     {
+        delete catalogCache;
         fatalError(_("Cannot read star database."));
         return false;
     }
@@ -4183,17 +4206,22 @@ bool CelestiaCore::initSimulation(const string* configFileName,
     	if (progressNotifier)
         	progressNotifier->update(*iter);
 	
-		ifstream dsoFile(iter->c_str(), ios::in);
-        if (!dsoFile.good())
+		CatalogReader dsoReader(*iter, catalogCache);
+        if (!dsoReader.good())
         {
         	cerr<< _("Error opening deepsky catalog file.") << '\n';
             delete dsoDB;
+            delete catalogCache;
             return false;
 		}
-        else if (!dsoDB->load(dsoFile, ""))		
+
+        bool success = dsoDB->load(dsoReader.getTokenizer(), "");
+        dsoReader.finish(success);
+        if (!success)
 	    {
     		cerr << "Cannot read Deep Sky Objects database." << '\n';
         	delete dsoDB;
+            delete catalogCache;
            	return false;
         }
     }
@@ -4210,7 +4238,8 @@ bool CelestiaCore::initSimulation(const string* configFileName,
                 DeepSkyLoader loader(dsoDB,
                                      "deep sky object",
                                      Content_CelestiaDeepSkyCatalog,
-                                     progressNotifier);
+                                     progressNotifier,
+                                     catalogCache);
                 loader.pushDir(*iter);
                 dir->enumFiles(loader, true);
 
@@ -4235,14 +4264,15 @@ bool CelestiaCore::initSimulation(const string* configFileName,
             if (progressNotifier)
                 progressNotifier->update(*iter);
 
-            ifstream solarSysFile(iter->c_str(), ios::in);
-            if (!solarSysFile.good())
+            CatalogReader solarSysReader(*iter, catalogCache);
+            if (!solarSysReader.good())
             {
                 warning(_("Error opening solar system catalog.\n"));
             }
             else
             {
-                LoadSolarSystemObjects(solarSysFile, *universe, "");
+                bool success = LoadSolarSystemObjects(solarSysReader.getTokenizer(), *universe, "");
+                solarSysReader.finish(success);
             }
         }
     }
@@ -4256,7 +4286,7 @@ bool CelestiaCore::initSimulation(const string* configFileName,
             {
                 Directory* dir = OpenDirectory(*iter);
 
-                SolarSystemLoader loader(universe, progressNotifier);
+                SolarSystemLoader loader(universe, progressNotifier, catalogCache);
                 loader.pushDir(*iter);
                 dir->enumFiles(loader, true);
 
@@ -4265,6 +4295,8 @@ bool CelestiaCore::initSimulation(const string* configFileName,
         }
     }
 
+    delete catalogCache;
+
     // Load asterisms:
     if (config->asterismsFile != "")
     {
@@ -4360,6 +4392,8 @@ bool CelestiaCore::initRenderer()
     detailOptions.orbitPathSamplePoints = config->orbitPathSamplePoints;
     detailOptions.shadowTextureSize = config->shadowTextureSize;
     detailOptions.eclipseTextureSize = config->eclipseTextureSize;
+    detailOptions.virtualTextureMemory = config->virtualTextureMemory;
+    detailOptions.orbitCacheMemory = config->orbitCacheMemory;
 
     // Prepare the scene for rendering.
     if (!renderer->init(context, (int) width, (int) height, detailOptions))
@@ -4446,7 +4480,8 @@ static void loadCrossIndex(StarDatabase* starDB,
 
 
 bool CelestiaCore::readStars(const CelestiaConfig& cfg,
-                             ProgressNotifier* progressNotifier)
+                             ProgressNotifier* progressNotifier,
+                             CatalogCache* catalogCache)
 {
     StarDetails::SetStarTextures(cfg.starTextures);
 
@@ -4472,15 +4507,8 @@ bool CelestiaCore::readStars(const CelestiaConfig& cfg,
         if (progressNotifier)
             progressNotifier->update(cfg.starDatabaseFile);
 
-        ifstream starFile(cfg.starDatabaseFile.c_str(), ios::in | ios::binary);
-        if (!starFile.good())
-        {
-            cerr << _("Error opening ") << cfg.starDatabaseFile << '\n';
-            delete starDB;
-            return false;
-        }
-
-        if (!starDB->loadBinary(starFile))
+        // The star database file is memory mapped when possible
+        if (!starDB->loadBinary(cfg.starDatabaseFile))
         {
             delete starDB;
             cerr << _("Error reading stars file\n");
@@ -4503,10 +4531,11 @@ bool CelestiaCore::readStars(const CelestiaConfig& cfg,
         {
             if (*iter != "")
             {
-                ifstream starFile(iter->c_str(), ios::in);
-                if (starFile.good())
+                CatalogReader starReader(*iter, catalogCache);
+                if (starReader.good())
                 {
-                    starDB->load(starFile, "");
+                    bool success = starDB->load(starReader.getTokenizer(), "");
+                    starReader.finish(success);
                 }
                 else
                 {
@@ -4524,7 +4553,7 @@ bool CelestiaCore::readStars(const CelestiaConfig& cfg,
         {
             Directory* dir = OpenDirectory(*iter);
 
-            StarLoader loader(starDB, "star", Content_CelestiaStarCatalog, progressNotifier);
+            StarLoader loader(starDB, "star", Content_CelestiaStarCatalog, progressNotifier, catalogCache);
             loader.pushDir(*iter);
             dir->enumFiles(loader, true);
 
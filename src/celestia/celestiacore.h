@@ -30,6 +30,7 @@
 #include "celx.h"
 #endif
 class Url;
+class CatalogCache;
 
 // class CelestiaWatcher;
 class CelestiaCore;
@@ -345,7 +346,7 @@ class CelestiaCore // : public Watchable<CelestiaCore>
     bool referenceMarkEnabled(const std::string& refMark, Selection sel = Selection()) const;
     
  private:
-    bool readStars(const CelestiaConfig&, ProgressNotifier*);
+    bool readStars(const CelestiaConfig&, ProgressNotifier*, CatalogCache*);
     void renderOverlay();
     void fatalError(const std::string&);
 #ifdef CELX
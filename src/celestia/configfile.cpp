@@ -100,6 +100,8 @@ CelestiaConfig* ReadCelestiaConfig(string filename, CelestiaConfig *config)
     config->SAOCrossIndexFile = WordExp(config->SAOCrossIndexFile);
     configParams->getString("GlieseCrossIndex", config->GlieseCrossIndexFile);
     config->GlieseCrossIndexFile = WordExp(config->GlieseCrossIndexFile);
+    configParams->getString("CatalogCacheDirectory", config->catalogCacheDirectory);
+    config->catalogCacheDirectory = WordExp(config->catalogCacheDirectory);
     configParams->getString("Font", config->mainFont);
     configParams->getString("LabelFont", config->labelFont);
     configParams->getString("TitleFont", config->titleFont);
@@ -128,6 +130,8 @@ CelestiaConfig* ReadCelestiaConfig(string filename, CelestiaConfig *config)
     config->orbitPathSamplePoints = getUint(configParams, "OrbitPathSamplePoints", 100);
     config->shadowTextureSize = getUint(configParams, "ShadowTextureSize", 256);
     config->eclipseTextureSize = getUint(configParams, "EclipseTextureSize", 128);
+    config->virtualTextureMemory = getUint(configParams, "VirtualTextureMemory", 128);
+    config->orbitCacheMemory = getUint(configParams, "OrbitCacheMemory", 64);
 
     config->consoleLogRows = getUint(configParams, "LogSize", 200);
 
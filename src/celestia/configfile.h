@@ -52,6 +52,7 @@ public:
     std::string HDCrossIndexFile;
     std::string SAOCrossIndexFile;
     std::string GlieseCrossIndexFile;
+    std::string catalogCacheDirectory;
     
     StarDetails::StarTextureSet starTextures;
 
@@ -60,6 +61,8 @@ public:
     unsigned int eclipseTextureSize;
     unsigned int ringSystemSections;
     unsigned int orbitPathSamplePoints;
+    unsigned int virtualTextureMemory;
+    unsigned int orbitCacheMemory;
 
     unsigned int aaSamples;
 
@@ -0,0 +1,242 @@
+// framereader.cpp
+//
+// Copyright (C) 2010, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// Read frames back from the OpenGL frame buffer and hand them to a worker
+// thread for encoding.
+
+#include <cstring>
+#include <GL/glew.h>
+#include "framereader.h"
+
+using namespace std;
+
+
+// Number of frames that may be in flight on the GPU. A frame is collected
+// from its pixel buffer this many frames after the read was started.
+static const unsigned int PixelBufferCount = 3;
+
+
+class FrameReader::WriterTask : public Task
+{
+ public:
+    WriterTask(FrameReader* _reader) : reader(_reader) {};
+    void run() { reader->writeFrames(); }
+
+ private:
+    FrameReader* reader;
+};
+
+
+FrameReader::FrameReader(int _width, int _height,
+                         bool pipelined,
+                         unsigned int _maxQueued) :
+    width(_width),
+    height(_height),
+    frameSize(_width * _height * 4),
+    maxQueued(_maxQueued == 0 ? 1 : _maxQueued),
+    nextBuffer(0),
+    queueMutex(NewMutex()),
+    queueCount(NewSemaphore(0)),
+    freeCount(NewSemaphore(maxQueued)),
+    writerTask(NULL),
+    writerThread(NULL)
+{
+    if (pipelined && GLEW_ARB_pixel_buffer_object)
+    {
+        pixelBuffers.resize(PixelBufferCount);
+        pendingWriters.resize(PixelBufferCount, NULL);
+        glGenBuffersARB(PixelBufferCount, &pixelBuffers[0]);
+        for (unsigned int i = 0; i < PixelBufferCount; i++)
+        {
+            glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB, pixelBuffers[i]);
+            glBufferDataARB(GL_PIXEL_PACK_BUFFER_ARB, frameSize, NULL, GL_STREAM_READ_ARB);
+        }
+        glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB, 0);
+    }
+
+    // Without a worker thread, frames are written as soon as they're read
+    writerTask = new WriterTask(this);
+    writerThread = StartThread(writerTask);
+}
+
+
+FrameReader::~FrameReader()
+{
+    finish();
+
+    if (writerThread != NULL)
+    {
+        // Wake the worker with an empty queue to make it exit
+        queueCount->signal();
+        writerThread->join();
+        delete writerThread;
+    }
+    delete writerTask;
+
+    if (!pixelBuffers.empty())
+        glDeleteBuffersARB(pixelBuffers.size(), &pixelBuffers[0]);
+
+    for (vector<unsigned char*>::iterator iter = allPixels.begin(); iter != allPixels.end(); iter++)
+        delete[] *iter;
+
+    delete freeCount;
+    delete queueCount;
+    delete queueMutex;
+}
+
+
+void FrameReader::readFrame(int x, int y, FrameWriter* writer)
+{
+    if (pixelBuffers.empty())
+    {
+        unsigned char* pixels = acquirePixels();
+        glReadPixels(x, y, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+        submit(pixels, writer);
+        return;
+    }
+
+    // The buffer was last used several frames ago; pass its frame on before
+    // starting to read the new one into it.
+    if (pendingWriters[nextBuffer] != NULL)
+        collect(nextBuffer);
+
+    glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB, pixelBuffers[nextBuffer]);
+    glReadPixels(x, y, width, height, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB, 0);
+
+    pendingWriters[nextBuffer] = writer;
+    nextBuffer = (nextBuffer + 1) % pixelBuffers.size();
+}
+
+
+void FrameReader::flush()
+{
+    // The oldest frame is in the buffer that will be used next
+    for (unsigned int i = 0; i < pixelBuffers.size(); i++)
+    {
+        unsigned int bufferIndex = (nextBuffer + i) % pixelBuffers.size();
+        if (pendingWriters[bufferIndex] != NULL)
+            collect(bufferIndex);
+    }
+}
+
+
+void FrameReader::finish()
+{
+    flush();
+
+    // Every frame has been written once all the pixel arrays are free
+    unsigned int i;
+    for (i = 0; i < maxQueued; i++)
+        freeCount->wait();
+    for (i = 0; i < maxQueued; i++)
+        freeCount->signal();
+}
+
+
+// Copy a frame out of its pixel buffer and queue it for writing. Mapping
+// the buffer only waits for the GPU if the read hasn't finished yet.
+void FrameReader::collect(unsigned int bufferIndex)
+{
+    unsigned char* pixels = acquirePixels();
+
+    glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB, pixelBuffers[bufferIndex]);
+    const void* data = glMapBufferARB(GL_PIXEL_PACK_BUFFER_ARB, GL_READ_ONLY_ARB);
+    if (data != NULL)
+    {
+        memcpy(pixels, data, frameSize);
+        glUnmapBufferARB(GL_PIXEL_PACK_BUFFER_ARB);
+    }
+    else
+    {
+        memset(pixels, 0, frameSize);
+    }
+    glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB, 0);
+
+    submit(pixels, pendingWriters[bufferIndex]);
+    pendingWriters[bufferIndex] = NULL;
+}
+
+
+// Take a free pixel array, waiting for the worker to finish with one if
+// too many frames are already queued.
+unsigned char* FrameReader::acquirePixels()
+{
+    freeCount->wait();
+
+    MutexLock lock(queueMutex);
+    if (freePixels.empty())
+    {
+        unsigned char* pixels = new unsigned char[frameSize];
+        allPixels.push_back(pixels);
+        return pixels;
+    }
+
+    unsigned char* pixels = freePixels.back();
+    freePixels.pop_back();
+    return pixels;
+}
+
+
+void FrameReader::releasePixels(unsigned char* pixels)
+{
+    {
+        MutexLock lock(queueMutex);
+        freePixels.push_back(pixels);
+    }
+    freeCount->signal();
+}
+
+
+void FrameReader::submit(unsigned char* pixels, FrameWriter* writer)
+{
+    if (writerThread == NULL)
+    {
+        writer->write(pixels, width, height);
+        delete writer;
+        releasePixels(pixels);
+        return;
+    }
+
+    {
+        MutexLock lock(queueMutex);
+        QueuedFrame frame;
+        frame.pixels = pixels;
+        frame.writer = writer;
+        queue.push_back(frame);
+    }
+    queueCount->signal();
+}
+
+
+// Body of the worker thread
+void FrameReader::writeFrames()
+{
+    for (;;)
+    {
+        queueCount->wait();
+
+        QueuedFrame frame;
+        {
+            MutexLock lock(queueMutex);
+
+            // Every queued frame signals once; a signal with nothing in the
+            // queue is the request to exit.
+            if (queue.empty())
+                return;
+
+            frame = queue.front();
+            queue.pop_front();
+        }
+
+        frame.writer->write(frame.pixels, width, height);
+        delete frame.writer;
+        releasePixels(frame.pixels);
+    }
+}
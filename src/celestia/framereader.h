@@ -0,0 +1,113 @@
+// framereader.h
+//
+// Copyright (C) 2010, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// Read frames back from the OpenGL frame buffer and hand them to a worker
+// thread for encoding.
+
+#ifndef _FRAMEREADER_H_
+#define _FRAMEREADER_H_
+
+#include <deque>
+#include <vector>
+#include <celutil/thread.h>
+
+
+/*! A job that receives the pixels of a single frame. The pixels are RGBA,
+ *  four bytes each, with the bottom row of the frame first.
+ */
+class FrameWriter
+{
+ public:
+    FrameWriter() {};
+    virtual ~FrameWriter() {};
+
+    virtual void write(const unsigned char* pixels, int width, int height) = 0;
+};
+
+
+/*! Reads frames of a fixed size from the current OpenGL read buffer and
+ *  runs a FrameWriter for each of them on a worker thread. Writers run one
+ *  at a time, in the order that the frames were read.
+ *
+ *  A pipelined reader reads into a ring of pixel buffer objects, when the
+ *  driver supports them. glReadPixels then only starts the transfer and
+ *  returns immediately; the pixels are collected when the ring comes around
+ *  to the buffer again a couple of frames later, by which time the GPU has
+ *  finished with them. Without pixel buffers, or when pipelining isn't
+ *  requested, frames are read synchronously and only the writing happens
+ *  in the background.
+ *
+ *  At most maxQueued frames wait for the worker. If the writers are slower
+ *  than rendering, reading a frame blocks until one has been written, so
+ *  memory use stays bounded.
+ *
+ *  All methods must be called from the thread that owns the GL context,
+ *  with the context current.
+ */
+class FrameReader
+{
+ public:
+    FrameReader(int width, int height, bool pipelined, unsigned int maxQueued = 4);
+    ~FrameReader();
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+
+    // Read the frame whose lower left corner is at x, y. The reader takes
+    // ownership of the writer, and deletes it after it has run.
+    void readFrame(int x, int y, FrameWriter* writer);
+
+    // Pass any frames still in pixel buffers on to the worker thread
+    void flush();
+
+    // Flush, then block until every frame read so far has been written
+    void finish();
+
+ private:
+    struct QueuedFrame
+    {
+        unsigned char* pixels;
+        FrameWriter* writer;
+    };
+
+    class WriterTask;
+    friend class WriterTask;
+
+    void collect(unsigned int bufferIndex);
+    unsigned char* acquirePixels();
+    void releasePixels(unsigned char* pixels);
+    void submit(unsigned char* pixels, FrameWriter* writer);
+    void writeFrames();
+
+    int width;
+    int height;
+    unsigned int frameSize;
+    unsigned int maxQueued;
+
+    // Ring of pixel buffer objects, and the writers for the frames that
+    // are still in them; empty when frames are read synchronously.
+    std::vector<unsigned int> pixelBuffers;
+    std::vector<FrameWriter*> pendingWriters;
+    unsigned int nextBuffer;
+
+    // Frames waiting for the worker, and the pixel arrays that are free.
+    // freeCount is the number of arrays that may be taken; arrays are only
+    // allocated when first needed.
+    std::deque<QueuedFrame> queue;
+    std::vector<unsigned char*> freePixels;
+    std::vector<unsigned char*> allPixels;
+    Mutex* queueMutex;
+    Semaphore* queueCount;
+    Semaphore* freeCount;
+
+    WriterTask* writerTask;
+    Thread* writerThread;
+};
+
+#endif // _FRAMEREADER_H_
@@ -8,10 +8,12 @@
 // of the License, or (at your option) any later version.
 
 #include <cstdio>
+#include <cstdlib>
 #include <celutil/debug.h>
 #include <GL/glew.h>
 #include <celengine/celestia.h>
 #include "imagecapture.h"
+#include "framereader.h"
 
 extern "C" {
 #ifdef _WIN32
@@ -46,161 +48,225 @@ extern "C" {
 using namespace std;
 
 
-bool CaptureGLBufferToJPEG(const string& filename,
-                           int x, int y,
-                           int width, int height)
+// Screenshots are compressed and written on a worker thread, so that image
+// sequences captured by scripts don't hold up rendering. At most this many
+// images wait to be written.
+static const unsigned int MaxQueuedImages = 4;
+
+static FrameReader* imageReader = NULL;
+
+
+static void FinishImageCaptures()
 {
-    int rowStride = (width * 3 + 3) & ~0x3;
-    int imageSize = height * rowStride;
-    unsigned char* pixels = new unsigned char[imageSize];
+    if (imageReader != NULL)
+        imageReader->finish();
+}
 
-    glReadBuffer(GL_BACK);
-    glReadPixels(x, y, width, height,
-                 GL_RGB, GL_UNSIGNED_BYTE,
-                 pixels);
 
-    // TODO: Check for GL errors
+static FrameReader* GetImageReader(int width, int height)
+{
+    if (imageReader != NULL &&
+        (imageReader->getWidth() != width || imageReader->getHeight() != height))
+    {
+        // Deleting the reader waits for the images still being written
+        delete imageReader;
+        imageReader = NULL;
+    }
 
-    FILE* out;
-    out = fopen(filename.c_str(), "wb");
-    if (out == NULL)
+    if (imageReader == NULL)
     {
-        DPRINTF(0, "Can't open screen capture file '%s'\n", filename.c_str());
-        delete[] pixels;
-        return false;
+        // Make sure that queued images are written before exiting
+        static bool finishAtExit = false;
+        if (!finishAtExit)
+        {
+            atexit(FinishImageCaptures);
+            finishAtExit = true;
+        }
+
+        // A screenshot may be the last frame drawn, so it's read right away
+        // rather than through pixel buffers that a later frame would have
+        // to collect.
+        imageReader = new FrameReader(width, height, false, MaxQueuedImages);
     }
 
-    struct jpeg_compress_struct cinfo;
+    return imageReader;
+}
 
-    struct jpeg_error_mgr jerr;
-    JSAMPROW row[1];
 
-    cinfo.err = jpeg_std_error(&jerr);
-    jpeg_create_compress(&cinfo);
+class JPEGWriter : public FrameWriter
+{
+ public:
+    JPEGWriter(FILE* _out) : out(_out) {};
 
-    jpeg_stdio_dest(&cinfo, out);
+    void write(const unsigned char* pixels, int width, int height)
+    {
+        struct jpeg_compress_struct cinfo;
 
-    cinfo.image_width = width;
-    cinfo.image_height = height;
-    cinfo.input_components = 3;
-    cinfo.in_color_space = JCS_RGB;
+        struct jpeg_error_mgr jerr;
+        JSAMPROW row[1];
 
-    jpeg_set_defaults(&cinfo);
+        cinfo.err = jpeg_std_error(&jerr);
+        jpeg_create_compress(&cinfo);
 
-    // jpeg_set_quality(&cinfo, quality, TRUE);
+        jpeg_stdio_dest(&cinfo, out);
 
-    jpeg_start_compress(&cinfo, TRUE);
+        cinfo.image_width = width;
+        cinfo.image_height = height;
+        cinfo.input_components = 3;
+        cinfo.in_color_space = JCS_RGB;
 
-    while (cinfo.next_scanline < cinfo.image_height)
-    {
-        row[0] = &pixels[rowStride * (cinfo.image_height - cinfo.next_scanline - 1)];
-        (void) jpeg_write_scanlines(&cinfo, row, 1);
-    }
+        jpeg_set_defaults(&cinfo);
 
-    jpeg_finish_compress(&cinfo);
-    fclose(out);
-    jpeg_destroy_compress(&cinfo);
+        // jpeg_set_quality(&cinfo, quality, TRUE);
 
-    delete[] pixels;
+        jpeg_start_compress(&cinfo, TRUE);
 
-    return true;
-}
+        // Drop the alpha channel from each row
+        unsigned char* rgb = new unsigned char[width * 3];
+        row[0] = rgb;
+        while (cinfo.next_scanline < cinfo.image_height)
+        {
+            const unsigned char* rgba = &pixels[width * 4 * (cinfo.image_height - cinfo.next_scanline - 1)];
+            for (int i = 0; i < width; i++)
+            {
+                rgb[i * 3]     = rgba[i * 4];
+                rgb[i * 3 + 1] = rgba[i * 4 + 1];
+                rgb[i * 3 + 2] = rgba[i * 4 + 2];
+            }
+            (void) jpeg_write_scanlines(&cinfo, row, 1);
+        }
+        delete[] rgb;
 
+        jpeg_finish_compress(&cinfo);
+        fclose(out);
+        jpeg_destroy_compress(&cinfo);
+    }
 
-void PNGWriteData(png_structp png_ptr, png_bytep data, png_size_t length)
-{
-    FILE* fp = (FILE*) png_get_io_ptr(png_ptr);
-    fwrite((void*) data, 1, length, fp);
-}
+ private:
+    FILE* out;
+};
 
-                           
-bool CaptureGLBufferToPNG(const string& filename,
+
+bool CaptureGLBufferToJPEG(const string& filename,
                            int x, int y,
                            int width, int height)
 {
-    int rowStride = (width * 3 + 3) & ~0x3;
-    int imageSize = height * rowStride;
-    unsigned char* pixels = new unsigned char[imageSize];
-
-    glReadBuffer(GL_BACK);
-    glReadPixels(x, y, width, height,
-                 GL_RGB, GL_UNSIGNED_BYTE,
-                 pixels);
-
-    // TODO: Check for GL errors
-
     FILE* out;
     out = fopen(filename.c_str(), "wb");
     if (out == NULL)
     {
         DPRINTF(0, "Can't open screen capture file '%s'\n", filename.c_str());
-        delete[] pixels;
         return false;
     }
 
-    png_bytep* row_pointers = new png_bytep[height];
-    for (int i = 0; i < height; i++)
-        row_pointers[i] = (png_bytep) &pixels[rowStride * (height - i - 1)];
+    glReadBuffer(GL_BACK);
+    GetImageReader(width, height)->readFrame(x, y, new JPEGWriter(out));
+
+    // TODO: Check for GL errors
 
-    png_structp png_ptr;
-    png_infop info_ptr;
+    return true;
+}
 
-    png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING,
-                                      NULL, NULL, NULL);
 
-    if (png_ptr == NULL)
-    {
-        DPRINTF(0, "Screen capture: error allocating png_ptr\n");
-        fclose(out);
-        delete[] pixels;
-        delete[] row_pointers;
-        return false;
-    }
+void PNGWriteData(png_structp png_ptr, png_bytep data, png_size_t length)
+{
+    FILE* fp = (FILE*) png_get_io_ptr(png_ptr);
+    fwrite((void*) data, 1, length, fp);
+}
+
+
+class PNGWriter : public FrameWriter
+{
+ public:
+    PNGWriter(FILE* _out, const string& _filename) : out(_out), filename(_filename) {};
 
-    info_ptr = png_create_info_struct(png_ptr);
-    if (info_ptr == NULL)
+    void write(const unsigned char* pixels, int width, int height)
     {
-        DPRINTF(0, "Screen capture: error allocating info_ptr\n");
-        fclose(out);
-        delete[] pixels;
+        png_bytep* row_pointers = new png_bytep[height];
+        for (int i = 0; i < height; i++)
+            row_pointers[i] = (png_bytep) &pixels[width * 4 * (height - i - 1)];
+
+        png_structp png_ptr;
+        png_infop info_ptr;
+
+        png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING,
+                                          NULL, NULL, NULL);
+
+        if (png_ptr == NULL)
+        {
+            DPRINTF(0, "Screen capture: error allocating png_ptr\n");
+            fclose(out);
+            delete[] row_pointers;
+            return;
+        }
+
+        info_ptr = png_create_info_struct(png_ptr);
+        if (info_ptr == NULL)
+        {
+            DPRINTF(0, "Screen capture: error allocating info_ptr\n");
+            fclose(out);
+            delete[] row_pointers;
+            png_destroy_write_struct(&png_ptr, (png_infopp) NULL);
+            return;
+        }
+
+        if (setjmp(png_jmpbuf(png_ptr)))
+        {
+            DPRINTF(0, "Error writing PNG file '%s'\n", filename.c_str());
+            fclose(out);
+            delete[] row_pointers;
+            png_destroy_write_struct(&png_ptr, &info_ptr);
+            return;
+        }
+
+        // png_init_io(png_ptr, out);
+        png_set_write_fn(png_ptr, (void*) out, PNGWriteData, NULL);
+
+        png_set_compression_level(png_ptr, Z_BEST_COMPRESSION);
+        png_set_IHDR(png_ptr, info_ptr,
+                     width, height,
+                     8,
+                     PNG_COLOR_TYPE_RGB,
+                     PNG_INTERLACE_NONE,
+                     PNG_COMPRESSION_TYPE_DEFAULT,
+                     PNG_FILTER_TYPE_DEFAULT);
+
+        png_write_info(png_ptr, info_ptr);
+
+        // Strip the alpha channel
+        png_set_filler(png_ptr, 0, PNG_FILLER_AFTER);
+
+        png_write_image(png_ptr, row_pointers);
+        png_write_end(png_ptr, info_ptr);
+
+        // Clean up everything . . .
+        png_destroy_write_struct(&png_ptr, &info_ptr);
         delete[] row_pointers;
-        png_destroy_write_struct(&png_ptr, (png_infopp) NULL);
-        return false;
+        fclose(out);
     }
 
-    if (setjmp(png_jmpbuf(png_ptr)))
+ private:
+    FILE* out;
+    string filename;
+};
+
+
+bool CaptureGLBufferToPNG(const string& filename,
+                           int x, int y,
+                           int width, int height)
+{
+    FILE* out;
+    out = fopen(filename.c_str(), "wb");
+    if (out == NULL)
     {
-        DPRINTF(0, "Error writing PNG file '%s'\n", filename.c_str());
-        fclose(out);
-        delete[] pixels;
-        delete[] row_pointers;
-        png_destroy_write_struct(&png_ptr, &info_ptr);
+        DPRINTF(0, "Can't open screen capture file '%s'\n", filename.c_str());
         return false;
     }
 
-    // png_init_io(png_ptr, out);
-    png_set_write_fn(png_ptr, (void*) out, PNGWriteData, NULL);
-
-    png_set_compression_level(png_ptr, Z_BEST_COMPRESSION);
-    png_set_IHDR(png_ptr, info_ptr,
-                 width, height,
-                 8,
-                 PNG_COLOR_TYPE_RGB,
-                 PNG_INTERLACE_NONE,
-                 PNG_COMPRESSION_TYPE_DEFAULT,
-                 PNG_FILTER_TYPE_DEFAULT);
-
-    png_write_info(png_ptr, info_ptr);
-    png_write_image(png_ptr, row_pointers);
-    png_write_end(png_ptr, info_ptr);
+    glReadBuffer(GL_BACK);
+    GetImageReader(width, height)->readFrame(x, y, new PNGWriter(out, filename));
 
-    // Clean up everything . . .
-    png_destroy_write_struct(&png_ptr, &info_ptr);
-    delete[] row_pointers;
-    delete[] pixels;
-    fclose(out);
+    // TODO: Check for GL errors
 
     return true;
 }
-
-
@@ -67,8 +67,14 @@
 #include <GL/glew.h>
 #include <string>
 #include <cstring>
+#include <algorithm>
 #include "theora/theora.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define YUV_CONVERT_SSE2 1
+#include <emmintrin.h>
+#endif
+
 using namespace std;
 
 #include "oggtheoracapture.h"
@@ -81,6 +87,161 @@ using namespace std;
 //  {"framerate-denominator",optional_argument,NULL,'F'},
 
 
+// Fixed point coefficients of the RGB to YUV conversion formulas above,
+// scaled by 2^13. The offsets include rounding.
+static const int YR = 2104;
+static const int YG = 4130;
+static const int YB = 802;
+static const int YOffset = 4096 + 131072;
+static const int UR = -1214;
+static const int UG = -2384;
+static const int UB = 3598;
+static const int VR = 3598;
+static const int VG = -3013;
+static const int VB = -585;
+static const int UVOffset = 4096 + 1048576;
+
+// Maximum frames waiting to be encoded; each one takes 4 bytes per pixel
+static const unsigned int MaxQueuedFrames = 4;
+
+
+static inline unsigned char rgbToY(const unsigned char* rgba)
+{
+    return (unsigned char) min((rgba[0] * YR + rgba[1] * YG + rgba[2] * YB + YOffset) >> 13, 235);
+}
+
+
+#ifdef YUV_CONVERT_SSE2
+// Add the adjacent pairs of 32-bit values in a and b: the result is
+// (a0 + a1, a2 + a3, b0 + b1, b2 + b3).
+static inline __m128i addPairs(__m128i a, __m128i b)
+{
+    __m128 fa = _mm_castsi128_ps(a);
+    __m128 fb = _mm_castsi128_ps(b);
+    __m128i even = _mm_castps_si128(_mm_shuffle_ps(fa, fb, _MM_SHUFFLE(2, 0, 2, 0)));
+    __m128i odd  = _mm_castps_si128(_mm_shuffle_ps(fa, fb, _MM_SHUFFLE(3, 1, 3, 1)));
+    return _mm_add_epi32(even, odd);
+}
+
+
+// Compute the luma of four RGBA pixels, before scaling
+static inline __m128i lumaSSE2(__m128i rgba, __m128i coeffs)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(rgba, zero), coeffs);
+    __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(rgba, zero), coeffs);
+    return addPairs(lo, hi);
+}
+
+
+// Compute the chroma of the two 2x2 blocks formed by four pixels from each
+// of two rows, before scaling; the result is (u0, u1, v0, v1).
+static inline __m128i chromaSSE2(__m128i rgba0, __m128i rgba1, __m128i uCoeffs, __m128i vCoeffs)
+{
+    __m128i zero = _mm_setzero_si128();
+
+    // Sum the pixels vertically, then horizontally
+    __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(rgba0, zero), _mm_unpacklo_epi8(rgba1, zero));
+    __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(rgba0, zero), _mm_unpackhi_epi8(rgba1, zero));
+    lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+    hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+    __m128i blocks = _mm_unpacklo_epi64(lo, hi);
+
+    return addPairs(_mm_madd_epi16(blocks, uCoeffs), _mm_madd_epi16(blocks, vCoeffs));
+}
+#endif // YUV_CONVERT_SSE2
+
+
+/*! Convert two rows of RGBA pixels to two rows of luma and one row each of
+ *  the U and V chroma planes, which are subsampled 2x2. If the width is odd,
+ *  the chroma of the last column is computed from a single column.
+ */
+static void convertRowPair(const unsigned char* rgba0,
+                           const unsigned char* rgba1,
+                           int width,
+                           unsigned char* y0,
+                           unsigned char* y1,
+                           unsigned char* u,
+                           unsigned char* v)
+{
+    int x = 0;
+
+#ifdef YUV_CONVERT_SSE2
+    const __m128i yCoeffs = _mm_setr_epi16(YR, YG, YB, 0, YR, YG, YB, 0);
+    const __m128i uCoeffs = _mm_setr_epi16(UR, UG, UB, 0, UR, UG, UB, 0);
+    const __m128i vCoeffs = _mm_setr_epi16(VR, VG, VB, 0, VR, VG, VB, 0);
+    const __m128i yOffset = _mm_set1_epi32(YOffset);
+    const __m128i uvOffset = _mm_set1_epi32(UVOffset * 4);
+    const __m128i yMax = _mm_set1_epi16(235);
+    const __m128i uvMax = _mm_set1_epi16(240);
+
+    // Eight pixels from each row at a time
+    for (; x + 8 <= width; x += 8)
+    {
+        __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rgba0 + x * 4));
+        __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rgba0 + x * 4 + 16));
+        __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rgba1 + x * 4));
+        __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rgba1 + x * 4 + 16));
+
+        __m128i ya = _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(lumaSSE2(a0, yCoeffs), yOffset), 13),
+                                     _mm_srai_epi32(_mm_add_epi32(lumaSSE2(a1, yCoeffs), yOffset), 13));
+        __m128i yb = _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(lumaSSE2(b0, yCoeffs), yOffset), 13),
+                                     _mm_srai_epi32(_mm_add_epi32(lumaSSE2(b1, yCoeffs), yOffset), 13));
+        ya = _mm_min_epi16(ya, yMax);
+        yb = _mm_min_epi16(yb, yMax);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(y0 + x), _mm_packus_epi16(ya, ya));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(y1 + x), _mm_packus_epi16(yb, yb));
+
+        __m128i uv0 = _mm_srai_epi32(_mm_add_epi32(chromaSSE2(a0, b0, uCoeffs, vCoeffs), uvOffset), 15);
+        __m128i uv1 = _mm_srai_epi32(_mm_add_epi32(chromaSSE2(a1, b1, uCoeffs, vCoeffs), uvOffset), 15);
+        __m128 f0 = _mm_castsi128_ps(uv0);
+        __m128 f1 = _mm_castsi128_ps(uv1);
+        __m128i us = _mm_castps_si128(_mm_shuffle_ps(f0, f1, _MM_SHUFFLE(1, 0, 1, 0)));
+        __m128i vs = _mm_castps_si128(_mm_shuffle_ps(f0, f1, _MM_SHUFFLE(3, 2, 3, 2)));
+        __m128i uv = _mm_min_epi16(_mm_packs_epi32(us, vs), uvMax);
+        uv = _mm_packus_epi16(uv, uv);
+
+        int u4 = _mm_cvtsi128_si32(uv);
+        int v4 = _mm_cvtsi128_si32(_mm_srli_si128(uv, 4));
+        memcpy(u + x / 2, &u4, 4);
+        memcpy(v + x / 2, &v4, 4);
+    }
+#endif // YUV_CONVERT_SSE2
+
+    for (; x < width; x += 2)
+    {
+        int x1 = x + 1 < width ? x + 1 : x;
+        const unsigned char* p00 = rgba0 + x * 4;
+        const unsigned char* p01 = rgba0 + x1 * 4;
+        const unsigned char* p10 = rgba1 + x * 4;
+        const unsigned char* p11 = rgba1 + x1 * 4;
+
+        y0[x] = rgbToY(p00);
+        y0[x1] = rgbToY(p01);
+        y1[x] = rgbToY(p10);
+        y1[x1] = rgbToY(p11);
+
+        int r = p00[0] + p01[0] + p10[0] + p11[0];
+        int g = p00[1] + p01[1] + p10[1] + p11[1];
+        int b = p00[2] + p01[2] + p10[2] + p11[2];
+        u[x / 2] = (unsigned char) min((r * UR + g * UG + b * UB + UVOffset * 4) >> 15, 240);
+        v[x / 2] = (unsigned char) min((r * VR + g * VG + b * VB + UVOffset * 4) >> 15, 240);
+    }
+}
+
+
+// Runs on the frame reader's worker thread
+class OggTheoraCapture::FrameEncoder : public FrameWriter
+{
+public:
+    FrameEncoder(OggTheoraCapture* _capture) : capture(_capture) {};
+    void write(const unsigned char* pixels, int, int) { capture->encodeFrame(pixels); }
+
+private:
+    OggTheoraCapture* capture;
+};
+
+
 OggTheoraCapture::OggTheoraCapture():
     video_x(0),
     video_y(0),
@@ -97,8 +258,9 @@ OggTheoraCapture::OggTheoraCapture():
     capturing(false),
     video_frame_count(0),
     video_bytesout(0),
-    rowStride(0),
-    pixels(NULL),
+    bytesout_mutex(NewMutex()),
+    reader(NULL),
+    encoded_frame_count(0),
     outfile(NULL)
 {
     yuvframe[0] = NULL;
@@ -279,28 +441,22 @@ bool OggTheoraCapture::start(const std::string& filename,
         fwrite(videopage.body,1,  videopage.body_len,outfile);
     }
     /* Initialize the double frame buffer.
-     * We allocate enough for a 4:4:4 color sampling
+     * The frames are converted straight to 4:2:0 color sampling
      */
-    yuvframe[0]= new unsigned char[video_x*video_y*3];
-    yuvframe[1]= new unsigned char[video_x*video_y*3];
-
-    // Now the buffer for reading the GL RGB pixels
-    rowStride = (frame_x * 3 + 3) & ~0x3;
-    pixels = new unsigned char[rowStride*frame_y];
+    yuvframe[0]= new unsigned char[video_x*video_y*3/2];
+    yuvframe[1]= new unsigned char[video_x*video_y*3/2];
 
         /* clear initial frame as it may be larger than actual video data */
         /* fill Y plane with 0x10 and UV planes with 0x80, for black data */
-    // The UV plane must be 4:2:0
     memset(yuvframe[0],0x10,video_x*video_y);
-    memset(yuvframe[0]+video_x*video_y,0x80,video_x*video_y*2);
+    memset(yuvframe[0]+video_x*video_y,0x80,video_x*video_y/2);
     memset(yuvframe[1],0x10,video_x*video_y);
-    memset(yuvframe[1]+video_x*video_y,0x80,video_x*video_y*2);
+    memset(yuvframe[1]+video_x*video_y,0x80,video_x*video_y/2);
 
     yuv.y_width=video_x;
     yuv.y_height=video_y;
     yuv.y_stride=video_x;
 
-    // Note we lie here by saying it's 4:2:0 and we will convert 4:4:4 to 4:2;0 later
     yuv.uv_width=video_x/2;
     yuv.uv_height=video_y/2;
     yuv.uv_stride=video_x/2;
@@ -313,6 +469,11 @@ bool OggTheoraCapture::start(const std::string& filename,
            video_x,video_y,
            frame_x_offset,frame_y_offset);
 
+    // Read frames back through pixel buffers, so that the render thread
+    // doesn't wait for them, and convert and encode them on a worker thread.
+    encoded_frame_count = 0;
+    reader = new FrameReader(frame_x, frame_y, true, MaxQueuedFrames);
+
     capturing = true;
     return true;
 }
@@ -322,44 +483,38 @@ bool OggTheoraCapture::captureFrame()
     if (!capturing)
         return false;
 
-    while (ogg_stream_pageout(&to,&videopage)>0)
-    {
-        /* flush a video page */
-        video_bytesout+=fwrite(videopage.header,1,videopage.header_len,outfile);
-        video_bytesout+=fwrite(videopage.body,1,videopage.body_len,outfile);
-
-    }
-    if(ogg_stream_eos(&to)) return false;
-
     // Get the dimensions of the current viewport
     int viewport[4];
     glGetIntegerv(GL_VIEWPORT, viewport);
 
     int x = viewport[0] + (viewport[2] - frame_x) / 2;
     int y = viewport[1] + (viewport[3] - frame_y) / 2;
-    glReadPixels(x, y, frame_x, frame_y,
-             GL_RGB, GL_UNSIGNED_BYTE,
-             pixels);
-
-    unsigned char *ybase = yuvframe[0];
-    unsigned char *ubase = yuvframe[0]+ video_x*video_y;
-    unsigned char *vbase = yuvframe[0]+ video_x*video_y*2;
-    // We go ahead and build 4:4:4 frames
-    for (int y=0; y<frame_y; y++)
+    reader->readFrame(x, y, new FrameEncoder(this));
+
+    video_frame_count += 1;
+    //if ((video_frame_count % 10) == 0)
+    //    printf("Writing frame %d\n", video_frame_count);
+    frameCaptured();
+
+    return true;
+}
+
+void OggTheoraCapture::encodeFrame(const unsigned char* pixels)
+{
+    unsigned char *ybase = yuvframe[0] + video_x*frame_y_offset + frame_x_offset;
+    unsigned char *ubase = yuvframe[0] + video_x*video_y + (video_x/2)*(frame_y_offset/2) + frame_x_offset/2;
+    unsigned char *vbase = ubase + video_x*video_y/4;
+    int rgbaStride = frame_x * 4;
+
+    // Build the 4:2:0 frame two rows at a time
+    for (int y=0; y<frame_y; y+=2)
     {
-        unsigned char *yptr = ybase + (video_x*(y+frame_y_offset))+frame_x_offset;
-        unsigned char *uptr = ubase + (video_x*(y+frame_y_offset))+frame_x_offset;
-        unsigned char *vptr = vbase + (video_x*(y+frame_y_offset))+frame_x_offset;
-        unsigned char *rgb = pixels + ((frame_y-1-y)*rowStride); // The video is inverted
-        for (int x=0; x<frame_x; x++)
-        {
-            unsigned char r = *rgb++;
-            unsigned char g = *rgb++;
-            unsigned char b = *rgb++;
-            *yptr++ = min(abs(r * 2104 + g * 4130 + b * 802 + 4096 + 131072) >> 13,235);
-            *uptr++ = min(abs(r * -1214 + g * -2384 + b * 3598 + 4096 + 1048576) >> 13,240);
-            *vptr++ = min(abs(r * 3598 + g * -3013 + b * -585 + 4096 + 1048576) >> 13,240);
-        }
+        int y1 = min(y+1, frame_y-1);
+        const unsigned char *rgba0 = pixels + (frame_y-1-y)*rgbaStride; // The video is inverted
+        const unsigned char *rgba1 = pixels + (frame_y-1-y1)*rgbaStride;
+        convertRowPair(rgba0, rgba1, frame_x,
+                       ybase + video_x*y, ybase + video_x*y1,
+                       ubase + (video_x/2)*(y/2), vbase + (video_x/2)*(y/2));
     }
 
     /*
@@ -369,50 +524,40 @@ bool OggTheoraCapture::captureFrame()
      * for compression and pull out the packet
      */
 
-    if (video_frame_count > 0)
-    {
-        yuv.y= yuvframe[1];
-        yuv.u= yuvframe[1]+ video_x*video_y;
-        yuv.v= yuvframe[1]+ video_x*video_y*2;
-        // Convert to 4:2:0
-        unsigned char * uin0 = yuv.u;
-        unsigned char * uin1 = yuv.u + video_x;
-        unsigned char * uout = yuv.u;
-        unsigned char * vin0 = yuv.v;
-        unsigned char * vin1 = yuv.v + video_x;
-        unsigned char * vout = yuv.v; 
-        for (int y = 0; y < video_y; y += 2)
-        {
-            for (int x = 0; x < video_x; x += 2)
-            {
-                *uout = (uin0[0] + uin0[1] + uin1[0] + uin1[1]) >> 2;
-                uin0 += 2;
-                uin1 += 2;
-                uout++;
-                *vout = (vin0[0] + vin0[1] + vin1[0] + vin1[1]) >> 2;
-                vin0 += 2;
-                vin1 += 2;
-                vout++;
-            }
-            uin0 += video_x;
-            uin1 += video_x;
-            vin0 += video_x;
-            vin1 += video_x;
-        }
-        theora_encode_YUVin(&td,&yuv);
-        theora_encode_packetout(&td,0,&op);
-        ogg_stream_packetin(&to,&op);
-    }
-    video_frame_count += 1;
-    //if ((video_frame_count % 10) == 0)
-    //    printf("Writing frame %d\n", video_frame_count);
+    if (encoded_frame_count > 0)
+        encodeYUVFrame(yuvframe[1], 0);
+    encoded_frame_count += 1;
+
     unsigned char *temp = yuvframe[0];
     yuvframe[0] = yuvframe[1];
     yuvframe[1] = temp;
-    frameCaptured();
+}
 
-    return true;
+void OggTheoraCapture::encodeYUVFrame(unsigned char* frame, int last)
+{
+    yuv.y= frame;
+    yuv.u= frame + video_x*video_y;
+    yuv.v= frame + video_x*video_y*5/4;
+    theora_encode_YUVin(&td,&yuv);
+    theora_encode_packetout(&td,last,&op);
+    ogg_stream_packetin(&to,&op);
+    writePages();
+}
+
+void OggTheoraCapture::writePages()
+{
+    int bytes = 0;
+    while (ogg_stream_pageout(&to,&videopage)>0)
+    {
+        /* flush a video page */
+        bytes+=fwrite(videopage.header,1,videopage.header_len,outfile);
+        bytes+=fwrite(videopage.body,1,videopage.body_len,outfile);
+    }
+
+    MutexLock lock(bytesout_mutex);
+    video_bytesout += bytes;
 }
+
 void OggTheoraCapture::cleanup()
 {
     capturing = false;
@@ -420,51 +565,17 @@ void OggTheoraCapture::cleanup()
 
     if(outfile)
     {
-        printf(_("OggTheoraCapture::cleanup() - wrote %d frames\n"), video_frame_count);
-        if (video_frame_count > 0)
-        {
-            yuv.y= yuvframe[1];
-            yuv.u= yuvframe[1]+ video_x*video_y;
-            yuv.v= yuvframe[1]+ video_x*video_y*2 ;
-            // Convert to 4:2:0
-            unsigned char * uin0 = yuv.u;
-            unsigned char * uin1 = yuv.u + video_x;
-            unsigned char * uout = yuv.u;
-            unsigned char * vin0 = yuv.v;
-            unsigned char * vin1 = yuv.v + video_x;
-            unsigned char * vout = yuv.v;
-            for (int y = 0; y < video_y; y += 2)
-            {
-                for (int x = 0; x < video_x; x += 2)
-                {
-                    *uout = (uin0[0] + uin0[1] + uin1[0] + uin1[1]) >> 2;
-                    uin0 += 2;
-                    uin1 += 2;
-                    uout++;
-                    *vout = (vin0[0] + vin0[1] + vin1[0] + vin1[1]) >> 2;
-                    vin0 += 2;
-                    vin1 += 2;
-                    vout++;
-                }
-                uin0 += video_x;
-                uin1 += video_x;
-                vin0 += video_x;
-                vin1 += video_x;
-            }
-            theora_encode_YUVin(&td,&yuv);
-            theora_encode_packetout(&td,1,&op);
-            ogg_stream_packetin(&to,&op);
-        }
-        while(ogg_stream_pageout(&to,&videopage)>0)
-        {
-            /* flush a video page */
-            video_bytesout+=fwrite(videopage.header,1,videopage.header_len,outfile);
-            video_bytesout+=fwrite(videopage.body,1,videopage.body_len,outfile);
+        // Wait for the frames still being read back and encoded
+        delete reader;
+        reader = NULL;
 
-        }
+        printf(_("OggTheoraCapture::cleanup() - wrote %d frames\n"), video_frame_count);
+        if (encoded_frame_count > 0)
+            encodeYUVFrame(yuvframe[1], 1);
         if(ogg_stream_flush(&to,&videopage)>0)
         {
             /* flush a video page */
+            MutexLock lock(bytesout_mutex);
             video_bytesout+=fwrite(videopage.header,1,videopage.header_len,outfile);
             video_bytesout+=fwrite(videopage.body,1,videopage.body_len,outfile);
 
@@ -477,7 +588,6 @@ void OggTheoraCapture::cleanup()
         outfile = NULL;
         delete [] yuvframe[0];
         delete [] yuvframe[1];
-        delete [] pixels;
     }
 }
 
@@ -498,6 +608,11 @@ int OggTheoraCapture::getFrameCount() const
 {
     return video_frame_count;
 }
+int OggTheoraCapture::getBytesOut() const
+{
+    MutexLock lock(bytesout_mutex);
+    return video_bytesout;
+}
 float OggTheoraCapture::getFrameRate() const
 {
     return float(video_hzn)/float(video_hzd);
@@ -505,5 +620,6 @@ float OggTheoraCapture::getFrameRate() const
 OggTheoraCapture::~OggTheoraCapture()
 {
     cleanup();
+    delete bytesout_mutex;
 }
 
@@ -4,6 +4,7 @@
 
 #include "theora/theora.h"
 #include "moviecapture.h"
+#include "framereader.h"
 
 class OggTheoraCapture : public MovieCapture
 {
@@ -19,13 +20,19 @@ public:
     int getHeight() const;
     float getFrameRate() const;
     int getFrameCount() const;
-    int getBytesOut() const { return video_bytesout; } ;
+    int getBytesOut() const;
     void setAspectRatio(int, int);
     void setQuality(float);
     void recordingStatus(bool) {};  // Added to allow GTK compilation
 
 private:
+    class FrameEncoder;
+    friend class FrameEncoder;
+
     void cleanup();
+    void encodeFrame(const unsigned char* pixels);
+    void encodeYUVFrame(unsigned char* frame, int last);
+    void writePages();
 
 private:
     int video_x;
@@ -44,13 +51,17 @@ private:
     bool        capturing;
     int        video_frame_count;
     int        video_bytesout;
+    Mutex      *bytesout_mutex;
+
+    // Frames are read back and encoded on a worker thread, which owns
+    // everything below once capture has started.
+    FrameReader    *reader;
+    int        encoded_frame_count;
 
     // Consider RGB to YUV Color converstion table - jpeglib has one
     // but according the standards it's incorrect (generates values 0-255,
     // instead of clamped to 16-240).
 
-    int        rowStride;
-    unsigned char  *pixels;
     unsigned char  *yuvframe[2];
     yuv_buffer    yuv;
     FILE           *outfile;
@@ -0,0 +1,143 @@
+// sse2math.h
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// Elementary functions for pairs of doubles in SSE2 registers.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#ifndef _CELMATH_SSE2MATH_H_
+#define _CELMATH_SSE2MATH_H_
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CELMATH_SSE2 1
+#endif
+
+#ifdef CELMATH_SSE2
+
+#include <emmintrin.h>
+
+
+// Sine and cosine of two doubles, using the range reduction and polynomials
+// from the Cephes library. The arguments must be less than about 1e9 in
+// magnitude; the results are accurate to within a couple of units in the
+// last place over that range.
+static inline void sinCosPD(__m128d x, __m128d& sinx, __m128d& cosx)
+{
+    // Cody-Waite reduction constants: pi/4 split into three parts
+    const __m128d DP1 = _mm_set1_pd(7.85398125648498535156e-1);
+    const __m128d DP2 = _mm_set1_pd(3.77489470793079817668e-8);
+    const __m128d DP3 = _mm_set1_pd(2.69515142907905952645e-15);
+
+    // sin(x) = -sin(-x) and cos(x) = cos(-x), so reduce |x| and restore
+    // the sign of the sine at the end.
+    __m128d signBit = _mm_and_pd(x, _mm_set1_pd(-0.0));
+    x = _mm_andnot_pd(_mm_set1_pd(-0.0), x);
+
+    // Octant of the argument, rounded up to an even number
+    __m128i j = _mm_cvttpd_epi32(_mm_mul_pd(x, _mm_set1_pd(1.27323954473516268615)));
+    j = _mm_and_si128(_mm_add_epi32(j, _mm_set1_epi32(1)), _mm_set1_epi32(~1));
+    __m128d y = _mm_cvtepi32_pd(j);
+
+    // The sine is negative in octants 4 and 6 (mod 8), and the cosine in
+    // octants 2 and 4. Octants 2 and 6 swap the sine and cosine polynomials.
+    // Widen the 32-bit per-lane flags to 64 bits.
+    __m128i sinNegate = _mm_slli_epi32(_mm_and_si128(j, _mm_set1_epi32(4)), 29);
+    sinNegate = _mm_shuffle_epi32(sinNegate, _MM_SHUFFLE(1, 1, 0, 0));
+    sinNegate = _mm_and_si128(sinNegate, _mm_set_epi32(0x80000000, 0, 0x80000000, 0));
+    __m128i cosNegate = _mm_slli_epi32(_mm_and_si128(_mm_add_epi32(j, _mm_set1_epi32(2)),
+                                                     _mm_set1_epi32(4)), 29);
+    cosNegate = _mm_shuffle_epi32(cosNegate, _MM_SHUFFLE(1, 1, 0, 0));
+    cosNegate = _mm_and_si128(cosNegate, _mm_set_epi32(0x80000000, 0, 0x80000000, 0));
+    __m128i swap = _mm_cmpeq_epi32(_mm_and_si128(j, _mm_set1_epi32(2)), _mm_set1_epi32(2));
+    swap = _mm_shuffle_epi32(swap, _MM_SHUFFLE(1, 1, 0, 0));
+
+    __m128d z = _mm_sub_pd(_mm_sub_pd(_mm_sub_pd(x, _mm_mul_pd(y, DP1)),
+                                      _mm_mul_pd(y, DP2)),
+                           _mm_mul_pd(y, DP3));
+    __m128d zz = _mm_mul_pd(z, z);
+
+    __m128d c = _mm_set1_pd(-1.13585365213876817300e-11);
+    c = _mm_add_pd(_mm_mul_pd(c, zz), _mm_set1_pd(2.08757008419747316778e-9));
+    c = _mm_add_pd(_mm_mul_pd(c, zz), _mm_set1_pd(-2.75573141792967388112e-7));
+    c = _mm_add_pd(_mm_mul_pd(c, zz), _mm_set1_pd(2.48015872888517045348e-5));
+    c = _mm_add_pd(_mm_mul_pd(c, zz), _mm_set1_pd(-1.38888888888730564116e-3));
+    c = _mm_add_pd(_mm_mul_pd(c, zz), _mm_set1_pd(4.16666666666665929218e-2));
+    c = _mm_add_pd(_mm_sub_pd(_mm_set1_pd(1.0), _mm_mul_pd(zz, _mm_set1_pd(0.5))),
+                   _mm_mul_pd(_mm_mul_pd(zz, zz), c));
+
+    __m128d s = _mm_set1_pd(1.58962301576546568060e-10);
+    s = _mm_add_pd(_mm_mul_pd(s, zz), _mm_set1_pd(-2.50507477628578072866e-8));
+    s = _mm_add_pd(_mm_mul_pd(s, zz), _mm_set1_pd(2.75573136213857245213e-6));
+    s = _mm_add_pd(_mm_mul_pd(s, zz), _mm_set1_pd(-1.98412698295895385996e-4));
+    s = _mm_add_pd(_mm_mul_pd(s, zz), _mm_set1_pd(8.33333333332211858878e-3));
+    s = _mm_add_pd(_mm_mul_pd(s, zz), _mm_set1_pd(-1.66666666666666307295e-1));
+    s = _mm_add_pd(z, _mm_mul_pd(_mm_mul_pd(z, zz), s));
+
+    __m128d swapMask = _mm_castsi128_pd(swap);
+    sinx = _mm_or_pd(_mm_and_pd(swapMask, c), _mm_andnot_pd(swapMask, s));
+    cosx = _mm_or_pd(_mm_and_pd(swapMask, s), _mm_andnot_pd(swapMask, c));
+
+    sinx = _mm_xor_pd(_mm_xor_pd(sinx, _mm_castsi128_pd(sinNegate)), signBit);
+    cosx = _mm_xor_pd(cosx, _mm_castsi128_pd(cosNegate));
+}
+
+
+static inline __m128d sinPD(__m128d x)
+{
+    __m128d s, c;
+    sinCosPD(x, s, c);
+    return s;
+}
+
+
+static inline __m128d cosPD(__m128d x)
+{
+    __m128d s, c;
+    sinCosPD(x, s, c);
+    return c;
+}
+
+
+// Exponential of two doubles, using the range reduction and rational
+// approximation from the Cephes library. Arguments are clamped to
+// +/-708, beyond which the result isn't representable as a double.
+static inline __m128d expPD(__m128d x)
+{
+    // ln 2 split into two parts
+    const __m128d C1 = _mm_set1_pd(6.93145751953125e-1);
+    const __m128d C2 = _mm_set1_pd(1.42860682030941723212e-6);
+
+    x = _mm_min_pd(_mm_max_pd(x, _mm_set1_pd(-708.0)), _mm_set1_pd(708.0));
+
+    // exp(x) = 2^n * exp(r), with n the nearest integer to x / ln 2
+    __m128i n = _mm_cvtpd_epi32(_mm_mul_pd(x, _mm_set1_pd(1.4426950408889634073599)));
+    __m128d px = _mm_cvtepi32_pd(n);
+    x = _mm_sub_pd(_mm_sub_pd(x, _mm_mul_pd(px, C1)), _mm_mul_pd(px, C2));
+
+    __m128d xx = _mm_mul_pd(x, x);
+    __m128d p = _mm_set1_pd(1.26177193074810590878e-4);
+    p = _mm_add_pd(_mm_mul_pd(p, xx), _mm_set1_pd(3.02994407707441961300e-2));
+    p = _mm_add_pd(_mm_mul_pd(p, xx), _mm_set1_pd(9.99999999999999999910e-1));
+    p = _mm_mul_pd(p, x);
+    __m128d q = _mm_set1_pd(3.00198505138664455042e-6);
+    q = _mm_add_pd(_mm_mul_pd(q, xx), _mm_set1_pd(2.52448340349684104192e-3));
+    q = _mm_add_pd(_mm_mul_pd(q, xx), _mm_set1_pd(2.27265548208155028766e-1));
+    q = _mm_add_pd(_mm_mul_pd(q, xx), _mm_set1_pd(2.00000000000000000009e0));
+    x = _mm_add_pd(_mm_set1_pd(1.0),
+                   _mm_mul_pd(_mm_set1_pd(2.0), _mm_div_pd(p, _mm_sub_pd(q, p))));
+
+    // Build 2^n by moving the biased exponent of each lane into place
+    n = _mm_add_epi32(n, _mm_set1_epi32(1023));
+    n = _mm_shuffle_epi32(n, _MM_SHUFFLE(3, 1, 2, 0));
+    __m128d scale = _mm_castsi128_pd(_mm_slli_epi64(n, 52));
+
+    return _mm_mul_pd(x, scale);
+}
+
+#endif // CELMATH_SSE2
+
+#endif // _CELMATH_SSE2MATH_H_
@@ -10,6 +10,7 @@
 
 #include "mesh.h"
 #include <cassert>
+#include <cmath>
 #include <iostream>
 #include <algorithm>
 #include <Eigen/Core>
@@ -99,6 +100,8 @@ Mesh::VertexDescription::validate() const
             return false;
         if (attr.offset + VertexAttributeFormatSizes[attr.format] > stride)
             return false;
+        if (!isValidEncoding(attr.format, attr.encoding))
+            return false;
         // TODO: check for repetition of attributes
         // if (vertexAttributeMap[attr->semantic].format != InvalidFormat)
         //   return false;
@@ -108,6 +111,19 @@ Mesh::VertexDescription::validate() const
 }
 
 
+bool
+Mesh::VertexDescription::hasEncodedAttributes() const
+{
+    for (unsigned int i = 0; i < nAttributes; i++)
+    {
+        if (attributes[i].encoding != RawEncoding)
+            return true;
+    }
+
+    return false;
+}
+
+
 Mesh::VertexDescription::~VertexDescription()
 {
     delete[] attributes;
@@ -166,11 +182,94 @@ Mesh::PrimitiveGroup::getPrimitiveCount() const
 }
 
 
+Mesh::LevelOfDetail::LevelOfDetail(float _error) :
+    error(_error)
+{
+}
+
+
+Mesh::LevelOfDetail::~LevelOfDetail()
+{
+    for (vector<PrimitiveGroup*>::iterator iter = groups.begin();
+         iter != groups.end(); iter++)
+    {
+        delete *iter;
+    }
+}
+
+
+const Mesh::PrimitiveGroup*
+Mesh::LevelOfDetail::getGroup(unsigned int index) const
+{
+    if (index >= groups.size())
+        return NULL;
+    else
+        return groups[index];
+}
+
+
+Mesh::PrimitiveGroup*
+Mesh::LevelOfDetail::getGroup(unsigned int index)
+{
+    if (index >= groups.size())
+        return NULL;
+    else
+        return groups[index];
+}
+
+
+unsigned int
+Mesh::LevelOfDetail::addGroup(PrimitiveGroup* group)
+{
+    groups.push_back(group);
+    return groups.size();
+}
+
+
+unsigned int
+Mesh::LevelOfDetail::addGroup(PrimitiveGroupType prim,
+                              unsigned int materialIndex,
+                              unsigned int nIndices,
+                              index32* indices)
+{
+    PrimitiveGroup* g = new PrimitiveGroup();
+    g->prim = prim;
+    g->materialIndex = materialIndex;
+    g->nIndices = nIndices;
+    g->indices = indices;
+
+    return addGroup(g);
+}
+
+
+unsigned int
+Mesh::LevelOfDetail::getGroupCount() const
+{
+    return groups.size();
+}
+
+
+unsigned int
+Mesh::LevelOfDetail::getPrimitiveCount() const
+{
+    unsigned int count = 0;
+
+    for (vector<PrimitiveGroup*>::const_iterator iter = groups.begin();
+         iter != groups.end(); iter++)
+    {
+        count += (*iter)->getPrimitiveCount();
+    }
+
+    return count;
+}
+
+
 Mesh::Mesh() :
     vertexDesc(0, 0, NULL),
     nVertices(0),
     vertices(NULL),
-    vbResource(0)
+    vbResource(0),
+    pickBVH(NULL)
 {
 }
 
@@ -183,6 +282,8 @@ Mesh::~Mesh()
         delete *iter;
     }
 
+    clearLevelsOfDetail();
+
     // TODO: this is just to cast away void* and shut up GCC warnings;
     // should probably be static_cast<VertexList::VertexPart*>
     if (vertices != NULL)
@@ -194,6 +295,8 @@ Mesh::~Mesh()
     {
         delete vbResource;
     }
+
+    invalidatePickHierarchy();
 }
 
 
@@ -214,6 +317,7 @@ Mesh::setVertices(unsigned int _nVertices, void* vertexData)
 
     nVertices = _nVertices;
     vertices = vertexData;
+    invalidatePickHierarchy();
 }
 
 
@@ -224,6 +328,7 @@ Mesh::setVertexDescription(const VertexDescription& desc)
         return false;
 
     vertexDesc = desc;
+    invalidatePickHierarchy();
 
     return true;
 }
@@ -259,6 +364,7 @@ unsigned int
 Mesh::addGroup(PrimitiveGroup* group)
 {
     groups.push_back(group);
+    invalidatePickHierarchy();
     return groups.size();
 }
 
@@ -296,6 +402,72 @@ Mesh::clearGroups()
     }
 
     groups.clear();
+    invalidatePickHierarchy();
+}
+
+
+void
+Mesh::addLevelOfDetail(LevelOfDetail* lod)
+{
+    vector<LevelOfDetail*>::iterator iter = levelsOfDetail.begin();
+    while (iter != levelsOfDetail.end() && (*iter)->error <= lod->error)
+        iter++;
+    levelsOfDetail.insert(iter, lod);
+}
+
+
+const Mesh::LevelOfDetail*
+Mesh::getLevelOfDetail(unsigned int index) const
+{
+    if (index >= levelsOfDetail.size())
+        return NULL;
+    else
+        return levelsOfDetail[index];
+}
+
+
+Mesh::LevelOfDetail*
+Mesh::getLevelOfDetail(unsigned int index)
+{
+    if (index >= levelsOfDetail.size())
+        return NULL;
+    else
+        return levelsOfDetail[index];
+}
+
+
+unsigned int
+Mesh::getLevelOfDetailCount() const
+{
+    return levelsOfDetail.size();
+}
+
+
+void
+Mesh::clearLevelsOfDetail()
+{
+    for (vector<LevelOfDetail*>::iterator iter = levelsOfDetail.begin();
+         iter != levelsOfDetail.end(); iter++)
+    {
+        delete *iter;
+    }
+
+    levelsOfDetail.clear();
+}
+
+
+const Mesh::LevelOfDetail*
+Mesh::selectLevelOfDetail(float maxError) const
+{
+    // Levels are ordered from finest to coarsest
+    const LevelOfDetail* lod = NULL;
+    for (vector<LevelOfDetail*>::const_iterator iter = levelsOfDetail.begin();
+         iter != levelsOfDetail.end() && (*iter)->error <= maxError; iter++)
+    {
+        lod = *iter;
+    }
+
+    return lod;
 }
 
 
@@ -325,6 +497,23 @@ Mesh::remapIndices(const vector<index32>& indexMap)
             group->indices[i] = indexMap[group->indices[i]];
         }
     }
+
+    for (vector<LevelOfDetail*>::iterator lodIter = levelsOfDetail.begin();
+         lodIter != levelsOfDetail.end(); lodIter++)
+    {
+        vector<PrimitiveGroup*>& lodGroups = (*lodIter)->groups;
+        for (vector<PrimitiveGroup*>::iterator iter = lodGroups.begin();
+             iter != lodGroups.end(); iter++)
+        {
+            PrimitiveGroup* group = *iter;
+            for (index32 i = 0; i < group->nIndices; i++)
+            {
+                group->indices[i] = indexMap[group->indices[i]];
+            }
+        }
+    }
+
+    invalidatePickHierarchy();
 }
 
 
@@ -336,6 +525,17 @@ Mesh::remapMaterials(const vector<unsigned int>& materialMap)
     {
         (*iter)->materialIndex = materialMap[(*iter)->materialIndex];
     }
+
+    for (vector<LevelOfDetail*>::iterator lodIter = levelsOfDetail.begin();
+         lodIter != levelsOfDetail.end(); lodIter++)
+    {
+        vector<PrimitiveGroup*>& lodGroups = (*lodIter)->groups;
+        for (vector<PrimitiveGroup*>::iterator iter = lodGroups.begin();
+             iter != lodGroups.end(); iter++)
+        {
+            (*iter)->materialIndex = materialMap[(*iter)->materialIndex];
+        }
+    }
 }
 
 
@@ -356,15 +556,557 @@ void
 Mesh::aggregateByMaterial()
 {
     sort(groups.begin(), groups.end(), PrimitiveGroupComparator());
+
+    for (vector<LevelOfDetail*>::iterator iter = levelsOfDetail.begin();
+         iter != levelsOfDetail.end(); iter++)
+    {
+        sort((*iter)->groups.begin(), (*iter)->groups.end(), PrimitiveGroupComparator());
+    }
+
+    invalidatePickHierarchy();
+}
+
+
+// Meshes with fewer triangles than this are picked by testing every
+// triangle rather than building a hierarchy.
+static const unsigned int MinPickBVHTriangleCount = 64;
+
+// Number of bins used when evaluating splits with the surface area
+// heuristic, and the size of leaves that are never split further
+static const unsigned int PickBVHBinCount = 16;
+static const unsigned int MinPickBVHSplitSize = 4;
+
+// The hierarchy depth is limited so that it can be traversed with a
+// fixed size stack.
+static const unsigned int MaxPickBVHDepth = 48;
+
+// Cost of visiting a node relative to testing a triangle
+static const float PickBVHTraversalCost = 1.0f;
+
+
+static bool isTriangleGroup(const Mesh::PrimitiveGroup* group)
+{
+    Mesh::PrimitiveGroupType primType = group->prim;
+    return (primType == Mesh::TriList || primType == Mesh::TriStrip || primType == Mesh::TriFan) &&
+           group->nIndices >= 3 &&
+           !(primType == Mesh::TriList && group->nIndices % 3 != 0);
+}
+
+
+// Get the vertex indices of a triangle in a triangle list, strip, or fan
+static void getTriangle(const Mesh::PrimitiveGroup* group, unsigned int primitiveIndex,
+                        Mesh::index32& i0, Mesh::index32& i1, Mesh::index32& i2)
+{
+    const Mesh::index32* indices = group->indices;
+    if (group->prim == Mesh::TriList)
+    {
+        i0 = indices[primitiveIndex * 3];
+        i1 = indices[primitiveIndex * 3 + 1];
+        i2 = indices[primitiveIndex * 3 + 2];
+    }
+    else if (group->prim == Mesh::TriStrip)
+    {
+        // The orientation of alternate triangles in a strip is reversed,
+        // but that doesn't matter for picking.
+        i0 = indices[primitiveIndex];
+        i1 = indices[primitiveIndex + 1];
+        i2 = indices[primitiveIndex + 2];
+    }
+    else // TriFan
+    {
+        i0 = indices[0];
+        i1 = indices[primitiveIndex + 1];
+        i2 = indices[primitiveIndex + 2];
+    }
+}
+
+
+// Compute the intersection of a ray with a triangle. Return true and set
+// t to the distance along the ray if there's an intersection closer than
+// closest.
+static bool rayTriangleIntersect(const Vector3d& rayOrigin, const Vector3d& rayDirection,
+                                 const Vector3d& v0, const Vector3d& v1, const Vector3d& v2,
+                                 double closest, double& t)
+{
+    // Compute the edge vectors e0 and e1, and the normal n
+    Vector3d e0 = v1 - v0;
+    Vector3d e1 = v2 - v0;
+    Vector3d n = e0.cross(e1);
+
+    // c is the cosine of the angle between the ray and triangle normal
+    double c = n.dot(rayDirection);
+
+    // If the ray is parallel to the triangle, it either misses the
+    // triangle completely, or is contained in the triangle's plane.
+    // If it's contained in the plane, we'll still call it a miss.
+    if (c == 0.0)
+        return false;
+
+    t = (n.dot(v0 - rayOrigin)) / c;
+    if (t >= closest || t <= 0.0)
+        return false;
+
+    double m00 = e0.dot(e0);
+    double m01 = e0.dot(e1);
+    double m10 = e1.dot(e0);
+    double m11 = e1.dot(e1);
+    double det = m00 * m11 - m01 * m10;
+    if (det == 0.0)
+        return false;
+
+    Vector3d p = rayOrigin + rayDirection * t;
+    Vector3d q = p - v0;
+    double q0 = e0.dot(q);
+    double q1 = e1.dot(q);
+    double d = 1.0 / det;
+    double s0 = (m11 * q0 - m01 * q1) * d;
+    double s1 = (m00 * q1 - m10 * q0) * d;
+    return s0 >= 0.0 && s1 >= 0.0 && s0 + s1 <= 1.0;
+}
+
+
+static inline Vector3d vertexPosition(const char* vdata, unsigned int stride, Mesh::index32 index)
+{
+    return Map<Vector3f>(reinterpret_cast<const float*>(vdata + index * stride)).cast<double>();
+}
+
+
+/* Bounding volume hierarchy over the triangles of a mesh, used to
+ * accelerate picking. The hierarchy is built top down, splitting nodes
+ * where the surface area heuristic estimates the lowest cost of tracing a
+ * ray, with the candidate splits taken from a fixed number of bins along
+ * each axis. The bounding boxes are single precision, as are the vertex
+ * positions they bound.
+ */
+class Mesh::PickBVH
+{
+public:
+    PickBVH(const vector<PrimitiveGroup*>& groups, const char* vdata, unsigned int stride);
+
+    bool pick(const vector<PrimitiveGroup*>& groups, const char* vdata, unsigned int stride,
+              const Vector3d& rayOrigin, const Vector3d& rayDirection,
+              PickResult* result) const;
+
+private:
+    struct Triangle
+    {
+        index32 vertices[3];
+        unsigned int group;
+        unsigned int primitiveIndex;
+    };
+
+    struct Node
+    {
+        float boxMin[3];
+        float boxMax[3];
+        unsigned int first;   // first triangle of a leaf, or second child of an
+                              // interior node; the first child immediately
+                              // follows its parent.
+        unsigned int count;   // number of triangles in a leaf; zero for interior nodes
+    };
+
+    struct Bounds
+    {
+        Bounds();
+        void extend(const float* p);
+        void extend(const Bounds& b);
+        float area() const;
+
+        float boxMin[3];
+        float boxMax[3];
+    };
+
+    void buildNode(unsigned int first, unsigned int count, unsigned int depth,
+                   const vector<Bounds>& triangleBounds,
+                   const vector<Vector3f>& centroids);
+    bool intersectBox(const Node& node, const double* origin, const double* invDirection,
+                      double closest, double& tNear) const;
+
+    vector<Triangle> triangles;
+    vector<Node> nodes;
+    vector<unsigned int> order;
+};
+
+
+Mesh::PickBVH::Bounds::Bounds()
+{
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        boxMin[i] = 1.0e30f;
+        boxMax[i] = -1.0e30f;
+    }
+}
+
+
+void
+Mesh::PickBVH::Bounds::extend(const float* p)
+{
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        boxMin[i] = min(boxMin[i], p[i]);
+        boxMax[i] = max(boxMax[i], p[i]);
+    }
+}
+
+
+void
+Mesh::PickBVH::Bounds::extend(const Bounds& b)
+{
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        boxMin[i] = min(boxMin[i], b.boxMin[i]);
+        boxMax[i] = max(boxMax[i], b.boxMax[i]);
+    }
+}
+
+
+float
+Mesh::PickBVH::Bounds::area() const
+{
+    if (boxMin[0] > boxMax[0])
+        return 0.0f;
+
+    float dx = boxMax[0] - boxMin[0];
+    float dy = boxMax[1] - boxMin[1];
+    float dz = boxMax[2] - boxMin[2];
+    return dx * dy + dy * dz + dz * dx;
 }
 
 
+Mesh::PickBVH::PickBVH(const vector<PrimitiveGroup*>& groups,
+                       const char* vdata,
+                       unsigned int stride)
+{
+    vector<Bounds> triangleBounds;
+    vector<Vector3f> centroids;
+
+    for (unsigned int g = 0; g < groups.size(); g++)
+    {
+        const PrimitiveGroup* group = groups[g];
+        if (!isTriangleGroup(group))
+            continue;
+
+        unsigned int primitiveCount = group->getPrimitiveCount();
+        for (unsigned int i = 0; i < primitiveCount; i++)
+        {
+            Triangle tri;
+            getTriangle(group, i, tri.vertices[0], tri.vertices[1], tri.vertices[2]);
+
+            // Skip the degenerate triangles often found in strips
+            if (tri.vertices[0] == tri.vertices[1] ||
+                tri.vertices[1] == tri.vertices[2] ||
+                tri.vertices[2] == tri.vertices[0])
+            {
+                continue;
+            }
+
+            tri.group = g;
+            tri.primitiveIndex = i;
+            triangles.push_back(tri);
+
+            Bounds b;
+            for (unsigned int j = 0; j < 3; j++)
+                b.extend(reinterpret_cast<const float*>(vdata + tri.vertices[j] * stride));
+            triangleBounds.push_back(b);
+            centroids.push_back((Map<Vector3f>(b.boxMin) + Map<Vector3f>(b.boxMax)) * 0.5f);
+        }
+    }
+
+    order.resize(triangles.size());
+    for (unsigned int i = 0; i < order.size(); i++)
+        order[i] = i;
+
+    if (!triangles.empty())
+    {
+        nodes.reserve(triangles.size() / 2 + 1);
+        buildNode(0, triangles.size(), 0, triangleBounds, centroids);
+    }
+
+    // Store the triangles in leaf order
+    vector<Triangle> sortedTriangles(triangles.size());
+    for (unsigned int i = 0; i < order.size(); i++)
+        sortedTriangles[i] = triangles[order[i]];
+    triangles.swap(sortedTriangles);
+    order.clear();
+}
+
+
+class BinIndexPredicate
+{
+public:
+    BinIndexPredicate(const vector<Vector3f>& _centroids,
+                      unsigned int _axis,
+                      float _binMin,
+                      float _binScale,
+                      unsigned int _splitBin) :
+        centroids(_centroids),
+        axis(_axis),
+        binMin(_binMin),
+        binScale(_binScale),
+        splitBin(_splitBin)
+    {
+    }
+
+    bool operator()(unsigned int triangle) const
+    {
+        return binIndex(centroids[triangle][axis]) < splitBin;
+    }
+
+    unsigned int binIndex(float x) const
+    {
+        int bin = (int) ((x - binMin) * binScale);
+        return (unsigned int) max(0, min(bin, (int) PickBVHBinCount - 1));
+    }
+
+private:
+    const vector<Vector3f>& centroids;
+    unsigned int axis;
+    float binMin;
+    float binScale;
+    unsigned int splitBin;
+};
+
+
+void
+Mesh::PickBVH::buildNode(unsigned int first, unsigned int count, unsigned int depth,
+                         const vector<Bounds>& triangleBounds,
+                         const vector<Vector3f>& centroids)
+{
+    unsigned int nodeIndex = nodes.size();
+    nodes.push_back(Node());
+
+    Bounds nodeBounds;
+    Bounds centroidBounds;
+    for (unsigned int i = first; i < first + count; i++)
+    {
+        nodeBounds.extend(triangleBounds[order[i]]);
+        centroidBounds.extend(centroids[order[i]].data());
+    }
+
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        nodes[nodeIndex].boxMin[i] = nodeBounds.boxMin[i];
+        nodes[nodeIndex].boxMax[i] = nodeBounds.boxMax[i];
+    }
+    nodes[nodeIndex].first = first;
+    nodes[nodeIndex].count = count;
+
+    if (count <= MinPickBVHSplitSize || depth >= MaxPickBVHDepth)
+        return;
+
+    // Find the split with the lowest cost over the bins of every axis
+    float bestCost = (float) count * nodeBounds.area();
+    unsigned int bestAxis = 0;
+    unsigned int bestSplit = 0;
+
+    for (unsigned int axis = 0; axis < 3; axis++)
+    {
+        float extent = centroidBounds.boxMax[axis] - centroidBounds.boxMin[axis];
+        if (extent <= 0.0f)
+            continue;
+
+        BinIndexPredicate binner(centroids, axis, centroidBounds.boxMin[axis],
+                                 (float) PickBVHBinCount / extent, 0);
+        Bounds binBounds[PickBVHBinCount];
+        unsigned int binCounts[PickBVHBinCount];
+        for (unsigned int bin = 0; bin < PickBVHBinCount; bin++)
+            binCounts[bin] = 0;
+
+        for (unsigned int i = first; i < first + count; i++)
+        {
+            unsigned int bin = binner.binIndex(centroids[order[i]][axis]);
+            binBounds[bin].extend(triangleBounds[order[i]]);
+            binCounts[bin]++;
+        }
+
+        // Sweep from the right to get the area and count of the bins to
+        // the right of each split, then from the left to evaluate them.
+        float rightAreas[PickBVHBinCount];
+        unsigned int rightCounts[PickBVHBinCount];
+        Bounds right;
+        unsigned int rightCount = 0;
+        for (unsigned int bin = PickBVHBinCount - 1; bin > 0; bin--)
+        {
+            right.extend(binBounds[bin]);
+            rightCount += binCounts[bin];
+            rightAreas[bin] = right.area();
+            rightCounts[bin] = rightCount;
+        }
+
+        Bounds left;
+        unsigned int leftCount = 0;
+        for (unsigned int split = 1; split < PickBVHBinCount; split++)
+        {
+            left.extend(binBounds[split - 1]);
+            leftCount += binCounts[split - 1];
+            if (leftCount == 0 || rightCounts[split] == 0)
+                continue;
+
+            float cost = PickBVHTraversalCost * nodeBounds.area() +
+                         (float) leftCount * left.area() +
+                         (float) rightCounts[split] * rightAreas[split];
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = split;
+            }
+        }
+    }
+
+    // Keep the node as a leaf if no split is cheaper than testing every
+    // triangle in it.
+    if (bestSplit == 0)
+        return;
+
+    float extent = centroidBounds.boxMax[bestAxis] - centroidBounds.boxMin[bestAxis];
+    BinIndexPredicate splitPredicate(centroids, bestAxis, centroidBounds.boxMin[bestAxis],
+                                     (float) PickBVHBinCount / extent, bestSplit);
+    unsigned int* middle = partition(&order[first], &order[first] + count, splitPredicate);
+    unsigned int leftCount = (unsigned int) (middle - &order[first]);
+
+    nodes[nodeIndex].count = 0;
+    buildNode(first, leftCount, depth + 1, triangleBounds, centroids);
+    nodes[nodeIndex].first = nodes.size();
+    buildNode(first + leftCount, count - leftCount, depth + 1, triangleBounds, centroids);
+}
+
+
+// Slab test of a ray against a node's bounding box; tNear is set to the
+// distance at which the ray enters the box.
 bool
-Mesh::pick(const Vector3d& rayOrigin, const Vector3d& rayDirection, PickResult* result) const
+Mesh::PickBVH::intersectBox(const Node& node,
+                            const double* origin,
+                            const double* invDirection,
+                            double closest,
+                            double& tNear) const
+{
+    double tMin = 0.0;
+    double tMax = closest;
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        double t0 = ((double) node.boxMin[i] - origin[i]) * invDirection[i];
+        double t1 = ((double) node.boxMax[i] - origin[i]) * invDirection[i];
+        if (t0 > t1)
+            swap(t0, t1);
+        tMin = max(tMin, t0);
+        tMax = min(tMax, t1);
+    }
+
+    tNear = tMin;
+    return tMin <= tMax;
+}
+
+
+bool
+Mesh::PickBVH::pick(const vector<PrimitiveGroup*>& groups,
+                    const char* vdata,
+                    unsigned int stride,
+                    const Vector3d& rayOrigin,
+                    const Vector3d& rayDirection,
+                    PickResult* result) const
 {
+    if (nodes.empty())
+        return false;
+
     double maxDistance = 1.0e30;
     double closest = maxDistance;
+    const Triangle* closestTriangle = NULL;
+
+    double origin[3] = { rayOrigin.x(), rayOrigin.y(), rayOrigin.z() };
+    double invDirection[3];
+    for (unsigned int i = 0; i < 3; i++)
+        invDirection[i] = 1.0 / rayDirection[i];
+
+    double tNear;
+    if (!intersectBox(nodes[0], origin, invDirection, closest, tNear))
+        return false;
+
+    // Visit the nearer child of each node first, so that more distant nodes
+    // are likely to be rejected once the closest intersection is found.
+    unsigned int stack[MaxPickBVHDepth + 1];
+    unsigned int stackSize = 0;
+    unsigned int nodeIndex = 0;
+
+    for (;;)
+    {
+        const Node& node = nodes[nodeIndex];
+        if (node.count != 0)
+        {
+            for (unsigned int i = node.first; i < node.first + node.count; i++)
+            {
+                const Triangle& tri = triangles[i];
+                double t;
+                if (rayTriangleIntersect(rayOrigin, rayDirection,
+                                         vertexPosition(vdata, stride, tri.vertices[0]),
+                                         vertexPosition(vdata, stride, tri.vertices[1]),
+                                         vertexPosition(vdata, stride, tri.vertices[2]),
+                                         closest, t))
+                {
+                    closest = t;
+                    closestTriangle = &tri;
+                }
+            }
+        }
+        else
+        {
+            unsigned int leftIndex = nodeIndex + 1;
+            unsigned int rightIndex = node.first;
+            double tLeft;
+            double tRight;
+            bool hitLeft = intersectBox(nodes[leftIndex], origin, invDirection, closest, tLeft);
+            bool hitRight = intersectBox(nodes[rightIndex], origin, invDirection, closest, tRight);
+
+            if (hitLeft && hitRight)
+            {
+                if (tRight < tLeft)
+                    swap(leftIndex, rightIndex);
+                stack[stackSize++] = rightIndex;
+                nodeIndex = leftIndex;
+                continue;
+            }
+            else if (hitLeft)
+            {
+                nodeIndex = leftIndex;
+                continue;
+            }
+            else if (hitRight)
+            {
+                nodeIndex = rightIndex;
+                continue;
+            }
+        }
+
+        // Pop nodes until one is found that may still contain a closer
+        // intersection.
+        bool found = false;
+        while (stackSize > 0 && !found)
+        {
+            nodeIndex = stack[--stackSize];
+            found = intersectBox(nodes[nodeIndex], origin, invDirection, closest, tNear);
+        }
+
+        if (!found)
+            break;
+    }
+
+    if (closestTriangle == NULL)
+        return false;
+
+    if (result)
+    {
+        result->group = groups[closestTriangle->group];
+        result->primitiveIndex = closestTriangle->primitiveIndex;
+        result->distance = closest;
+    }
+
+    return true;
+}
 
+
+bool
+Mesh::pick(const Vector3d& rayOrigin, const Vector3d& rayDirection, PickResult* result) const
+{
     // Pick will automatically fail without vertex positions--no reasonable
     // mesh should lack these.
     if (vertexDesc.getAttribute(Position).semantic != Position ||
@@ -373,116 +1115,63 @@ Mesh::pick(const Vector3d& rayOrigin, const Vector3d& rayDirection, PickResult*
         return false;
     }
 
-    unsigned int posOffset = vertexDesc.getAttribute(Position).offset;
-    char* vdata = reinterpret_cast<char*>(vertices);
+    const char* vdata = reinterpret_cast<const char*>(vertices) + vertexDesc.getAttribute(Position).offset;
+
+    if (pickBVH == NULL)
+    {
+        if (getPrimitiveCount() < MinPickBVHTriangleCount)
+            return pickExhaustive(rayOrigin, rayDirection, result);
+        pickBVH = new PickBVH(groups, vdata, vertexDesc.stride);
+    }
+
+    return pickBVH->pick(groups, vdata, vertexDesc.stride, rayOrigin, rayDirection, result);
+}
+
+
+bool
+Mesh::pickExhaustive(const Vector3d& rayOrigin, const Vector3d& rayDirection, PickResult* result) const
+{
+    double maxDistance = 1.0e30;
+    double closest = maxDistance;
+
+    if (vertexDesc.getAttribute(Position).semantic != Position ||
+        vertexDesc.getAttribute(Position).format != Float3)
+    {
+        return false;
+    }
+
+    const char* vdata = reinterpret_cast<const char*>(vertices) + vertexDesc.getAttribute(Position).offset;
 
     // Iterate over all primitive groups in the mesh
     for (vector<PrimitiveGroup*>::const_iterator iter = groups.begin();
          iter != groups.end(); iter++)
     {
-        Mesh::PrimitiveGroupType primType = (*iter)->prim;
-        index32 nIndices = (*iter)->nIndices;
-
         // Only attempt to compute the intersection of the ray with triangle
         // groups.
-        if ((primType == TriList || primType == TriStrip || primType == TriFan) &&
-            (nIndices >= 3) &&
-            !(primType == TriList && nIndices % 3 != 0))
+        if (!isTriangleGroup(*iter))
+            continue;
+
+        unsigned int primitiveCount = (*iter)->getPrimitiveCount();
+        for (unsigned int primitiveIndex = 0; primitiveIndex < primitiveCount; primitiveIndex++)
         {
-            unsigned int primitiveIndex = 0;
-            index32 index = 0;
-            index32 i0 = (*iter)->indices[0];
-            index32 i1 = (*iter)->indices[1];
-            index32 i2 = (*iter)->indices[2];
-
-            // Iterate over the triangles in the primitive group
-            do
+            index32 i0, i1, i2;
+            getTriangle(*iter, primitiveIndex, i0, i1, i2);
+
+            double t;
+            if (rayTriangleIntersect(rayOrigin, rayDirection,
+                                     vertexPosition(vdata, vertexDesc.stride, i0),
+                                     vertexPosition(vdata, vertexDesc.stride, i1),
+                                     vertexPosition(vdata, vertexDesc.stride, i2),
+                                     closest, t))
             {
-                // Get the triangle vertices v0, v1, and v2
-                Vector3d v0 = Map<Vector3f>(reinterpret_cast<float*>(vdata + i0 * vertexDesc.stride + posOffset)).cast<double>();
-                Vector3d v1 = Map<Vector3f>(reinterpret_cast<float*>(vdata + i1 * vertexDesc.stride + posOffset)).cast<double>();
-                Vector3d v2 = Map<Vector3f>(reinterpret_cast<float*>(vdata + i2 * vertexDesc.stride + posOffset)).cast<double>();
-
-                // Compute the edge vectors e0 and e1, and the normal n
-                Vector3d e0 = v1 - v0;
-                Vector3d e1 = v2 - v0;
-                Vector3d n = e0.cross(e1);
-
-                // c is the cosine of the angle between the ray and triangle normal
-                double c = n.dot(rayDirection);
-
-                // If the ray is parallel to the triangle, it either misses the
-                // triangle completely, or is contained in the triangle's plane.
-                // If it's contained in the plane, we'll still call it a miss.
-                if (c != 0.0)
-                {
-                    double t = (n.dot(v0 - rayOrigin)) / c;
-                    if (t < closest && t > 0.0)
-                    {
-                        double m00 = e0.dot(e0);
-                        double m01 = e0.dot(e1);
-                        double m10 = e1.dot(e0);
-                        double m11 = e1.dot(e1);
-                        double det = m00 * m11 - m01 * m10;
-                        if (det != 0.0)
-                        {
-                            Vector3d p = rayOrigin + rayDirection * t;
-                            Vector3d q = p - v0;
-                            double q0 = e0.dot(q);
-                            double q1 = e1.dot(q);
-                            double d = 1.0 / det;
-                            double s0 = (m11 * q0 - m01 * q1) * d;
-                            double s1 = (m00 * q1 - m10 * q0) * d;
-                            if (s0 >= 0.0 && s1 >= 0.0 && s0 + s1 <= 1.0)
-                            {
-                                closest = t;
-                                if (result)
-                                {
-                                    result->group = *iter;
-                                    result->primitiveIndex = primitiveIndex;
-                                    result->distance = closest;
-                                }
-                            }
-                        }
-                    }
-                }
-
-                // Get the indices for the next triangle
-                if (primType == TriList)
-                {
-                    index += 3;
-                    if (index < nIndices)
-                    {
-                        i0 = (*iter)->indices[index + 0];
-                        i1 = (*iter)->indices[index + 1];
-                        i2 = (*iter)->indices[index + 2];
-                    }
-                }
-                else if (primType == TriStrip)
+                closest = t;
+                if (result)
                 {
-                    index += 1;
-                    if (index < nIndices)
-                    {
-                        i0 = i1;
-                        i1 = i2;
-                        i2 = (*iter)->indices[index];
-                        // TODO: alternate orientation of triangles in a strip
-                    }
+                    result->group = *iter;
+                    result->primitiveIndex = primitiveIndex;
+                    result->distance = closest;
                 }
-                else // primType == TriFan
-                {
-                    index += 1;
-                    if (index < nIndices)
-                    {
-                        index += 1;
-                        i1 = i2;
-                        i2 = (*iter)->indices[index];
-                    }
-                }
-
-                primitiveIndex++;
-
-            } while (index < nIndices);
+            }
         }
     }
 
@@ -490,6 +1179,14 @@ Mesh::pick(const Vector3d& rayOrigin, const Vector3d& rayDirection, PickResult*
 }
 
 
+void
+Mesh::invalidatePickHierarchy()
+{
+    delete pickBVH;
+    pickBVH = NULL;
+}
+
+
 bool
 Mesh::pick(const Vector3d& rayOrigin, const Vector3d& rayDirection, double& distance) const
 {
@@ -565,6 +1262,15 @@ Mesh::transform(const Vector3f& translation, float scale)
         for (i = 0; i < nVertices; i++, vdata += vertexDesc.stride)
             reinterpret_cast<float*>(vdata)[0] *= scale;
     }
+
+    // The errors of the levels of detail are distances in model space
+    for (vector<LevelOfDetail*>::iterator iter = levelsOfDetail.begin();
+         iter != levelsOfDetail.end(); iter++)
+    {
+        (*iter)->error *= fabs(scale);
+    }
+
+    invalidatePickHierarchy();
 }
 
 
@@ -652,6 +1358,20 @@ Mesh::parseVertexAttributeFormat(const string& name)
 }
 
 
+Mesh::VertexAttributeEncoding
+Mesh::parseVertexAttributeEncoding(const string& name)
+{
+    if (name == "quantized")
+        return QuantizedEncoding;
+    else if (name == "octahedral")
+        return OctahedralEncoding;
+    else if (name == "half")
+        return HalfEncoding;
+    else
+        return InvalidEncoding;
+}
+
+
 Material::TextureSemantic
 Mesh::parseTextureSemantic(const string& name)
 {
@@ -688,6 +1408,26 @@ Mesh::getVertexAttributeSize(VertexAttributeFormat fmt)
 }
 
 
+// Quantized and half float encodings apply to any floating point format;
+// octahedral encoding only to three-component vectors.
+bool
+Mesh::isValidEncoding(VertexAttributeFormat fmt, VertexAttributeEncoding encoding)
+{
+    switch (encoding)
+    {
+    case RawEncoding:
+        return true;
+    case QuantizedEncoding:
+    case HalfEncoding:
+        return fmt == Float1 || fmt == Float2 || fmt == Float3 || fmt == Float4;
+    case OctahedralEncoding:
+        return fmt == Float3;
+    default:
+        return false;
+    }
+}
+
+
 Mesh::PickResult::PickResult() :
     mesh(NULL),
     group(NULL),
@@ -57,27 +57,46 @@ class Mesh
         InvalidFormat = -1,
     };
 
+    /*! How the values of an attribute are stored in a binary cmod file.
+     *  Encoded attributes are always decoded to their format when a model
+     *  is loaded, so the encoding only affects the size and precision of
+     *  the file.
+     */
+    enum VertexAttributeEncoding
+    {
+        RawEncoding        = 0,
+        QuantizedEncoding  = 1, // 16 bits per component, relative to the attribute's bounds
+        OctahedralEncoding = 2, // unit vectors as two 16-bit octahedral coordinates
+        HalfEncoding       = 3, // 16-bit floating point
+        EncodingMax        = 4,
+        InvalidEncoding    = -1,
+    };
+
     struct VertexAttribute
     {
         VertexAttribute() :
             semantic(InvalidSemantic),
             format(InvalidFormat),
-            offset(0)
+            offset(0),
+            encoding(RawEncoding)
         {
         }
 
         VertexAttribute(VertexAttributeSemantic _semantic,
                         VertexAttributeFormat _format,
-                        unsigned int _offset) :
+                        unsigned int _offset,
+                        VertexAttributeEncoding _encoding = RawEncoding) :
             semantic(_semantic),
             format(_format),
-            offset(_offset)
+            offset(_offset),
+            encoding(_encoding)
         {
         }
 
         VertexAttributeSemantic semantic;
         VertexAttributeFormat   format;
         unsigned int            offset;
+        VertexAttributeEncoding encoding;
     };
 
     struct VertexDescription
@@ -95,6 +114,12 @@ class Mesh
 
         bool validate() const;
 
+        /*! Return true if any attribute has an encoding other than
+         *  RawEncoding; such meshes are written with packed vertex and
+         *  index data.
+         */
+        bool hasEncodedAttributes() const;
+
         VertexDescription& operator=(const VertexDescription&);
 
         unsigned int stride;
@@ -136,6 +161,33 @@ class Mesh
         unsigned int nIndices;
     };
 
+    /*! A simplified version of the mesh that's drawn in place of the
+     *  full detail primitive groups when the mesh is small on screen.
+     *  Levels of detail have their own primitive groups, but they share
+     *  the vertices of the mesh. The error is the greatest distance
+     *  between the simplified surface and the original one, in model
+     *  coordinates.
+     */
+    class LevelOfDetail
+    {
+    public:
+        LevelOfDetail(float _error);
+        ~LevelOfDetail();
+
+        const PrimitiveGroup* getGroup(unsigned int index) const;
+        PrimitiveGroup* getGroup(unsigned int index);
+        unsigned int addGroup(PrimitiveGroup* group);
+        unsigned int addGroup(PrimitiveGroupType prim,
+                              unsigned int materialIndex,
+                              unsigned int nIndices,
+                              index32* indices);
+        unsigned int getGroupCount() const;
+        unsigned int getPrimitiveCount() const;
+
+        float error;
+        std::vector<PrimitiveGroup*> groups;
+    };
+
     class PickResult
     {
     public:
@@ -165,6 +217,23 @@ class Mesh
     void remapIndices(const std::vector<index32>& indexMap);
     void clearGroups();
 
+    /*! Add a level of detail to the mesh, which takes ownership of it.
+     *  Levels are kept in order of increasing error. Their indices are
+     *  remapped along with the mesh's, but any other change to the
+     *  vertices requires the levels of detail to be cleared.
+     */
+    void addLevelOfDetail(LevelOfDetail* lod);
+    const LevelOfDetail* getLevelOfDetail(unsigned int index) const;
+    LevelOfDetail* getLevelOfDetail(unsigned int index);
+    unsigned int getLevelOfDetailCount() const;
+    void clearLevelsOfDetail();
+
+    /*! Return the coarsest level of detail with an error no larger than
+     *  maxError, or NULL if the full detail primitive groups should be
+     *  drawn.
+     */
+    const LevelOfDetail* selectLevelOfDetail(float maxError) const;
+
     void remapMaterials(const std::vector<unsigned int>& materialMap);
 
     /*! Reorder primitive groups so that groups with identical materials
@@ -176,9 +245,24 @@ class Mesh
     const std::string& getName() const;
     void setName(const std::string&);
 
+    /*! Find the closest intersection of a ray with the mesh's triangles.
+     *  Large meshes are searched with a bounding volume hierarchy that's
+     *  built the first time the mesh is picked; changes to the vertices or
+     *  primitive groups made through the Mesh methods discard it, but
+     *  groups modified in place after picking must be followed by a call
+     *  to invalidatePickHierarchy().
+     */
     bool pick(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, PickResult* result) const;
     bool pick(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double& distance) const;
 
+    /*! Pick by testing every triangle in the mesh; this gives the same
+     *  result as pick(), and is used for meshes too small to benefit from
+     *  the hierarchy.
+     */
+    bool pickExhaustive(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, PickResult* result) const;
+
+    void invalidatePickHierarchy();
+
     Eigen::AlignedBox<float, 3> getBoundingBox() const;
     void transform(const Eigen::Vector3f& translation, float scale);
 
@@ -190,20 +274,26 @@ class Mesh
     static PrimitiveGroupType        parsePrimitiveGroupType(const std::string&);
     static VertexAttributeSemantic   parseVertexAttributeSemantic(const std::string&);
     static VertexAttributeFormat     parseVertexAttributeFormat(const std::string&);
+    static VertexAttributeEncoding   parseVertexAttributeEncoding(const std::string&);
     static Material::TextureSemantic parseTextureSemantic(const std::string&);
     static unsigned int              getVertexAttributeSize(VertexAttributeFormat);
+    static bool                      isValidEncoding(VertexAttributeFormat, VertexAttributeEncoding);
 
  private:
     void recomputeBoundingBox();
 
+    class PickBVH;
+
  private:
     VertexDescription vertexDesc;
 
     unsigned int nVertices;
     void* vertices;
     mutable BufferResource* vbResource;
+    mutable PickBVH* pickBVH;
 
     std::vector<PrimitiveGroup*> groups;
+    std::vector<LevelOfDetail*> levelsOfDetail;
 
     std::string name;
 };
@@ -15,6 +15,8 @@
 #include <cassert>
 #include <cmath>
 #include <cstdio>
+#include <algorithm>
+#include <vector>
 
 
 using namespace cmod;
@@ -611,6 +613,7 @@ defined here--they have the obvious definitions.
                           <vertex_description>
                           <vertex_pool>
                           { <prim_group> }
+                          { <level_of_detail> }
                           end_mesh
 
 <vertex_description>  ::= vertexdesc
@@ -633,6 +636,9 @@ defined here--they have the obvious definitions.
 <prim_group>          ::= <prim_group_type> <material_index> <count>
                           { <unsigned_int> }
 
+<level_of_detail>     ::= lod <float>
+                          { <prim_group> }
+
 <prim_group_type>     ::= trilist | tristrip | trifan |
                           linelist | linestrip | points |
                           sprites
@@ -666,6 +672,7 @@ static Token EndMeshToken = Token::NameToken("end_mesh");
 static Token VertexDescToken = Token::NameToken("vertexdesc");
 static Token EndVertexDescToken = Token::NameToken("end_vertexdesc");
 static Token VerticesToken = Token::NameToken("vertices");
+static Token LevelOfDetailToken = Token::NameToken("lod");
 static Token MaterialToken = Token::NameToken("material");
 static Token EndMaterialToken = Token::NameToken("end_material");
 
@@ -683,10 +690,15 @@ private:
     void writeMaterial(const Material&);
     void writeGroup(const Mesh::PrimitiveGroup&);
     void writeVertexDescription(const Mesh::VertexDescription&);
+    void writePackedGroup(const Mesh::PrimitiveGroup&);
     void writeVertices(const void* vertexData,
                        unsigned int nVertices,
                        unsigned int stride,
                        const Mesh::VertexDescription& desc);
+    void writePackedVertices(const void* vertexData,
+                             unsigned int nVertices,
+                             unsigned int stride,
+                             const Mesh::VertexDescription& desc);
 
     ostream& out;
 };
@@ -706,6 +718,9 @@ public:
     Mesh*                    loadMesh();
     char*                    loadVertices(const Mesh::VertexDescription& vertexDesc,
                                           unsigned int& vertexCount);
+    char*                    loadPackedVertices(Mesh::VertexDescription& vertexDesc,
+                                                unsigned int& vertexCount);
+    bool                     loadPackedIndices(uint32* indices, unsigned int indexCount);
 
 private:
     istream& in;
@@ -725,10 +740,15 @@ private:
     void writeMaterial(const Material&);
     void writeGroup(const Mesh::PrimitiveGroup&);
     void writeVertexDescription(const Mesh::VertexDescription&);
+    void writePackedGroup(const Mesh::PrimitiveGroup&);
     void writeVertices(const void* vertexData,
                        unsigned int nVertices,
                        unsigned int stride,
                        const Mesh::VertexDescription& desc);
+    void writePackedVertices(const void* vertexData,
+                             unsigned int nVertices,
+                             unsigned int stride,
+                             const Mesh::VertexDescription& desc);
 
     ostream& out;
 };
@@ -1058,9 +1078,29 @@ AsciiModelLoader::loadVertexDescription()
             return NULL;
         }
 
+        // An encoding may follow the format
+        Mesh::VertexAttributeEncoding encoding = Mesh::RawEncoding;
+        if (tok.nextToken().isName() &&
+            Mesh::parseVertexAttributeEncoding(tok.currentToken().stringValue()) != Mesh::InvalidEncoding)
+        {
+            encoding = Mesh::parseVertexAttributeEncoding(tok.currentToken().stringValue());
+            if (!Mesh::isValidEncoding(format, encoding))
+            {
+                reportError(string("Encoding '") + tok.currentToken().stringValue() +
+                            "' can't be used with format '" + formatName + "'");
+                delete[] attributes;
+                return NULL;
+            }
+        }
+        else
+        {
+            tok.pushBack();
+        }
+
         attributes[nAttributes].semantic = semantic;
         attributes[nAttributes].format = format;
         attributes[nAttributes].offset = offset;
+        attributes[nAttributes].encoding = encoding;
 
         offset += Mesh::getVertexAttributeSize(format);
         nAttributes++;
@@ -1211,8 +1251,25 @@ AsciiModelLoader::loadMesh()
     mesh->setVertices(vertexCount, vertexData);
     delete vertexDesc;
 
+    // Primitive groups after a lod line belong to that level of detail
+    Mesh::LevelOfDetail* lod = NULL;
+
     while (tok.nextToken().isName() && tok.currentToken() != EndMeshToken)
     {
+        if (tok.currentToken() == LevelOfDetailToken)
+        {
+            if (!tok.nextToken().isNumber() || tok.currentToken().numberValue() < 0.0)
+            {
+                reportError("Bad error value in level of detail");
+                delete mesh;
+                return NULL;
+            }
+
+            lod = new Mesh::LevelOfDetail((float) tok.currentToken().numberValue());
+            mesh->addLevelOfDetail(lod);
+            continue;
+        }
+
         Mesh::PrimitiveGroupType type =
             Mesh::parsePrimitiveGroupType(tok.currentToken().stringValue());
         if (type == Mesh::InvalidPrimitiveGroupType)
@@ -1278,7 +1335,10 @@ AsciiModelLoader::loadMesh()
             indices[i] = index;
         }
 
-        mesh->addGroup(type, materialIndex, indexCount, indices);
+        if (lod != NULL)
+            lod->addGroup(type, materialIndex, indexCount, indices);
+        else
+            mesh->addGroup(type, materialIndex, indexCount, indices);
     }
 
     return mesh;
@@ -1451,6 +1511,17 @@ AsciiModelWriter::writeMesh(const Mesh& mesh)
         out << '\n';
     }
 
+    for (unsigned int lodIndex = 0; mesh.getLevelOfDetail(lodIndex); lodIndex++)
+    {
+        const Mesh::LevelOfDetail* lod = mesh.getLevelOfDetail(lodIndex);
+        out << "lod " << lod->error << "\n\n";
+        for (unsigned int groupIndex = 0; lod->getGroup(groupIndex); groupIndex++)
+        {
+            writeGroup(*lod->getGroup(groupIndex));
+            out << '\n';
+        }
+    }
+
     out << "end_mesh\n";
 }
 
@@ -1573,6 +1644,21 @@ AsciiModelWriter::writeVertexDescription(const Mesh::VertexDescription& desc)
             break;
         }
 
+        switch (desc.attributes[attr].encoding)
+        {
+        case Mesh::QuantizedEncoding:
+            out << " quantized";
+            break;
+        case Mesh::OctahedralEncoding:
+            out << " octahedral";
+            break;
+        case Mesh::HalfEncoding:
+            out << " half";
+            break;
+        default:
+            break;
+        }
+
         out << '\n';
     }
     out << "end_vertexdesc\n";
@@ -1670,6 +1756,203 @@ AsciiModelWriter::writeMaterial(const Material& material)
 }
 
 
+/***** Attribute and index encodings *****/
+
+static inline float halfToFloat(uint16 h)
+{
+    uint32 sign = (uint32) (h & 0x8000) << 16;
+    uint32 exponent = (h >> 10) & 0x1f;
+    uint32 mantissa = h & 0x3ff;
+    uint32 bits;
+
+    if (exponent - 1 < 30)
+    {
+        // Normalized half; by far the most common case
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    }
+    else if (exponent == 31)
+    {
+        // Infinity or NaN
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    }
+    else if (mantissa == 0)
+    {
+        bits = sign;
+    }
+    else
+    {
+        // Denormalized half; normalize it
+        exponent = 113;
+        while ((mantissa & 0x400) == 0)
+        {
+            mantissa <<= 1;
+            exponent--;
+        }
+        bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+    }
+
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+
+// Convert a float to a half, rounding to the nearest value
+static uint16 floatToHalf(float f)
+{
+    uint32 bits;
+    memcpy(&bits, &f, sizeof(bits));
+
+    uint16 sign = (uint16) ((bits >> 16) & 0x8000);
+    int exponent = (int) ((bits >> 23) & 0xff) - 127 + 15;
+    uint32 mantissa = bits & 0x7fffff;
+
+    if ((bits & 0x7fffffff) > 0x7f800000)
+        return sign | 0x7e00;    // NaN
+    if (exponent >= 31)
+        return sign | 0x7c00;    // Infinity, or too large
+    if (exponent < -10)
+        return sign;             // Too small even for a denormal
+
+    uint32 half;
+    uint32 shift;
+    if (exponent <= 0)
+    {
+        mantissa |= 0x800000;
+        shift = 14 - exponent;
+        half = mantissa >> shift;
+    }
+    else
+    {
+        shift = 13;
+        half = ((uint32) exponent << 10) | (mantissa >> shift);
+    }
+
+    // Round to nearest even; a carry out of the mantissa correctly
+    // increments the exponent.
+    uint32 remainder = mantissa & ((1u << shift) - 1);
+    uint32 halfway = 1u << (shift - 1);
+    if (remainder > halfway || (remainder == halfway && (half & 1) != 0))
+        half++;
+
+    return sign | (uint16) half;
+}
+
+
+static int16 toSnorm16(float x)
+{
+    x = max(-1.0f, min(1.0f, x));
+    return (int16) floor(x * 32767.0f + 0.5f);
+}
+
+
+// Map a unit vector onto an octahedron, and the octahedron onto a square
+static void encodeOctahedral(const float* v, int16& u, int16& w)
+{
+    float l1 = fabs(v[0]) + fabs(v[1]) + fabs(v[2]);
+    if (l1 == 0.0f)
+    {
+        u = w = 0;
+        return;
+    }
+
+    float x = v[0] / l1;
+    float y = v[1] / l1;
+    if (v[2] < 0.0f)
+    {
+        float ox = (1.0f - fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float oy = (1.0f - fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = ox;
+        y = oy;
+    }
+
+    u = toSnorm16(x);
+    w = toSnorm16(y);
+}
+
+
+static inline void decodeOctahedral(int16 u, int16 w, float* v)
+{
+    // -32768 is never written, so there's no need to clamp to -1
+    float x = (float) u * (1.0f / 32767.0f);
+    float y = (float) w * (1.0f / 32767.0f);
+    float z = 1.0f - fabs(x) - fabs(y);
+    if (z < 0.0f)
+    {
+        float ox = (1.0f - fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float oy = (1.0f - fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = ox;
+        y = oy;
+    }
+
+    float s = 1.0f / sqrt(x * x + y * y + z * z);
+    v[0] = x * s;
+    v[1] = y * s;
+    v[2] = z * s;
+}
+
+
+// Packed indices are stored as differences from the previous index. The
+// differences are zigzag coded so that small negative values are small too,
+// then written seven bits to a byte, with the high bit set on every byte
+// but the last one of each index.
+static void encodeIndices(const uint32* indices, unsigned int nIndices,
+                          vector<char>& packed)
+{
+    uint32 lastIndex = 0;
+    for (unsigned int i = 0; i < nIndices; i++)
+    {
+        uint32 delta = indices[i] - lastIndex;
+        uint32 value = (delta << 1) ^ ((delta & 0x80000000) != 0 ? 0xffffffff : 0);
+        while (value >= 0x80)
+        {
+            packed.push_back((char) ((value & 0x7f) | 0x80));
+            value >>= 7;
+        }
+        packed.push_back((char) value);
+        lastIndex = indices[i];
+    }
+}
+
+
+// Returns false unless the data holds exactly nIndices indices
+static bool decodeIndices(const unsigned char* data, unsigned int size,
+                          uint32* indices, unsigned int nIndices)
+{
+    const unsigned char* end = data + size;
+    uint32 index = 0;
+
+    for (unsigned int i = 0; i < nIndices; i++)
+    {
+        if (data == end)
+            return false;
+
+        // Most differences fit in one or two bytes
+        uint32 value = *data++;
+        if (value >= 0x80)
+        {
+            value &= 0x7f;
+            for (unsigned int shift = 7; ; shift += 7)
+            {
+                if (data == end || shift > 28)
+                    return false;
+
+                unsigned char c = *data++;
+                value |= (uint32) (c & 0x7f) << shift;
+                if ((c & 0x80) == 0)
+                    break;
+            }
+        }
+
+        index += (value >> 1) ^ (0 - (value & 1));
+        indices[i] = index;
+    }
+
+    return data == end;
+}
+
+
+
 /***** Binary loader *****/
 
 BinaryModelLoader::BinaryModelLoader(istream& _in) :
@@ -1720,6 +2003,19 @@ static int16 readInt16(istream& in)
 }
 
 
+// Largest vertex or index block that will be read; keeps the size of the
+// block from overflowing an unsigned int.
+static const unsigned int MaxBlockSize = 0x7fffffff;
+
+// Read a block of raw data with a single call. Returns false if the stream
+// ended before the whole block could be read.
+static bool readBlock(istream& in, char* data, unsigned int size)
+{
+    in.read(data, size);
+    return (unsigned int) in.gcount() == size;
+}
+
+
 static ModelFileToken readToken(istream& in)
 {
     return (ModelFileToken) readInt16(in);
@@ -2095,8 +2391,20 @@ BinaryModelLoader::loadMesh()
     if (vertexDesc == NULL)
         return NULL;
 
+    // Meshes with encoded attributes have packed vertex data, and the
+    // indices of their primitive groups are packed too.
+    ModelFileToken vertexToken = readToken(in);
+    bool packed = vertexToken == CMOD_PackedVertices;
+
     unsigned int vertexCount = 0;
-    char* vertexData = loadVertices(*vertexDesc, vertexCount);
+    char* vertexData = NULL;
+    if (vertexToken == CMOD_Vertices)
+        vertexData = loadVertices(*vertexDesc, vertexCount);
+    else if (packed)
+        vertexData = loadPackedVertices(*vertexDesc, vertexCount);
+    else
+        reportError("Vertex data expected");
+
     if (vertexData == NULL)
     {
         delete vertexDesc;
@@ -2108,6 +2416,9 @@ BinaryModelLoader::loadMesh()
     mesh->setVertices(vertexCount, vertexData);
     delete vertexDesc;
 
+    // Primitive groups after a level of detail token belong to that level
+    Mesh::LevelOfDetail* lod = NULL;
+
     for (;;)
     {
         int16 tok = readInt16(in);
@@ -2116,6 +2427,20 @@ BinaryModelLoader::loadMesh()
         {
             break;
         }
+        else if (tok == CMOD_LevelOfDetail)
+        {
+            float error = 0.0f;
+            if (!readTypeFloat1(in, error) || !(error >= 0.0f))
+            {
+                reportError("Bad error value in level of detail");
+                delete mesh;
+                return NULL;
+            }
+
+            lod = new Mesh::LevelOfDetail(error);
+            mesh->addLevelOfDetail(lod);
+            continue;
+        }
         else if (tok < 0 || tok >= Mesh::PrimitiveTypeMax)
         {
             reportError("Bad primitive group type");
@@ -2128,6 +2453,13 @@ BinaryModelLoader::loadMesh()
         unsigned int materialIndex = readUint(in);
         unsigned int indexCount = readUint(in);
 
+        if (indexCount > MaxBlockSize / sizeof(uint32))
+        {
+            reportError("Too many indices in primitive group");
+            delete mesh;
+            return NULL;
+        }
+
         uint32* indices = new uint32[indexCount];
         if (indices == NULL)
         {
@@ -2136,21 +2468,45 @@ BinaryModelLoader::loadMesh()
             return NULL;
         }
 
+        if (packed)
+        {
+            if (!loadPackedIndices(indices, indexCount))
+            {
+                delete[] indices;
+                delete mesh;
+                return NULL;
+            }
+        }
+        else
+        {
+            // Read all of the indices at once, then convert them
+            if (!readBlock(in, reinterpret_cast<char*>(indices), indexCount * sizeof(uint32)))
+            {
+                reportError("Unexpected end of file in index data");
+                delete[] indices;
+                delete mesh;
+                return NULL;
+            }
+
+            for (unsigned int i = 0; i < indexCount; i++)
+                LE_TO_CPU_INT32(indices[i], indices[i]);
+        }
+
         for (unsigned int i = 0; i < indexCount; i++)
         {
-            uint32 index = readUint(in);
-            if (index >= vertexCount)
+            if (indices[i] >= vertexCount)
             {
                 reportError("Index out of range");
-                delete indices;
+                delete[] indices;
                 delete mesh;
                 return NULL;
             }
-
-            indices[i] = index;
         }
 
-        mesh->addGroup(type, materialIndex, indexCount, indices);
+        if (lod != NULL)
+            lod->addGroup(type, materialIndex, indexCount, indices);
+        else
+            mesh->addGroup(type, materialIndex, indexCount, indices);
     }
 
     return mesh;
@@ -2161,13 +2517,13 @@ char*
 BinaryModelLoader::loadVertices(const Mesh::VertexDescription& vertexDesc,
                                 unsigned int& vertexCount)
 {
-    if (readToken(in) != CMOD_Vertices)
+    vertexCount = readUint(in);
+    if (vertexCount > MaxBlockSize / vertexDesc.stride)
     {
-        reportError("Vertex data expected");
+        reportError("Too many vertices in mesh");
         return NULL;
     }
 
-    vertexCount = readUint(in);
     unsigned int vertexDataSize = vertexDesc.stride * vertexCount;
     char* vertexData = new char[vertexDataSize];
     if (vertexData == NULL)
@@ -2176,51 +2532,244 @@ BinaryModelLoader::loadVertices(const Mesh::VertexDescription& vertexDesc,
         return NULL;
     }
 
-    unsigned int offset = 0;
+    // The attributes of each vertex are stored in the order that they appear
+    // in the vertex description, with no padding, which is exactly the layout
+    // that loadVertexDescription() assigns. So the whole block can be read
+    // at once; only big-endian systems need to touch the data afterward.
+    if (!readBlock(in, vertexData, vertexDataSize))
+    {
+        reportError("Unexpected end of file in vertex data");
+        delete[] vertexData;
+        return NULL;
+    }
 
-    for (unsigned int i = 0; i < vertexCount; i++, offset += vertexDesc.stride)
+#if defined(WORDS_BIGENDIAN) || defined(__BIG_ENDIAN__)
+    for (unsigned int attr = 0; attr < vertexDesc.nAttributes; attr++)
     {
-        assert(offset < vertexDataSize);
-        for (unsigned int attr = 0; attr < vertexDesc.nAttributes; attr++)
+        unsigned int nFloats = 0;
+        if (vertexDesc.attributes[attr].format != Mesh::UByte4)
+            nFloats = Mesh::getVertexAttributeSize(vertexDesc.attributes[attr].format) / sizeof(float);
+
+        char* base = vertexData + vertexDesc.attributes[attr].offset;
+        for (unsigned int i = 0; i < vertexCount; i++, base += vertexDesc.stride)
         {
-            unsigned int base = offset + vertexDesc.attributes[attr].offset;
-            Mesh::VertexAttributeFormat fmt = vertexDesc.attributes[attr].format;
-            /*int readCount = 0;    Unused*/
-            switch (fmt)
+            float* f = reinterpret_cast<float*>(base);
+            for (unsigned int j = 0; j < nFloats; j++)
+                LE_TO_CPU_FLOAT(f[j], f[j]);
+        }
+    }
+#endif
+
+    return vertexData;
+}
+
+
+// The values of one attribute of a packed mesh, as read from the file
+struct PackedAttribute
+{
+    vector<char> data;
+    float minValues[4];
+    float steps[4];
+};
+
+// Packed attributes are decoded in blocks of vertices small enough to stay
+// in the cache while every attribute of the block is decoded.
+static const unsigned int DecodeBlockSize = 1024;
+
+
+// Decode values first through first + count - 1 of an attribute into their
+// place in each vertex
+static void decodeAttribute(const Mesh::VertexAttribute& attribute,
+                            const PackedAttribute& packed,
+                            char* vertexData,
+                            unsigned int stride,
+                            unsigned int first,
+                            unsigned int count)
+{
+    unsigned int nComponents = Mesh::getVertexAttributeSize(attribute.format) / sizeof(float);
+    char* dest = vertexData + first * stride + attribute.offset;
+
+    switch (attribute.encoding)
+    {
+    case Mesh::RawEncoding:
+        {
+            // Every format is a whole number of 32-bit words
+            const uint32* words = reinterpret_cast<const uint32*>(&packed.data[0]) + first * nComponents;
+            for (unsigned int i = 0; i < count; i++, dest += stride)
+            {
+                uint32* d = reinterpret_cast<uint32*>(dest);
+                for (unsigned int j = 0; j < nComponents; j++)
+                    d[j] = *words++;
+#if defined(WORDS_BIGENDIAN) || defined(__BIG_ENDIAN__)
+                float* f = reinterpret_cast<float*>(dest);
+                for (unsigned int j = 0; attribute.format != Mesh::UByte4 && j < nComponents; j++)
+                    LE_TO_CPU_FLOAT(f[j], f[j]);
+#endif
+            }
+        }
+        break;
+
+    case Mesh::QuantizedEncoding:
+        {
+            const uint16* q = reinterpret_cast<const uint16*>(&packed.data[0]) + first * nComponents;
+            for (unsigned int i = 0; i < count; i++, dest += stride)
             {
-            case Mesh::Float1:
-                reinterpret_cast<float*>(vertexData + base)[0] = readFloat(in);
-                break;
-            case Mesh::Float2:
-                reinterpret_cast<float*>(vertexData + base)[0] = readFloat(in);
-                reinterpret_cast<float*>(vertexData + base)[1] = readFloat(in);
-                break;
-            case Mesh::Float3:
-                reinterpret_cast<float*>(vertexData + base)[0] = readFloat(in);
-                reinterpret_cast<float*>(vertexData + base)[1] = readFloat(in);
-                reinterpret_cast<float*>(vertexData + base)[2] = readFloat(in);
-                break;
-            case Mesh::Float4:
-                reinterpret_cast<float*>(vertexData + base)[0] = readFloat(in);
-                reinterpret_cast<float*>(vertexData + base)[1] = readFloat(in);
-                reinterpret_cast<float*>(vertexData + base)[2] = readFloat(in);
-                reinterpret_cast<float*>(vertexData + base)[3] = readFloat(in);
-                break;
-            case Mesh::UByte4:
-                in.get(reinterpret_cast<char*>(vertexData + base), 4);
-                break;
-            default:
-                assert(0);
-                delete[] vertexData;
-                return NULL;
+                float* f = reinterpret_cast<float*>(dest);
+                for (unsigned int j = 0; j < nComponents; j++)
+                {
+                    uint16 value = *q++;
+                    LE_TO_CPU_INT16(value, value);
+                    f[j] = packed.minValues[j] + (float) value * packed.steps[j];
+                }
             }
         }
+        break;
+
+    case Mesh::OctahedralEncoding:
+        {
+            const int16* uv = reinterpret_cast<const int16*>(&packed.data[0]) + first * 2;
+            for (unsigned int i = 0; i < count; i++, dest += stride, uv += 2)
+            {
+                int16 u = uv[0];
+                int16 w = uv[1];
+                LE_TO_CPU_INT16(u, u);
+                LE_TO_CPU_INT16(w, w);
+                decodeOctahedral(u, w, reinterpret_cast<float*>(dest));
+            }
+        }
+        break;
+
+    case Mesh::HalfEncoding:
+        {
+            const uint16* h = reinterpret_cast<const uint16*>(&packed.data[0]) + first * nComponents;
+            for (unsigned int i = 0; i < count; i++, dest += stride)
+            {
+                float* f = reinterpret_cast<float*>(dest);
+                for (unsigned int j = 0; j < nComponents; j++)
+                {
+                    uint16 value = *h++;
+                    LE_TO_CPU_INT16(value, value);
+                    f[j] = halfToFloat(value);
+                }
+            }
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+
+// Packed vertex data is stored one attribute at a time: the encoding of the
+// attribute, followed by its values for every vertex. The encodings read
+// are stored in vertexDesc.
+char*
+BinaryModelLoader::loadPackedVertices(Mesh::VertexDescription& vertexDesc,
+                                      unsigned int& vertexCount)
+{
+    vertexCount = readUint(in);
+    if (vertexCount > MaxBlockSize / vertexDesc.stride)
+    {
+        reportError("Too many vertices in mesh");
+        return NULL;
+    }
+
+    vector<PackedAttribute> packedAttributes(vertexDesc.nAttributes);
+    for (unsigned int attr = 0; attr < vertexDesc.nAttributes; attr++)
+    {
+        Mesh::VertexAttribute& attribute = vertexDesc.attributes[attr];
+        PackedAttribute& packed = packedAttributes[attr];
+
+        int16 encoding = readInt16(in);
+        if (encoding < 0 || encoding >= Mesh::EncodingMax ||
+            !Mesh::isValidEncoding(attribute.format, static_cast<Mesh::VertexAttributeEncoding>(encoding)))
+        {
+            reportError("Invalid vertex attribute encoding");
+            return NULL;
+        }
+        attribute.encoding = static_cast<Mesh::VertexAttributeEncoding>(encoding);
+
+        unsigned int attributeSize = Mesh::getVertexAttributeSize(attribute.format);
+        unsigned int nComponents = attributeSize / sizeof(float);
+
+        // Quantized values are relative to bounds that precede them
+        if (attribute.encoding == Mesh::QuantizedEncoding)
+        {
+            for (unsigned int i = 0; i < nComponents; i++)
+            {
+                packed.minValues[i] = readFloat(in);
+                packed.steps[i] = (readFloat(in) - packed.minValues[i]) / 65535.0f;
+            }
+        }
+
+        unsigned int size = vertexCount * attributeSize;
+        if (attribute.encoding == Mesh::OctahedralEncoding)
+            size = vertexCount * 2 * sizeof(int16);
+        else if (attribute.encoding != Mesh::RawEncoding)
+            size = vertexCount * nComponents * sizeof(uint16);
+
+        packed.data.resize(size);
+        if (size != 0 && !readBlock(in, &packed.data[0], size))
+        {
+            reportError("Unexpected end of file in vertex data");
+            return NULL;
+        }
+    }
+
+    char* vertexData = new char[vertexDesc.stride * vertexCount];
+    if (vertexData == NULL)
+    {
+        reportError("Not enough memory to hold vertex data");
+        return NULL;
+    }
+
+    for (unsigned int first = 0; first < vertexCount; first += DecodeBlockSize)
+    {
+        unsigned int count = min(DecodeBlockSize, vertexCount - first);
+        for (unsigned int attr = 0; attr < vertexDesc.nAttributes; attr++)
+        {
+            decodeAttribute(vertexDesc.attributes[attr], packedAttributes[attr],
+                            vertexData, vertexDesc.stride, first, count);
+        }
     }
 
     return vertexData;
 }
 
 
+bool
+BinaryModelLoader::loadPackedIndices(uint32* indices, unsigned int indexCount)
+{
+    // Every index takes from one to five bytes
+    unsigned int byteCount = readUint(in);
+    if (byteCount < indexCount || byteCount / 5 > indexCount)
+    {
+        reportError("Bad packed index data");
+        return false;
+    }
+
+    if (indexCount == 0)
+        return true;
+
+    vector<char> packedIndices(byteCount);
+    if (!readBlock(in, &packedIndices[0], byteCount))
+    {
+        reportError("Unexpected end of file in index data");
+        return false;
+    }
+
+    if (!decodeIndices(reinterpret_cast<const unsigned char*>(&packedIndices[0]), byteCount,
+                       indices, indexCount))
+    {
+        reportError("Bad packed index data");
+        return false;
+    }
+
+    return true;
+}
+
+
 
 /***** Binary writer *****/
 
@@ -2318,6 +2867,23 @@ BinaryModelWriter::writeGroup(const Mesh::PrimitiveGroup& group)
 }
 
 
+void
+BinaryModelWriter::writePackedGroup(const Mesh::PrimitiveGroup& group)
+{
+    writeInt16(out, static_cast<int16>(group.prim));
+    writeUint32(out, group.materialIndex);
+    writeUint32(out, group.nIndices);
+
+    vector<char> packed;
+    packed.reserve(group.nIndices * 2);
+    encodeIndices(group.indices, group.nIndices, packed);
+
+    writeUint32(out, (uint32) packed.size());
+    if (!packed.empty())
+        out.write(&packed[0], packed.size());
+}
+
+
 void
 BinaryModelWriter::writeMesh(const Mesh& mesh)
 {
@@ -2325,13 +2891,44 @@ BinaryModelWriter::writeMesh(const Mesh& mesh)
 
     writeVertexDescription(mesh.getVertexDescription());
 
-    writeVertices(mesh.getVertexData(),
-                  mesh.getVertexCount(),
-                  mesh.getVertexStride(),
-                  mesh.getVertexDescription());
+    // Meshes without encoded attributes are written in the original format,
+    // which older versions of Celestia can read.
+    bool packed = mesh.getVertexDescription().hasEncodedAttributes();
+    if (packed)
+    {
+        writePackedVertices(mesh.getVertexData(),
+                            mesh.getVertexCount(),
+                            mesh.getVertexStride(),
+                            mesh.getVertexDescription());
 
-    for (unsigned int groupIndex = 0; mesh.getGroup(groupIndex); groupIndex++)
-        writeGroup(*mesh.getGroup(groupIndex));
+        for (unsigned int groupIndex = 0; mesh.getGroup(groupIndex); groupIndex++)
+            writePackedGroup(*mesh.getGroup(groupIndex));
+    }
+    else
+    {
+        writeVertices(mesh.getVertexData(),
+                      mesh.getVertexCount(),
+                      mesh.getVertexStride(),
+                      mesh.getVertexDescription());
+
+        for (unsigned int groupIndex = 0; mesh.getGroup(groupIndex); groupIndex++)
+            writeGroup(*mesh.getGroup(groupIndex));
+    }
+
+    for (unsigned int lodIndex = 0; mesh.getLevelOfDetail(lodIndex); lodIndex++)
+    {
+        const Mesh::LevelOfDetail* lod = mesh.getLevelOfDetail(lodIndex);
+        writeToken(out, CMOD_LevelOfDetail);
+        writeTypeFloat1(out, lod->error);
+
+        for (unsigned int groupIndex = 0; lod->getGroup(groupIndex); groupIndex++)
+        {
+            if (packed)
+                writePackedGroup(*lod->getGroup(groupIndex));
+            else
+                writeGroup(*lod->getGroup(groupIndex));
+        }
+    }
 
     writeToken(out, CMOD_EndMesh);
 }
@@ -2387,6 +2984,104 @@ BinaryModelWriter::writeVertices(const void* vertexData,
 }
 
 
+void
+BinaryModelWriter::writePackedVertices(const void* vertexData,
+                                       unsigned int nVertices,
+                                       unsigned int stride,
+                                       const Mesh::VertexDescription& desc)
+{
+    writeToken(out, CMOD_PackedVertices);
+    writeUint32(out, nVertices);
+
+    for (unsigned int attr = 0; attr < desc.nAttributes; attr++)
+    {
+        const Mesh::VertexAttribute& attribute = desc.attributes[attr];
+        const char* base = reinterpret_cast<const char*>(vertexData) + attribute.offset;
+        unsigned int nComponents = Mesh::getVertexAttributeSize(attribute.format) / sizeof(float);
+
+        writeInt16(out, static_cast<int16>(attribute.encoding));
+
+        switch (attribute.encoding)
+        {
+        case Mesh::QuantizedEncoding:
+            {
+                float minValues[4];
+                float maxValues[4];
+                for (unsigned int j = 0; j < nComponents; j++)
+                {
+                    minValues[j] = nVertices == 0 ? 0.0f : reinterpret_cast<const float*>(base)[j];
+                    maxValues[j] = minValues[j];
+                }
+
+                for (unsigned int i = 0; i < nVertices; i++)
+                {
+                    const float* f = reinterpret_cast<const float*>(base + i * stride);
+                    for (unsigned int j = 0; j < nComponents; j++)
+                    {
+                        minValues[j] = min(minValues[j], f[j]);
+                        maxValues[j] = max(maxValues[j], f[j]);
+                    }
+                }
+
+                float scales[4];
+                for (unsigned int j = 0; j < nComponents; j++)
+                {
+                    writeFloat(out, minValues[j]);
+                    writeFloat(out, maxValues[j]);
+                    scales[j] = maxValues[j] > minValues[j] ? 65535.0f / (maxValues[j] - minValues[j]) : 0.0f;
+                }
+
+                for (unsigned int i = 0; i < nVertices; i++)
+                {
+                    const float* f = reinterpret_cast<const float*>(base + i * stride);
+                    for (unsigned int j = 0; j < nComponents; j++)
+                    {
+                        float q = floor((f[j] - minValues[j]) * scales[j] + 0.5f);
+                        writeInt16(out, static_cast<int16>((uint16) max(0.0f, min(65535.0f, q))));
+                    }
+                }
+            }
+            break;
+
+        case Mesh::OctahedralEncoding:
+            for (unsigned int i = 0; i < nVertices; i++)
+            {
+                int16 u, w;
+                encodeOctahedral(reinterpret_cast<const float*>(base + i * stride), u, w);
+                writeInt16(out, u);
+                writeInt16(out, w);
+            }
+            break;
+
+        case Mesh::HalfEncoding:
+            for (unsigned int i = 0; i < nVertices; i++)
+            {
+                const float* f = reinterpret_cast<const float*>(base + i * stride);
+                for (unsigned int j = 0; j < nComponents; j++)
+                    writeInt16(out, static_cast<int16>(floatToHalf(f[j])));
+            }
+            break;
+
+        default:
+            for (unsigned int i = 0; i < nVertices; i++)
+            {
+                const float* f = reinterpret_cast<const float*>(base + i * stride);
+                if (attribute.format == Mesh::UByte4)
+                {
+                    out.write(base + i * stride, 4);
+                }
+                else
+                {
+                    for (unsigned int j = 0; j < nComponents; j++)
+                        writeFloat(out, f[j]);
+                }
+            }
+            break;
+        }
+    }
+}
+
+
 void
 BinaryModelWriter::writeVertexDescription(const Mesh::VertexDescription& desc)
 {
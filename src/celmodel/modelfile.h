@@ -91,6 +91,8 @@ enum ModelFileToken
     CMOD_Vertices       = 1013,
     CMOD_Emissive       = 1014,
     CMOD_Blend          = 1015,
+    CMOD_PackedVertices = 1016,
+    CMOD_LevelOfDetail  = 1017,
 };
 
 enum ModelFileType
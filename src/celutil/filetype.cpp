@@ -37,6 +37,8 @@ static const string CelestiaModelExt(".cmod");
 static const string CelestiaParticleSystemExt(".cpart");
 static const string CelestiaXYZTrajectoryExt(".xyz");
 static const string CelestiaXYZVTrajectoryExt(".xyzv");
+static const string CelestiaXYZBinaryTrajectoryExt(".xyzbin");
+static const string CelestiaXYZVBinaryTrajectoryExt(".xyzvbin");
 
 ContentType DetermineFileType(const string& filename)
 {
@@ -86,6 +88,9 @@ ContentType DetermineFileType(const string& filename)
         return Content_CelestiaXYZTrajectory;
     else if (compareIgnoringCase(CelestiaXYZVTrajectoryExt, ext) == 0)
         return Content_CelestiaXYZVTrajectory;
+    else if (compareIgnoringCase(CelestiaXYZBinaryTrajectoryExt, ext) == 0 ||
+             compareIgnoringCase(CelestiaXYZVBinaryTrajectoryExt, ext) == 0)
+        return Content_CelestiaBinaryTrajectory;
     else
         return Content_Unknown;
 }
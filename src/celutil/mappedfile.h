@@ -0,0 +1,42 @@
+// mappedfile.h
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#ifndef _CELUTIL_MAPPEDFILE_H_
+#define _CELUTIL_MAPPEDFILE_H_
+
+#include <string>
+#include <cstddef>
+
+/*! A MappedFile gives read-only access to the complete contents of a file
+ *  as a single block of memory. Where the operating system supports it,
+ *  the file is memory mapped, so that pages are only read from disk when
+ *  they are first touched, and may be discarded again under memory
+ *  pressure.
+ *
+ *  The mapped data remains valid until the MappedFile is deleted.
+ */
+class MappedFile
+{
+ public:
+    MappedFile() {};
+    virtual ~MappedFile() {};
+
+    virtual const char* getData() const = 0;
+    virtual std::size_t getSize() const = 0;
+
+ private:
+    // Mapped files may not be copied
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+};
+
+// Returns NULL if the file couldn't be opened or mapped.
+extern MappedFile* OpenMappedFile(const std::string& filename);
+
+#endif // _CELUTIL_MAPPEDFILE_H_
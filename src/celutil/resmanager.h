@@ -12,14 +12,19 @@
 
 #include <string>
 #include <vector>
+#include <deque>
 #include <map>
 #include <celutil/reshandle.h>
+#include <celutil/thread.h>
+#include <celutil/timer.h>
+#include <celutil/workerpool.h>
 
 
 enum ResourceState {
     ResourceNotLoaded     = 0,
     ResourceLoaded        = 1,
     ResourceLoadingFailed = 2,
+    ResourceLoading       = 3,
 };
 
 
@@ -32,6 +37,16 @@ template<class T> class ResourceInfo
     virtual std::string resolve(const std::string&) = 0;
     virtual T* load(const std::string&) = 0;
 
+    // Resources that can be loaded in the background override these three
+    // methods. loadInBackground() is called on a worker thread with a copy
+    // of the resource info, and should do the slow part of loading: reading
+    // and decoding files. It must not make any OpenGL calls. Later,
+    // finishLoad() is called on the copy from the thread that calls
+    // ResourceManager::finishLoads() to create the resource.
+    virtual bool canLoadInBackground(const std::string&) const { return false; };
+    virtual bool loadInBackground(const std::string&) { return false; };
+    virtual T* finishLoad(const std::string&) { return NULL; };
+
     typedef T ResourceType;
     ResourceState state;
     std::string resolvedName;
@@ -39,6 +54,19 @@ template<class T> class ResourceInfo
 };
 
 
+/*! A ResourceManager maps resource infos to handles, and loads resources
+ *  the first time they're looked up.
+ *
+ *  By default, resources are loaded synchronously by find(). If a loader
+ *  pool is set, resources that support it are instead loaded by the pool in
+ *  the background: find() returns NULL until the resource is ready, and
+ *  finishLoads() must be called regularly (typically once per frame) to
+ *  complete loads that have finished in the background.
+ *
+ *  getHandle() may be called from any thread, including from resources
+ *  loading in the background. The other methods must all be called from
+ *  the same thread.
+ */
 template<class T> class ResourceManager
 {
  private:
@@ -46,26 +74,108 @@ template<class T> class ResourceManager
 
  public:
     ResourceManager();
-    ResourceManager(std::string _baseDir) : baseDir(_baseDir) {};
+    ResourceManager(std::string _baseDir) :
+        baseDir(_baseDir),
+        mutex(NewMutex()),
+        loaderPool(NULL),
+        timer(CreateTimer())
+    {
+    };
     ~ResourceManager();
 
     typedef typename T::ResourceType ResourceType;
 
  private:
-    typedef std::vector<T> ResourceTable;
+    // Resource infos are stored in a deque so that references to them
+    // remain valid when handles are added by another thread.
+    typedef std::deque<T> ResourceTable;
     typedef std::map<T, ResourceHandle> ResourceHandleMap;
     typedef std::map<std::string, ResourceType*> NameMap;
+    typedef std::map<std::string, std::vector<ResourceHandle> > PendingLoadMap;
 
     typedef typename ResourceHandleMap::value_type ResourceHandleMapValue;
     typedef typename NameMap::value_type NameMapValue;
 
+    struct CompletedLoad
+    {
+        T* info;
+        bool succeeded;
+    };
+
+    class LoadTask : public Task
+    {
+     public:
+        LoadTask(ResourceManager* _manager, T* _info) :
+            manager(_manager), info(_info) {};
+        ~LoadTask() { delete info; };
+
+        void run()
+        {
+            bool succeeded = info->loadInBackground(info->resolvedName);
+            manager->loadCompleted(info, succeeded);
+            info = NULL;
+        }
+
+     private:
+        ResourceManager* manager;
+        T* info;
+    };
+
+    friend class LoadTask;
+
     ResourceTable resources;
     ResourceHandleMap handles;
     NameMap loadedResources;
 
+    // Guards the resource table and handle map, and the list of completed
+    // loads.
+    Mutex* mutex;
+
+    WorkerPool* loaderPool;
+    PendingLoadMap pendingLoads;
+    std::deque<CompletedLoad> completedLoads;
+    Timer* timer;
+
+    T* getInfo(ResourceHandle h)
+    {
+        MutexLock lock(mutex);
+        if (h >= (int) resources.size() || h < 0)
+            return NULL;
+        else
+            return &resources[h];
+    }
+
+    void loadCompleted(T* info, bool succeeded)
+    {
+        MutexLock lock(mutex);
+        CompletedLoad completed;
+        completed.info = info;
+        completed.succeeded = succeeded;
+        completedLoads.push_back(completed);
+    }
+
+    // Begin loading a resource in the background. Handles that resolve to
+    // the same name share a single load.
+    void startLoad(ResourceHandle h, T& info)
+    {
+        info.state = ResourceLoading;
+
+        typename PendingLoadMap::iterator iter = pendingLoads.find(info.resolvedName);
+        if (iter != pendingLoads.end())
+        {
+            iter->second.push_back(h);
+        }
+        else
+        {
+            pendingLoads[info.resolvedName].push_back(h);
+            loaderPool->submit(new LoadTask(this, new T(info)));
+        }
+    }
+
  public:
     ResourceHandle getHandle(const T& info)
     {
+        MutexLock lock(mutex);
         typename ResourceHandleMap::iterator iter = handles.find(info);
         if (iter != handles.end())
         {
@@ -82,52 +192,102 @@ template<class T> class ResourceManager
 
     ResourceType* find(ResourceHandle h)
     {
-        if (h >= (int) handles.size() || h < 0)
-        {
+        T* info = getInfo(h);
+        if (info == NULL)
             return NULL;
-        }
-        else
+
+        if (info->state == ResourceNotLoaded)
         {
-            if (resources[h].state == ResourceNotLoaded)
+            info->resolvedName = info->resolve(baseDir);
+            typename NameMap::iterator iter =
+                loadedResources.find(info->resolvedName);
+            if (iter != loadedResources.end())
+            {
+                info->resource = iter->second;
+                info->state = ResourceLoaded;
+            }
+            else if (loaderPool != NULL && info->canLoadInBackground(info->resolvedName))
             {
-                resources[h].resolvedName = resources[h].resolve(baseDir);
-                typename NameMap::iterator iter =
-                    loadedResources.find(resources[h].resolvedName);
-                if (iter != loadedResources.end())
+                startLoad(h, *info);
+            }
+            else
+            {
+                info->resource = info->load(info->resolvedName);
+                if (info->resource == NULL)
                 {
-                    resources[h].resource = iter->second;
-                    resources[h].state = ResourceLoaded;
+                    info->state = ResourceLoadingFailed;
                 }
                 else
                 {
-                    resources[h].resource = resources[h].load(resources[h].resolvedName);
-                    if (resources[h].resource == NULL)
-                    {
-                        resources[h].state = ResourceLoadingFailed;
-                    }
-                    else
-                    {
-                        resources[h].state = ResourceLoaded;
-                        loadedResources.insert(NameMapValue(resources[h].resolvedName, resources[h].resource));
-                    }
+                    info->state = ResourceLoaded;
+                    loadedResources.insert(NameMapValue(info->resolvedName, info->resource));
                 }
             }
-
-            if (resources[h].state == ResourceLoaded)
-                return resources[h].resource;
-            else
-                return NULL;
         }
+
+        if (info->state == ResourceLoaded)
+            return info->resource;
+        else
+            return NULL;
     }
 
     const T* getResourceInfo(ResourceHandle h)
     {
-        if (h >= (int) handles.size() || h < 0)
-            return NULL;
-        else
-            return &resources[h];
+        return getInfo(h);
+    }
+
+    /*! Set the pool used to load resources in the background; NULL restores
+     *  synchronous loading. Loads already in progress are unaffected.
+     */
+    void setLoaderPool(WorkerPool* pool)
+    {
+        loaderPool = pool;
+    }
+
+    /*! Create the resources that have finished loading in the background,
+     *  stopping when more than maxTime seconds have been spent. At least
+     *  one resource is created per call, so that loading always progresses.
+     */
+    void finishLoads(double maxTime)
+    {
+        timer->reset();
+
+        for (;;)
+        {
+            CompletedLoad completed;
+            {
+                MutexLock lock(mutex);
+                if (completedLoads.empty())
+                    break;
+                completed = completedLoads.front();
+                completedLoads.pop_front();
+            }
+
+            T* loadedInfo = completed.info;
+            ResourceType* resource = NULL;
+            if (completed.succeeded)
+                resource = loadedInfo->finishLoad(loadedInfo->resolvedName);
+            if (resource != NULL)
+                loadedResources.insert(NameMapValue(loadedInfo->resolvedName, resource));
+
+            typename PendingLoadMap::iterator iter = pendingLoads.find(loadedInfo->resolvedName);
+            if (iter != pendingLoads.end())
+            {
+                for (unsigned int i = 0; i < iter->second.size(); i++)
+                {
+                    T* info = getInfo(iter->second[i]);
+                    info->resource = resource;
+                    info->state = resource != NULL ? ResourceLoaded : ResourceLoadingFailed;
+                }
+                pendingLoads.erase(iter);
+            }
+
+            delete loadedInfo;
+
+            if (timer->getTime() > maxTime)
+                break;
+        }
     }
 };
 
 #endif // _CELUTIL_RESMANAGER_H_
-
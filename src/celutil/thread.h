@@ -0,0 +1,86 @@
+// thread.h
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// Minimal, platform independent threading primitives.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#ifndef _CELUTIL_THREAD_H_
+#define _CELUTIL_THREAD_H_
+
+/*! A unit of work that can be run on another thread.
+ */
+class Task
+{
+ public:
+    Task() {};
+    virtual ~Task() {};
+
+    virtual void run() = 0;
+};
+
+
+class Mutex
+{
+ public:
+    Mutex() {};
+    virtual ~Mutex() {};
+
+    virtual void lock() = 0;
+    virtual void unlock() = 0;
+};
+
+
+/*! Counting semaphore: wait() blocks until the count is greater than zero,
+ *  then decrements it. signal() increments the count.
+ */
+class Semaphore
+{
+ public:
+    Semaphore() {};
+    virtual ~Semaphore() {};
+
+    virtual void wait() = 0;
+    virtual void signal() = 0;
+};
+
+
+class Thread
+{
+ public:
+    Thread() {};
+    virtual ~Thread() {};
+
+    // Block until the thread's task has finished running
+    virtual void join() = 0;
+};
+
+
+/*! Lock a mutex for the lifetime of the MutexLock object.
+ */
+class MutexLock
+{
+ public:
+    MutexLock(Mutex* _mutex) : mutex(_mutex) { mutex->lock(); }
+    ~MutexLock() { mutex->unlock(); }
+
+ private:
+    Mutex* mutex;
+};
+
+
+extern Mutex* NewMutex();
+extern Semaphore* NewSemaphore(unsigned int initialCount = 0);
+
+// Start a new thread running the specified task. The task is not deleted
+// when it completes; it must remain valid until the thread is joined.
+extern Thread* StartThread(Task* task);
+
+// Number of processors available for running threads (at least 1)
+extern unsigned int GetProcessorCount();
+
+#endif // _CELUTIL_THREAD_H_
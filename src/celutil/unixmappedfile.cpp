@@ -0,0 +1,79 @@
+// unixmappedfile.cpp
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "mappedfile.h"
+
+
+class UnixMappedFile : public MappedFile
+{
+ public:
+    UnixMappedFile(void* _data, std::size_t _size);
+    ~UnixMappedFile();
+
+    const char* getData() const;
+    std::size_t getSize() const;
+
+ private:
+    void* data;
+    std::size_t size;
+};
+
+
+UnixMappedFile::UnixMappedFile(void* _data, std::size_t _size) :
+    data(_data),
+    size(_size)
+{
+}
+
+UnixMappedFile::~UnixMappedFile()
+{
+    if (data != NULL)
+        munmap(data, size);
+}
+
+const char* UnixMappedFile::getData() const
+{
+    return reinterpret_cast<const char*>(data);
+}
+
+std::size_t UnixMappedFile::getSize() const
+{
+    return size;
+}
+
+
+MappedFile* OpenMappedFile(const std::string& filename)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat fileInfo;
+    if (fstat(fd, &fileInfo) != 0 || fileInfo.st_size == 0)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    std::size_t size = (std::size_t) fileInfo.st_size;
+    void* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    // The mapping remains valid after the file descriptor is closed
+    close(fd);
+
+    if (data == MAP_FAILED)
+        return NULL;
+
+    return new UnixMappedFile(data, size);
+}
@@ -0,0 +1,142 @@
+// unixthread.cpp
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include <pthread.h>
+#include <unistd.h>
+#include "thread.h"
+
+
+class PosixMutex : public Mutex
+{
+ public:
+    PosixMutex()  { pthread_mutex_init(&mutex, NULL); }
+    ~PosixMutex() { pthread_mutex_destroy(&mutex); }
+
+    void lock()   { pthread_mutex_lock(&mutex); }
+    void unlock() { pthread_mutex_unlock(&mutex); }
+
+ private:
+    pthread_mutex_t mutex;
+};
+
+
+// Unnamed POSIX semaphores aren't available everywhere (Mac OS X), so
+// the semaphore is built from a mutex and condition variable instead.
+class PosixSemaphore : public Semaphore
+{
+ public:
+    PosixSemaphore(unsigned int initialCount);
+    ~PosixSemaphore();
+
+    void wait();
+    void signal();
+
+ private:
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    unsigned int count;
+};
+
+
+PosixSemaphore::PosixSemaphore(unsigned int initialCount) :
+    count(initialCount)
+{
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&cond, NULL);
+}
+
+PosixSemaphore::~PosixSemaphore()
+{
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&mutex);
+}
+
+void PosixSemaphore::wait()
+{
+    pthread_mutex_lock(&mutex);
+    while (count == 0)
+        pthread_cond_wait(&cond, &mutex);
+    count--;
+    pthread_mutex_unlock(&mutex);
+}
+
+void PosixSemaphore::signal()
+{
+    pthread_mutex_lock(&mutex);
+    count++;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&mutex);
+}
+
+
+class PosixThread : public Thread
+{
+ public:
+    PosixThread(pthread_t _thread) : thread(_thread), joined(false) {};
+    ~PosixThread();
+
+    void join();
+
+ private:
+    pthread_t thread;
+    bool joined;
+};
+
+
+PosixThread::~PosixThread()
+{
+    if (!joined)
+        pthread_detach(thread);
+}
+
+void PosixThread::join()
+{
+    if (!joined)
+    {
+        pthread_join(thread, NULL);
+        joined = true;
+    }
+}
+
+
+static void* runTask(void* arg)
+{
+    reinterpret_cast<Task*>(arg)->run();
+    return NULL;
+}
+
+
+Mutex* NewMutex()
+{
+    return new PosixMutex();
+}
+
+Semaphore* NewSemaphore(unsigned int initialCount)
+{
+    return new PosixSemaphore(initialCount);
+}
+
+Thread* StartThread(Task* task)
+{
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, runTask, task) != 0)
+        return NULL;
+
+    return new PosixThread(thread);
+}
+
+unsigned int GetProcessorCount()
+{
+#ifdef _SC_NPROCESSORS_ONLN
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (count > 0)
+        return (unsigned int) count;
+#endif
+    return 1;
+}
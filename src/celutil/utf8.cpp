@@ -595,6 +595,34 @@ int UTF8StringCompare(const std::string& s0, const std::string& s1, size_t n)
 }
 
 
+//! Return a copy of a UTF-8 string with each character normalized in the
+//! same way as UTF8StringCompare(). Comparing normalized strings byte by
+//! byte gives the same result as UTF8StringCompare() on the originals, so
+//! they can be used as keys for sorting and prefix searches. Conversion
+//! stops at the first invalid character.
+std::string UTF8NormalizeString(const std::string& s)
+{
+    std::string normalized;
+    normalized.reserve(s.length());
+
+    int len = s.length();
+    int i = 0;
+    while (i < len)
+    {
+        wchar_t ch = 0;
+        if (!UTF8Decode(s, i, ch))
+            break;
+        i += UTF8EncodedSize(ch);
+
+        char buf[8];
+        int n = UTF8Encode(UTF8Normalize(ch), buf);
+        normalized.append(buf, n);
+    }
+
+    return normalized;
+}
+
+
 //! Currently incomplete, but could be a helpful class for dealing with
 //! UTF-8 streams
 class UTF8StringIterator
@@ -24,6 +24,7 @@ bool UTF8Decode(const char* str, int pos, int length, wchar_t& ch);
 int UTF8Encode(wchar_t ch, char* s);
 int UTF8StringCompare(const std::string& s0, const std::string& s1);
 int UTF8StringCompare(const std::string& s0, const std::string& s1, size_t length);
+std::string UTF8NormalizeString(const std::string& s);
 
 class UTF8StringOrderingPredicate
 {
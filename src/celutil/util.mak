@@ -26,7 +26,10 @@ OBJS=\
 	$(INTDIR)\formatnum.obj \
 	$(INTDIR)\utf8.obj \
 	$(INTDIR)\util.obj \
+	$(INTDIR)\workerpool.obj \
 	$(INTDIR)\windirectory.obj \
+	$(INTDIR)\winmappedfile.obj \
+	$(INTDIR)\winthread.obj \
 	$(INTDIR)\wintimer.obj \
 	$(INTDIR)\winutil.obj
 
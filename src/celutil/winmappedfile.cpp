@@ -0,0 +1,100 @@
+// winmappedfile.cpp
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include <windows.h>
+#include "mappedfile.h"
+
+
+class WindowsMappedFile : public MappedFile
+{
+ public:
+    WindowsMappedFile(HANDLE _mapping, const void* _data, std::size_t _size);
+    ~WindowsMappedFile();
+
+    const char* getData() const;
+    std::size_t getSize() const;
+
+ private:
+    HANDLE mapping;
+    const void* data;
+    std::size_t size;
+};
+
+
+WindowsMappedFile::WindowsMappedFile(HANDLE _mapping, const void* _data, std::size_t _size) :
+    mapping(_mapping),
+    data(_data),
+    size(_size)
+{
+}
+
+WindowsMappedFile::~WindowsMappedFile()
+{
+    if (data != NULL)
+        UnmapViewOfFile(data);
+    if (mapping != NULL)
+        CloseHandle(mapping);
+}
+
+const char* WindowsMappedFile::getData() const
+{
+    return reinterpret_cast<const char*>(data);
+}
+
+std::size_t WindowsMappedFile::getSize() const
+{
+    return size;
+}
+
+
+MappedFile* OpenMappedFile(const std::string& filename)
+{
+    HANDLE file = CreateFileA(filename.c_str(),
+                              GENERIC_READ,
+                              FILE_SHARE_READ,
+                              NULL,
+                              OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL,
+                              NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return NULL;
+
+    DWORD sizeHigh = 0;
+    DWORD sizeLow = GetFileSize(file, &sizeHigh);
+    if (sizeLow == INVALID_FILE_SIZE && GetLastError() != NO_ERROR)
+    {
+        CloseHandle(file);
+        return NULL;
+    }
+
+    // Files larger than the address space can't be mapped as a whole
+    unsigned __int64 fileSize = ((unsigned __int64) sizeHigh << 32) | sizeLow;
+    if (fileSize == 0 || fileSize > (unsigned __int64) ((std::size_t) -1))
+    {
+        CloseHandle(file);
+        return NULL;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+    // The mapping object keeps its own reference to the file
+    CloseHandle(file);
+
+    if (mapping == NULL)
+        return NULL;
+
+    const void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (data == NULL)
+    {
+        CloseHandle(mapping);
+        return NULL;
+    }
+
+    return new WindowsMappedFile(mapping, data, (std::size_t) fileSize);
+}
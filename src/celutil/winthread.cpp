@@ -0,0 +1,93 @@
+// winthread.cpp
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include <windows.h>
+#include <process.h>
+#include <climits>
+#include "thread.h"
+
+
+class WindowsMutex : public Mutex
+{
+ public:
+    WindowsMutex()  { InitializeCriticalSection(&section); }
+    ~WindowsMutex() { DeleteCriticalSection(&section); }
+
+    void lock()   { EnterCriticalSection(&section); }
+    void unlock() { LeaveCriticalSection(&section); }
+
+ private:
+    CRITICAL_SECTION section;
+};
+
+
+class WindowsSemaphore : public Semaphore
+{
+ public:
+    WindowsSemaphore(unsigned int initialCount)
+    {
+        semaphore = CreateSemaphore(NULL, (LONG) initialCount, LONG_MAX, NULL);
+    }
+    ~WindowsSemaphore() { CloseHandle(semaphore); }
+
+    void wait()   { WaitForSingleObject(semaphore, INFINITE); }
+    void signal() { ReleaseSemaphore(semaphore, 1, NULL); }
+
+ private:
+    HANDLE semaphore;
+};
+
+
+class WindowsThread : public Thread
+{
+ public:
+    WindowsThread(HANDLE _thread) : thread(_thread) {};
+    ~WindowsThread() { CloseHandle(thread); }
+
+    void join() { WaitForSingleObject(thread, INFINITE); }
+
+ private:
+    HANDLE thread;
+};
+
+
+// _beginthreadex rather than CreateThread, so that the C runtime is
+// properly initialized for the new thread.
+static unsigned __stdcall runTask(void* arg)
+{
+    reinterpret_cast<Task*>(arg)->run();
+    return 0;
+}
+
+
+Mutex* NewMutex()
+{
+    return new WindowsMutex();
+}
+
+Semaphore* NewSemaphore(unsigned int initialCount)
+{
+    return new WindowsSemaphore(initialCount);
+}
+
+Thread* StartThread(Task* task)
+{
+    uintptr_t thread = _beginthreadex(NULL, 0, runTask, task, 0, NULL);
+    if (thread == 0)
+        return NULL;
+
+    return new WindowsThread(reinterpret_cast<HANDLE>(thread));
+}
+
+unsigned int GetProcessorCount()
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (unsigned int) info.dwNumberOfProcessors : 1;
+}
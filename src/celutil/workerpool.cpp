@@ -0,0 +1,227 @@
+// workerpool.cpp
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include "workerpool.h"
+
+using namespace std;
+
+
+TaskGroup::TaskGroup() :
+    mutex(NewMutex()),
+    finished(NewSemaphore(0)),
+    pending(0)
+{
+}
+
+
+TaskGroup::~TaskGroup()
+{
+    delete finished;
+    delete mutex;
+}
+
+
+bool TaskGroup::isFinished() const
+{
+    MutexLock lock(mutex);
+    return pending == 0;
+}
+
+
+void TaskGroup::taskAdded()
+{
+    MutexLock lock(mutex);
+    pending++;
+}
+
+
+void TaskGroup::taskFinished()
+{
+    // Wake up a waiting thread so that it can check whether the group is
+    // finished or run another queued task. The semaphore is signaled while
+    // the lock is still held: once pending reaches zero the waiting thread
+    // may return and destroy the group, so the group must not be touched
+    // after the lock is released.
+    MutexLock lock(mutex);
+    pending--;
+    finished->signal();
+}
+
+
+void WorkerPool::Worker::run()
+{
+    for (;;)
+    {
+        pool->queueSemaphore->wait();
+
+        QueuedTask queued;
+        {
+            MutexLock lock(pool->queueMutex);
+            if (pool->shuttingDown)
+                return;
+
+            // The task may already have been taken by a thread waiting on
+            // a task group.
+            if (pool->queue.empty())
+                continue;
+
+            queued = pool->queue.front();
+            pool->queue.pop_front();
+        }
+
+        pool->runTask(queued);
+    }
+}
+
+
+WorkerPool::WorkerPool(unsigned int nThreads) :
+    queueMutex(NewMutex()),
+    queueSemaphore(NewSemaphore(0)),
+    shuttingDown(false)
+{
+    if (nThreads == 0)
+        nThreads = GetProcessorCount();
+
+    for (unsigned int i = 0; i < nThreads; i++)
+    {
+        Worker* worker = new Worker(this);
+        Thread* thread = StartThread(worker);
+        if (thread == NULL)
+        {
+            delete worker;
+            break;
+        }
+
+        workers.push_back(worker);
+        threads.push_back(thread);
+    }
+}
+
+
+WorkerPool::~WorkerPool()
+{
+    {
+        MutexLock lock(queueMutex);
+        shuttingDown = true;
+    }
+
+    for (unsigned int i = 0; i < threads.size(); i++)
+        queueSemaphore->signal();
+
+    for (unsigned int i = 0; i < threads.size(); i++)
+    {
+        threads[i]->join();
+        delete threads[i];
+        delete workers[i];
+    }
+
+    // Discard any tasks that never ran
+    for (deque<QueuedTask>::iterator iter = queue.begin(); iter != queue.end(); iter++)
+    {
+        delete iter->task;
+        if (iter->group != NULL)
+            iter->group->taskFinished();
+    }
+
+    delete queueSemaphore;
+    delete queueMutex;
+}
+
+
+unsigned int WorkerPool::getThreadCount() const
+{
+    return threads.size();
+}
+
+
+void WorkerPool::submit(Task* task, TaskGroup* group)
+{
+    if (group != NULL)
+        group->taskAdded();
+
+    // Without any worker threads, run the task immediately
+    if (threads.empty())
+    {
+        QueuedTask queued;
+        queued.task = task;
+        queued.group = group;
+        runTask(queued);
+        return;
+    }
+
+    {
+        MutexLock lock(queueMutex);
+        QueuedTask queued;
+        queued.task = task;
+        queued.group = group;
+        queue.push_back(queued);
+    }
+    queueSemaphore->signal();
+}
+
+
+void WorkerPool::wait(TaskGroup& group)
+{
+    while (!group.isFinished())
+    {
+        QueuedTask queued;
+        if (tryPopTask(queued))
+            runTask(queued);
+        else
+            group.finished->wait();
+    }
+}
+
+
+unsigned int WorkerPool::getQueueLength() const
+{
+    MutexLock lock(queueMutex);
+    return queue.size();
+}
+
+
+bool WorkerPool::tryPopTask(QueuedTask& queued)
+{
+    MutexLock lock(queueMutex);
+    if (queue.empty())
+        return false;
+
+    queued = queue.front();
+    queue.pop_front();
+
+    return true;
+}
+
+
+void WorkerPool::runTask(const QueuedTask& queued)
+{
+    queued.task->run();
+    delete queued.task;
+
+    if (queued.group != NULL)
+        queued.group->taskFinished();
+}
+
+
+// The shared pool is created on first use, which may happen on any thread:
+// the background loaders and orbit samplers can get there before the star
+// database does. The mutex guarding it is created during static
+// initialization, before any threads are started.
+static Mutex* sharedPoolMutex = NewMutex();
+
+WorkerPool* WorkerPool::getSharedPool()
+{
+    static WorkerPool* sharedPool = NULL;
+
+    MutexLock lock(sharedPoolMutex);
+    if (sharedPool == NULL)
+        sharedPool = new WorkerPool();
+
+    return sharedPool;
+}
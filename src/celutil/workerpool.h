@@ -0,0 +1,101 @@
+// workerpool.h
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#ifndef _CELUTIL_WORKERPOOL_H_
+#define _CELUTIL_WORKERPOOL_H_
+
+#include <cstddef>
+#include <deque>
+#include <vector>
+#include <celutil/thread.h>
+
+
+/*! A TaskGroup tracks a set of tasks submitted to a WorkerPool, so that
+ *  a thread can wait for all of them to finish. Tasks may add more tasks
+ *  to their own group while running.
+ */
+class TaskGroup
+{
+ public:
+    TaskGroup();
+    ~TaskGroup();
+
+    bool isFinished() const;
+
+ private:
+    void taskAdded();
+    void taskFinished();
+
+    Mutex* mutex;
+    Semaphore* finished;
+    unsigned int pending;
+
+    friend class WorkerPool;
+};
+
+
+/*! A fixed set of worker threads running tasks from a shared queue. The
+ *  pool takes ownership of submitted tasks and deletes them after they run.
+ */
+class WorkerPool
+{
+ public:
+    // A thread count of zero creates one worker per processor
+    WorkerPool(unsigned int nThreads = 0);
+    ~WorkerPool();
+
+    unsigned int getThreadCount() const;
+
+    void submit(Task* task, TaskGroup* group = NULL);
+
+    // Block until all tasks in the group have finished. The calling thread
+    // runs queued tasks while it waits, so it's safe to wait from the main
+    // thread even when the pool has a single worker.
+    void wait(TaskGroup& group);
+
+    // Number of tasks that are queued but haven't started yet
+    unsigned int getQueueLength() const;
+
+    // Process wide pool shared by the engine for short, CPU bound jobs. It
+    // may be requested from any thread.
+    static WorkerPool* getSharedPool();
+
+ private:
+    struct QueuedTask
+    {
+        Task* task;
+        TaskGroup* group;
+    };
+
+    class Worker;
+    friend class Worker;
+
+    class Worker : public Task
+    {
+     public:
+        Worker(WorkerPool* _pool) : pool(_pool) {};
+        void run();
+
+     private:
+        WorkerPool* pool;
+    };
+
+    bool tryPopTask(QueuedTask& queued);
+    void runTask(const QueuedTask& queued);
+
+    std::deque<QueuedTask> queue;
+    Mutex* queueMutex;
+    Semaphore* queueSemaphore;
+    bool shuttingDown;
+
+    std::vector<Worker*> workers;
+    std::vector<Thread*> threads;
+};
+
+#endif // _CELUTIL_WORKERPOOL_H_
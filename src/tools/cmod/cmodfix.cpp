@@ -9,6 +9,8 @@
 //
 // Perform various adjustments to a cmod file
 
+#include "vertexcache.h"
+#include "simplify.h"
 #include <celmodel/modelfile.h>
 #include <celutil/basictypes.h>
 #include <celmath/mathlib.h>
@@ -37,6 +39,10 @@ bool genTangents = false;
 bool weldVertices = false;
 bool mergeMeshes = false;
 bool stripify = false;
+bool compress = false;
+bool reorder = false;
+bool genLevelsOfDetail = false;
+unsigned int maxLevelsOfDetail = 8;
 unsigned int vertexCacheSize = 16;
 float smoothAngle = 60.0f;
 
@@ -55,6 +61,9 @@ void usage()
 #ifdef TRISTRIP
     cerr << "   --optimize (or -o)    : optimize by converting triangle lists to strips\n";
 #endif
+    cerr << "   --lod (or -l)         : generate simplified levels of detail\n";
+    cerr << "   --reorder (or -r)     : reorder triangles and vertices for the vertex cache\n";
+    cerr << "   --compress (or -c)    : store vertices in compact encodings\n";
 }
 
 
@@ -1346,6 +1355,7 @@ convertToStrips(Mesh& mesh)
     // NvTriStrip library can only handle 16-bit indices
     if (mesh.getVertexCount() >= 0x10000)
     {
+        cerr << "Mesh has too many vertices to convert to strips; use --reorder instead\n";
         return true;
     }
 
@@ -1435,6 +1445,47 @@ convertToStrips(Mesh& mesh)
 #endif
 
 
+// Choose compact encodings for the attributes of a mesh: positions are
+// quantized relative to the mesh bounds, normals and tangents are stored
+// as octahedral coordinates, and texture coordinates as half floats.
+// Other attributes are left alone.
+void
+encodeVertexAttributes(Mesh& mesh)
+{
+    Mesh::VertexDescription desc = mesh.getVertexDescription();
+
+    for (uint32 i = 0; i < desc.nAttributes; i++)
+    {
+        Mesh::VertexAttribute& attr = desc.attributes[i];
+        Mesh::VertexAttributeEncoding encoding = Mesh::RawEncoding;
+
+        switch (attr.semantic)
+        {
+        case Mesh::Position:
+            encoding = Mesh::QuantizedEncoding;
+            break;
+        case Mesh::Normal:
+        case Mesh::Tangent:
+            encoding = Mesh::OctahedralEncoding;
+            break;
+        case Mesh::Texture0:
+        case Mesh::Texture1:
+        case Mesh::Texture2:
+        case Mesh::Texture3:
+            encoding = Mesh::HalfEncoding;
+            break;
+        default:
+            break;
+        }
+
+        if (Mesh::isValidEncoding(attr.format, encoding))
+            attr.encoding = encoding;
+    }
+
+    mesh.setVertexDescription(desc);
+}
+
+
 bool parseCommandLine(int argc, char* argv[])
 {
     int i = 1;
@@ -1476,6 +1527,18 @@ bool parseCommandLine(int argc, char* argv[])
             {
                 stripify = true;
             }
+            else if (!strcmp(argv[i], "-l") || !strcmp(argv[i], "--lod"))
+            {
+                genLevelsOfDetail = true;
+            }
+            else if (!strcmp(argv[i], "-r") || !strcmp(argv[i], "--reorder"))
+            {
+                reorder = true;
+            }
+            else if (!strcmp(argv[i], "-c") || !strcmp(argv[i], "--compress"))
+            {
+                compress = true;
+            }
             else if (!strcmp(argv[i], "-s") || !strcmp(argv[i], "--smooth"))
             {
                 if (i == argc - 1)
@@ -1613,6 +1676,42 @@ int main(int argc, char* argv[])
         }
     }
 
+    if (genLevelsOfDetail)
+    {
+        for (uint32 i = 0; model->getMesh(i) != NULL; i++)
+        {
+            Mesh* mesh = model->getMesh(i);
+            unsigned int levelCount = GenerateLevelsOfDetail(*mesh, maxLevelsOfDetail);
+
+            // The model may be written to cout, so report on cerr
+            cerr << "Mesh " << i << ": " << mesh->getPrimitiveCount() << " primitives";
+            for (unsigned int j = 0; j < levelCount; j++)
+            {
+                const Mesh::LevelOfDetail* lod = mesh->getLevelOfDetail(j);
+                cerr << ", " << lod->getPrimitiveCount() << " (error " << lod->error << ")";
+            }
+            cerr << '\n';
+        }
+    }
+
+    if (reorder)
+    {
+        for (uint32 i = 0; model->getMesh(i) != NULL; i++)
+        {
+            Mesh* mesh = model->getMesh(i);
+            float acmrBefore = ComputeACMR(*mesh, vertexCacheSize);
+            OptimizeVertexCache(*mesh);
+            float acmrAfter = ComputeACMR(*mesh, vertexCacheSize);
+
+            // The model may be written to cout, so report on cerr
+            if (acmrBefore > 0.0f)
+            {
+                cerr << "Mesh " << i << ": ACMR " << acmrBefore
+                     << " -> " << acmrAfter << '\n';
+            }
+        }
+    }
+
 #ifdef TRISTRIP
     if (stripify)
     {
@@ -1625,6 +1724,15 @@ int main(int argc, char* argv[])
     }
 #endif
 
+    if (compress)
+    {
+        for (uint32 i = 0; model->getMesh(i) != NULL; i++)
+        {
+            Mesh* mesh = model->getMesh(i);
+            encodeVertexAttributes(*mesh);
+        }
+    }
+
     if (outputFilename.empty())
     {
         if (outputBinary)
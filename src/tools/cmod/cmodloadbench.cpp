@@ -0,0 +1,382 @@
+// cmodloadbench.cpp
+//
+// Copyright (C) 2010, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// Measure how long binary cmod files take to load, using either a cmod file
+// or synthetic shape models that are saved to a temporary file. Synthetic
+// models are checked against the data that was saved; when they're saved
+// with compressed vertices, the error introduced by compression is measured.
+
+#include <celmodel/modelfile.h>
+#include <celutil/timer.h>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+using namespace cmod;
+using namespace std;
+
+
+static const double PI = 3.14159265358979323846;
+
+
+void Usage()
+{
+    cerr << "Usage: cmodloadbench [--iterations <n>] [--colors] [--compress] [--temp <file>] [--model <cmod file>] [vertex count ...]\n";
+    cerr << "  Vertex counts default to 100000 1000000 2000000\n";
+}
+
+
+// Build a lumpy sphere with roughly the requested number of vertices. Each
+// vertex has a position, normal, and texture coordinate, and optionally a
+// color.
+static Model* makeShapeModel(unsigned int nVertices, bool withColors)
+{
+    unsigned int nRings = max(2u, (unsigned int) sqrt((double) nVertices / 2.0));
+    unsigned int nSlices = nRings * 2;
+    nVertices = (nRings + 1) * (nSlices + 1);
+
+    Mesh::VertexAttribute attributes[4];
+    unsigned int nAttributes = 0;
+    attributes[nAttributes++] = Mesh::VertexAttribute(Mesh::Position, Mesh::Float3, 0);
+    attributes[nAttributes++] = Mesh::VertexAttribute(Mesh::Normal, Mesh::Float3, 12);
+    attributes[nAttributes++] = Mesh::VertexAttribute(Mesh::Texture0, Mesh::Float2, 24);
+    unsigned int stride = 32;
+    if (withColors)
+    {
+        attributes[nAttributes++] = Mesh::VertexAttribute(Mesh::Color0, Mesh::UByte4, 32);
+        stride += 4;
+    }
+
+    char* vertexData = new char[nVertices * stride];
+    char* vertex = vertexData;
+    for (unsigned int i = 0; i <= nRings; i++)
+    {
+        double theta = PI * (double) i / (double) nRings;
+        for (unsigned int j = 0; j <= nSlices; j++, vertex += stride)
+        {
+            double phi = 2.0 * PI * (double) j / (double) nSlices;
+            double r = 1.0 + 0.2 * sin(3.0 * theta) * cos(2.0 * phi);
+            float* f = reinterpret_cast<float*>(vertex);
+            f[0] = (float) (r * sin(theta) * cos(phi));
+            f[1] = (float) (r * cos(theta));
+            f[2] = (float) (r * sin(theta) * sin(phi));
+            f[3] = (float) (sin(theta) * cos(phi));
+            f[4] = (float) cos(theta);
+            f[5] = (float) (sin(theta) * sin(phi));
+            f[6] = (float) j / (float) nSlices;
+            f[7] = (float) i / (float) nRings;
+            if (withColors)
+            {
+                // Include byte values that a text mode read would mangle
+                unsigned char* c = reinterpret_cast<unsigned char*>(vertex + 32);
+                c[0] = (unsigned char) (i * 7);
+                c[1] = (unsigned char) (j * 13);
+                c[2] = '\n';
+                c[3] = 0xff;
+            }
+        }
+    }
+
+    unsigned int nIndices = nRings * nSlices * 6;
+    Mesh::index32* indices = new Mesh::index32[nIndices];
+    Mesh::index32* index = indices;
+    for (unsigned int i = 0; i < nRings; i++)
+    {
+        for (unsigned int j = 0; j < nSlices; j++)
+        {
+            Mesh::index32 v0 = i * (nSlices + 1) + j;
+            Mesh::index32 v1 = v0 + nSlices + 1;
+            *index++ = v0;
+            *index++ = v1;
+            *index++ = v0 + 1;
+            *index++ = v0 + 1;
+            *index++ = v1;
+            *index++ = v1 + 1;
+        }
+    }
+
+    Mesh* mesh = new Mesh();
+    mesh->setVertexDescription(Mesh::VertexDescription(stride, nAttributes, attributes));
+    mesh->setVertices(nVertices, vertexData);
+    mesh->addGroup(Mesh::TriList, 0, nIndices, indices);
+
+    Model* model = new Model();
+    model->addMesh(mesh);
+
+    return model;
+}
+
+
+// Store positions, normals, and texture coordinates in compact encodings
+static void compressModel(Model* model)
+{
+    for (unsigned int i = 0; i < model->getMeshCount(); i++)
+    {
+        Mesh* mesh = model->getMesh(i);
+        Mesh::VertexDescription desc = mesh->getVertexDescription();
+        for (unsigned int j = 0; j < desc.nAttributes; j++)
+        {
+            if (desc.attributes[j].semantic == Mesh::Position)
+                desc.attributes[j].encoding = Mesh::QuantizedEncoding;
+            else if (desc.attributes[j].semantic == Mesh::Normal)
+                desc.attributes[j].encoding = Mesh::OctahedralEncoding;
+            else if (desc.attributes[j].semantic == Mesh::Texture0)
+                desc.attributes[j].encoding = Mesh::HalfEncoding;
+        }
+        mesh->setVertexDescription(desc);
+    }
+}
+
+
+// Compare a loaded mesh with the one that was saved. Unless the saved mesh
+// was compressed, the vertices must match exactly; otherwise, the largest
+// error of each encoded attribute is accumulated. Indices must always match.
+static bool compareMesh(const Mesh* loaded, const Mesh* saved,
+                        double& positionError, double& normalError, double& texCoordError)
+{
+    if (loaded->getVertexCount() != saved->getVertexCount() ||
+        loaded->getVertexStride() != saved->getVertexStride() ||
+        loaded->getGroupCount() != saved->getGroupCount())
+    {
+        return false;
+    }
+
+    for (unsigned int i = 0; i < loaded->getGroupCount(); i++)
+    {
+        const Mesh::PrimitiveGroup* ga = loaded->getGroup(i);
+        const Mesh::PrimitiveGroup* gb = saved->getGroup(i);
+        if (ga->prim != gb->prim || ga->nIndices != gb->nIndices ||
+            memcmp(ga->indices, gb->indices, ga->nIndices * sizeof(Mesh::index32)) != 0)
+        {
+            return false;
+        }
+    }
+
+    const Mesh::VertexDescription& desc = saved->getVertexDescription();
+    if (!desc.hasEncodedAttributes())
+    {
+        return memcmp(loaded->getVertexData(), saved->getVertexData(),
+                      saved->getVertexCount() * saved->getVertexStride()) == 0;
+    }
+
+    const char* a = reinterpret_cast<const char*>(loaded->getVertexData());
+    const char* b = reinterpret_cast<const char*>(saved->getVertexData());
+    for (unsigned int i = 0; i < saved->getVertexCount(); i++)
+    {
+        for (unsigned int j = 0; j < desc.nAttributes; j++)
+        {
+            const Mesh::VertexAttribute& attr = desc.attributes[j];
+            const float* fa = reinterpret_cast<const float*>(a + i * desc.stride + attr.offset);
+            const float* fb = reinterpret_cast<const float*>(b + i * desc.stride + attr.offset);
+            if (attr.encoding == Mesh::QuantizedEncoding)
+            {
+                for (unsigned int k = 0; k < 3; k++)
+                    positionError = max(positionError, (double) fabs(fa[k] - fb[k]));
+            }
+            else if (attr.encoding == Mesh::OctahedralEncoding)
+            {
+                // The angle from the chord between the vectors; acos of the
+                // dot product is too imprecise for tiny angles.
+                double dx = (double) fa[0] - fb[0];
+                double dy = (double) fa[1] - fb[1];
+                double dz = (double) fa[2] - fb[2];
+                double chord = sqrt(dx * dx + dy * dy + dz * dz);
+                normalError = max(normalError, 2.0 * asin(min(1.0, chord * 0.5)) * 180.0 / PI);
+            }
+            else if (attr.encoding == Mesh::HalfEncoding)
+            {
+                for (unsigned int k = 0; k < 2; k++)
+                    texCoordError = max(texCoordError, (double) fabs(fa[k] - fb[k]));
+            }
+            else if (memcmp(fa, fb, Mesh::getVertexAttributeSize(attr.format)) != 0)
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+
+static Model* loadModelFile(const string& filename)
+{
+    ifstream in(filename.c_str(), ios::in | ios::binary);
+    if (!in.good())
+    {
+        cerr << "Error opening " << filename << '\n';
+        return NULL;
+    }
+
+    return LoadModel(in);
+}
+
+
+// Load a cmod file repeatedly and report the average time. If a reference
+// model is given, the last model loaded is compared with it.
+static bool benchmark(const string& filename, unsigned int iterations,
+                      const Model* reference, Timer* timer)
+{
+    ifstream in(filename.c_str(), ios::in | ios::binary);
+    in.seekg(0, ios::end);
+    double fileSize = (double) in.tellg();
+    in.close();
+
+    Model* model = NULL;
+    timer->reset();
+    for (unsigned int i = 0; i < iterations; i++)
+    {
+        delete model;
+        model = loadModelFile(filename);
+        if (model == NULL)
+        {
+            cerr << "Error loading " << filename << '\n';
+            return false;
+        }
+    }
+    double loadTime = timer->getTime() / iterations;
+
+    unsigned int nVertices = 0;
+    for (unsigned int i = 0; i < model->getMeshCount(); i++)
+        nVertices += model->getMesh(i)->getVertexCount();
+
+    cout << nVertices << " vertices, " << model->getPrimitiveCount() << " primitives, "
+         << fileSize / 1.0e6 << " MB\n";
+    cout << "  load: " << loadTime * 1000.0 << " ms, "
+         << fileSize / loadTime / 1.0e6 << " MB/s\n";
+
+    bool matched = true;
+    if (reference != NULL)
+    {
+        double positionError = 0.0;
+        double normalError = 0.0;
+        double texCoordError = 0.0;
+        matched = model->getMeshCount() == reference->getMeshCount();
+        for (unsigned int i = 0; matched && i < model->getMeshCount(); i++)
+        {
+            matched = compareMesh(model->getMesh(i), reference->getMesh(i),
+                                  positionError, normalError, texCoordError);
+        }
+
+        // Shape models are less than 2.5 units across, so quantized
+        // positions should be within half of 2.5/65535 of the originals.
+        if (positionError > 2.0e-5 || normalError > 0.01 || texCoordError > 2.5e-4)
+            matched = false;
+
+        cout << "  " << (matched ? "matches saved model" : "DOES NOT MATCH saved model") << '\n';
+        if (positionError != 0.0 || normalError != 0.0 || texCoordError != 0.0)
+        {
+            cout << "  largest errors: position " << positionError
+                 << ", normal " << normalError << " degrees"
+                 << ", texture coordinate " << texCoordError << '\n';
+        }
+    }
+
+    delete model;
+
+    return matched;
+}
+
+
+int main(int argc, char* argv[])
+{
+    unsigned int iterations = 5;
+    bool withColors = false;
+    bool compress = false;
+    string modelFilename;
+    string tempFilename = "cmodloadbench.tmp";
+    vector<unsigned int> counts;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--iterations") && i + 1 < argc)
+        {
+            iterations = (unsigned int) strtoul(argv[++i], NULL, 10);
+        }
+        else if (!strcmp(argv[i], "--colors"))
+        {
+            withColors = true;
+        }
+        else if (!strcmp(argv[i], "--compress"))
+        {
+            compress = true;
+        }
+        else if (!strcmp(argv[i], "--temp") && i + 1 < argc)
+        {
+            tempFilename = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--model") && i + 1 < argc)
+        {
+            modelFilename = argv[++i];
+        }
+        else if (argv[i][0] >= '0' && argv[i][0] <= '9')
+        {
+            counts.push_back((unsigned int) strtoul(argv[i], NULL, 10));
+        }
+        else
+        {
+            Usage();
+            return 1;
+        }
+    }
+
+    if (iterations == 0)
+    {
+        Usage();
+        return 1;
+    }
+
+    Timer* timer = CreateTimer();
+    bool allMatched = true;
+
+    if (!modelFilename.empty())
+    {
+        allMatched = benchmark(modelFilename, iterations, NULL, timer);
+    }
+    else
+    {
+        if (counts.empty())
+        {
+            counts.push_back(100000);
+            counts.push_back(1000000);
+            counts.push_back(2000000);
+        }
+
+        for (unsigned int i = 0; i < counts.size(); i++)
+        {
+            Model* model = makeShapeModel(counts[i], withColors);
+            if (compress)
+                compressModel(model);
+
+            ofstream out(tempFilename.c_str(), ios::out | ios::binary);
+            if (!out.good() || !SaveModelBinary(model, out))
+            {
+                cerr << "Error writing " << tempFilename << '\n';
+                delete model;
+                return 1;
+            }
+            out.close();
+
+            allMatched = benchmark(tempFilename, iterations, model, timer) && allMatched;
+            delete model;
+        }
+
+        remove(tempFilename.c_str());
+    }
+
+    delete timer;
+
+    return allMatched ? 0 : 1;
+}
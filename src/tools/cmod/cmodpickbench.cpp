@@ -0,0 +1,272 @@
+// cmodpickbench.cpp
+//
+// Copyright (C) 2010, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// Compare picking with the mesh bounding volume hierarchy to testing every
+// triangle, using either a cmod file or synthetic shape models, and verify
+// that both find the same intersections.
+
+#include <celmodel/modelfile.h>
+#include <celutil/timer.h>
+#include <Eigen/Core>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+
+using namespace cmod;
+using namespace Eigen;
+using namespace std;
+
+
+static const double PI = 3.14159265358979323846;
+
+
+void Usage()
+{
+    cerr << "Usage: cmodpickbench [--rays <n>] [--model <cmod file>] [triangle count ...]\n";
+    cerr << "  Triangle counts default to 10000 100000 1000000\n";
+}
+
+
+static double uniformRandom()
+{
+    return (double) rand() / (double) RAND_MAX;
+}
+
+
+// Build a lumpy, asteroid-like shape model with roughly the requested
+// number of triangles, as a single triangle list.
+static Model* makeShapeModel(unsigned int nTriangles)
+{
+    unsigned int nRings = max(2u, (unsigned int) sqrt((double) nTriangles / 4.0));
+    unsigned int nSlices = nRings * 2;
+
+    unsigned int nVertices = (nRings + 1) * (nSlices + 1);
+    float* vertices = new float[nVertices * 3];
+    float* v = vertices;
+    for (unsigned int i = 0; i <= nRings; i++)
+    {
+        double theta = PI * (double) i / (double) nRings;
+
+        // Make the vertices at the poles coincide exactly, so that the
+        // triangles touching them are degenerate rather than slivers.
+        double sinTheta = (i == 0 || i == nRings) ? 0.0 : sin(theta);
+        for (unsigned int j = 0; j <= nSlices; j++)
+        {
+            double phi = 2.0 * PI * (double) j / (double) nSlices;
+            double r = 1.0 + 0.2 * sin(3.0 * theta) * cos(2.0 * phi) +
+                       0.05 * sin(17.0 * theta + 1.0) * sin(13.0 * phi);
+            *v++ = (float) (r * sinTheta * cos(phi));
+            *v++ = (float) (r * cos(theta) * 0.7);
+            *v++ = (float) (r * sinTheta * sin(phi));
+        }
+    }
+
+    unsigned int nIndices = nRings * nSlices * 6;
+    Mesh::index32* indices = new Mesh::index32[nIndices];
+    Mesh::index32* index = indices;
+    for (unsigned int i = 0; i < nRings; i++)
+    {
+        for (unsigned int j = 0; j < nSlices; j++)
+        {
+            Mesh::index32 v0 = i * (nSlices + 1) + j;
+            Mesh::index32 v1 = v0 + nSlices + 1;
+            *index++ = v0;
+            *index++ = v1;
+            *index++ = v0 + 1;
+            *index++ = v0 + 1;
+            *index++ = v1;
+            *index++ = v1 + 1;
+        }
+    }
+
+    Mesh::VertexAttribute position(Mesh::Position, Mesh::Float3, 0);
+    Mesh* mesh = new Mesh();
+    mesh->setVertexDescription(Mesh::VertexDescription(12, 1, &position));
+    mesh->setVertices(nVertices, vertices);
+    mesh->addGroup(Mesh::TriList, 0, nIndices, indices);
+
+    Model* model = new Model();
+    model->addMesh(mesh);
+
+    return model;
+}
+
+
+static bool pickExhaustive(const Model* model, const Vector3d& origin, const Vector3d& direction,
+                           Mesh::PickResult& result)
+{
+    bool hit = false;
+    for (unsigned int i = 0; i < model->getMeshCount(); i++)
+    {
+        Mesh::PickResult meshResult;
+        if (model->getMesh(i)->pickExhaustive(origin, direction, &meshResult) &&
+            (!hit || meshResult.distance < result.distance))
+        {
+            result = meshResult;
+            result.mesh = model->getMesh(i);
+            hit = true;
+        }
+    }
+
+    return hit;
+}
+
+
+// Pick rays start outside the model and are aimed at points scattered
+// around its center, so that most of them hit it.
+static void makeRays(const Model* model, unsigned int nRays,
+                     vector<Vector3d>& origins, vector<Vector3d>& directions)
+{
+    AlignedBox<float, 3> bbox;
+    for (unsigned int i = 0; i < model->getMeshCount(); i++)
+        bbox.extend(model->getMesh(i)->getBoundingBox());
+    Vector3d center = ((bbox.min() + bbox.max()) * 0.5f).cast<double>();
+    double radius = (bbox.max() - bbox.min()).cast<double>().norm() * 0.5;
+
+    srand(1);
+    for (unsigned int i = 0; i < nRays; i++)
+    {
+        Vector3d u(uniformRandom() * 2.0 - 1.0, uniformRandom() * 2.0 - 1.0, uniformRandom() * 2.0 - 1.0);
+        Vector3d target(uniformRandom() * 2.0 - 1.0, uniformRandom() * 2.0 - 1.0, uniformRandom() * 2.0 - 1.0);
+        Vector3d origin = center + u.normalized() * radius * 3.0;
+        origins.push_back(origin);
+        directions.push_back((center + target * radius * 0.6 - origin).normalized());
+    }
+}
+
+
+static bool benchmark(const Model* model, unsigned int nRays, Timer* timer)
+{
+    vector<Vector3d> origins;
+    vector<Vector3d> directions;
+    makeRays(model, nRays, origins, directions);
+
+    // The first pick builds the hierarchies
+    timer->reset();
+    double distance;
+    model->pick(origins[0], directions[0], distance);
+    double buildTime = timer->getTime();
+
+    vector<Mesh::PickResult> results(nRays);
+    vector<bool> hits(nRays);
+    timer->reset();
+    for (unsigned int i = 0; i < nRays; i++)
+        hits[i] = model->pick(origins[i], directions[i], &results[i]);
+    double bvhTime = timer->getTime();
+
+    // Testing every triangle is slow on large models, so fewer rays are used
+    unsigned int nExhaustiveRays = max(1u, min(nRays, 20000000 / max(1u, model->getPrimitiveCount())));
+    unsigned int mismatches = 0;
+    unsigned int hitCount = 0;
+    timer->reset();
+    for (unsigned int i = 0; i < nExhaustiveRays; i++)
+    {
+        Mesh::PickResult result;
+        bool hit = pickExhaustive(model, origins[i], directions[i], result);
+        if (hit != hits[i] ||
+            (hit && (result.mesh != results[i].mesh ||
+                     fabs(result.distance - results[i].distance) > 1.0e-9 * result.distance)))
+        {
+            mismatches++;
+        }
+        if (hit)
+            hitCount++;
+    }
+    double exhaustiveTime = timer->getTime();
+
+    cout << model->getPrimitiveCount() << " triangles, " << model->getMeshCount() << " meshes\n";
+    cout << "  hierarchy build:  " << buildTime * 1000.0 << " ms\n";
+    cout << "  bvh pick:         " << bvhTime / nRays * 1.0e6 << " us per ray\n";
+    cout << "  exhaustive pick:  " << exhaustiveTime / nExhaustiveRays * 1.0e6 << " us per ray ("
+         << nExhaustiveRays << " rays, " << hitCount << " hits)\n";
+    cout << "  mismatches:       " << mismatches << '\n';
+
+    return mismatches == 0;
+}
+
+
+int main(int argc, char* argv[])
+{
+    unsigned int nRays = 10000;
+    string modelFilename;
+    vector<unsigned int> counts;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--rays") && i + 1 < argc)
+        {
+            nRays = (unsigned int) strtoul(argv[++i], NULL, 10);
+        }
+        else if (!strcmp(argv[i], "--model") && i + 1 < argc)
+        {
+            modelFilename = argv[++i];
+        }
+        else if (argv[i][0] >= '0' && argv[i][0] <= '9')
+        {
+            counts.push_back((unsigned int) strtoul(argv[i], NULL, 10));
+        }
+        else
+        {
+            Usage();
+            return 1;
+        }
+    }
+
+    if (nRays == 0)
+    {
+        Usage();
+        return 1;
+    }
+
+    Timer* timer = CreateTimer();
+    bool allMatched = true;
+
+    if (!modelFilename.empty())
+    {
+        ifstream in(modelFilename.c_str(), ios::in | ios::binary);
+        if (!in.good())
+        {
+            cerr << "Error opening " << modelFilename << '\n';
+            return 1;
+        }
+
+        Model* model = LoadModel(in);
+        if (model == NULL)
+        {
+            cerr << "Error loading " << modelFilename << '\n';
+            return 1;
+        }
+
+        allMatched = benchmark(model, nRays, timer);
+        delete model;
+    }
+    else
+    {
+        if (counts.empty())
+        {
+            counts.push_back(10000);
+            counts.push_back(100000);
+            counts.push_back(1000000);
+        }
+
+        for (unsigned int i = 0; i < counts.size(); i++)
+        {
+            Model* model = makeShapeModel(counts[i]);
+            allMatched = benchmark(model, nRays, timer) && allMatched;
+            delete model;
+        }
+    }
+
+    delete timer;
+
+    return allMatched ? 0 : 1;
+}
@@ -29,7 +29,15 @@ TDSTOCMOD_OBJS=\
 	$(INTDIR)\3dstocmod.obj
 
 CMODFIX_OBJS=\
-	$(INTDIR)\cmodfix.obj
+	$(INTDIR)\cmodfix.obj \
+	$(INTDIR)\vertexcache.obj \
+	$(INTDIR)\simplify.obj
+
+CMODPICKBENCH_OBJS=\
+	$(INTDIR)\cmodpickbench.obj
+
+CMODLOADBENCH_OBJS=\
+	$(INTDIR)\cmodloadbench.obj
 
 DX_INCLUDEDIRS=/I c:\dx90sdk\include
 
@@ -116,12 +124,16 @@ RSC_FLAGS=/l 0x409 /d "_DEBUG"
 <<
 
 
-all : $(OUTDIR)\3dstocmod.exe $(OUTDIR)\cmodfix.exe
+all : $(OUTDIR)\3dstocmod.exe $(OUTDIR)\cmodfix.exe $(OUTDIR)\cmodpickbench.exe $(OUTDIR)\cmodloadbench.exe
 
 3dstocmod.exe : $(OUTDIR)\3dstocmod.exe
 
 cmodfix.exe : $(OUTDIR)\cmodfix.exe
 
+cmodpickbench.exe : $(OUTDIR)\cmodpickbench.exe
+
+cmodloadbench.exe : $(OUTDIR)\cmodloadbench.exe
+
 $(OUTDIR)\xtocmod.exe : $(OUTDIR) $(XTOCMOD_OBJS) $(LIBS) $(RESOURCES)
 	$(LINK32) @<<
         $(WIN_LINK32_FLAGS) /out:$(OUTDIR)\xtocmod.exe $(XTOCMOD_OBJS) $(RESOURCES) $(DXLIBS)
@@ -136,6 +148,14 @@ $(OUTDIR)\cmodfix.exe : $(OUTDIR) $(CMODFIX_OBJS) $(CEL_LIBS) $(RESOURCES)
 	$(LINK32) $(LINK32_FLAGS) /out:$(OUTDIR)\cmodfix.exe $(CMODFIX_OBJS) $(RESOURCES) $(OGLLIBS) $(IMGLIBS) $(CEL_LIBS) $(STRIPLIBS) $(EXTRA_LIBS)
 
 
+$(OUTDIR)\cmodpickbench.exe : $(OUTDIR) $(CMODPICKBENCH_OBJS) $(CEL_LIBS)
+	$(LINK32) $(LINK32_FLAGS) /out:$(OUTDIR)\cmodpickbench.exe $(CMODPICKBENCH_OBJS) $(CEL_LIBS) $(EXTRA_LIBS)
+
+
+$(OUTDIR)\cmodloadbench.exe : $(OUTDIR) $(CMODLOADBENCH_OBJS) $(CEL_LIBS)
+	$(LINK32) $(LINK32_FLAGS) /out:$(OUTDIR)\cmodloadbench.exe $(CMODLOADBENCH_OBJS) $(CEL_LIBS) $(EXTRA_LIBS)
+
+
 $(OUTDIR)\cmodtangents.exe : $(OUTDIR) $(CMODTANGENT_OBJS) $(CEL_LIBS) $(RESOURCES)
 	$(LINK32) @<<
         $(LINK32_FLAGS) /out:$(OUTDIR)\cmodtangents.exe $(CMODTANGENT_OBJS) $(RESOURCES) $(CEL_LIBS) $(EXTRA_LIBS)
@@ -146,4 +166,4 @@ $(OUTDIR)\cmodtangents.exe : $(OUTDIR) $(CMODTANGENT_OBJS) $(CEL_LIBS) $(RESOURC
 	if not exist "$(OUTDIR)/$(NULL)" mkdir "$(OUTDIR)"
 
 clean:
-	-@del $(OUTDIR)\cmodtangents.exe $(OUTDIR)\xtocmod.exe $(OUTDIR)\3dstocmod.exe $(OBJS) $(RESOURCES)
+	-@del $(OUTDIR)\cmodpickbench.exe $(OUTDIR)\cmodloadbench.exe $(OUTDIR)\cmodtangents.exe $(OUTDIR)\xtocmod.exe $(OUTDIR)\3dstocmod.exe $(OBJS) $(RESOURCES)
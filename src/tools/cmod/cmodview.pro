@@ -13,6 +13,8 @@ HEADERS = \
     convert3ds.h \
     convertobj.h \
     cmodops.h \
+    vertexcache.h \
+    simplify.h \
     materialwidget.h \
     glshader.h \
     glframebuffer.h
@@ -24,6 +26,8 @@ SOURCES = \
     convert3ds.cpp \
     convertobj.cpp \
     cmodops.cpp \
+    vertexcache.cpp \
+    simplify.cpp \
     materialwidget.cpp \
     glshader.cpp \
     glframebuffer.cpp
@@ -14,6 +14,8 @@
 #include "convert3ds.h"
 #include "convertobj.h"
 #include "cmodops.h"
+#include "vertexcache.h"
+#include "simplify.h"
 #include <cel3ds/3dsread.h>
 #include <celmodel/modelfile.h>
 
@@ -98,11 +100,15 @@ MainWindow::MainWindow() :
     QAction* generateTangentsAction = new QAction(tr("Generate &Tangents..."), this);
     QAction* uniquifyVerticesAction = new QAction(tr("&Uniquify Vertices"), this);
     QAction* mergeMeshesAction = new QAction(tr("&Merge Meshes"), this);
+    QAction* optimizeVertexCacheAction = new QAction(tr("Optimize for Vertex &Cache"), this);
+    QAction* generateLevelsOfDetailAction = new QAction(tr("Generate &Levels of Detail"), this);
 
     operationsMenu->addAction(generateNormalsAction);
     operationsMenu->addAction(generateTangentsAction);
     operationsMenu->addAction(uniquifyVerticesAction);
     operationsMenu->addAction(mergeMeshesAction);
+    operationsMenu->addAction(optimizeVertexCacheAction);
+    operationsMenu->addAction(generateLevelsOfDetailAction);
     menuBar->addMenu(operationsMenu);
 
     QMenu* toolsMenu = new QMenu(tr("&Tools"));
@@ -137,6 +143,8 @@ MainWindow::MainWindow() :
     connect(generateTangentsAction, SIGNAL(triggered()), this, SLOT(generateTangents()));
     connect(uniquifyVerticesAction, SIGNAL(triggered()), this, SLOT(uniquifyVertices()));
     connect(mergeMeshesAction, SIGNAL(triggered()), this, SLOT(mergeMeshes()));
+    connect(optimizeVertexCacheAction, SIGNAL(triggered()), this, SLOT(optimizeVertexCache()));
+    connect(generateLevelsOfDetailAction, SIGNAL(triggered()), this, SLOT(generateLevelsOfDetail()));
 
     // Apply settings
     QSettings settings;
@@ -710,6 +718,74 @@ MainWindow::mergeMeshes()
 }
 
 
+void
+MainWindow::optimizeVertexCache()
+{
+    Model* model = m_modelView->model();
+    if (!model)
+    {
+        return;
+    }
+
+    // Report the cache miss ratio of the whole model, weighting each
+    // mesh by its number of triangles.
+    const unsigned int cacheSize = 16;
+    double missesBefore = 0.0;
+    double missesAfter = 0.0;
+    unsigned int triangleCount = 0;
+
+    for (unsigned int i = 0; model->getMesh(i) != NULL; i++)
+    {
+        Mesh* mesh = model->getMesh(i);
+
+        unsigned int meshTriangles = 0;
+        for (unsigned int groupIndex = 0; groupIndex < mesh->getGroupCount(); ++groupIndex)
+        {
+            if (mesh->getGroup(groupIndex)->prim == Mesh::TriList)
+                meshTriangles += mesh->getGroup(groupIndex)->nIndices / 3;
+        }
+
+        missesBefore += ComputeACMR(*mesh, cacheSize) * meshTriangles;
+        OptimizeVertexCache(*mesh);
+        missesAfter += ComputeACMR(*mesh, cacheSize) * meshTriangles;
+        triangleCount += meshTriangles;
+    }
+
+    showModelStatistics();
+    if (triangleCount > 0)
+    {
+        statusBar()->showMessage(tr("Average cache miss ratio: %1 before, %2 after").
+                                 arg(missesBefore / triangleCount, 0, 'f', 3).
+                                 arg(missesAfter / triangleCount, 0, 'f', 3),
+                                 10000);
+    }
+    m_modelView->update();
+}
+
+
+void
+MainWindow::generateLevelsOfDetail()
+{
+    Model* model = m_modelView->model();
+    if (!model)
+    {
+        return;
+    }
+
+    // Report the number of levels generated for the mesh that has the most
+    const unsigned int maxLevels = 8;
+    unsigned int levelCount = 0;
+    for (unsigned int i = 0; model->getMesh(i) != NULL; i++)
+    {
+        unsigned int meshLevelCount = GenerateLevelsOfDetail(*model->getMesh(i), maxLevels);
+        if (meshLevelCount > levelCount)
+            levelCount = meshLevelCount;
+    }
+
+    statusBar()->showMessage(tr("Generated %1 levels of detail").arg(levelCount), 10000);
+}
+
+
 void
 MainWindow::updateSelectionInfo()
 {
@@ -55,6 +55,8 @@ public slots:
     void generateTangents();
     void uniquifyVertices();
     void mergeMeshes();
+    void optimizeVertexCache();
+    void generateLevelsOfDetail();
 
     void changeCurrentMaterial(const cmod::Material&);
     void updateSelectionInfo();
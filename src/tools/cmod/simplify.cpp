@@ -0,0 +1,1141 @@
+// simplify.cpp
+//
+// Copyright (C) 2010, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// Generate simplified levels of detail for a mesh.
+
+#include "simplify.h"
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <vector>
+
+using namespace cmod;
+using namespace Eigen;
+using namespace std;
+
+
+typedef Mesh::index32 index32;
+
+// Levels of detail with fewer triangles than this aren't generated
+static const unsigned int MinLevelTriangleCount = 32;
+
+// Stop adding levels once simplification can't reduce the triangle count
+// of a level to this fraction of the previous one.
+static const float MaxLevelTriangleRatio = 0.75f;
+
+// A collapse is rejected if it would turn any triangle by more than about
+// 80 degrees; this prevents triangles from folding over.
+static const float MinNormalCosine = 0.2f;
+
+// Weight of the planes that hold border vertices to the border, relative to
+// the planes of the triangles.
+static const double BorderPlaneWeight = 10.0;
+
+// A border position is a corner, and won't be moved, unless its two border
+// edges are within about 18 degrees of a straight line.
+static const float MinBorderStraightness = 0.95f;
+
+// Levels of detail are generated only until the error grows to this
+// fraction of the size of the mesh's bounding box; coarser levels would
+// only be drawn when the mesh covers a pixel or two.
+static const float MaxRelativeError = 0.1f;
+
+static const index32 NoVertex = ~0u;
+
+
+// A quadric gives the sum of the squared distances from a point to a set of
+// planes. Planes are weighted by the area of their triangles, and the error
+// is normalized by the total weight, so that it can be treated as a squared
+// distance.
+struct Quadric
+{
+    Quadric() :
+        a00(0.0), a01(0.0), a02(0.0), a11(0.0), a12(0.0), a22(0.0),
+        b0(0.0), b1(0.0), b2(0.0), c(0.0), weight(0.0)
+    {
+    }
+
+    void addPlane(const Vector3d& n, double d, double w)
+    {
+        a00 += w * n.x() * n.x();
+        a01 += w * n.x() * n.y();
+        a02 += w * n.x() * n.z();
+        a11 += w * n.y() * n.y();
+        a12 += w * n.y() * n.z();
+        a22 += w * n.z() * n.z();
+        b0  += w * n.x() * d;
+        b1  += w * n.y() * d;
+        b2  += w * n.z() * d;
+        c   += w * d * d;
+        weight += w;
+    }
+
+    Quadric& operator+=(const Quadric& q)
+    {
+        a00 += q.a00; a01 += q.a01; a02 += q.a02;
+        a11 += q.a11; a12 += q.a12; a22 += q.a22;
+        b0 += q.b0; b1 += q.b1; b2 += q.b2;
+        c += q.c;
+        weight += q.weight;
+        return *this;
+    }
+
+    double error(const Vector3d& p) const
+    {
+        if (weight <= 0.0)
+            return 0.0;
+
+        double e = p.x() * (a00 * p.x() + a01 * p.y() + a02 * p.z()) +
+                   p.y() * (a01 * p.x() + a11 * p.y() + a12 * p.z()) +
+                   p.z() * (a02 * p.x() + a12 * p.y() + a22 * p.z()) +
+                   2.0 * (b0 * p.x() + b1 * p.y() + b2 * p.z()) + c;
+
+        // Rounding can make the error slightly negative
+        return max(e, 0.0) / weight;
+    }
+
+    double a00, a01, a02, a11, a12, a22;
+    double b0, b1, b2;
+    double c;
+    double weight;
+};
+
+
+// An edge between two positions, and the number of triangles sharing it
+struct Edge
+{
+    Edge() : a(0), b(0), triangle(0), count(0) {}
+    Edge(index32 _a, index32 _b, unsigned int _triangle) :
+        a(min(_a, _b)), b(max(_a, _b)), triangle(_triangle), count(1) {}
+
+    bool operator<(const Edge& e) const
+    {
+        return a < e.a || (a == e.a && b < e.b);
+    }
+
+    index32 a;
+    index32 b;
+    unsigned int triangle;
+    unsigned int count;
+};
+
+
+struct Collapse
+{
+    bool operator<(const Collapse& c) const
+    {
+        return cost < c.cost;
+    }
+
+    index32 from;
+    index32 to;
+    double cost;
+};
+
+
+class PositionOrder
+{
+public:
+    PositionOrder(const vector<Vector3f>& _positions) : positions(_positions) {}
+
+    bool operator()(index32 i0, index32 i1) const
+    {
+        const Vector3f& p0 = positions[i0];
+        const Vector3f& p1 = positions[i1];
+        if (p0.x() != p1.x())
+            return p0.x() < p1.x();
+        else if (p0.y() != p1.y())
+            return p0.y() < p1.y();
+        else if (p0.z() != p1.z())
+            return p0.z() < p1.z();
+        else
+            return i0 < i1;
+    }
+
+private:
+    const vector<Vector3f>& positions;
+};
+
+
+// Squared distance from a point to a triangle; from Christer Ericson's
+// Real-Time Collision Detection.
+static float
+pointTriangleDistanceSquared(const Vector3f& p,
+                             const Vector3f& a,
+                             const Vector3f& b,
+                             const Vector3f& c)
+{
+    Vector3f ab = b - a;
+    Vector3f ac = c - a;
+    Vector3f ap = p - a;
+    float d1 = ab.dot(ap);
+    float d2 = ac.dot(ap);
+    if (d1 <= 0.0f && d2 <= 0.0f)
+        return ap.squaredNorm();
+
+    Vector3f bp = p - b;
+    float d3 = ab.dot(bp);
+    float d4 = ac.dot(bp);
+    if (d3 >= 0.0f && d4 <= d3)
+        return bp.squaredNorm();
+
+    float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+        return (p - (a + ab * (d1 / (d1 - d3)))).squaredNorm();
+
+    Vector3f cp = p - c;
+    float d5 = ab.dot(cp);
+    float d6 = ac.dot(cp);
+    if (d6 >= 0.0f && d5 <= d6)
+        return cp.squaredNorm();
+
+    float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+        return (p - (a + ac * (d2 / (d2 - d6)))).squaredNorm();
+
+    float va = d3 * d6 - d5 * d4;
+    if (va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f)
+        return (p - (b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6))))).squaredNorm();
+
+    float denom = 1.0f / (va + vb + vc);
+    return (p - (a + ab * (vb * denom) + ac * (vc * denom))).squaredNorm();
+}
+
+
+/*! A uniform grid of cells over a set of triangles, for finding the
+ *  distance from a point to the nearest of them. Each triangle is listed
+ *  in every cell that its bounding box overlaps.
+ */
+class TriangleGrid
+{
+public:
+    TriangleGrid(const vector<Vector3f>& _positions) :
+        positions(_positions),
+        cellSize(1.0f)
+    {
+        dims[0] = dims[1] = dims[2] = 0;
+    }
+
+    void build(const vector<index32>& _triangles);
+
+    // Return the squared distance from p to the nearest triangle. The
+    // search stops early once a triangle closer than sqrt(stopDistanceSq)
+    // is found, in which case the distance to that triangle is returned.
+    float distanceSquared(const Vector3f& p, float stopDistanceSq) const;
+
+private:
+    int cellCoord(float x, unsigned int axis) const
+    {
+        int i = (int) floor((x - origin[axis]) / cellSize);
+        return max(0, min(dims[axis] - 1, i));
+    }
+
+    const vector<Vector3f>& positions;
+    vector<index32> triangles;
+    Vector3f origin;
+    float cellSize;
+    int dims[3];
+
+    // The triangles in cell i are cellTriangles[cellStart[i]] through
+    // cellTriangles[cellStart[i + 1] - 1].
+    vector<unsigned int> cellStart;
+    vector<unsigned int> cellTriangles;
+};
+
+
+// Cells per axis are limited so that the grid stays small for flat or
+// elongated meshes.
+static const int MaxGridDimension = 256;
+
+
+void
+TriangleGrid::build(const vector<index32>& _triangles)
+{
+    triangles = _triangles;
+    unsigned int nTriangles = triangles.size() / 3;
+    dims[0] = dims[1] = dims[2] = 0;
+    cellStart.clear();
+    cellTriangles.clear();
+    if (nTriangles == 0)
+        return;
+
+    AlignedBox<float, 3> bbox(positions[triangles[0]]);
+    for (unsigned int i = 1; i < triangles.size(); i++)
+        bbox.extend(positions[triangles[i]]);
+
+    // Choose the cell size to give about one cell per triangle. Extents are
+    // padded so that a flat mesh still gets a grid with some volume.
+    Vector3f extent = bbox.max() - bbox.min();
+    float pad = max(extent.norm() * 0.01f, 1.0e-6f);
+    Vector3f padded = extent + Vector3f::Constant(pad);
+    cellSize = (float) pow((double) padded.x() * padded.y() * padded.z() / nTriangles, 1.0 / 3.0);
+    for (unsigned int axis = 0; axis < 3; axis++)
+        cellSize = max(cellSize, padded[axis] / (float) MaxGridDimension);
+
+    origin = bbox.min() - Vector3f::Constant(pad * 0.5f);
+    for (unsigned int axis = 0; axis < 3; axis++)
+        dims[axis] = max(1, min(MaxGridDimension, (int) ceil(padded[axis] / cellSize)));
+
+    // Count the triangles in each cell, then fill in the lists
+    unsigned int nCells = dims[0] * dims[1] * dims[2];
+    cellStart.assign(nCells + 1, 0);
+    for (unsigned int pass = 0; pass < 2; pass++)
+    {
+        for (unsigned int t = 0; t < nTriangles; t++)
+        {
+            AlignedBox<float, 3> triBox(positions[triangles[t * 3]]);
+            triBox.extend(positions[triangles[t * 3 + 1]]);
+            triBox.extend(positions[triangles[t * 3 + 2]]);
+
+            int lo[3], hi[3];
+            for (unsigned int axis = 0; axis < 3; axis++)
+            {
+                lo[axis] = cellCoord(triBox.min()[axis], axis);
+                hi[axis] = cellCoord(triBox.max()[axis], axis);
+            }
+
+            for (int z = lo[2]; z <= hi[2]; z++)
+            {
+                for (int y = lo[1]; y <= hi[1]; y++)
+                {
+                    for (int x = lo[0]; x <= hi[0]; x++)
+                    {
+                        unsigned int cell = (z * dims[1] + y) * dims[0] + x;
+                        if (pass == 0)
+                            cellStart[cell + 1]++;
+                        else
+                            cellTriangles[cellStart[cell]++] = t;
+                    }
+                }
+            }
+        }
+
+        if (pass == 0)
+        {
+            for (unsigned int i = 0; i < nCells; i++)
+                cellStart[i + 1] += cellStart[i];
+            cellTriangles.resize(cellStart[nCells]);
+        }
+        else
+        {
+            // Filling advanced each start to the start of the next cell
+            for (unsigned int i = nCells; i > 0; i--)
+                cellStart[i] = cellStart[i - 1];
+            cellStart[0] = 0;
+        }
+    }
+}
+
+
+float
+TriangleGrid::distanceSquared(const Vector3f& p, float stopDistanceSq) const
+{
+    float best = numeric_limits<float>::max();
+    if (cellStart.empty())
+        return best;
+
+    int center[3];
+    for (unsigned int axis = 0; axis < 3; axis++)
+        center[axis] = cellCoord(p[axis], axis);
+
+    // Search shells of cells around the one containing the point. Before
+    // searching a shell, any triangle not yet tested is in a cell at least
+    // ring - 1 cell widths from the point.
+    bool allSearched = false;
+    for (int ring = 0; !allSearched; ring++)
+    {
+        float ringDistance = (float) max(ring - 1, 0) * cellSize;
+        if (best <= ringDistance * ringDistance || best <= stopDistanceSq)
+            break;
+
+        int lo[3], hi[3];
+        allSearched = true;
+        for (unsigned int axis = 0; axis < 3; axis++)
+        {
+            lo[axis] = max(0, center[axis] - ring);
+            hi[axis] = min(dims[axis] - 1, center[axis] + ring);
+            allSearched = allSearched && lo[axis] == 0 && hi[axis] == dims[axis] - 1;
+        }
+
+        for (int z = lo[2]; z <= hi[2]; z++)
+        {
+            for (int y = lo[1]; y <= hi[1]; y++)
+            {
+                bool shellRow = abs(z - center[2]) == ring || abs(y - center[1]) == ring;
+                for (int x = lo[0]; x <= hi[0]; x++)
+                {
+                    // Only the cells on the surface of the shell are new
+                    if (!shellRow && abs(x - center[0]) != ring)
+                        continue;
+
+                    unsigned int cell = (z * dims[1] + y) * dims[0] + x;
+                    for (unsigned int i = cellStart[cell]; i < cellStart[cell + 1]; i++)
+                    {
+                        const index32* tri = &triangles[cellTriangles[i] * 3];
+                        best = min(best, pointTriangleDistanceSquared(p,
+                                                                      positions[tri[0]],
+                                                                      positions[tri[1]],
+                                                                      positions[tri[2]]));
+                    }
+                }
+            }
+        }
+    }
+
+    return best;
+}
+
+
+/*! The simplifier works on positions rather than vertices: vertices with
+ *  identical positions are different wedges of the same position, split
+ *  by a texture seam or a crease in the normals. Each position is
+ *  represented by its lowest numbered vertex. A position is collapsed by
+ *  moving all of its wedges to wedges of a neighboring position, which is
+ *  only allowed when every wedge has an obvious counterpart; this keeps
+ *  seams intact.
+ *
+ *  Collapses are made in passes. Each pass finds the cheapest collapse for
+ *  every position, then makes them in order of increasing cost; positions
+ *  changed by a collapse aren't touched again until the next pass.
+ */
+class MeshSimplifier
+{
+public:
+    MeshSimplifier(const Mesh& _mesh);
+
+    void simplify(unsigned int targetTriangleCount);
+    float measureDeviation() const;
+    Mesh::LevelOfDetail* createLevelOfDetail(float error) const;
+
+    unsigned int getTriangleCount() const { return liveTriangleCount; }
+
+    // Largest quadric error of any collapse so far, as a distance. This
+    // is usually somewhat smaller than the actual deviation.
+    float getError() const { return (float) sqrt(maxError); }
+
+private:
+    enum PositionKind
+    {
+        Interior,
+        Border,
+        Locked,
+    };
+
+    bool collapsePass(unsigned int targetTriangleCount);
+    void buildAdjacency();
+    void buildEdges();
+    void classifyPositions();
+    bool collapse(index32 from, index32 to);
+    void addNeighbors(index32 position, index32 exclude, vector<index32>& neighbors) const;
+
+    const Mesh& mesh;
+
+    vector<Vector3f> positions;
+    vector<index32> positionRoot;
+    vector<Quadric> quadrics;
+
+    vector<index32> triangles;
+
+    // The original triangles, and the positions they use, for measuring
+    // how far the simplified mesh deviates from them
+    TriangleGrid originalSurface;
+    vector<index32> surfacePositions;
+
+    vector<unsigned int> groupStart;
+    vector<bool> removed;
+    unsigned int liveTriangleCount;
+    double maxError;
+
+    // Rebuilt for every pass
+    vector<unsigned int> adjacencyStart;
+    vector<unsigned int> adjacency;
+    vector<Edge> edges;
+    vector<unsigned char> kind;
+    vector<bool> touched;
+
+    // Scratch space for collapses
+    vector<pair<index32, index32> > wedgeMap;
+    vector<index32> fromNeighbors;
+    vector<index32> toNeighbors;
+};
+
+
+MeshSimplifier::MeshSimplifier(const Mesh& _mesh) :
+    mesh(_mesh),
+    originalSurface(positions),
+    liveTriangleCount(0),
+    maxError(0.0)
+{
+    unsigned int nVertices = mesh.getVertexCount();
+    const Mesh::VertexDescription& desc = mesh.getVertexDescription();
+    const Mesh::VertexAttribute& positionAttr = desc.getAttribute(Mesh::Position);
+    const char* vertexData = reinterpret_cast<const char*>(mesh.getVertexData());
+
+    groupStart.push_back(0);
+    if (positionAttr.format != Mesh::Float3 || vertexData == NULL)
+    {
+        groupStart.resize(mesh.getGroupCount() + 1, 0);
+        return;
+    }
+
+    positions.resize(nVertices);
+    for (unsigned int i = 0; i < nVertices; i++)
+    {
+        const float* p = reinterpret_cast<const float*>(vertexData + i * desc.stride + positionAttr.offset);
+        positions[i] = Vector3f(p[0], p[1], p[2]);
+    }
+
+    // Find the vertices that share positions
+    vector<index32> order(nVertices);
+    for (unsigned int i = 0; i < nVertices; i++)
+        order[i] = i;
+    sort(order.begin(), order.end(), PositionOrder(positions));
+
+    positionRoot.resize(nVertices);
+    for (unsigned int i = 0; i < nVertices; i++)
+    {
+        if (i > 0 && positions[order[i]] == positions[order[i - 1]])
+            positionRoot[order[i]] = positionRoot[order[i - 1]];
+        else
+            positionRoot[order[i]] = order[i];
+    }
+
+    // Gather the triangles, dropping any that are degenerate
+    for (unsigned int i = 0; i < mesh.getGroupCount(); i++)
+    {
+        const Mesh::PrimitiveGroup* group = mesh.getGroup(i);
+        if (group->prim == Mesh::TriList)
+        {
+            for (unsigned int j = 0; j + 2 < group->nIndices; j += 3)
+            {
+                index32 r0 = positionRoot[group->indices[j]];
+                index32 r1 = positionRoot[group->indices[j + 1]];
+                index32 r2 = positionRoot[group->indices[j + 2]];
+                if (r0 != r1 && r1 != r2 && r2 != r0)
+                {
+                    triangles.push_back(group->indices[j]);
+                    triangles.push_back(group->indices[j + 1]);
+                    triangles.push_back(group->indices[j + 2]);
+                }
+            }
+        }
+
+        groupStart.push_back(triangles.size() / 3);
+    }
+
+    liveTriangleCount = triangles.size() / 3;
+    removed.resize(liveTriangleCount, false);
+    originalSurface.build(triangles);
+    {
+        vector<bool> used(nVertices, false);
+        for (unsigned int i = 0; i < triangles.size(); i++)
+        {
+            index32 root = positionRoot[triangles[i]];
+            if (!used[root])
+            {
+                used[root] = true;
+                surfacePositions.push_back(root);
+            }
+        }
+    }
+
+    // Each position starts with the planes of the triangles around it
+    quadrics.resize(nVertices);
+    for (unsigned int t = 0; t < liveTriangleCount; t++)
+    {
+        const index32* tri = &triangles[t * 3];
+        Vector3d a = positions[tri[0]].cast<double>();
+        Vector3d b = positions[tri[1]].cast<double>();
+        Vector3d c = positions[tri[2]].cast<double>();
+        Vector3d n = (b - a).cross(c - a);
+        double length = n.norm();
+        if (length == 0.0)
+            continue;
+
+        n /= length;
+        double d = -n.dot(a);
+        for (unsigned int i = 0; i < 3; i++)
+            quadrics[positionRoot[tri[i]]].addPlane(n, d, length * 0.5);
+    }
+
+    // Border positions are also held to planes perpendicular to the
+    // triangles at the border edges.
+    buildEdges();
+    for (vector<Edge>::const_iterator iter = edges.begin(); iter != edges.end(); iter++)
+    {
+        if (iter->count != 1)
+            continue;
+
+        const index32* tri = &triangles[iter->triangle * 3];
+        Vector3d a = positions[tri[0]].cast<double>();
+        Vector3d b = positions[tri[1]].cast<double>();
+        Vector3d c = positions[tri[2]].cast<double>();
+        Vector3d normal = (b - a).cross(c - a);
+
+        Vector3d p0 = positions[iter->a].cast<double>();
+        Vector3d p1 = positions[iter->b].cast<double>();
+        Vector3d n = (p1 - p0).cross(normal);
+        double length = n.norm();
+        if (length == 0.0)
+            continue;
+
+        n /= length;
+        double d = -n.dot(p0);
+        double w = BorderPlaneWeight * (p1 - p0).squaredNorm();
+        quadrics[iter->a].addPlane(n, d, w);
+        quadrics[iter->b].addPlane(n, d, w);
+    }
+}
+
+
+void
+MeshSimplifier::simplify(unsigned int targetTriangleCount)
+{
+    while (liveTriangleCount > targetTriangleCount)
+    {
+        if (!collapsePass(targetTriangleCount))
+            break;
+    }
+}
+
+
+// Points at which the distance from the simplified triangles to the
+// original surface is measured, as barycentric coordinates: the center,
+// the edge midpoints, and points between the center and each corner.
+static const float DeviationSamplePoints[7][3] =
+{
+    { 1.0f / 3.0f, 1.0f / 3.0f, 1.0f / 3.0f },
+    { 0.5f, 0.5f, 0.0f },
+    { 0.0f, 0.5f, 0.5f },
+    { 0.5f, 0.0f, 0.5f },
+    { 2.0f / 3.0f, 1.0f / 6.0f, 1.0f / 6.0f },
+    { 1.0f / 6.0f, 2.0f / 3.0f, 1.0f / 6.0f },
+    { 1.0f / 6.0f, 1.0f / 6.0f, 2.0f / 3.0f },
+};
+
+
+/*! Measure the greatest distance between the simplified and the original
+ *  surface: the distance from every original position to the nearest
+ *  simplified triangle, and from sample points on every simplified
+ *  triangle to the nearest original triangle.
+ */
+float
+MeshSimplifier::measureDeviation() const
+{
+    vector<index32> simplified;
+    simplified.reserve(liveTriangleCount * 3);
+    for (unsigned int t = 0; t < removed.size(); t++)
+    {
+        if (!removed[t])
+            simplified.insert(simplified.end(), &triangles[t * 3], &triangles[t * 3] + 3);
+    }
+
+    TriangleGrid simplifiedSurface(positions);
+    simplifiedSurface.build(simplified);
+
+    // Points closer than the largest distance found so far can't change
+    // the result, so searches stop as soon as they find a nearer triangle.
+    float maxDistanceSq = 0.0f;
+
+    for (unsigned int i = 0; i < surfacePositions.size(); i++)
+    {
+        float d = simplifiedSurface.distanceSquared(positions[surfacePositions[i]], maxDistanceSq);
+        maxDistanceSq = max(maxDistanceSq, d);
+    }
+
+    for (unsigned int t = 0; t < simplified.size(); t += 3)
+    {
+        const Vector3f& a = positions[simplified[t]];
+        const Vector3f& b = positions[simplified[t + 1]];
+        const Vector3f& c = positions[simplified[t + 2]];
+        for (unsigned int i = 0; i < 7; i++)
+        {
+            const float* w = DeviationSamplePoints[i];
+            Vector3f p = a * w[0] + b * w[1] + c * w[2];
+            float d = originalSurface.distanceSquared(p, maxDistanceSq);
+            maxDistanceSq = max(maxDistanceSq, d);
+        }
+    }
+
+    return (float) sqrt(maxDistanceSq);
+}
+
+
+Mesh::LevelOfDetail*
+MeshSimplifier::createLevelOfDetail(float error) const
+{
+    Mesh::LevelOfDetail* lod = new Mesh::LevelOfDetail(error);
+
+    for (unsigned int i = 0; i < mesh.getGroupCount(); i++)
+    {
+        const Mesh::PrimitiveGroup* group = mesh.getGroup(i);
+
+        // Groups other than triangle lists aren't simplified
+        if (group->prim != Mesh::TriList)
+        {
+            index32* indices = new index32[group->nIndices];
+            copy(group->indices, group->indices + group->nIndices, indices);
+            lod->addGroup(group->prim, group->materialIndex, group->nIndices, indices);
+            continue;
+        }
+
+        unsigned int count = 0;
+        for (unsigned int t = groupStart[i]; t < groupStart[i + 1]; t++)
+        {
+            if (!removed[t])
+                count++;
+        }
+
+        if (count == 0)
+            continue;
+
+        index32* indices = new index32[count * 3];
+        index32* out = indices;
+        for (unsigned int t = groupStart[i]; t < groupStart[i + 1]; t++)
+        {
+            if (!removed[t])
+            {
+                out[0] = triangles[t * 3];
+                out[1] = triangles[t * 3 + 1];
+                out[2] = triangles[t * 3 + 2];
+                out += 3;
+            }
+        }
+
+        lod->addGroup(Mesh::TriList, group->materialIndex, count * 3, indices);
+    }
+
+    return lod;
+}
+
+
+// Build the list of triangles around each position
+void
+MeshSimplifier::buildAdjacency()
+{
+    unsigned int nTriangles = triangles.size() / 3;
+
+    adjacencyStart.assign(positions.size() + 1, 0);
+    for (unsigned int t = 0; t < nTriangles; t++)
+    {
+        if (removed[t])
+            continue;
+        for (unsigned int i = 0; i < 3; i++)
+            adjacencyStart[positionRoot[triangles[t * 3 + i]] + 1]++;
+    }
+
+    for (unsigned int i = 0; i < positions.size(); i++)
+        adjacencyStart[i + 1] += adjacencyStart[i];
+
+    adjacency.resize(adjacencyStart.back());
+    vector<unsigned int> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+    for (unsigned int t = 0; t < nTriangles; t++)
+    {
+        if (removed[t])
+            continue;
+        for (unsigned int i = 0; i < 3; i++)
+            adjacency[fill[positionRoot[triangles[t * 3 + i]]]++] = t;
+    }
+}
+
+
+// Build a sorted list of the edges between positions, with the number of
+// triangles that use each one. For border edges, which are used by a single
+// triangle, the triangle is recorded too.
+void
+MeshSimplifier::buildEdges()
+{
+    unsigned int nTriangles = triangles.size() / 3;
+
+    edges.clear();
+    edges.reserve(liveTriangleCount * 3);
+    for (unsigned int t = 0; t < nTriangles; t++)
+    {
+        if (removed[t])
+            continue;
+
+        index32 r0 = positionRoot[triangles[t * 3]];
+        index32 r1 = positionRoot[triangles[t * 3 + 1]];
+        index32 r2 = positionRoot[triangles[t * 3 + 2]];
+        edges.push_back(Edge(r0, r1, t));
+        edges.push_back(Edge(r1, r2, t));
+        edges.push_back(Edge(r2, r0, t));
+    }
+
+    sort(edges.begin(), edges.end());
+
+    // Merge duplicate edges
+    unsigned int nUnique = 0;
+    for (unsigned int i = 0; i < edges.size(); i++)
+    {
+        if (nUnique > 0 && edges[nUnique - 1].a == edges[i].a && edges[nUnique - 1].b == edges[i].b)
+            edges[nUnique - 1].count++;
+        else
+            edges[nUnique++] = edges[i];
+    }
+    edges.resize(nUnique);
+}
+
+
+// Decide which positions may move. Positions on a border may only move
+// along it, and positions at corners of the border, on non-manifold edges,
+// or between groups (which may have different materials) may not move at
+// all.
+void
+MeshSimplifier::classifyPositions()
+{
+    unsigned int nPositions = positions.size();
+    unsigned int nTriangles = triangles.size() / 3;
+
+    kind.assign(nPositions, Interior);
+
+    vector<unsigned int> positionGroup(nPositions, ~0u);
+    for (unsigned int g = 0; g + 1 < groupStart.size(); g++)
+    {
+        for (unsigned int t = groupStart[g]; t < groupStart[g + 1] && t < nTriangles; t++)
+        {
+            if (removed[t])
+                continue;
+            for (unsigned int i = 0; i < 3; i++)
+            {
+                index32 r = positionRoot[triangles[t * 3 + i]];
+                if (positionGroup[r] == ~0u)
+                    positionGroup[r] = g;
+                else if (positionGroup[r] != g)
+                    kind[r] = Locked;
+            }
+        }
+    }
+
+    vector<unsigned int> borderEdgeCount(nPositions, 0);
+    vector<index32> borderNeighbors(nPositions * 2, NoVertex);
+    for (vector<Edge>::const_iterator iter = edges.begin(); iter != edges.end(); iter++)
+    {
+        if (iter->count == 1)
+        {
+            if (borderEdgeCount[iter->a] < 2)
+                borderNeighbors[iter->a * 2 + borderEdgeCount[iter->a]] = iter->b;
+            if (borderEdgeCount[iter->b] < 2)
+                borderNeighbors[iter->b * 2 + borderEdgeCount[iter->b]] = iter->a;
+            borderEdgeCount[iter->a]++;
+            borderEdgeCount[iter->b]++;
+        }
+        else if (iter->count > 2)
+        {
+            kind[iter->a] = Locked;
+            kind[iter->b] = Locked;
+        }
+    }
+
+    for (unsigned int i = 0; i < nPositions; i++)
+    {
+        if (borderEdgeCount[i] == 0 || kind[i] == Locked)
+            continue;
+
+        kind[i] = Locked;
+        if (borderEdgeCount[i] == 2)
+        {
+            Vector3f d0 = positions[borderNeighbors[i * 2]] - positions[i];
+            Vector3f d1 = positions[i] - positions[borderNeighbors[i * 2 + 1]];
+            if (d0.dot(d1) >= MinBorderStraightness * d0.norm() * d1.norm())
+                kind[i] = Border;
+        }
+    }
+}
+
+
+bool
+MeshSimplifier::collapsePass(unsigned int targetTriangleCount)
+{
+    buildAdjacency();
+    buildEdges();
+    classifyPositions();
+
+    // Find the cheapest collapse for every position
+    unsigned int nPositions = positions.size();
+    vector<index32> bestTarget(nPositions, NoVertex);
+    vector<double> bestCost(nPositions, 0.0);
+    for (vector<Edge>::const_iterator iter = edges.begin(); iter != edges.end(); iter++)
+    {
+        if (iter->count > 2)
+            continue;
+
+        for (unsigned int direction = 0; direction < 2; direction++)
+        {
+            index32 from = direction == 0 ? iter->a : iter->b;
+            index32 to   = direction == 0 ? iter->b : iter->a;
+
+            if (kind[from] == Locked || (kind[from] == Border && iter->count != 1))
+                continue;
+
+            Quadric q = quadrics[from];
+            q += quadrics[to];
+            double cost = q.error(positions[to].cast<double>());
+            if (bestTarget[from] == NoVertex || cost < bestCost[from])
+            {
+                bestTarget[from] = to;
+                bestCost[from] = cost;
+            }
+        }
+    }
+
+    vector<Collapse> collapses;
+    for (unsigned int i = 0; i < nPositions; i++)
+    {
+        if (bestTarget[i] != NoVertex)
+        {
+            Collapse c;
+            c.from = i;
+            c.to = bestTarget[i];
+            c.cost = bestCost[i];
+            collapses.push_back(c);
+        }
+    }
+
+    sort(collapses.begin(), collapses.end());
+
+    touched.assign(nPositions, false);
+    bool collapsed = false;
+    for (vector<Collapse>::const_iterator iter = collapses.begin();
+         iter != collapses.end() && liveTriangleCount > targetTriangleCount; iter++)
+    {
+        if (touched[iter->from] || touched[iter->to])
+            continue;
+
+        if (collapse(iter->from, iter->to))
+        {
+            maxError = max(maxError, iter->cost);
+            touched[iter->from] = true;
+            touched[iter->to] = true;
+            collapsed = true;
+        }
+    }
+
+    return collapsed;
+}
+
+
+// Add the positions that share a triangle with the given one
+void
+MeshSimplifier::addNeighbors(index32 position, index32 exclude, vector<index32>& neighbors) const
+{
+    neighbors.clear();
+    for (unsigned int k = adjacencyStart[position]; k < adjacencyStart[position + 1]; k++)
+    {
+        unsigned int t = adjacency[k];
+        if (removed[t])
+            continue;
+
+        for (unsigned int i = 0; i < 3; i++)
+        {
+            index32 r = positionRoot[triangles[t * 3 + i]];
+            if (r != position && r != exclude)
+                neighbors.push_back(r);
+        }
+    }
+
+    sort(neighbors.begin(), neighbors.end());
+    neighbors.erase(unique(neighbors.begin(), neighbors.end()), neighbors.end());
+}
+
+
+// Move the position from onto the position to, if that can be done without
+// tearing seams, folding triangles, or making the mesh non-manifold.
+bool
+MeshSimplifier::collapse(index32 from, index32 to)
+{
+    unsigned int begin = adjacencyStart[from];
+    unsigned int end = adjacencyStart[from + 1];
+
+    // The triangles on the collapsed edge give the wedge of the target
+    // position that each wedge of the source moves to.
+    wedgeMap.clear();
+    unsigned int sharedCount = 0;
+    for (unsigned int k = begin; k < end; k++)
+    {
+        unsigned int t = adjacency[k];
+        if (removed[t])
+            continue;
+
+        const index32* tri = &triangles[t * 3];
+        int fromCorner = -1;
+        int toCorner = -1;
+        for (int i = 0; i < 3; i++)
+        {
+            index32 r = positionRoot[tri[i]];
+            if (r == from)
+                fromCorner = i;
+            else if (r == to)
+                toCorner = i;
+        }
+
+        if (toCorner < 0)
+            continue;
+
+        sharedCount++;
+        vector<pair<index32, index32> >::const_iterator w;
+        for (w = wedgeMap.begin(); w != wedgeMap.end() && w->first != tri[fromCorner]; w++)
+            ;
+        if (w == wedgeMap.end())
+            wedgeMap.push_back(make_pair(tri[fromCorner], tri[toCorner]));
+        else if (w->second != tri[toCorner])
+            return false;
+    }
+
+    if (sharedCount == 0)
+        return false;
+
+    // Every other triangle keeps its shape; check that each of its wedges
+    // has somewhere to go and that it won't flip over.
+    const Vector3f& target = positions[to];
+    for (unsigned int k = begin; k < end; k++)
+    {
+        unsigned int t = adjacency[k];
+        if (removed[t])
+            continue;
+
+        const index32* tri = &triangles[t * 3];
+        int fromCorner = -1;
+        bool shared = false;
+        for (int i = 0; i < 3; i++)
+        {
+            index32 r = positionRoot[tri[i]];
+            if (r == from)
+                fromCorner = i;
+            else if (r == to)
+                shared = true;
+        }
+
+        if (shared)
+            continue;
+
+        vector<pair<index32, index32> >::const_iterator w;
+        for (w = wedgeMap.begin(); w != wedgeMap.end() && w->first != tri[fromCorner]; w++)
+            ;
+        if (w == wedgeMap.end())
+            return false;
+
+        Vector3f p[3] = { positions[tri[0]], positions[tri[1]], positions[tri[2]] };
+        Vector3f n0 = (p[1] - p[0]).cross(p[2] - p[0]);
+        p[fromCorner] = target;
+        Vector3f n1 = (p[1] - p[0]).cross(p[2] - p[0]);
+        if (n0.dot(n1) <= MinNormalCosine * n0.norm() * n1.norm())
+            return false;
+    }
+
+    // The only positions adjacent to both ends of the edge must be the
+    // third corners of the triangles on the edge; otherwise, the collapse
+    // would create non-manifold edges.
+    addNeighbors(from, to, fromNeighbors);
+    addNeighbors(to, from, toNeighbors);
+    unsigned int commonCount = 0;
+    vector<index32>::const_iterator i0 = fromNeighbors.begin();
+    vector<index32>::const_iterator i1 = toNeighbors.begin();
+    while (i0 != fromNeighbors.end() && i1 != toNeighbors.end())
+    {
+        if (*i0 < *i1)
+        {
+            ++i0;
+        }
+        else if (*i1 < *i0)
+        {
+            ++i1;
+        }
+        else
+        {
+            commonCount++;
+            ++i0;
+            ++i1;
+        }
+    }
+
+    if (commonCount != sharedCount)
+        return false;
+
+    // Make the collapse
+    for (unsigned int k = begin; k < end; k++)
+    {
+        unsigned int t = adjacency[k];
+        if (removed[t])
+            continue;
+
+        index32* tri = &triangles[t * 3];
+        int fromCorner = -1;
+        bool shared = false;
+        for (int i = 0; i < 3; i++)
+        {
+            index32 r = positionRoot[tri[i]];
+            if (r == from)
+                fromCorner = i;
+            else if (r == to)
+                shared = true;
+        }
+
+        if (shared)
+        {
+            removed[t] = true;
+            liveTriangleCount--;
+        }
+        else
+        {
+            vector<pair<index32, index32> >::const_iterator w;
+            for (w = wedgeMap.begin(); w->first != tri[fromCorner]; w++)
+                ;
+            tri[fromCorner] = w->second;
+        }
+    }
+
+    quadrics[to] += quadrics[from];
+
+    return true;
+}
+
+
+unsigned int
+GenerateLevelsOfDetail(Mesh& mesh, unsigned int maxLevels)
+{
+    mesh.clearLevelsOfDetail();
+
+    MeshSimplifier simplifier(mesh);
+    unsigned int triangleCount = simplifier.getTriangleCount();
+    AlignedBox<float, 3> bbox = mesh.getBoundingBox();
+    float maxError = (bbox.max() - bbox.min()).norm() * MaxRelativeError;
+    unsigned int levelCount = 0;
+    float lastError = 0.0f;
+
+    while (levelCount < maxLevels)
+    {
+        unsigned int targetCount = triangleCount / 2;
+        if (targetCount < MinLevelTriangleCount)
+            break;
+
+        simplifier.simplify(targetCount);
+        unsigned int newCount = simplifier.getTriangleCount();
+        if (newCount > triangleCount * MaxLevelTriangleRatio || simplifier.getError() > maxError)
+            break;
+
+        // The quadric error only guides simplification; the error recorded
+        // for a level is its measured deviation from the full mesh. Levels
+        // must be in order of increasing error, so a coarser level is never
+        // given a smaller error than a finer one.
+        float error = max(lastError, simplifier.measureDeviation());
+        if (error > maxError)
+            break;
+
+        mesh.addLevelOfDetail(simplifier.createLevelOfDetail(error));
+        triangleCount = newCount;
+        lastError = error;
+        levelCount++;
+    }
+
+    return levelCount;
+}
@@ -0,0 +1,36 @@
+// simplify.h
+//
+// Copyright (C) 2010, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// Generate simplified levels of detail for a mesh.
+
+#ifndef _CMOD_SIMPLIFY_H_
+#define _CMOD_SIMPLIFY_H_
+
+#include <celmodel/mesh.h>
+
+
+/*! Replace the levels of detail of a mesh with a chain of simplified
+ *  versions of its triangle lists, each with about half the triangles of
+ *  the one before. Edges are collapsed in order of the quadric error
+ *  metric of Garland and Heckbert. Every collapse moves a vertex onto one
+ *  of its neighbors, so the levels of detail use the mesh's vertices and
+ *  only add new index lists. Texture seams are preserved, vertices on
+ *  borders only move along the border, and vertices shared by groups
+ *  with different materials don't move. The error recorded for each level
+ *  is its measured deviation from the full detail mesh: the greatest
+ *  distance from a point on either surface to the other, sampled at the
+ *  original vertices and at points on the simplified triangles. Meshes
+ *  without triangle lists or three component float positions are left
+ *  unchanged.
+ *
+ *  Returns the number of levels of detail generated.
+ */
+extern unsigned int GenerateLevelsOfDetail(cmod::Mesh& mesh, unsigned int maxLevels);
+
+#endif // _CMOD_SIMPLIFY_H_
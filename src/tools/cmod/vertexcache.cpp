@@ -0,0 +1,341 @@
+// vertexcache.cpp
+//
+// Copyright (C) 2010, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// Reorder the triangles and vertices of a mesh to make better use of
+// the GPU's post-transform vertex cache and vertex fetches.
+
+#include "vertexcache.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+using namespace cmod;
+using namespace std;
+
+
+typedef Mesh::index32 index32;
+
+// Parameters of the scoring function; these are the values suggested by
+// Forsyth. The cache modeled is an LRU cache a bit larger than any real
+// hardware FIFO, which produces orderings that work well across GPUs.
+static const unsigned int MaxCacheSize      = 32;
+static const float        CacheDecayPower   = 1.5f;
+static const float        LastTriangleScore = 0.75f;
+static const float        ValenceBoostScale = 2.0f;
+static const float        ValenceBoostPower = 0.5f;
+
+// Vertex scores for valences below this are looked up in a table
+static const unsigned int MaxTableValence   = 64;
+
+static const index32 NoTriangle = ~0u;
+static const index32 NoVertex = ~0u;
+
+
+class VertexScorer
+{
+public:
+    VertexScorer()
+    {
+        for (unsigned int i = 0; i < MaxCacheSize; i++)
+        {
+            if (i < 3)
+            {
+                // The vertices of the triangle just added get a fixed
+                // score, so that the next triangle doesn't simply reuse
+                // the same edge and generate a strip.
+                cacheScore[i] = LastTriangleScore;
+            }
+            else
+            {
+                float scale = 1.0f / (float) (MaxCacheSize - 3);
+                cacheScore[i] = (float) pow(1.0f - (float) (i - 3) * scale, CacheDecayPower);
+            }
+        }
+
+        valenceScore[0] = 0.0f;
+        for (unsigned int i = 1; i < MaxTableValence; i++)
+            valenceScore[i] = ValenceBoostScale * (float) pow((float) i, -ValenceBoostPower);
+    }
+
+    // Score of a vertex given its position in the cache (or -1 if it's
+    // not in the cache) and the number of triangles that haven't yet been
+    // added which use it. Vertices with few remaining triangles get a
+    // boost so that lone triangles aren't left behind.
+    float score(int cachePosition, unsigned int activeTriangles) const
+    {
+        if (activeTriangles == 0)
+            return -1.0f;
+
+        float s = cachePosition < 0 ? 0.0f : cacheScore[cachePosition];
+        if (activeTriangles < MaxTableValence)
+            s += valenceScore[activeTriangles];
+        else
+            s += ValenceBoostScale * (float) pow((float) activeTriangles, -ValenceBoostPower);
+
+        return s;
+    }
+
+private:
+    float cacheScore[MaxCacheSize];
+    float valenceScore[MaxTableValence];
+};
+
+
+// Reorder the triangles of a single triangle list in place
+static void
+optimizeTriangleList(index32* indices,
+                     unsigned int nTriangles,
+                     unsigned int nVertices,
+                     const VertexScorer& scorer)
+{
+    if (nTriangles < 2)
+        return;
+
+    unsigned int nIndices = nTriangles * 3;
+
+    // Build the vertex to triangle adjacency lists. Each vertex's list
+    // holds its active triangles (those that haven't been added yet)
+    // first; the count records how many of them there are.
+    vector<unsigned int> activeCount(nVertices, 0);
+    unsigned int i;
+    for (i = 0; i < nIndices; i++)
+        activeCount[indices[i]]++;
+
+    vector<unsigned int> adjacencyStart(nVertices + 1);
+    adjacencyStart[0] = 0;
+    for (i = 0; i < nVertices; i++)
+        adjacencyStart[i + 1] = adjacencyStart[i] + activeCount[i];
+
+    vector<index32> adjacency(nIndices);
+    {
+        vector<unsigned int> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+        for (i = 0; i < nIndices; i++)
+            adjacency[fill[indices[i]]++] = i / 3;
+    }
+
+    vector<int> cachePosition(nVertices, -1);
+    vector<float> vertexScore(nVertices);
+    for (i = 0; i < nVertices; i++)
+        vertexScore[i] = scorer.score(-1, activeCount[i]);
+
+    vector<float> triangleScore(nTriangles);
+    vector<bool> triangleAdded(nTriangles, false);
+    index32 bestTriangle = 0;
+    for (i = 0; i < nTriangles; i++)
+    {
+        triangleScore[i] = vertexScore[indices[i * 3]] +
+                           vertexScore[indices[i * 3 + 1]] +
+                           vertexScore[indices[i * 3 + 2]];
+        if (triangleScore[i] > triangleScore[bestTriangle])
+            bestTriangle = i;
+    }
+
+    vector<index32> cache;
+    vector<index32> newCache;
+    cache.reserve(MaxCacheSize + 3);
+    newCache.reserve(MaxCacheSize + 3);
+
+    vector<index32> newIndices(nIndices);
+    unsigned int nextUnadded = 0;
+
+    for (unsigned int nAdded = 0; nAdded < nTriangles; nAdded++)
+    {
+        if (bestTriangle == NoTriangle)
+        {
+            // None of the triangles using the cached vertices is left;
+            // start again from the first triangle that hasn't been added.
+            while (triangleAdded[nextUnadded])
+                nextUnadded++;
+            bestTriangle = nextUnadded;
+        }
+
+        const index32* tri = indices + bestTriangle * 3;
+        newIndices[nAdded * 3]     = tri[0];
+        newIndices[nAdded * 3 + 1] = tri[1];
+        newIndices[nAdded * 3 + 2] = tri[2];
+        triangleAdded[bestTriangle] = true;
+
+        // Remove the triangle from the active lists of its vertices, and
+        // move the vertices to the front of the cache.
+        newCache.clear();
+        for (unsigned int j = 0; j < 3; j++)
+        {
+            index32 v = tri[j];
+            index32* adj = &adjacency[adjacencyStart[v]];
+            unsigned int last = activeCount[v] - 1;
+            for (unsigned int k = 0; k <= last; k++)
+            {
+                if (adj[k] == bestTriangle)
+                {
+                    adj[k] = adj[last];
+                    adj[last] = bestTriangle;
+                    break;
+                }
+            }
+            activeCount[v] = last;
+
+            // Degenerate triangles may repeat a vertex
+            if (find(newCache.begin(), newCache.end(), v) == newCache.end())
+                newCache.push_back(v);
+        }
+
+        for (vector<index32>::const_iterator iter = cache.begin(); iter != cache.end(); iter++)
+        {
+            if (*iter != tri[0] && *iter != tri[1] && *iter != tri[2])
+                newCache.push_back(*iter);
+        }
+
+        // Update the scores of the vertices whose cache position or
+        // triangle count changed, and the scores of their triangles.
+        // While doing so, look for the best triangle to add next; only
+        // triangles that use a cached vertex are candidates.
+        float bestScore = -1.0f;
+        bestTriangle = NoTriangle;
+        for (unsigned int j = 0; j < newCache.size(); j++)
+        {
+            index32 v = newCache[j];
+            int position = j < MaxCacheSize ? (int) j : -1;
+            cachePosition[v] = position;
+
+            float score = scorer.score(position, activeCount[v]);
+            float delta = score - vertexScore[v];
+            vertexScore[v] = score;
+
+            const index32* adj = &adjacency[adjacencyStart[v]];
+            for (unsigned int k = 0; k < activeCount[v]; k++)
+            {
+                float triScore = triangleScore[adj[k]] + delta;
+                triangleScore[adj[k]] = triScore;
+                if (position >= 0 && triScore > bestScore)
+                {
+                    bestScore = triScore;
+                    bestTriangle = adj[k];
+                }
+            }
+        }
+
+        if (newCache.size() > MaxCacheSize)
+            newCache.resize(MaxCacheSize);
+        cache.swap(newCache);
+    }
+
+    copy(newIndices.begin(), newIndices.end(), indices);
+}
+
+
+// Renumber the vertices in the order that they're first referenced, so
+// that vertex fetches move through the vertex buffer sequentially.
+static void
+optimizeVertexFetch(Mesh& mesh)
+{
+    unsigned int nVertices = mesh.getVertexCount();
+    unsigned int stride = mesh.getVertexStride();
+    const char* vertexData = reinterpret_cast<const char*>(mesh.getVertexData());
+    if (nVertices == 0 || vertexData == NULL)
+        return;
+
+    vector<index32> vertexMap(nVertices, NoVertex);
+    index32 nextVertex = 0;
+    for (unsigned int i = 0; i < mesh.getGroupCount(); i++)
+    {
+        const Mesh::PrimitiveGroup* group = mesh.getGroup(i);
+        for (unsigned int j = 0; j < group->nIndices; j++)
+        {
+            index32 v = group->indices[j];
+            if (vertexMap[v] == NoVertex)
+                vertexMap[v] = nextVertex++;
+        }
+    }
+
+    // Vertices that aren't used by any primitive go at the end
+    for (unsigned int i = 0; i < nVertices; i++)
+    {
+        if (vertexMap[i] == NoVertex)
+            vertexMap[i] = nextVertex++;
+    }
+
+    char* newVertexData = new char[nVertices * stride];
+    for (unsigned int i = 0; i < nVertices; i++)
+        memcpy(newVertexData + vertexMap[i] * stride, vertexData + i * stride, stride);
+
+    mesh.setVertices(nVertices, newVertexData);
+    mesh.remapIndices(vertexMap);
+}
+
+
+void
+OptimizeVertexCache(Mesh& mesh)
+{
+    unsigned int nVertices = mesh.getVertexCount();
+    VertexScorer scorer;
+
+    for (unsigned int i = 0; i < mesh.getGroupCount(); i++)
+    {
+        Mesh::PrimitiveGroup* group = mesh.getGroup(i);
+        if (group->prim == Mesh::TriList)
+            optimizeTriangleList(group->indices, group->nIndices / 3, nVertices, scorer);
+    }
+
+    for (unsigned int i = 0; i < mesh.getLevelOfDetailCount(); i++)
+    {
+        Mesh::LevelOfDetail* lod = mesh.getLevelOfDetail(i);
+        for (unsigned int j = 0; j < lod->getGroupCount(); j++)
+        {
+            Mesh::PrimitiveGroup* group = lod->getGroup(j);
+            if (group->prim == Mesh::TriList)
+                optimizeTriangleList(group->indices, group->nIndices / 3, nVertices, scorer);
+        }
+    }
+
+    // The triangles were reordered in place
+    mesh.invalidatePickHierarchy();
+
+    optimizeVertexFetch(mesh);
+}
+
+
+float
+ComputeACMR(const Mesh& mesh, unsigned int cacheSize)
+{
+    // A vertex is in the FIFO cache if fewer than cacheSize vertices have
+    // been loaded since it was; insertion times are counted in misses.
+    vector<unsigned int> insertTime(mesh.getVertexCount(), 0);
+    unsigned int time = 0;
+    unsigned int misses = 0;
+    unsigned int nTriangles = 0;
+
+    for (unsigned int i = 0; i < mesh.getGroupCount(); i++)
+    {
+        const Mesh::PrimitiveGroup* group = mesh.getGroup(i);
+        if (group->prim != Mesh::TriList)
+            continue;
+
+        // Flush the cache
+        time += cacheSize;
+
+        for (unsigned int j = 0; j < group->nIndices; j++)
+        {
+            index32 v = group->indices[j];
+            if (insertTime[v] == 0 || time - insertTime[v] >= cacheSize)
+            {
+                time++;
+                misses++;
+                insertTime[v] = time;
+            }
+        }
+
+        nTriangles += group->nIndices / 3;
+    }
+
+    if (nTriangles == 0)
+        return 0.0f;
+    else
+        return (float) misses / (float) nTriangles;
+}
@@ -0,0 +1,39 @@
+// vertexcache.h
+//
+// Copyright (C) 2010, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// Reorder the triangles and vertices of a mesh to make better use of
+// the GPU's post-transform vertex cache and vertex fetches.
+
+#ifndef _CMOD_VERTEXCACHE_H_
+#define _CMOD_VERTEXCACHE_H_
+
+#include <celmodel/mesh.h>
+
+
+/*! Reorder the triangles in each triangle list of the mesh so that
+ *  vertices are reused while they're still in the post-transform cache,
+ *  using Tom Forsyth's linear-speed vertex cache optimization. The
+ *  vertices are then renumbered in the order that they're first used,
+ *  so that vertex fetches are as sequential as possible. Other primitive
+ *  groups keep their order, though their indices are renumbered. The
+ *  triangle lists of the mesh's levels of detail are reordered too. Unlike
+ *  conversion to strips, this works on meshes of any size.
+ */
+extern void OptimizeVertexCache(cmod::Mesh& mesh);
+
+/*! Compute the average cache miss ratio of the mesh's triangle lists: the
+ *  number of vertices that must be transformed per triangle drawn, given a
+ *  FIFO vertex cache with the specified number of entries. The cache is
+ *  emptied at the start of each primitive group. Lower is better; the
+ *  ratio is between 0.5 and 3 for any reasonable mesh. Returns zero if
+ *  the mesh has no triangle lists.
+ */
+extern float ComputeACMR(const cmod::Mesh& mesh, unsigned int cacheSize);
+
+#endif // _CMOD_VERTEXCACHE_H_
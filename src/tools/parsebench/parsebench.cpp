@@ -0,0 +1,329 @@
+// parsebench.cpp
+//
+// Copyright (C) 2010, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// Measure how quickly catalog and configuration files are tokenized and
+// parsed, and how many heap allocations parsing makes. Files are read
+// through an ifstream, as Celestia reads them; after the first iteration
+// they're in the operating system's file cache.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <celutil/timer.h>
+#include <celutil/directory.h>
+#include <celengine/tokenizer.h>
+#include <celengine/parser.h>
+
+using namespace std;
+
+
+// Count every allocation made through operator new
+static unsigned long allocationCount = 0;
+
+void* operator new(size_t size) throw(std::bad_alloc)
+{
+    allocationCount++;
+    void* p = malloc(size == 0 ? 1 : size);
+    if (p == NULL)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size) throw(std::bad_alloc)
+{
+    return operator new(size);
+}
+
+void operator delete(void* p) throw()
+{
+    free(p);
+}
+
+void operator delete[](void* p) throw()
+{
+    free(p);
+}
+
+
+void Usage()
+{
+    cerr << "Usage: parsebench [--iterations <n>] <file or directory> ...\n";
+    cerr << "  Directories are searched for .ssc, .stc, .dsc, and .cfg files\n";
+}
+
+
+struct SourceFile
+{
+    string name;
+    size_t size;
+};
+
+
+static bool isParsedFile(const string& filename)
+{
+    string::size_type dot = filename.rfind('.');
+    if (dot == string::npos)
+        return false;
+
+    string ext = filename.substr(dot);
+    return ext == ".ssc" || ext == ".stc" || ext == ".dsc" || ext == ".cfg";
+}
+
+
+static bool addSource(const string& filename, vector<SourceFile>& files)
+{
+    ifstream in(filename.c_str(), ios::in | ios::binary);
+    if (!in.good())
+    {
+        cerr << "Error opening " << filename << '\n';
+        return false;
+    }
+
+    in.seekg(0, ios::end);
+
+    SourceFile file;
+    file.name = filename;
+    file.size = (size_t) in.tellg();
+    files.push_back(file);
+
+    return true;
+}
+
+
+class SourceFileCollector : public EnumFilesHandler
+{
+public:
+    SourceFileCollector(vector<SourceFile>& _files) : files(_files) {};
+
+    bool process(const string& filename)
+    {
+        if (isParsedFile(filename))
+            addSource(getPath() + "/" + filename, files);
+        return true;
+    }
+
+private:
+    vector<SourceFile>& files;
+};
+
+
+// Read every token of a file; returns the number of tokens
+static unsigned int tokenizeFile(const SourceFile& file)
+{
+    ifstream in(file.name.c_str(), ios::in);
+    Tokenizer tokenizer(&in);
+
+    unsigned int tokenCount = 0;
+    Tokenizer::TokenType tok = tokenizer.nextToken();
+    while (tok != Tokenizer::TokenEnd && tok != Tokenizer::TokenError)
+    {
+        tokenCount++;
+        tok = tokenizer.nextToken();
+    }
+
+    return tokenCount;
+}
+
+
+// Read a file the way the catalog loaders do: names, strings, and numbers
+// at the top level are skipped, and every hash or array is read as a value.
+// Returns the number of values read.
+static unsigned int parseFile(const SourceFile& file)
+{
+    ifstream in(file.name.c_str(), ios::in);
+    Tokenizer tokenizer(&in);
+    Parser parser(&tokenizer);
+
+    unsigned int valueCount = 0;
+    Tokenizer::TokenType tok = tokenizer.nextToken();
+    while (tok != Tokenizer::TokenEnd && tok != Tokenizer::TokenError)
+    {
+        if (tok == Tokenizer::TokenBeginGroup || tok == Tokenizer::TokenBeginArray)
+        {
+            tokenizer.pushBack();
+            Value* value = parser.readValue();
+            if (value == NULL)
+            {
+                cerr << file.name << ": error at line " << tokenizer.getLineNumber() << '\n';
+                break;
+            }
+            delete value;
+            valueCount++;
+        }
+
+        tok = tokenizer.nextToken();
+    }
+
+    return valueCount;
+}
+
+
+// Parse hashes and arrays too large for a single block of the parser's
+// pool, both on their own and nested inside another hash, and check that
+// every value can be read back. Returns false if any is missing.
+static bool checkLargeValues()
+{
+    const unsigned int nEntries = 1000;
+
+    ostringstream text;
+    for (unsigned int nesting = 0; nesting < 2; nesting++)
+    {
+        if (nesting != 0)
+            text << "{ Inner ";
+        text << "{ ";
+        for (unsigned int i = 0; i < nEntries; i++)
+            text << 'K' << i << ' ' << i << ' ';
+        text << "Array [ ";
+        for (unsigned int i = 0; i < nEntries; i++)
+            text << i << ' ';
+        text << "] }";
+        if (nesting != 0)
+            text << " }";
+        text << '\n';
+    }
+
+    istringstream in(text.str());
+    Tokenizer tokenizer(&in);
+    Parser parser(&tokenizer);
+
+    for (unsigned int nesting = 0; nesting < 2; nesting++)
+    {
+        Value* value = parser.readValue();
+        Hash* hash = NULL;
+        if (value != NULL && value->getType() == Value::HashType)
+            hash = value->getHash();
+        if (hash != NULL && nesting != 0)
+        {
+            Value* inner = hash->getValue("Inner");
+            hash = NULL;
+            if (inner != NULL && inner->getType() == Value::HashType)
+                hash = inner->getHash();
+        }
+
+        bool ok = hash != NULL;
+        for (unsigned int i = 0; ok && i < nEntries; i++)
+        {
+            ostringstream key;
+            key << 'K' << i;
+            double d = 0.0;
+            ok = hash->getNumber(key.str(), d) && d == (double) i;
+        }
+
+        Value* arrayValue = ok ? hash->getValue("Array") : NULL;
+        Array* array = NULL;
+        if (arrayValue != NULL && arrayValue->getType() == Value::ArrayType)
+            array = arrayValue->getArray();
+        ok = array != NULL && array->size() == nEntries;
+        for (unsigned int i = 0; ok && i < nEntries; i++)
+        {
+            Value* element = (*array)[i];
+            ok = element->getType() == Value::NumberType && element->getNumber() == (double) i;
+        }
+
+        delete value;
+        if (!ok)
+        {
+            cerr << "Large " << (nesting == 0 ? "hash" : "nested hash")
+                 << " was not parsed correctly\n";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+int main(int argc, char* argv[])
+{
+    unsigned int iterations = 10;
+    vector<SourceFile> files;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--iterations") && i + 1 < argc)
+        {
+            iterations = (unsigned int) atoi(argv[++i]);
+        }
+        else if (argv[i][0] == '-')
+        {
+            Usage();
+            return 1;
+        }
+        else if (IsDirectory(argv[i]))
+        {
+            Directory* dir = OpenDirectory(argv[i]);
+            SourceFileCollector collector(files);
+            collector.pushDir(argv[i]);
+            dir->enumFiles(collector, true);
+            delete dir;
+        }
+        else if (!addSource(argv[i], files))
+        {
+            return 1;
+        }
+    }
+
+    if (files.empty() || iterations == 0)
+    {
+        Usage();
+        return 1;
+    }
+
+    if (!checkLargeValues())
+        return 1;
+
+    size_t totalBytes = 0;
+    for (vector<SourceFile>::const_iterator iter = files.begin(); iter != files.end(); iter++)
+        totalBytes += iter->size;
+
+    cout << files.size() << " files, " << totalBytes << " bytes, "
+         << iterations << " iterations\n";
+
+    Timer* timer = CreateTimer();
+
+    unsigned int tokenCount = 0;
+    double start = timer->getTime();
+    for (unsigned int i = 0; i < iterations; i++)
+    {
+        tokenCount = 0;
+        for (vector<SourceFile>::const_iterator iter = files.begin(); iter != files.end(); iter++)
+            tokenCount += tokenizeFile(*iter);
+    }
+    double tokenizeTime = (timer->getTime() - start) / iterations;
+
+    unsigned int valueCount = 0;
+    unsigned long allocations = 0;
+    start = timer->getTime();
+    for (unsigned int i = 0; i < iterations; i++)
+    {
+        unsigned long startCount = allocationCount;
+        valueCount = 0;
+        for (vector<SourceFile>::const_iterator iter = files.begin(); iter != files.end(); iter++)
+            valueCount += parseFile(*iter);
+        allocations = allocationCount - startCount;
+    }
+    double parseTime = (timer->getTime() - start) / iterations;
+
+    cout << "tokenize: " << tokenCount << " tokens, "
+         << tokenizeTime * 1000.0 << " ms, "
+         << totalBytes / tokenizeTime / 1.0e6 << " MB/s\n";
+    cout << "parse:    " << valueCount << " values, "
+         << parseTime * 1000.0 << " ms, "
+         << totalBytes / parseTime / 1.0e6 << " MB/s, "
+         << allocations << " allocations\n";
+
+    delete timer;
+
+    return 0;
+}
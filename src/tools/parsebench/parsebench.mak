@@ -0,0 +1,105 @@
+!IF "$(CFG)" == ""
+CFG=Release
+!MESSAGE No configuration specified. Defaulting to release.
+!ENDIF
+
+!IF "$(CFG)" == "Release"
+OUTDIR=.\Release
+INTDIR=.\Release
+LIBDIR=Release
+!ELSE
+OUTDIR=.\Debug
+INTDIR=.\Debug
+LIBDIR=Debug
+!ENDIF
+
+!IF "$(OS)" == "Windows_NT"
+NULL=
+!ELSE 
+NULL=nul
+!ENDIF 
+
+PARSEBENCH_OBJS=\
+	$(INTDIR)\parsebench.obj
+
+!IF "$(CELX)" == "enable"
+!IF "$(LUA_VER)" == "0x050100"
+LUALIBS=lua5.1.lib
+!ELSE
+LUALIBS=lua.lib lualib.lib
+!ENDIF
+!ELSE
+LUALIBS=
+!ENDIF
+
+!IF "$(SPICE)" == "enable"
+SPICELIBS=cspice.lib
+!ELSE
+SPICELIBS=
+!ENDIF
+
+CEL_INCLUDEDIRS=\
+	/I ../..
+
+INCLUDEDIRS=$(CEL_INCLUDEDIRS) /I ..\..\..\inc\libintl
+
+LIBDIRS=/LIBPATH:..\..\..\lib
+
+CEL_LIBS=\
+	..\..\celutil\$(CFG)\cel_utils.lib \
+	..\..\celmath\$(CFG)\cel_math.lib \
+	..\..\celengine\$(CFG)\cel_engine.lib
+
+EXTRA_LIBS=\
+	intl.lib \
+	kernel32.lib \
+	user32.lib \
+	gdi32.lib \
+	advapi32.lib \
+	winmm.lib \
+	$(LUALIBS) \
+	$(SPICELIBS)
+
+!IF "$(CFG)" == "Release"
+
+CPP=cl.exe
+CPPFLAGS=/nologo /ML /W3 /GX /O2 /D "NDEBUG" /D "WIN32" /D "_WINDOWS" /D "_MBCS" /D WINVER=0x0400 /D _WIN32_WINNT=0x0400 /YX /Fo"$(INTDIR)\\" /Fd"$(INTDIR)\\" /FD /c $(EXTRADEFS) $(INCLUDEDIRS)
+
+OGLLIBS=opengl32.lib glu32.lib
+IMGLIBS=ijgjpeg.lib zlib.lib libpng1.lib
+
+LINK32=link.exe
+LINK32_FLAGS=/nologo /incremental:no /machine:I386 $(LIBDIRS)
+
+!ELSE
+
+CPP=cl.exe
+CPPFLAGS=/nologo /MLd /W3 /Gm /GX /ZI /Od /D "_DEBUG" /D "WIN32" /D "_WINDOWS" /D "_MBCS" /D WINVER=0x0400 /D _WIN32_WINNT=0x0400 /YX /Fo"$(INTDIR)\\" /Fd"$(INTDIR)\\" /FD /GZ /c $(EXTRADEFS) $(INCLUDEDIRS)
+
+OGLLIBS=opengl32.lib glu32.lib
+IMGLIBS=ijgjpeg.lib zlibd.lib libpng1d.lib
+
+LINK32=link.exe
+LINK32_FLAGS=/nologo /incremental:yes /debug /machine:I386 /pdbtype:sept $(LIBDIRS)
+
+!ENDIF
+
+.cpp{$(INTDIR)}.obj::
+   $(CPP) @<<
+   $(CPPFLAGS) $<
+<<
+
+
+all : $(OUTDIR)\parsebench.exe
+
+parsebench.exe : $(OUTDIR)\parsebench.exe
+
+$(OUTDIR)\parsebench.exe : $(OUTDIR) $(PARSEBENCH_OBJS) $(CEL_LIBS)
+	$(LINK32) $(LINK32_FLAGS) /out:$(OUTDIR)\parsebench.exe $(PARSEBENCH_OBJS) $(CEL_LIBS) $(OGLLIBS) $(IMGLIBS) $(EXTRA_LIBS)
+
+
+"$(OUTDIR)" :
+	if not exist "$(OUTDIR)/$(NULL)" mkdir "$(OUTDIR)"
+
+clean:
+	-@del $(OUTDIR)\parsebench.exe $(PARSEBENCH_OBJS)
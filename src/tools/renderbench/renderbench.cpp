@@ -0,0 +1,292 @@
+// renderbench.cpp
+//
+// Copyright (C) 2010, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// Measure the time taken to build the render lists for a cluster of
+// synthetic solar systems, with different numbers of worker threads.
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <celutil/timer.h>
+#include <celutil/workerpool.h>
+#include <celmath/mathlib.h>
+#include <celmath/frustum.h>
+#include <celengine/astro.h>
+#include <celengine/universe.h>
+#include <celengine/stardb.h>
+#include <celengine/starname.h>
+#include <celengine/solarsys.h>
+#include <celengine/observer.h>
+#include <celengine/render.h>
+
+using namespace std;
+using namespace Eigen;
+
+
+static const unsigned int FirstCatalogNumber = 1000000;
+
+
+void Usage()
+{
+    cerr << "Usage: renderbench [--frames <n>] [--asteroids <n>] [--threads <n>] [system count ...]\n";
+    cerr << "  System counts default to 10 100 1000\n";
+}
+
+
+static double uniformRandom()
+{
+    return (double) rand() / (double) RAND_MAX;
+}
+
+
+static string systemName(unsigned int i)
+{
+    ostringstream name;
+    name << "Bench " << i;
+    return name.str();
+}
+
+
+// Create a universe with stars scattered through a sphere with a radius of
+// 0.01 light years (about 600 au) centered on the origin. Each star has a
+// system of planets, moons, and asteroids on elliptical orbits.
+static Universe* createUniverse(unsigned int nSystems, unsigned int nAsteroids)
+{
+    srand(1);
+
+    ostringstream stars;
+    for (unsigned int i = 0; i < nSystems; i++)
+    {
+        stars << FirstCatalogNumber + i << " \"" << systemName(i) << "\"\n"
+              << "{\n"
+              << "  RA " << uniformRandom() * 360.0 << "\n"
+              << "  Dec " << radToDeg(asin(uniformRandom() * 2.0 - 1.0)) << "\n"
+              << "  Distance " << 0.01 * pow(uniformRandom(), 1.0 / 3.0) + 0.0001 << "\n"
+              << "  SpectralType \"G2V\"\n"
+              << "  AppMag 10\n"
+              << "}\n";
+    }
+
+    StarDatabase* starDB = new StarDatabase();
+    starDB->setNameDatabase(new StarNameDatabase());
+    istringstream starsIn(stars.str());
+    if (!starDB->load(starsIn, ""))
+    {
+        delete starDB;
+        return NULL;
+    }
+    starDB->finish();
+
+    Universe* universe = new Universe();
+    universe->setStarCatalog(starDB);
+    universe->setSolarSystemCatalog(new SolarSystemCatalog());
+
+    ostringstream bodies;
+    for (unsigned int i = 0; i < nSystems; i++)
+    {
+        string star = systemName(i);
+        for (unsigned int j = 0; j < 8; j++)
+        {
+            ostringstream planet;
+            planet << "Planet " << j;
+            bodies << '"' << planet.str() << "\" \"" << star << "\"\n"
+                   << "{\n"
+                   << "  Class \"planet\"\n"
+                   << "  Radius " << 2000.0 + uniformRandom() * 60000.0 << "\n"
+                   << "  EllipticalOrbit {\n"
+                   << "    Period " << pow(0.4 + j * 0.7, 1.5) << "\n"
+                   << "    SemiMajorAxis " << 0.4 + j * 0.7 << "\n"
+                   << "    Eccentricity " << uniformRandom() * 0.1 << "\n"
+                   << "    Inclination " << uniformRandom() * 5.0 << "\n"
+                   << "    MeanAnomaly " << uniformRandom() * 360.0 << "\n"
+                   << "  }\n"
+                   << "}\n";
+
+            for (unsigned int k = 0; k < 4; k++)
+            {
+                bodies << "\"Moon " << k << "\" \"" << star << '/' << planet.str() << "\"\n"
+                       << "{\n"
+                       << "  Class \"moon\"\n"
+                       << "  Radius " << 100.0 + uniformRandom() * 2000.0 << "\n"
+                       << "  EllipticalOrbit {\n"
+                       << "    Period " << 1.0 + k * 3.0 << "\n"
+                       << "    SemiMajorAxis " << 100000.0 * (k + 1) << "\n"
+                       << "    Eccentricity " << uniformRandom() * 0.05 << "\n"
+                       << "    MeanAnomaly " << uniformRandom() * 360.0 << "\n"
+                       << "  }\n"
+                       << "}\n";
+            }
+        }
+
+        for (unsigned int j = 0; j < nAsteroids; j++)
+        {
+            double a = 2.0 + uniformRandom() * 1.5;
+            bodies << "\"Asteroid " << j << "\" \"" << star << "\"\n"
+                   << "{\n"
+                   << "  Class \"asteroid\"\n"
+                   << "  Radius " << 1.0 + uniformRandom() * 100.0 << "\n"
+                   << "  EllipticalOrbit {\n"
+                   << "    Period " << pow(a, 1.5) << "\n"
+                   << "    SemiMajorAxis " << a << "\n"
+                   << "    Eccentricity " << uniformRandom() * 0.3 << "\n"
+                   << "    Inclination " << uniformRandom() * 20.0 << "\n"
+                   << "    AscendingNode " << uniformRandom() * 360.0 << "\n"
+                   << "    MeanAnomaly " << uniformRandom() * 360.0 << "\n"
+                   << "  }\n"
+                   << "}\n";
+        }
+    }
+
+    istringstream bodiesIn(bodies.str());
+    if (!LoadSolarSystemObjects(bodiesIn, *universe, ""))
+    {
+        delete universe;
+        return NULL;
+    }
+
+    return universe;
+}
+
+
+// Build the lists for a number of frames with the observer turning a full
+// circle, and return the mean time per frame.
+static double timeFrames(Renderer& renderer,
+                         const Universe& universe,
+                         const vector<const Star*>& stars,
+                         unsigned int nFrames,
+                         WorkerPool* pool,
+                         Timer* timer)
+{
+    Observer observer;
+    observer.setPosition(UniversalCoord::CreateLy(Vector3d::Zero()));
+    observer.setTime(astro::J2000);
+
+    double totalTime = 0.0;
+    for (unsigned int i = 0; i < nFrames; i++)
+    {
+        double angle = 2.0 * PI * (double) i / (double) nFrames;
+        observer.setOrientation(Quaterniond(AngleAxisd(angle, Vector3d::UnitY())) *
+                                Quaterniond(AngleAxisd(0.3, Vector3d::UnitX())));
+
+        Frustum frustum(degToRad(45.0f), 4.0f / 3.0f, 0.0001f);
+        frustum.transform(observer.getOrientationf().conjugate().toRotationMatrix());
+
+        timer->reset();
+        renderer.buildNearSystemsLists(stars, universe, observer, frustum, pool);
+        totalTime += timer->getTime();
+    }
+
+    return totalTime / (double) nFrames;
+}
+
+
+int main(int argc, char* argv[])
+{
+    unsigned int nFrames = 36;
+    unsigned int nAsteroids = 1000;
+    unsigned int maxThreads = 0;
+    vector<unsigned int> counts;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--frames") && i + 1 < argc)
+        {
+            nFrames = (unsigned int) strtoul(argv[++i], NULL, 10);
+        }
+        else if (!strcmp(argv[i], "--asteroids") && i + 1 < argc)
+        {
+            nAsteroids = (unsigned int) strtoul(argv[++i], NULL, 10);
+        }
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+        {
+            maxThreads = (unsigned int) strtoul(argv[++i], NULL, 10);
+        }
+        else if (argv[i][0] >= '0' && argv[i][0] <= '9')
+        {
+            counts.push_back((unsigned int) strtoul(argv[i], NULL, 10));
+        }
+        else
+        {
+            Usage();
+            return 1;
+        }
+    }
+
+    if (nFrames == 0)
+    {
+        Usage();
+        return 1;
+    }
+
+    if (counts.empty())
+    {
+        counts.push_back(10);
+        counts.push_back(100);
+        counts.push_back(1000);
+    }
+
+    // Thread counts double up to the number of processors, unless a
+    // maximum was given.
+    if (maxThreads == 0)
+    {
+        WorkerPool probe;
+        maxThreads = probe.getThreadCount();
+    }
+
+    Timer* timer = CreateTimer();
+
+    for (unsigned int i = 0; i < counts.size(); i++)
+    {
+        Universe* universe = createUniverse(counts[i], nAsteroids);
+        if (universe == NULL)
+        {
+            cerr << "Error creating the synthetic systems\n";
+            return 1;
+        }
+
+        vector<const Star*> stars;
+        universe->getNearStars(UniversalCoord::CreateLy(Vector3d::Zero()), 1.0f, stars);
+
+        Renderer renderer;
+        renderer.resize(1024, 768);
+        renderer.setRenderFlags(Renderer::ShowPlanets | Renderer::ShowOrbits);
+        renderer.setLabelMode(Renderer::PlanetLabels | Renderer::MoonLabels | Renderer::AsteroidLabels);
+        renderer.setOrbitMask(Body::Planet | Body::Moon | Body::Asteroid);
+
+        // The first frame computes the frame tree bounding volumes
+        timeFrames(renderer, *universe, stars, 1, NULL, timer);
+
+        cout << stars.size() << " systems, " << (8 * 5 + nAsteroids) * stars.size() << " bodies\n";
+        double serialTime = timeFrames(renderer, *universe, stars, nFrames, NULL, timer);
+        cout << "  serial:      " << serialTime * 1000.0 << " ms per frame\n";
+
+        vector<unsigned int> threadCounts;
+        for (unsigned int nThreads = 1; nThreads < maxThreads; nThreads *= 2)
+            threadCounts.push_back(nThreads);
+        threadCounts.push_back(maxThreads);
+
+        for (unsigned int j = 0; j < threadCounts.size(); j++)
+        {
+            WorkerPool pool(threadCounts[j]);
+            double t = timeFrames(renderer, *universe, stars, nFrames, &pool, timer);
+            cout << "  " << threadCounts[j] << (threadCounts[j] == 1 ? " worker:    " : " workers:   ")
+                 << t * 1000.0 << " ms per frame (" << serialTime / t << "x)\n";
+        }
+
+        delete universe;
+    }
+
+    delete timer;
+
+    return 0;
+}
@@ -18,6 +18,7 @@
 #include <celutil/bytes.h>
 #include <celengine/astro.h>
 #include <celengine/star.h>
+#include <celengine/stardb.h>
 
 using namespace std;
 
@@ -25,6 +26,7 @@ using namespace std;
 static string inputFilename;
 static string outputFilename;
 static bool useSphericalCoords = false;
+static bool writeUnsorted = false;
 
 
 void Usage()
@@ -32,6 +34,7 @@ void Usage()
     cerr << "Usage: makestardb [options] <input file> <output star database>\n";
     cerr << "  Options:\n";
     cerr << "    --spherical (or -s) : input file has spherical coords (RA/dec/distance\n";
+    cerr << "    --unsorted (or -u) : write an unsorted database without a prebuilt octree\n";
 }
 
 
@@ -48,6 +51,10 @@ bool parseCommandLine(int argc, char* argv[])
             {
                 useSphericalCoords = true;
             }
+            else if (!strcmp(argv[i], "--unsorted") || !strcmp(argv[i], "-u"))
+            {
+                writeUnsorted = true;
+            }
             else
             {
                 cerr << "Unknown command line switch: " << argv[i] << '\n';
@@ -109,7 +116,6 @@ static void writeShort(ostream& out, int16 n)
 
 bool WriteStarDatabase(istream& in, ostream& out, bool sphericalCoords)
 {
-    unsigned int record = 0;
     unsigned int nStarsInFile = 0;
 
     in >> nStarsInFile;
@@ -119,13 +125,8 @@ bool WriteStarDatabase(istream& in, ostream& out, bool sphericalCoords)
         return 1;
     }
 
-    // Write the header
-    out.write("CELSTARS", 8);
-
-    // Write the version
-    writeShort(out, 0x0100);
-
-    writeUint(out, nStarsInFile);
+    vector<StarDatabase::BinaryStarRecord> records;
+    records.reserve(nStarsInFile);
 
     for (unsigned int record = 0; record < nStarsInFile; record++)
     {
@@ -135,7 +136,7 @@ bool WriteStarDatabase(istream& in, ostream& out, bool sphericalCoords)
 
         in >> catalogNumber;
         if (in.eof())
-            return true;
+            break;
 
         if (!in.good())
         {
@@ -203,12 +204,38 @@ bool WriteStarDatabase(istream& in, ostream& out, bool sphericalCoords)
         cout << scString << ' ' << details->getSpectralType() << '\n';
 #endif
 
-        writeUint(out, catalogNumber);
-        writeFloat(out, x);
-        writeFloat(out, y);
-        writeFloat(out, z);
-        writeShort(out, (int16) (absMag * 256.0f));
-        writeUshort(out, sc.pack());
+        StarDatabase::BinaryStarRecord starRecord;
+        starRecord.catalogNumber = catalogNumber;
+        starRecord.x = x;
+        starRecord.y = y;
+        starRecord.z = z;
+        starRecord.absMag = (int16) (absMag * 256.0f);
+        starRecord.spectralType = sc.pack();
+        records.push_back(starRecord);
+    }
+
+    // By default, write a database with the stars sorted into a prebuilt
+    // octree, so that Celestia doesn't have to build it at startup.
+    if (!writeUnsorted)
+        return StarDatabase::writeBinary(out, records);
+
+    // Write the header
+    out.write("CELSTARS", 8);
+
+    // Write the version
+    writeShort(out, 0x0100);
+
+    writeUint(out, (uint32) records.size());
+
+    for (vector<StarDatabase::BinaryStarRecord>::const_iterator iter = records.begin();
+         iter != records.end(); iter++)
+    {
+        writeUint(out, iter->catalogNumber);
+        writeFloat(out, iter->x);
+        writeFloat(out, iter->y);
+        writeFloat(out, iter->z);
+        writeShort(out, iter->absMag);
+        writeUshort(out, iter->spectralType);
     }
 
     return true;
@@ -0,0 +1,213 @@
+// octreebench.cpp
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// Compare serial and parallel star octree construction on synthetic
+// catalogs, and verify that both produce identical octrees.
+
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <celutil/timer.h>
+#include <celutil/workerpool.h>
+#include <celmath/mathlib.h>
+#include <celengine/astro.h>
+#include <celengine/star.h>
+#include <celengine/staroctree.h>
+
+using namespace std;
+using namespace Eigen;
+
+
+// Same root node parameters as the star database
+static const float STAR_OCTREE_ROOT_SIZE = 10000000.0f;
+static const float STAR_OCTREE_MAGNITUDE = 6.0f;
+
+
+void Usage()
+{
+    cerr << "Usage: octreebench [--threads <n>] [star count ...]\n";
+    cerr << "  Star counts default to 1000000 10000000 100000000\n";
+}
+
+
+static float uniformRandom()
+{
+    return (float) rand() / (float) RAND_MAX;
+}
+
+
+// Stars are placed in a thin exponential disk with a spherical halo,
+// roughly like a galaxy seen from the inside, with absolute magnitudes
+// spread over the range typical of star catalogs.
+static void makeCatalog(Star* stars, unsigned int nStars, StarDetails* details)
+{
+    srand(1);
+
+    for (unsigned int i = 0; i < nStars; i++)
+    {
+        float x, y, z;
+        if (i % 10 == 0)
+        {
+            float r = 50000.0f * pow(uniformRandom(), 2.0f);
+            float theta = acos(2.0f * uniformRandom() - 1.0f);
+            float phi = 2.0f * (float) PI * uniformRandom();
+            x = r * sin(theta) * cos(phi);
+            y = r * sin(theta) * sin(phi);
+            z = r * cos(theta);
+        }
+        else
+        {
+            float r = -8000.0f * log(1.0f - 0.999f * uniformRandom());
+            float phi = 2.0f * (float) PI * uniformRandom();
+            x = r * cos(phi) + 26000.0f;
+            y = 300.0f * (uniformRandom() - 0.5f);
+            z = r * sin(phi);
+        }
+
+        stars[i].setCatalogNumber(i);
+        stars[i].setPosition(x, y, z);
+        stars[i].setAbsoluteMagnitude(-5.0f + 20.0f * sqrt(uniformRandom()));
+        stars[i].setDetails(details);
+    }
+}
+
+
+static DynamicStarOctree* createRoot()
+{
+    float absMag = astro::appToAbsMag(STAR_OCTREE_MAGNITUDE,
+                                      STAR_OCTREE_ROOT_SIZE * (float) sqrt(3.0));
+    return new DynamicStarOctree(Vector3f(1000.0f, 1000.0f, 1000.0f), absMag);
+}
+
+
+static bool sameOctree(const vector<OctreeNodeRecord>& nodes0, const vector<uint32>& order0,
+                       const vector<OctreeNodeRecord>& nodes1, const Star* stars1)
+{
+    if (nodes0.size() != nodes1.size())
+        return false;
+    if (memcmp(&nodes0[0], &nodes1[0], nodes0.size() * sizeof(OctreeNodeRecord)) != 0)
+        return false;
+
+    for (unsigned int i = 0; i < order0.size(); i++)
+    {
+        if (order0[i] != stars1[i].getCatalogNumber())
+            return false;
+    }
+
+    return true;
+}
+
+
+int main(int argc, char* argv[])
+{
+    unsigned int nThreads = 0;
+    vector<unsigned int> counts;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+        {
+            nThreads = (unsigned int) atoi(argv[++i]);
+        }
+        else if (argv[i][0] >= '0' && argv[i][0] <= '9')
+        {
+            counts.push_back((unsigned int) strtoul(argv[i], NULL, 10));
+        }
+        else
+        {
+            Usage();
+            return 1;
+        }
+    }
+
+    if (counts.empty())
+    {
+        counts.push_back(1000000);
+        counts.push_back(10000000);
+        counts.push_back(100000000);
+    }
+
+    WorkerPool pool(nThreads);
+    StarDetails* details = StarDetails::GetStarDetails(StellarClass(StellarClass::NormalStar,
+                                                                    StellarClass::Spectral_G,
+                                                                    2,
+                                                                    StellarClass::Lum_V));
+    Timer* timer = CreateTimer();
+
+    cout << "Worker threads: " << pool.getThreadCount() << '\n';
+
+    bool allIdentical = true;
+    for (unsigned int c = 0; c < counts.size(); c++)
+    {
+        unsigned int nStars = counts[c];
+        Star* catalog = new Star[nStars];
+        makeCatalog(catalog, nStars, details);
+
+        // Serial build, one insertion at a time
+        timer->reset();
+        DynamicStarOctree* serialRoot = createRoot();
+        for (unsigned int i = 0; i < nStars; i++)
+            serialRoot->insertObject(catalog[i], STAR_OCTREE_ROOT_SIZE);
+        double serialInsertTime = timer->getTime();
+
+        Star* serialStars = new Star[nStars];
+        Star* firstStar = serialStars;
+        StarOctree* serialOctree = NULL;
+        serialRoot->rebuildAndSort(serialOctree, firstStar);
+        double serialTime = timer->getTime();
+        delete serialRoot;
+
+        vector<OctreeNodeRecord> serialNodes;
+        serialOctree->flatten(serialNodes, serialStars);
+        delete serialOctree;
+
+        vector<uint32> serialOrder(nStars);
+        for (unsigned int i = 0; i < nStars; i++)
+            serialOrder[i] = serialStars[i].getCatalogNumber();
+        delete[] serialStars;
+
+        // Parallel build
+        timer->reset();
+        DynamicStarOctree* parallelRoot = createRoot();
+        vector<const Star*> objects(nStars);
+        for (unsigned int i = 0; i < nStars; i++)
+            objects[i] = &catalog[i];
+        parallelRoot->insertObjects(objects, STAR_OCTREE_ROOT_SIZE, &pool);
+        double parallelInsertTime = timer->getTime();
+
+        Star* parallelStars = new Star[nStars];
+        firstStar = parallelStars;
+        StarOctree* parallelOctree = NULL;
+        parallelRoot->rebuildAndSort(parallelOctree, firstStar);
+        double parallelTime = timer->getTime();
+        delete parallelRoot;
+
+        vector<OctreeNodeRecord> parallelNodes;
+        parallelOctree->flatten(parallelNodes, parallelStars);
+        delete parallelOctree;
+
+        bool identical = sameOctree(serialNodes, serialOrder, parallelNodes, parallelStars);
+        allIdentical = allIdentical && identical;
+
+        cout << nStars << " stars, " << serialNodes.size() << " nodes\n";
+        cout << "  serial:   " << serialInsertTime << " s insert, " << serialTime << " s total\n";
+        cout << "  parallel: " << parallelInsertTime << " s insert, " << parallelTime << " s total\n";
+        cout << "  speedup:  " << serialTime / parallelTime
+             << (identical ? ", octrees identical\n" : ", OCTREES DIFFER\n");
+
+        delete[] parallelStars;
+        delete[] catalog;
+    }
+
+    delete timer;
+
+    return allIdentical ? 0 : 1;
+}
@@ -0,0 +1,222 @@
+// trajbench.cpp
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// Measure the cost of evaluating sampled (xyzv) trajectories with
+// sequential, near-sequential, and random access patterns.
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <celutil/timer.h>
+#include <celmath/mathlib.h>
+#include <celephem/orbit.h>
+#include <celephem/samporbit.h>
+
+using namespace std;
+using namespace Eigen;
+
+
+void Usage()
+{
+    cerr << "Usage: trajbench [--queries <n>] [--file <xyzv file>] [sample count ...]\n";
+    cerr << "  Sample counts default to 1000 100000 1000000\n";
+}
+
+
+static double uniformRandom()
+{
+    return (double) rand() / (double) RAND_MAX;
+}
+
+
+// Write an xyzv file for an eccentric orbit with unequal time steps: the
+// step size is proportional to the distance from the central body, much as
+// an adaptive sampler like spice2xyzv would produce.
+static bool writeTrajectory(const string& filename, unsigned int nSamples,
+                            double& startTime, double& endTime)
+{
+    ofstream out(filename.c_str());
+    if (!out.good())
+        return false;
+
+    const double a = 1.0e6;
+    const double e = 0.6;
+    const double period = 10.0;
+    const double n = 2.0 * PI / period;
+
+    startTime = 2451545.0;
+    double t = startTime;
+    double meanStep = period * 20.0 / (double) nSamples;
+
+    out << setprecision(17);
+    for (unsigned int i = 0; i < nSamples; i++)
+    {
+        double M = n * (t - startTime);
+        double E = M;
+        for (int k = 0; k < 8; k++)
+            E = M + e * sin(E);
+
+        double cosE = cos(E);
+        double sinE = sin(E);
+        double r = a * (1.0 - e * cosE);
+        double x = a * (cosE - e);
+        double y = a * sqrt(1.0 - e * e) * sinE;
+        double Edot = n / (1.0 - e * cosE);
+        double vx = -a * sinE * Edot;
+        double vy = a * sqrt(1.0 - e * e) * cosE * Edot;
+
+        out << t << ' ' << x << ' ' << y << ' ' << 0.0 << ' '
+            << vx << ' ' << vy << ' ' << 0.0 << '\n';
+
+        endTime = t;
+        t += meanStep * r / a;
+    }
+
+    return out.good();
+}
+
+
+// Evaluate the orbit at each of the query times, returning the elapsed
+// time in seconds. The positions are summed so that the compiler can't
+// discard the evaluation.
+static double timeQueries(const Orbit* orbit, const vector<double>& times,
+                          Timer* timer, double& checksum)
+{
+    Vector3d sum = Vector3d::Zero();
+
+    timer->reset();
+    for (unsigned int i = 0; i < times.size(); i++)
+        sum += orbit->positionAtTime(times[i]);
+    double elapsed = timer->getTime();
+
+    checksum += sum.x() + sum.y() + sum.z();
+
+    return elapsed;
+}
+
+
+static void report(const char* name, double elapsed, unsigned int nQueries)
+{
+    cout << "  " << setw(16) << left << name << right
+         << setw(10) << fixed << setprecision(1)
+         << elapsed * 1.0e9 / (double) nQueries << " ns/query\n";
+}
+
+
+int main(int argc, char* argv[])
+{
+    unsigned int nQueries = 1000000;
+    string filename = "trajbench.xyzv";
+    vector<unsigned int> counts;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--queries") && i + 1 < argc)
+        {
+            nQueries = (unsigned int) strtoul(argv[++i], NULL, 10);
+        }
+        else if (!strcmp(argv[i], "--file") && i + 1 < argc)
+        {
+            filename = argv[++i];
+        }
+        else if (argv[i][0] >= '0' && argv[i][0] <= '9')
+        {
+            counts.push_back((unsigned int) strtoul(argv[i], NULL, 10));
+        }
+        else
+        {
+            Usage();
+            return 1;
+        }
+    }
+
+    if (counts.empty())
+    {
+        counts.push_back(1000);
+        counts.push_back(100000);
+        counts.push_back(1000000);
+    }
+
+    if (nQueries == 0)
+    {
+        Usage();
+        return 1;
+    }
+
+    Timer* timer = CreateTimer();
+    double checksum = 0.0;
+
+    for (unsigned int c = 0; c < counts.size(); c++)
+    {
+        unsigned int nSamples = counts[c];
+        if (nSamples < 2)
+            continue;
+
+        double startTime = 0.0;
+        double endTime = 0.0;
+        if (!writeTrajectory(filename, nSamples, startTime, endTime))
+        {
+            cerr << "Error writing trajectory file " << filename << '\n';
+            return 1;
+        }
+
+        timer->reset();
+        Orbit* orbit = LoadXYZVTrajectoryDoublePrec(filename, TrajectoryInterpolationCubic);
+        double loadTime = timer->getTime();
+        if (orbit == NULL)
+        {
+            cerr << "Error loading trajectory file " << filename << '\n';
+            return 1;
+        }
+
+        double span = endTime - startTime;
+        double dt = span / (double) nQueries;
+        vector<double> times(nQueries);
+
+        cout << nSamples << " samples, loaded in " << setprecision(3) << loadTime << " s\n";
+
+        // Forward sweep, as when animating time forward
+        for (unsigned int i = 0; i < nQueries; i++)
+            times[i] = startTime + dt * (double) i;
+        report("forward sweep", timeQueries(orbit, times, timer, checksum), nQueries);
+
+        // Backward sweep
+        for (unsigned int i = 0; i < nQueries; i++)
+            times[i] = endTime - dt * (double) i;
+        report("backward sweep", timeQueries(orbit, times, timer, checksum), nQueries);
+
+        // Near-sequential: a forward sweep with jitter of a few samples,
+        // as when plotting an orbit path or several views at nearby times
+        srand(1);
+        double jitter = 4.0 * span / (double) nSamples;
+        for (unsigned int i = 0; i < nQueries; i++)
+            times[i] = startTime + dt * (double) i + jitter * (uniformRandom() - 0.5);
+        report("jittered sweep", timeQueries(orbit, times, timer, checksum), nQueries);
+
+        // Uniformly random times over the whole trajectory
+        for (unsigned int i = 0; i < nQueries; i++)
+            times[i] = startTime + span * uniformRandom();
+        report("random", timeQueries(orbit, times, timer, checksum), nQueries);
+
+        delete orbit;
+    }
+
+    remove(filename.c_str());
+    delete timer;
+
+    // Printing the checksum keeps the evaluation from being optimized away
+    cout << "checksum " << setprecision(6) << checksum << '\n';
+
+    return 0;
+}
@@ -0,0 +1,96 @@
+!IF "$(CFG)" == ""
+CFG=Release
+!MESSAGE No configuration specified. Defaulting to release.
+!ENDIF
+
+!IF "$(CFG)" == "Release"
+OUTDIR=.\Release
+INTDIR=.\Release
+LIBDIR=Release
+!ELSE
+OUTDIR=.\Debug
+INTDIR=.\Debug
+LIBDIR=Debug
+!ENDIF
+
+!IF "$(OS)" == "Windows_NT"
+NULL=
+!ELSE 
+NULL=nul
+!ENDIF 
+
+TRAJBENCH_OBJS=\
+	$(INTDIR)\trajbench.obj
+
+XYZV2BIN_OBJS=\
+	$(INTDIR)\xyzv2bin.obj
+
+CEL_INCLUDEDIRS=\
+	/I ../..
+
+INCLUDEDIRS=$(DX_INCLUDEDIRS) $(CEL_INCLUDEDIRS) /I .\include
+
+LIBDIRS=/LIBPATH:..\..\..\lib /LIBPATH:.\lib\Release
+
+CEL_LIBS=\
+	..\..\celutil\$(CFG)\cel_utils.lib \
+	..\..\celmath\$(CFG)\cel_math.lib \
+	..\..\celengine\$(CFG)\cel_engine.lib
+
+!IF "$(CFG)" == "Release"
+
+CPP=cl.exe
+CPPFLAGS=/nologo /ML /W3 /GX /O2 /D "NDEBUG" /D "WIN32" /D "_WINDOWS" /D "_MBCS" /D WINVER=0x0400 /D _WIN32_WINNT=0x0400 /YX /Fo"$(INTDIR)\\" /Fd"$(INTDIR)\\" /FD /c $(EXTRADEFS) $(INCLUDEDIRS)
+
+LINK32=link.exe
+LINK32_FLAGS=/nologo /incremental:no /machine:I386 $(LIBDIRS)
+
+RSC=rc
+RSC_FLAGS=/l 0x409 /d "NDEBUG" 
+
+!ELSE
+
+CPP=cl.exe
+CPPFLAGS=/nologo /MLd /W3 /Gm /GX /ZI /Od /D "_DEBUG" /D "WIN32" /D "_WINDOWS" /D "_MBCS" /D WINVER=0x0400 /D _WIN32_WINNT=0x0400 /YX /Fo"$(INTDIR)\\" /Fd"$(INTDIR)\\" /FD /GZ /c $(EXTRADEFS) $(INCLUDEDIRS)
+
+DXLIBS=d3d9.lib d3dx9d.lib
+OGLLIBS=opengl32.lib glu32.lib
+IMGLIBS=ijgjpeg.lib zlibd.lib libpng1d.lib
+
+LINK32=link.exe
+LINK32_FLAGS=/nologo /incremental:yes /debug /machine:I386 /pdbtype:sept $(LIBDIRS)
+
+RSC=rc.exe
+RSC_FLAGS=/l 0x409 /d "_DEBUG" 
+
+!ENDIF
+
+.c{$(INTDIR)}.obj::
+   $(CPP) @<<
+   $(CPPFLAGS) $<
+<<
+
+.cpp{$(INTDIR)}.obj::
+   $(CPP) @<<
+   $(CPPFLAGS) $<
+<<
+
+
+all : $(OUTDIR)\trajbench.exe $(OUTDIR)\xyzv2bin.exe
+
+trajbench.exe : $(OUTDIR)\trajbench.exe
+
+xyzv2bin.exe : $(OUTDIR)\xyzv2bin.exe
+
+$(OUTDIR)\trajbench.exe : $(OUTDIR) $(TRAJBENCH_OBJS)
+	$(LINK32) $(LINK32_FLAGS) /out:$(OUTDIR)\trajbench.exe $(TRAJBENCH_OBJS) $(CEL_LIBS)
+
+$(OUTDIR)\xyzv2bin.exe : $(OUTDIR) $(XYZV2BIN_OBJS)
+	$(LINK32) $(LINK32_FLAGS) /out:$(OUTDIR)\xyzv2bin.exe $(XYZV2BIN_OBJS) $(CEL_LIBS)
+
+
+"$(OUTDIR)" :
+	if not exist "$(OUTDIR)/$(NULL)" mkdir "$(OUTDIR)"
+
+clean:
+	-@del $(OUTDIR)\trajbench.exe $(OUTDIR)\xyzv2bin.exe $(TRAJBENCH_OBJS) $(XYZV2BIN_OBJS)
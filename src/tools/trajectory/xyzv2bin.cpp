@@ -0,0 +1,281 @@
+// xyzv2bin.cpp
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// Convert a Celestia xyz or xyzv trajectory file to the binary trajectory
+// format, which Celestia memory maps instead of parsing.
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <cctype>
+#include <celutil/basictypes.h>
+#include <celutil/bytes.h>
+
+using namespace std;
+
+
+static const char FILE_HEADER[] = "CELTRAJ";
+static const uint16 FILE_VERSION = 0x0100;
+
+static const uint16 SAMPLE_TYPE_XYZ  = 0;
+static const uint16 SAMPLE_TYPE_XYZV = 1;
+
+static const uint16 INTERPOLATION_LINEAR = 0;
+static const uint16 INTERPOLATION_CUBIC  = 1;
+
+static const uint32 DEFAULT_BLOCK_SIZE = 512;
+
+
+void Usage()
+{
+    cerr << "Usage: xyzv2bin [options] <input file> <output file>\n";
+    cerr << "  --xyz : input file contains positions only (default for .xyz files)\n";
+    cerr << "  --xyzv : input file contains positions and velocities\n";
+    cerr << "  --linear : recommend linear rather than cubic interpolation\n";
+    cerr << "  --block-size <n> : samples per indexed block (default 512)\n";
+}
+
+
+static void writeUint32(ostream& out, uint32 n)
+{
+    LE_TO_CPU_INT32(n, n);
+    out.write((const char*) &n, sizeof n);
+}
+
+static void writeUint16(ostream& out, uint16 n)
+{
+    LE_TO_CPU_INT16(n, n);
+    out.write((const char*) &n, sizeof n);
+}
+
+static void writeDouble(ostream& out, double d)
+{
+    LE_TO_CPU_DOUBLE(d, d);
+    out.write((const char*) &d, sizeof d);
+}
+
+
+// Scan past comments. A comment begins with the # character and ends
+// with a newline. Return true if the stream state is good.
+static bool skipComments(istream& in)
+{
+    bool inComment = false;
+    bool done = false;
+
+    while (!done)
+    {
+        int c = in.get();
+        if (!in.good())
+            return false;
+
+        if (inComment)
+        {
+            if (c == '\n')
+                inComment = false;
+        }
+        else if (c == '#')
+        {
+            inComment = true;
+        }
+        else if (!isspace(c))
+        {
+            in.unget();
+            done = true;
+        }
+    }
+
+    return in.good();
+}
+
+
+static bool endsWith(const string& s, const string& suffix)
+{
+    return s.size() >= suffix.size() &&
+           s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+
+static void writeHeader(ostream& out,
+                        uint16 sampleType,
+                        uint16 interpolation,
+                        uint32 nSamples,
+                        uint32 blockSize,
+                        uint32 nBlocks,
+                        double startTime,
+                        double endTime,
+                        double boundingRadius)
+{
+    out.write(FILE_HEADER, sizeof FILE_HEADER);
+    writeUint16(out, FILE_VERSION);
+    writeUint16(out, sampleType);
+    writeUint16(out, interpolation);
+    writeUint16(out, 0);
+    writeUint32(out, nSamples);
+    writeUint32(out, blockSize);
+    writeUint32(out, nBlocks);
+    writeUint32(out, 0);
+    writeDouble(out, startTime);
+    writeDouble(out, endTime);
+    writeDouble(out, boundingRadius);
+}
+
+
+int main(int argc, char* argv[])
+{
+    string inputFilename;
+    string outputFilename;
+    int sampleType = -1;
+    uint16 interpolation = INTERPOLATION_CUBIC;
+    uint32 blockSize = DEFAULT_BLOCK_SIZE;
+
+    int fileCount = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--xyz"))
+        {
+            sampleType = SAMPLE_TYPE_XYZ;
+        }
+        else if (!strcmp(argv[i], "--xyzv"))
+        {
+            sampleType = SAMPLE_TYPE_XYZV;
+        }
+        else if (!strcmp(argv[i], "--linear"))
+        {
+            interpolation = INTERPOLATION_LINEAR;
+        }
+        else if (!strcmp(argv[i], "--block-size") && i + 1 < argc)
+        {
+            blockSize = (uint32) strtoul(argv[++i], NULL, 10);
+        }
+        else if (argv[i][0] == '-')
+        {
+            Usage();
+            return 1;
+        }
+        else if (fileCount == 0)
+        {
+            inputFilename = argv[i];
+            fileCount++;
+        }
+        else if (fileCount == 1)
+        {
+            outputFilename = argv[i];
+            fileCount++;
+        }
+        else
+        {
+            Usage();
+            return 1;
+        }
+    }
+
+    if (fileCount != 2 || blockSize == 0)
+    {
+        Usage();
+        return 1;
+    }
+
+    if (sampleType < 0)
+        sampleType = endsWith(inputFilename, ".xyz") ? SAMPLE_TYPE_XYZ : SAMPLE_TYPE_XYZV;
+    unsigned int nValues = sampleType == SAMPLE_TYPE_XYZ ? 4 : 7;
+
+    ifstream in(inputFilename.c_str());
+    if (!in.good())
+    {
+        cerr << "Error opening " << inputFilename << '\n';
+        return 1;
+    }
+
+    ofstream out(outputFilename.c_str(), ios::out | ios::binary);
+    if (!out.good())
+    {
+        cerr << "Error opening " << outputFilename << '\n';
+        return 1;
+    }
+
+    // The header is written again once the sample count is known
+    writeHeader(out, (uint16) sampleType, interpolation, 0, blockSize, 0, 0.0, 0.0, 0.0);
+
+    // Stream the samples to the output, recording the time of the first
+    // sample in each block. As when Celestia loads a text trajectory,
+    // records with the same time as the preceding record are dropped.
+    vector<double> blockStartTimes;
+    uint32 nSamples = 0;
+    double startTime = 0.0;
+    double lastTime = 0.0;
+    double boundingRadius = 0.0;
+
+    if (skipComments(in))
+    {
+        double values[7];
+        for (;;)
+        {
+            for (unsigned int i = 0; i < nValues; i++)
+                in >> values[i];
+            if (!in.good())
+                break;
+
+            double t = values[0];
+            if (nSamples > 0)
+            {
+                if (t == lastTime)
+                    continue;
+                if (t < lastTime)
+                {
+                    cerr << "Samples are not in time order at t = " << t << '\n';
+                    return 1;
+                }
+            }
+            else
+            {
+                startTime = t;
+            }
+
+            if (nSamples % blockSize == 0)
+                blockStartTimes.push_back(t);
+
+            for (unsigned int i = 0; i < nValues; i++)
+                writeDouble(out, values[i]);
+
+            double r = sqrt(values[1] * values[1] + values[2] * values[2] + values[3] * values[3]);
+            if (r > boundingRadius)
+                boundingRadius = r;
+
+            lastTime = t;
+            nSamples++;
+        }
+    }
+
+    if (nSamples == 0)
+    {
+        cerr << "No samples found in " << inputFilename << '\n';
+        return 1;
+    }
+
+    for (unsigned int i = 0; i < blockStartTimes.size(); i++)
+        writeDouble(out, blockStartTimes[i]);
+
+    out.seekp(0);
+    writeHeader(out, (uint16) sampleType, interpolation, nSamples, blockSize,
+                (uint32) blockStartTimes.size(), startTime, lastTime, boundingRadius);
+
+    if (!out.good())
+    {
+        cerr << "Error writing " << outputFilename << '\n';
+        return 1;
+    }
+
+    cerr << nSamples << " samples written to " << outputFilename << '\n';
+
+    return 0;
+}